@@ -0,0 +1,129 @@
+/*
+* Copyright (c) 2019, Intel Corporation
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the Intel Corporation nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#pragma once
+#include <algorithm>
+#include <cstdint>
+
+#if (defined(WIN32) || defined(_WIN32))
+#include "intrin.h"
+#else
+// Linux
+#include "x86intrin.h"
+#include <cpuid.h>
+#endif
+
+// The library is compiled for SSE4 (-msse4); wider kernels are compiled per function
+// and must only be called after checking `detected_simd_level()`
+#if defined(__GNUC__) || defined(__clang__)
+#define TEISKO_TARGET_AVX2 __attribute__((target("avx2")))
+#define TEISKO_TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512bw")))
+#else
+#define TEISKO_TARGET_AVX2
+#define TEISKO_TARGET_AVX512
+#endif
+
+namespace Teisko
+{
+    /// Instruction set tiers of the SIMD kernels in increasing order
+    enum class simd_level_e
+    {
+        scalar = 0,
+        sse4,
+        avx2,
+        avx512      // AVX-512F + AVX-512BW
+    };
+
+    /// Executes cpuid instruction for `leaf` and `subleaf` -- regs = { eax, ebx, ecx, edx }
+    inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t(&regs)[4])
+    {
+#if (defined(WIN32) || defined(_WIN32))
+        int r[4];
+        __cpuidex(r, static_cast<int>(leaf), static_cast<int>(subleaf));
+        std::copy(r, r + 4, regs);
+#else
+        __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    }
+
+    /// Returns the extended control register 0 -- the register states enabled by the OS
+    inline uint64_t read_xcr0()
+    {
+#if (defined(WIN32) || defined(_WIN32))
+        return _xgetbv(0);
+#else
+        uint32_t eax, edx;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+    }
+
+    /// Queries the highest tier supported by both the processor and the operating system
+    inline simd_level_e query_simd_level()
+    {
+        uint32_t regs[4];
+        cpuid(0, 0, regs);
+        auto max_leaf = regs[0];
+
+        cpuid(1, 0, regs);
+        auto level = (regs[2] & (1u << 19)) ? simd_level_e::sse4 : simd_level_e::scalar;
+        bool has_osxsave = (regs[2] & (1u << 27)) != 0;
+        bool has_avx = (regs[2] & (1u << 28)) != 0;
+        if (level != simd_level_e::sse4 || !has_osxsave || !has_avx || max_leaf < 7)
+            return level;
+
+        // The OS must preserve xmm and ymm registers (and opmask + zmm for AVX-512)
+        auto xcr0 = read_xcr0();
+        if ((xcr0 & 0x6) != 0x6)
+            return level;
+
+        cpuid(7, 0, regs);
+        if ((regs[1] & (1u << 5)) == 0)     // AVX2
+            return level;
+        level = simd_level_e::avx2;
+
+        bool has_avx512f = (regs[1] & (1u << 16)) != 0;
+        bool has_avx512bw = (regs[1] & (1u << 30)) != 0;
+        if (has_avx512f && has_avx512bw && (xcr0 & 0xe6) == 0xe6)
+            level = simd_level_e::avx512;
+        return level;
+    }
+
+    /// Returns the highest supported tier -- the cpu is queried only once
+    inline simd_level_e detected_simd_level()
+    {
+        static const simd_level_e level = query_simd_level();
+        return level;
+    }
+
+    /// Clamps a requested tier to the highest supported tier
+    inline simd_level_e supported_simd_level(simd_level_e requested)
+    {
+        return std::min(requested, detected_simd_level());
+    }
+}
@@ -31,6 +31,7 @@
 #include <vector>
 #include <map>
 #include <array>
+#include <algorithm>
 
 namespace Teisko
 {
@@ -116,6 +117,160 @@ namespace Teisko
         }
     };
 
+    /// interpolate_x_dim flattened to contiguous arrays for allocation free lookups
+    /// - the children of each node are stored consecutively with their keys in
+    ///   sorted order, and are located with a branchless binary search
+    /// - results are bit exact with interpolate_x_dim -- each item is interpolated
+    ///   recursively with the same arithmetic, one item at a time
+    /// - the compiled table is a snapshot; later changes to the tree are not seen
+    template <typename T>
+    class compiled_interpolate_x_dim
+    {
+    public:
+        using type = T;
+
+        compiled_interpolate_x_dim() : _max_leaf_size(0) { }
+
+        explicit compiled_interpolate_x_dim(const interpolate_x_dim<type> &tree)
+            : _max_leaf_size(0)
+        {
+            // Breadth first -- the children of a node are appended consecutively
+            std::vector<const interpolate_x_dim<type>*> sources = { &tree };
+            _nodes.push_back(node_s{});
+            _keys.push_back(type{});
+            for (size_t i = 0; i < sources.size(); i++)
+            {
+                auto src = sources[i];
+                _nodes[i].first_child = static_cast<uint32_t>(_nodes.size());
+                _nodes[i].child_count = static_cast<uint32_t>(src->tree.size());
+                _nodes[i].leaf_offset = static_cast<uint32_t>(_leaves.size());
+                _nodes[i].leaf_size = static_cast<uint32_t>(src->leaf.size());
+                _leaves.insert(_leaves.end(), src->leaf.begin(), src->leaf.end());
+                _max_leaf_size = std::max(_max_leaf_size, src->leaf.size());
+                for (auto &child : src->tree)
+                {
+                    _keys.push_back(child.first);
+                    _nodes.push_back(node_s{});
+                    sources.push_back(&child.second);
+                }
+            }
+        }
+
+        /// Number of items the output buffer of a single lookup must hold
+        size_t max_leaf_size() const { return _max_leaf_size; }
+
+        /// Interpolates the table at `keys`
+        /// \param keys        Key for each dimension -- first key selects the first dimension
+        /// \param key_count   Number of keys
+        /// \param out         Output buffer of at least `max_leaf_size()` items
+        /// \returns           Number of items written to `out`
+        size_t lookup(const type *keys, size_t key_count, type *out) const
+        {
+            auto size = result_size(0, keys, key_count);
+            for (size_t i = 0; i < size; i++)
+                out[i] = evaluate(0, keys, key_count, i);
+            return size;
+        }
+
+        /// Interpolates the table at `query_count` points of `key_count` keys each
+        /// \param keys        Keys of all the queries, one query after another
+        /// \param out         Output buffer, whose items i * max_leaf_size() ... receive the result of query i
+        /// \param sizes       Optional output for the number of items of each result
+        void lookup(const type *keys, size_t key_count, size_t query_count, type *out, size_t *sizes = nullptr) const
+        {
+            for (size_t i = 0; i < query_count; i++)
+            {
+                auto size = lookup(keys + i * key_count, key_count, out + i * _max_leaf_size);
+                if (sizes != nullptr)
+                    sizes[i] = size;
+            }
+        }
+
+    private:
+        struct node_s
+        {
+            uint32_t first_child;   // index to _nodes and _keys
+            uint32_t child_count;
+            uint32_t leaf_offset;   // index to _leaves
+            uint32_t leaf_size;
+        };
+
+        std::vector<node_s> _nodes;
+        std::vector<type> _keys;        // key of each node in its parent
+        std::vector<type> _leaves;
+        size_t _max_leaf_size;
+
+        // Selects the two children interpolated at `key` -- or a single child on exact match
+        // Returns the number of children selected
+        int select(const node_s &node, type key, uint32_t &first, uint32_t &second, type &factor) const
+        {
+            if (node.child_count == 1)
+            {
+                first = node.first_child;
+                return 1;
+            }
+
+            // Branchless search of the last key <= `key` -- or the first key
+            const type *base = _keys.data() + node.first_child;
+            uint32_t n = node.child_count;
+            while (n > 1)
+            {
+                uint32_t half = n / 2;
+                base = (base[half] <= key) ? base + half : base;
+                n -= half;
+            }
+            first = static_cast<uint32_t>(base - _keys.data());
+            if (*base == key)
+                return 1;
+
+            // Interpolate between neighbors -- or extrapolate from the two first / last
+            if (first + 1 == node.first_child + node.child_count)
+                first--;
+            second = first + 1;
+            factor = (key - _keys[first]) / (_keys[second] - _keys[first]);
+            return 2;
+        }
+
+        size_t result_size(uint32_t index, const type *keys, size_t key_count) const
+        {
+            auto &node = _nodes[index];
+            if (key_count == 0 || node.child_count == 0)
+                return node.leaf_size;
+
+            uint32_t first, second;
+            type factor;
+            if (select(node, keys[0], first, second, factor) == 1)
+                return result_size(first, keys + 1, key_count - 1);
+
+            auto size = result_size(first, keys + 1, key_count - 1);
+            if (size != result_size(second, keys + 1, key_count - 1))
+                return node.leaf_size;  // Misconfigured tree -- as in interpolate_x_dim
+            return size;
+        }
+
+        // Item `item` of the result of node `index` -- same operations as interpolate_x_dim
+        type evaluate(uint32_t index, const type *keys, size_t key_count, size_t item) const
+        {
+            auto &node = _nodes[index];
+            uint32_t first = 0, second = 0;
+            type factor{};
+            int branches = (key_count == 0 || node.child_count == 0) ? 0 : select(node, keys[0], first, second, factor);
+
+            if (branches == 2 &&
+                result_size(first, keys + 1, key_count - 1) != result_size(second, keys + 1, key_count - 1))
+                branches = 0;   // Misconfigured tree returns the leaf of this node
+
+            if (branches == 0)
+                return _leaves[node.leaf_offset + item];
+            if (branches == 1)
+                return evaluate(first, keys + 1, key_count - 1, item);
+
+            auto v1 = evaluate(first, keys + 1, key_count - 1, item);
+            auto v2 = evaluate(second, keys + 1, key_count - 1, item);
+            return v1 + (v2 - v1) * factor;
+        }
+    };
+
     /// <summary>
     /// Linearly interpolates input data in sampling points as in Matlab.
     /// x_data must be strictly monotonically increasing.
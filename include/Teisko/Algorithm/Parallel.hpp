@@ -0,0 +1,129 @@
+/*
+* Copyright (c) 2019, Intel Corporation
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the Intel Corporation nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#pragma once
+
+// In alphabetical order
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Teisko
+{
+    /// \brief Returns the number of worker threads to be used, when caller requests 0 threads
+    inline unsigned int default_thread_count()
+    {
+        auto count = std::thread::hardware_concurrency();
+        return count == 0 ? 1 : count;
+    }
+
+    /// \brief Calls `func(i)` for each i in [first, last[ on up to `threads` threads
+    /// The threads are started for the call and joined before returning; there is no
+    /// persistent pool, so nested calls should be given a share of the outer budget
+    /// Work items are handed out dynamically one at a time, so the items can be of uneven cost
+    /// The calling thread participates in the work; the first exception thrown by any
+    /// of the work items is rethrown after all threads have finished
+    /// \param  first       First index to process
+    /// \param  last        One past the last index to process
+    /// \param  func        Function object called as func(index), must be thread safe
+    /// \param  threads     Maximum number of threads (0 == hardware concurrency)
+    template <typename index_type, typename function_type>
+    void parallel_for(index_type first, index_type last, function_type func, unsigned int threads = 0)
+    {
+        if (last <= first)
+            return;
+
+        auto count = static_cast<size_t>(last - first);
+        if (threads == 0)
+            threads = default_thread_count();
+        threads = static_cast<unsigned int>(std::min<size_t>(threads, count));
+
+        std::atomic<size_t> next(0);
+        std::exception_ptr error = nullptr;
+        std::mutex error_lock;
+
+        auto worker = [&]()
+        {
+            for (size_t i = next++; i < count; i = next++)
+            {
+                try
+                {
+                    func(static_cast<index_type>(first + static_cast<index_type>(i)));
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(error_lock);
+                    if (!error)
+                        error = std::current_exception();
+                    next = count;       // cancels the remaining items
+                }
+            }
+        };
+
+        std::vector<std::thread> helpers;
+        for (unsigned int i = 1; i < threads; i++)
+            helpers.emplace_back(worker);
+        worker();
+        for (auto &t : helpers)
+            t.join();
+
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    /// \brief Splits [first, last[ into contiguous bands of a multiple of `grain` items and
+    /// calls `func(band_first, band_last)` for each band in parallel
+    /// - every band except the last starts and ends at `first + k * grain`
+    template <typename index_type, typename function_type>
+    void parallel_for_bands(index_type first, index_type last, index_type grain, function_type func,
+        unsigned int threads = 0)
+    {
+        if (last <= first)
+            return;
+        if (grain < 1)
+            grain = 1;
+        if (threads == 0)
+            threads = default_thread_count();
+
+        // About four bands per thread balances uneven rows without excessive scheduling
+        auto count = last - first;
+        auto band = static_cast<index_type>((count + threads * 4 - 1) / (threads * 4));
+        band = static_cast<index_type>((band + grain - 1) / grain * grain);
+        auto bands = static_cast<index_type>((count + band - 1) / band);
+        parallel_for(static_cast<index_type>(0), bands, [&](index_type b)
+        {
+            auto band_first = first + b * band;
+            auto band_last = std::min(last, band_first + band);
+            func(band_first, band_last);
+        }, threads);
+    }
+}
@@ -0,0 +1,248 @@
+/*
+* Copyright (c) 2019, Intel Corporation
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the Intel Corporation nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#pragma once
+
+// In alphabetical order
+#include "Teisko/Algorithm/PointXY.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace Teisko
+{
+    /// Uniform grid index over a fixed set of 2D points
+    /// - the point indices are bucketed by cell to one contiguous array,
+    ///   each cell holding its indices in ascending order
+    /// - radius and nearest neighbor queries visit only the cells around the query point,
+    ///   which makes N queries over N roughly uniformly spread points about O(N)
+    struct point_grid_s
+    {
+        /// Builds the index over `points`, which must outlive the index
+        /// - the default cell size gives about one point per cell
+        point_grid_s(const std::vector<point_xy> &points, double cell_size = 0.0)
+            : _points(points)
+        {
+            auto n = points.size();
+            if (n == 0)
+                return;
+
+            _min = points[0];
+            point_xy max = points[0];
+            for (auto &p : points)
+            {
+                _min.x = std::min(_min.x, p.x);
+                _min.y = std::min(_min.y, p.y);
+                max.x = std::max(max.x, p.x);
+                max.y = std::max(max.y, p.y);
+            }
+            auto w = max.x - _min.x;
+            auto h = max.y - _min.y;
+
+            // Bound the grid to at most ~3N cells, even when all points are on a line
+            if (!(cell_size > 0.0))
+                cell_size = std::max(std::sqrt(w * h / n), std::max(w, h) / n);
+            if (!(cell_size > 0.0))
+                cell_size = 1.0;
+
+            _cell_size = cell_size;
+            _inv_cell_size = 1.0 / cell_size;
+            _cols = static_cast<int>(w * _inv_cell_size) + 1;
+            _rows = static_cast<int>(h * _inv_cell_size) + 1;
+
+            // Counting sort of the point indices by cell
+            _cell_start.assign(static_cast<size_t>(_cols) * _rows + 1, 0);
+            std::vector<uint32_t> cell_of(n);
+            for (size_t i = 0; i < n; i++)
+            {
+                cell_of[i] = static_cast<uint32_t>(cell_y(points[i].y) * _cols + cell_x(points[i].x));
+                _cell_start[cell_of[i] + 1]++;
+            }
+            for (size_t c = 1; c < _cell_start.size(); c++)
+                _cell_start[c] += _cell_start[c - 1];
+
+            _indices.resize(n);
+            auto fill = _cell_start;
+            for (size_t i = 0; i < n; i++)
+                _indices[fill[cell_of[i]]++] = static_cast<uint32_t>(i);
+        }
+
+        /// The index refers to the points, so it can't be built over a temporary
+        point_grid_s(std::vector<point_xy> &&points, double cell_size = 0.0) = delete;
+
+        /// Calls `func(index)` for every point `q` with norm2(q - p) <= radius2
+        /// - the points are visited cell by cell, not in index order
+        template <typename F>
+        void for_each_within(point_xy p, double radius2, F &&func) const
+        {
+            if (_indices.empty() || !(radius2 >= 0.0))
+                return;
+
+            auto radius = std::sqrt(radius2);
+            auto x0 = std::max(0, cell_x(p.x - radius));
+            auto x1 = std::min(_cols - 1, cell_x(p.x + radius));
+            auto y0 = std::max(0, cell_y(p.y - radius));
+            auto y1 = std::min(_rows - 1, cell_y(p.y + radius));
+
+            for (int y = y0; y <= y1; y++)
+            {
+                auto row = static_cast<size_t>(y) * _cols;
+                for (auto k = _cell_start[row + x0]; k < _cell_start[row + x1 + 1]; k++)
+                {
+                    auto index = _indices[k];
+                    if (norm2(_points[index] - p) <= radius2)
+                        func(static_cast<size_t>(index));
+                }
+            }
+        }
+
+        /// Returns the squared distance from `p` to the closest point not coinciding with `p`
+        /// - returns -1 when there is no such point
+        double nearest_distance2(point_xy p) const
+        {
+            double best = -1.0;
+            if (_indices.empty())
+                return best;
+
+            auto cx = cell_x(p.x);
+            auto cy = cell_y(p.y);
+            // Rings of cells are scanned outwards until no unvisited cell can hold a closer point
+            // - after ring `r` the unvisited points are at least (r - 1) cells away; one cell
+            //   of slack keeps the bound safe from rounding in the cell coordinates
+            for (int ring = 0; ; ring++)
+            {
+                auto reach = (ring - 2) * _cell_size;
+                if (best >= 0.0 && ring > 2 && best < reach * reach)
+                    break;
+
+                auto x0 = cx - ring, x1 = cx + ring;
+                auto y0 = cy - ring, y1 = cy + ring;
+                for (int y = std::max(0, y0); y <= std::min(_rows - 1, y1); y++)
+                {
+                    // full rows at the top and bottom of the ring, only the two side cells otherwise
+                    auto step = (y == y0 || y == y1) ? 1 : x1 - x0;
+                    for (int x = x0; x <= x1; x += step)
+                    {
+                        if (x < 0 || x >= _cols)
+                            continue;
+                        auto cell = static_cast<size_t>(y) * _cols + x;
+                        for (auto k = _cell_start[cell]; k < _cell_start[cell + 1]; k++)
+                        {
+                            auto dist2 = norm2(_points[_indices[k]] - p);
+                            if (dist2 == 0.0)
+                                continue;
+                            if (best < 0 || dist2 < best)
+                                best = dist2;
+                        }
+                    }
+                }
+                if (x0 <= 0 && y0 <= 0 && x1 >= _cols - 1 && y1 >= _rows - 1)
+                    break;      // the whole grid has been scanned
+            }
+            return best;
+        }
+
+        size_t size() const { return _indices.size(); }
+
+    private:
+        const std::vector<point_xy> &_points;
+        point_xy _min;
+        double _cell_size = 1.0;
+        double _inv_cell_size = 1.0;
+        int _cols = 0;
+        int _rows = 0;
+        std::vector<uint32_t> _cell_start;  // _cols * _rows + 1 offsets to _indices
+        std::vector<uint32_t> _indices;     // point indices ordered by cell
+
+        // cell coordinates, clamped to one cell outside the grid to avoid overflow
+        int cell_x(double x) const { return clamp_cell((x - _min.x) * _inv_cell_size, _cols); }
+        int cell_y(double y) const { return clamp_cell((y - _min.y) * _inv_cell_size, _rows); }
+        static int clamp_cell(double c, int count)
+        {
+            if (!(c >= 0.0))
+                return -1;
+            return c >= count ? count : static_cast<int>(c);
+        }
+    };
+
+    /// Groups `items` to sets of adjacent items, returning the item indices of each group
+    /// - an item provides `centroid`, `connection_radius2()` and `is_connected(other)`, where
+    ///   `a.is_connected(b)` holds only for `b.centroid` within `a.connection_radius2()`
+    /// - a group grows breadth first from its lowest unassigned item, adding the connected
+    ///   items of each member in index order; groups are sorted by decreasing size (stable)
+    /// Complexity: O(N) for evenly spread items of similar size
+    template <typename T>
+    std::vector<std::vector<size_t>> find_adjacent_groups(const std::vector<T> &items)
+    {
+        auto count = items.size();
+        std::vector<point_xy> centroids;
+        centroids.reserve(count);
+        for (auto &item : items)
+            centroids.push_back(item.centroid);
+        point_grid_s grid(centroids);
+
+        std::vector<std::vector<size_t>> groups;
+        std::vector<bool> assigned(count, false);
+        std::vector<size_t> neighbors;
+        for (size_t first = 0; first < count; first++)
+        {
+            if (assigned[first])
+                continue;
+            assigned[first] = true;
+            groups.emplace_back(1, first);
+            auto &group = groups.back();
+            for (size_t m = 0; m < group.size(); m++)
+            {
+                auto &member = items[group[m]];
+                neighbors.clear();
+                grid.for_each_within(member.centroid, member.connection_radius2(), [&](size_t j)
+                {
+                    if (!assigned[j])
+                        neighbors.push_back(j);
+                });
+                std::sort(neighbors.begin(), neighbors.end());
+                for (auto j : neighbors)
+                {
+                    if (member.is_connected(items[j]))
+                    {
+                        assigned[j] = true;
+                        group.push_back(j);
+                    }
+                }
+            }
+        }
+
+        std::stable_sort(groups.begin(), groups.end(),
+            [](const std::vector<size_t> &a, const std::vector<size_t> &b)
+        {
+            return a.size() > b.size();
+        });
+        return groups;
+    }
+}
@@ -34,6 +34,7 @@
 #include <cmath>
 #include <cstdint>
 #include <functional>
+#include <iterator>
 #include <limits>
 #include <stdexcept>
 #include <vector>
@@ -65,6 +66,33 @@ namespace Teisko
         return (double)sum / (double)divisor;
     }
 
+    /// \brief Computes the mean of the range [begin, end) excluding highest and lowest samples
+    /// Same as `trimmed_mean(data, trim)`, but selects the middle items by `std::nth_element`
+    /// instead of sorting all of them -- the range is reordered
+    /// \param  begin   First item of the data
+    /// \param  end     One past the last item of the data
+    /// \param  trim    Proportion of good samples -- (1-trim)/2 items to be excluded on both sides
+    /// \returns    Average of data without outliers
+    template <typename iterator>
+    double trimmed_mean(iterator begin, iterator end, double trim)
+    {
+        typedef typename std::iterator_traits<iterator>::value_type T;
+        auto size = static_cast<size_t>(end - begin);
+        auto first_idx = std::min(size, static_cast<size_t>(std::max(0.0, 0.5 + 0.5 * (1.0 - trim) * size)));
+        auto last_idx = size - first_idx;
+        if (first_idx >= last_idx)
+            return static_cast<T>(0);
+
+        std::nth_element(begin, begin + first_idx, end);
+        std::nth_element(begin + first_idx, begin + last_idx, end);
+
+        decltype (T(1)*T(1)) sum = 0;
+        auto divisor = static_cast<decltype(sum)>(last_idx - first_idx);
+        for (auto it = begin + first_idx; it != begin + last_idx; ++it)
+            sum += *it;
+        return (double)sum / (double)divisor;
+    }
+
     /// \brief trimmed mean calculated from a histogram
     /// \param histogram    count of each sample
     /// \param skip         number of items to skip
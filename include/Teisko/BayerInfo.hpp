@@ -34,6 +34,7 @@
 #include <array>
 #include <string>
 #include <algorithm>  // std::find
+#include <stdexcept>
 
 namespace Teisko
 {
@@ -0,0 +1,526 @@
+/*
+* Copyright (c) 2019, Intel Corporation
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the Intel Corporation nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#pragma once
+#include "Teisko/Algorithm/Parallel.hpp"
+#include "Teisko/BayerImage.hpp"
+#include "Teisko/BayerInfo.hpp"
+#include "Teisko/Image/API.hpp"
+#include "Teisko/Image/LosslessJPEG.hpp"
+#include "Teisko/Image/TIFF.hpp"
+#include "Teisko/Preprocessing.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace Teisko
+{
+    enum class dng_compression_e
+    {
+        uncompressed = tag_compression_method_uncompressed,
+        lossless_jpeg = tag_compression_method_lossless_jpeg
+    };
+
+    /// Raw sensor data with the associated metadata in a DNG compatible container
+    ///  - CFAPattern maps to bayer_info_s::bayer_pattern_e
+    ///  - BlackLevel / WhiteLevel map to preprocessor_s, LinearizationTable to linearization_s
+    ///  - the raw data is stored as (optionally lossless JPEG compressed) tiles, which are
+    ///    encoded and decoded in parallel directly from/to bayer_image_s<uint16_t>
+    /// Infrared pixels have no DNG color; they are stored with cfa plane color 8
+    struct dng_file
+    {
+        bayer_pattern_e pattern = bayer_pattern_e::rggb;
+        std::vector<float> black_level;             ///< One per channel of pattern (or empty)
+        uint32_t white_level = 65535;               ///< Saturation level
+        std::vector<uint16_t> linearization_table;  ///< Shared by all channels (or empty)
+        double exposure_time = 0.0;                 ///< Seconds, 0 == unknown
+        double iso = 0.0;                           ///< 0 == unknown
+        double f_number = 0.0;                      ///< 0 == unknown
+        std::string description;
+        std::string camera_model = "Teisko";
+        dng_compression_e compression = dng_compression_e::lossless_jpeg;
+        uint32_t tile_width = 256;                  ///< Must be a multiple of 16
+        uint32_t tile_height = 256;                 ///< Must be a multiple of 16
+
+        enum { plane_color_ir = 8 };                ///< CFAPlaneColor of infrared pixels
+
+        /// \brief  write       Writes raw image and metadata as DNG
+        /// \param  out         Binary output stream
+        /// \param  img         Raw image -- the bayer pattern of the image overrides `pattern`
+        /// \param  threads     Number of threads for tile encoding (0 == hardware concurrency)
+        void write(std::ostream &out, bayer_image_s<uint16_t> &img, unsigned int threads = 0)
+        {
+            if (tile_width == 0 || tile_height == 0 || tile_width % 16 || tile_height % 16)
+                throw std::invalid_argument("DNG tile dimensions must be multiples of 16");
+            pattern = img._layout;
+            auto &layout = img._layout;
+            if (!black_level.empty() && black_level.size() != layout.get_channels())
+                throw std::invalid_argument("Black level vector size doesn't match image type");
+
+            tiff_file tiff;
+            int width = img._img._width;
+            int height = img._img._height;
+            uint16_t cfa_rows = static_cast<uint16_t>(layout.get_height());
+            uint16_t cfa_cols = static_cast<uint16_t>(layout.get_width());
+
+            std::vector<uint8_t> plane_colors = { 0, 1, 2 };
+            if (layout.is_ir_sensor())
+                plane_colors.push_back(static_cast<uint8_t>(plane_color_ir));
+
+            tiff.add_tag({
+                tiff_tag<LONG>(tag_new_subfile_type, 0u),
+                tiff_tag<LONG>(tag_image_width, (uint32_t)width),
+                tiff_tag<LONG>(tag_image_height, (uint32_t)height),
+                tiff_tag<SHORT>(tag_bits_per_sample, 16),
+                tiff_tag<SHORT>(tag_compression_method, (uint16_t)compression),
+                tiff_tag<SHORT>(tag_photometric_interpretation, (uint16_t)tag_photometric_interpretation_cfa),
+                tiff_tag<SHORT>(tag_orientation, tag_orientation_top_left),
+                tiff_tag<SHORT>(tag_samples_per_pixel, 1),
+                tiff_tag<SHORT>(tag_planar_configuration, tag_planar_configuration_chunky),
+                tiff_tag<LONG>(tag_tile_width, tile_width),
+                tiff_tag<LONG>(tag_tile_length, tile_height),
+                tiff_tag<SHORT>(tag_cfa_repeat_pattern_dim, { cfa_rows, cfa_cols }),
+                tiff_tag<BYTE>(tag_cfa_pattern, cfa_pattern(layout)),
+                tiff_tag<BYTE>(tag_dng_version, { 1, 4, 0, 0 }),
+                tiff_tag<BYTE>(tag_dng_backward_version, { 1, 1, 0, 0 }),
+                tiff_tag<ASCII>(tag_unique_camera_model, camera_model),
+                tiff_tag<BYTE>(tag_cfa_plane_color, plane_colors),
+                tiff_tag<SHORT>(tag_cfa_layout, tag_cfa_layout_rectangular),
+                tiff_tag<LONG>(tag_white_level, white_level)
+            });
+
+            if (!black_level.empty())
+            {
+                // Rationals with denominator 256 represent the fractional black levels exactly enough
+                std::vector<uint32_t> rationals;
+                for (auto bl : black_level)
+                {
+                    rationals.push_back((uint32_t)std::lround(std::max(0.0f, bl) * 256.0f));
+                    rationals.push_back(256);
+                }
+                tiff.add_tag({
+                    tiff_tag<SHORT>(tag_black_level_repeat_dim, { cfa_rows, cfa_cols }),
+                    tiff_tag<RATIONAL>(tag_black_level, rationals)
+                });
+            }
+            if (!linearization_table.empty())
+                tiff.add_tag(tiff_tag<SHORT>(tag_linearization_table, linearization_table));
+            if (!description.empty())
+                tiff.add_tag(tiff_tag<ASCII>(tag_image_description, description));
+            if (exposure_time > 0)
+                tiff.add_exif_tag(tiff_tag<RATIONAL>(tag_exif_exposure_time,
+                    { (uint32_t)std::lround(exposure_time * 1000000.0), 1000000u }));
+            if (f_number > 0)
+                tiff.add_exif_tag(tiff_tag<RATIONAL>(tag_exif_f_number,
+                    { (uint32_t)std::lround(f_number * 100.0), 100u }));
+            if (iso > 0)
+                tiff.add_exif_tag(tiff_tag<SHORT>(tag_exif_iso_speed,
+                    (uint16_t)std::min(65535L, std::lround(iso))));
+
+            tiff.set_image_data(encode_tiles(img._img, threads), true);
+            tiff.write(out);
+        }
+
+        /// \brief  read        Reads a DNG / CFA tiff with the raw data either in the primary
+        ///                     IFD or in one of its sub IFDs
+        /// \param  input       Binary input stream
+        /// \param  threads     Number of threads for tile decoding (0 == hardware concurrency)
+        /// \returns            The raw image -- metadata is stored to this object
+        bayer_image_s<uint16_t> read(std::istream &input, unsigned int threads = 0)
+        {
+            const auto all_values = std::numeric_limits<uint32_t>::max();
+            tiff_metadata primary(input, all_values);
+            if (!primary.is_valid())
+                throw std::runtime_error("Not a tiff file");
+
+            tiff_metadata raw = primary;
+            if (!is_cfa(raw))
+            {
+                for (auto offset : primary.tag_as_vector<uint32_t>(tag_sub_ifds))
+                {
+                    raw = primary.sub_directory(input, offset, all_values);
+                    if (is_cfa(raw))
+                        break;
+                }
+                if (!is_cfa(raw))
+                    throw std::runtime_error("No color filter array image found");
+            }
+
+            read_metadata(primary, raw);
+
+            auto width = first_or(raw, tag_image_width, 0);
+            auto height = first_or(raw, tag_image_height, 0);
+            auto bits = first_or(raw, tag_bits_per_sample, 0);
+            auto method = first_or(raw, tag_compression_method, tag_compression_method_uncompressed);
+            if (width <= 0 || height <= 0)
+                throw std::runtime_error("Invalid raw image dimensions");
+            if (first_or(raw, tag_samples_per_pixel, 1) != 1)
+                throw std::runtime_error("Only single sample CFA images are supported");
+            if (method == tag_compression_method_uncompressed && bits != 8 && bits != 16)
+                throw std::runtime_error("Only 8 and 16 bit uncompressed raw images are supported");
+            if (method != tag_compression_method_uncompressed && method != tag_compression_method_lossless_jpeg)
+                throw std::runtime_error("Unsupported raw compression method");
+            compression = (dng_compression_e)method;
+
+            // Strips are handled as tiles of full image width
+            auto offsets = raw.tag_as_vector<uint32_t>(tag_tile_offsets);
+            auto counts = raw.tag_as_vector<uint32_t>(tag_tile_byte_counts);
+            int tw = first_or(raw, tag_tile_width, 0);
+            int th = first_or(raw, tag_tile_length, 0);
+            if (offsets.empty())
+            {
+                offsets = raw.tag_as_vector<uint32_t>(tag_strip_offsets);
+                counts = raw.tag_as_vector<uint32_t>(tag_strip_byte_counts);
+                tw = width;
+                th = std::min(height, first_or(raw, tag_rows_per_strip, height));
+            }
+            if (tw <= 0 || th <= 0)
+                throw std::runtime_error("Invalid tile dimensions");
+            int tiles_across = (width - 1) / tw + 1;
+            int tiles_down = (height - 1) / th + 1;
+            auto tile_count = static_cast<uint64_t>(tiles_across) * static_cast<uint64_t>(tiles_down);
+            if (offsets.size() != counts.size() || offsets.size() < tile_count)
+                throw std::runtime_error("Missing raw image tiles");
+            tile_width = tw;
+            tile_height = th;
+
+            // Reject tiles outside the stream or too short for their samples before
+            // allocating any of them or the image; lossless JPEG needs at least one bit per sample
+            std::vector<std::vector<uint8_t>> tiles(static_cast<size_t>(tile_count));
+            auto length = stream_length(input);
+            for (size_t i = 0; i < tiles.size(); i++)
+            {
+                if (static_cast<uint64_t>(offsets[i]) + counts[i] > length)
+                    throw std::runtime_error("Truncated raw image tile");
+                uint64_t rows = std::min(th, height - static_cast<int>(i / tiles_across) * th);
+                uint64_t cols = std::min(tw, width - static_cast<int>(i % tiles_across) * tw);
+                uint64_t needed = compression == dng_compression_e::lossless_jpeg
+                    ? (rows * cols + 7) / 8
+                    : static_cast<uint64_t>(bits / 8) * (static_cast<uint64_t>(tw) * (rows - 1) + cols);
+                if (counts[i] < needed)
+                    throw std::runtime_error("Raw image tile is too short");
+            }
+
+            // Read the tiles sequentially, then decode them in parallel
+            for (size_t i = 0; i < tiles.size(); i++)
+            {
+                tiles[i].resize(counts[i]);
+                input.clear();
+                input.seekg(offsets[i], std::ios::beg);
+                input.read(reinterpret_cast<char*>(tiles[i].data()), counts[i]);
+                if (input.gcount() != static_cast<std::streamsize>(counts[i]))
+                    throw std::runtime_error("Truncated raw image tile");
+            }
+
+            bayer_image_s<uint16_t> img(height, width, pattern);
+            bool is_big_endian = raw.is_big_endian();
+            parallel_for(size_t(0), tiles.size(), [&](size_t i)
+            {
+                int tx = static_cast<int>(i % tiles_across) * tw;
+                int ty = static_cast<int>(i / tiles_across) * th;
+                auto dst = img._img.region(std::min(th, height - ty), std::min(tw, width - tx), ty, tx);
+                auto &data = tiles[i];
+                if (compression == dng_compression_e::lossless_jpeg)
+                    lossless_jpeg::decode(data.data(), data.size(), dst);
+                else
+                    decode_uncompressed(data, tw, bits, is_big_endian, dst);
+            }, threads);
+            return img;
+        }
+
+        /// Returns the TIFF/EP CFAPattern of a layout -- indices to cfa plane colors
+        static std::vector<uint8_t> cfa_pattern(bayer_info_s &layout)
+        {
+            std::vector<uint8_t> result;
+            for (auto color : layout.get_color_pattern())
+                result.push_back(static_cast<uint8_t>(color));      // red, green, blue, ir
+            return result;
+        }
+
+        /// Locates the bayer pattern matching the CFA repeat pattern
+        /// \param  rows, cols      CFARepeatPatternDim
+        /// \param  cfa             CFAPattern
+        /// \param  plane_colors    CFAPlaneColor (default 0,1,2)
+        static bayer_pattern_e pattern_from_cfa(int rows, int cols, const std::vector<uint8_t> &cfa,
+            std::vector<uint8_t> plane_colors = { 0, 1, 2 })
+        {
+            if (cfa.size() != static_cast<size_t>(rows * cols))
+                throw std::runtime_error("CFA pattern size mismatch");
+
+            std::vector<color_info_e> colors;
+            for (auto index : cfa)
+            {
+                if (index >= plane_colors.size())
+                    throw std::runtime_error("CFA pattern refers to a missing plane color");
+                switch (plane_colors[index])
+                {
+                case 0: colors.push_back(color_info_e::red); break;
+                case 1: colors.push_back(color_info_e::green); break;
+                case 2: colors.push_back(color_info_e::blue); break;
+                case plane_color_ir: colors.push_back(color_info_e::ir); break;
+                default: throw std::runtime_error("Unsupported CFA plane color");
+                }
+            }
+
+            for (auto &list : { bayer_info_s::get_regular_2x2_patterns(), bayer_info_s::get_ir_2x2_patterns(),
+                bayer_info_s::get_dp_4x2_patterns(), bayer_info_s::get_ir_4x4_patterns() })
+            {
+                for (auto candidate : list)
+                {
+                    bayer_info_s info(candidate);
+                    if ((int)info.get_height() == rows && (int)info.get_width() == cols &&
+                        info.get_color_pattern() == colors)
+                        return candidate;
+                }
+            }
+            throw std::runtime_error("CFA pattern has no matching bayer pattern");
+        }
+
+        /// Sets the black level model and saturation of a preprocessor
+        /// The model is independent of analog gain and exposure
+        void apply_to(preprocessor_s &preprocessor) const
+        {
+            preprocessor.bl_model = black_level_model();
+            if (!black_level.empty())
+                preprocessor.bl_model.set(1.0f, 0.0f, black_level);
+            preprocessor.saturation = static_cast<float>(white_level);
+        }
+
+        /// Copies the black level (at given analog gain and exposure) and saturation from a preprocessor
+        void set_from(preprocessor_s &preprocessor, float analog_gain, float exposure)
+        {
+            bayer_info_s layout(pattern);
+            black_level = preprocessor.get_black_level(layout, analog_gain, exposure);
+            white_level = static_cast<uint32_t>(std::lround(preprocessor.saturation));
+        }
+
+        /// Returns the linearization table as a linearization_s shared by all channels
+        linearization_s get_linearization() const
+        {
+            linearization_s result;
+            if (linearization_table.empty())
+                return result;
+            result.grid_indices = std::vector<int8_t>(16, 0);
+            result.knee_points.emplace_back();
+            auto &knees = result.knee_points.back();
+            for (size_t i = 0; i < linearization_table.size(); i++)
+                knees.emplace_back(static_cast<int>(i), static_cast<int>(linearization_table[i]));
+            return result;
+        }
+
+        /// Converts a linearization_s to the single DNG linearization table
+        /// Throws if the channels of `pattern` use different curves
+        void set_linearization(linearization_s &linearization)
+        {
+            bayer_image_s<uint16_t> layout(0, 0, pattern);
+            linearization_table.clear();
+            for (auto ch : layout)
+            {
+                auto lut = linearization.make_lut(layout, ch, 65535);
+                if (ch > 0 && lut != linearization_table)
+                    throw std::invalid_argument("DNG supports only one linearization table for all channels");
+                linearization_table = lut;
+            }
+        }
+
+        /// Parses a `.meta` side-car file of `key value` lines
+        /// Recognizes exposure_time, iso and aperture; other keys are ignored
+        void read_meta(std::istream &meta)
+        {
+            std::string line;
+            while (std::getline(meta, line))
+            {
+                std::istringstream fields(line);
+                std::string key;
+                double value = 0.0;
+                if (!(fields >> key >> value) || std::isnan(value))
+                    continue;
+                if (key == "exposure_time")
+                    exposure_time = value;
+                else if (key == "iso")
+                    iso = value;
+                else if (key == "aperture")
+                    f_number = value;
+            }
+        }
+
+        /// Reads a headerless little endian `.plain16` raw file
+        static bayer_image_s<uint16_t> read_plain16(std::istream &input, int height, int width, bayer_pattern_e layout)
+        {
+            bayer_image_s<uint16_t> img(height, width, layout);
+            std::vector<uint8_t> row(static_cast<size_t>(width) * 2);
+            for (int y = 0; y < height; y++)
+            {
+                input.read(reinterpret_cast<char*>(row.data()), row.size());
+                if (input.gcount() != static_cast<std::streamsize>(row.size()))
+                    throw std::runtime_error("Truncated plain16 file");
+                for (int x = 0; x < width; x++)
+                    img._img(y, x) = get_short(row.data() + 2 * x, false);
+            }
+            return img;
+        }
+
+    private:
+        static bool is_cfa(const tiff_metadata &dir)
+        {
+            return first_or(dir, tag_photometric_interpretation, 0) == tag_photometric_interpretation_cfa;
+        }
+
+        static int first_or(const tiff_metadata &dir, tiff_tags id, int default_value)
+        {
+            auto values = dir.tag_as_vector(id);
+            return values.empty() ? default_value : values[0];
+        }
+
+        /// Returns tag values as doubles dividing rationals
+        static std::vector<double> as_doubles(const tiff_metadata &dir, tiff_tags id)
+        {
+            if (!dir.has_value(id))
+                return{};
+            auto tag = dir.tag(id);
+            auto values = tag.value<double>();
+            if (tag.type() != RATIONAL && tag.type() != SRATIONAL)
+                return values;
+            std::vector<double> result;
+            for (size_t i = 0; i + 1 < values.size(); i += 2)
+                result.push_back(values[i + 1] != 0.0 ? values[i] / values[i + 1] : 0.0);
+            return result;
+        }
+
+        void read_metadata(const tiff_metadata &primary, const tiff_metadata &raw)
+        {
+            auto dims = raw.tag_as_vector(tag_cfa_repeat_pattern_dim);
+            auto cfa = raw.tag_as_vector<uint8_t>(tag_cfa_pattern);
+            if (dims.size() != 2)
+                throw std::runtime_error("Missing CFA repeat pattern dimensions");
+            auto plane_colors = raw.has_value(tag_cfa_plane_color)
+                ? raw.tag_as_vector<uint8_t>(tag_cfa_plane_color)
+                : primary.has_value(tag_cfa_plane_color)
+                ? primary.tag_as_vector<uint8_t>(tag_cfa_plane_color)
+                : std::vector<uint8_t>{ 0, 1, 2 };
+            pattern = pattern_from_cfa(dims[0], dims[1], cfa, plane_colors);
+
+            // Black level is given for a repeating pattern; expand it to the channels of the layout
+            bayer_info_s layout(pattern);
+            black_level.clear();
+            auto levels = as_doubles(raw, tag_black_level);
+            if (!levels.empty())
+            {
+                auto repeat = raw.tag_as_vector(tag_black_level_repeat_dim);
+                int rows = repeat.size() == 2 ? repeat[0] : 1;
+                int cols = repeat.size() == 2 ? repeat[1] : 1;
+                if (rows < 1 || cols < 1 || levels.size() < (size_t)(rows * cols))
+                    throw std::runtime_error("Black level size mismatch");
+                for (auto ch : layout)
+                {
+                    int y = ch / layout.get_width();
+                    int x = ch % layout.get_width();
+                    black_level.push_back(static_cast<float>(levels[(y % rows) * cols + (x % cols)]));
+                }
+            }
+
+            auto bits = first_or(raw, tag_bits_per_sample, 16);
+            if (bits < 1 || bits > 16)
+                throw std::runtime_error("Only 1 to 16 bit raw images are supported");
+            white_level = static_cast<uint32_t>(first_or(raw, tag_white_level, (1 << bits) - 1));
+            linearization_table = raw.tag_as_vector<uint16_t>(tag_linearization_table);
+
+            auto exposure = as_doubles(primary, tag_exif_exposure_time);
+            auto aperture = as_doubles(primary, tag_exif_f_number);
+            auto speed = primary.tag_as_vector(tag_exif_iso_speed);
+            exposure_time = exposure.empty() ? 0.0 : exposure[0];
+            f_number = aperture.empty() ? 0.0 : aperture[0];
+            iso = speed.empty() ? 0.0 : speed[0];
+            description = primary.tag_as_string(tag_image_description);
+            if (primary.has_value(tag_unique_camera_model))
+                camera_model = primary.tag_as_string(tag_unique_camera_model);
+        }
+
+        /// Splits the image to tiles padded by edge replication and encodes them in parallel
+        std::vector<std::vector<uint8_t>> encode_tiles(image<uint16_t> &img, unsigned int threads)
+        {
+            int width = img._width;
+            int height = img._height;
+            int tw = tile_width;
+            int th = tile_height;
+            int tiles_across = (width + tw - 1) / tw;
+            int tiles_down = (height + th - 1) / th;
+            std::vector<std::vector<uint8_t>> tiles(tiles_across * tiles_down);
+
+            parallel_for(size_t(0), tiles.size(), [&](size_t i)
+            {
+                int tx = static_cast<int>(i % tiles_across) * tw;
+                int ty = static_cast<int>(i / tiles_across) * th;
+                image<uint16_t> tile(th, tw);
+                for (int y = 0; y < th; y++)
+                {
+                    int sy = std::min(ty + y, height - 1);
+                    for (int x = 0; x < tw; x++)
+                        tile(y, x) = img(sy, std::min(tx + x, width - 1));
+                }
+                if (compression == dng_compression_e::lossless_jpeg)
+                {
+                    tiles[i] = lossless_jpeg::encode(tile, 16);
+                }
+                else
+                {
+                    auto &data = tiles[i];
+                    data.resize(static_cast<size_t>(tw) * th * 2);
+                    auto dptr = data.data();
+                    tile.for_each([&dptr](uint16_t &pixel)
+                    {
+                        *dptr++ = static_cast<uint8_t>(pixel & 0xff);     // little endian
+                        *dptr++ = static_cast<uint8_t>(pixel >> 8);
+                    });
+                }
+            }, threads);
+            return tiles;
+        }
+
+        static void decode_uncompressed(std::vector<uint8_t> &data, int tile_stride, int bits,
+            bool is_big_endian, image<uint16_t> &dst)
+        {
+            size_t bytes = bits / 8;
+            if (data.size() < bytes * tile_stride * (dst._height - 1) + bytes * dst._width)
+                throw std::runtime_error("Raw image tile is too short");
+            for (int y = 0; y < dst._height; y++)
+            {
+                const uint8_t *src = data.data() + bytes * tile_stride * y;
+                for (int x = 0; x < dst._width; x++, src += bytes)
+                    dst(y, x) = bytes == 1 ? *src : get_short(src, is_big_endian);
+            }
+        }
+    };
+}
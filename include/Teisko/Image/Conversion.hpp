@@ -27,7 +27,10 @@
 
 
 #pragma once
+#include "Teisko/Algorithm/CpuFeatures.hpp"
+#include "Teisko/Algorithm/Parallel.hpp"
 #include "Teisko/Image/API.hpp"
+#include "Teisko/Image/RGB.hpp"
 #include <cstdint>
 #include <memory>
 #include <vector>
@@ -196,7 +199,7 @@ namespace Teisko
     ///      0 2 4 6|8 a c e
     ///      1 3 5 7|9 b d f
     ///      - this has the possibility of processing just one item at a time
-    inline image<uint16_t> chroma_upscale_asm(image<uint16_t> &input, int bits)
+    inline image<uint16_t> chroma_upscale_sse4(image<uint16_t> &input, int bits)
     {
         auto size = input.size();
         if (size == roi_point(0))
@@ -321,6 +324,251 @@ namespace Teisko
         return output;
     }
 
+    /// AVX2 version of `chroma_upscale_sse4` -- processes 16 pixels at a time (8 for bit depths 13..16)
+    ///   - `alignr` does not cross the 128-bit lanes in AVX2; the three kernel columns
+    ///     [a b c] are instead read with three unaligned loads
+    ///   - the interleaved results are reordered with `permute2x128` (16-bit) or
+    ///     come out in order from `packus_epi32` when interleaved before packing (32-bit)
+    TEISKO_TARGET_AVX2
+    inline image<uint16_t> chroma_upscale_avx2(image<uint16_t> &input, int bits)
+    {
+        auto size = input.size();
+        if (size == roi_point(0))
+            return input;
+
+        auto output = image<uint16_t>(size * 2);
+        auto right_pad = (-size._x) & 15;       // the last vector + 2 neighbours must be readable
+        auto temp = input.make_borders(1, 1, 1, 1 + right_pad, REPLICATE);
+        auto stride_y = temp._skip_y;
+        alignas(32) uint16_t tail[32];          // staging area for the partial vectors at the end of row
+
+        const __m256i three = _mm256_set1_epi16(3);
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i eight = _mm256_set1_epi32(8);
+
+        for (int j = 0; j < size._y; j++)
+        {
+            const uint16_t *src = &temp(j, 0);
+            uint16_t *dst[2] = { &output(j * 2, 0), &output(j * 2 + 1, 0) };
+            if (bits <= 12)
+            {
+                // 16-bit arithmetic: 16 * (2^12 - 1) fits uint16_t
+                for (int x = 0; x < size._x; x += 16)
+                {
+                    __m256i sums[2][3];     // top + 3 * mid, bot + 3 * mid for columns x, x+1, x+2
+                    for (int k = 0; k < 3; k++)
+                    {
+                        auto ptr = src + x + k;
+                        auto mid = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr + stride_y));
+                        mid = _mm256_mullo_epi16(mid, three);
+                        sums[0][k] = _mm256_add_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr)), mid);
+                        sums[1][k] = _mm256_add_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr + 2 * stride_y)), mid);
+                    }
+                    auto count = 2 * std::min(16, size._x - x);
+                    for (int r = 0; r < 2; r++)
+                    {
+                        auto center = _mm256_mullo_epi16(sums[r][1], three);
+                        auto left = _mm256_add_epi16(sums[r][0], center);
+                        auto right = _mm256_add_epi16(sums[r][2], center);
+                        left = _mm256_avg_epu16(_mm256_srli_epi16(left, 3), zero);      // == (left + 8) >> 4
+                        right = _mm256_avg_epu16(_mm256_srli_epi16(right, 3), zero);
+                        auto lo = _mm256_unpacklo_epi16(left, right);       // pixels 0..3 | 8..11
+                        auto hi = _mm256_unpackhi_epi16(left, right);       // pixels 4..7 | 12..15
+                        auto first = _mm256_permute2x128_si256(lo, hi, 0x20);
+                        auto second = _mm256_permute2x128_si256(lo, hi, 0x31);
+                        auto d = dst[r] + 2 * x;
+                        if (count == 32)
+                        {
+                            _mm256_storeu_si256(reinterpret_cast<__m256i*>(d), first);
+                            _mm256_storeu_si256(reinterpret_cast<__m256i*>(d + 16), second);
+                        }
+                        else
+                        {
+                            _mm256_store_si256(reinterpret_cast<__m256i*>(tail), first);
+                            _mm256_store_si256(reinterpret_cast<__m256i*>(tail + 16), second);
+                            std::copy(tail, tail + count, d);
+                        }
+                    }
+                }
+            }
+            else
+            {
+                // 32-bit arithmetic for bit depths 13..16
+                for (int x = 0; x < size._x; x += 8)
+                {
+                    __m256i sums[2][3];
+                    for (int k = 0; k < 3; k++)
+                    {
+                        auto ptr = src + x + k;
+                        auto top = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr)));
+                        auto mid = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + stride_y)));
+                        auto bot = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + 2 * stride_y)));
+                        mid = _mm256_add_epi32(mid, _mm256_add_epi32(mid, mid));
+                        sums[0][k] = _mm256_add_epi32(top, mid);
+                        sums[1][k] = _mm256_add_epi32(bot, mid);
+                    }
+                    auto count = 2 * std::min(8, size._x - x);
+                    for (int r = 0; r < 2; r++)
+                    {
+                        auto center = _mm256_add_epi32(sums[r][1], _mm256_add_epi32(sums[r][1], sums[r][1]));
+                        auto left = _mm256_add_epi32(sums[r][0], center);
+                        auto right = _mm256_add_epi32(sums[r][2], center);
+                        left = _mm256_srli_epi32(_mm256_add_epi32(left, eight), 4);
+                        right = _mm256_srli_epi32(_mm256_add_epi32(right, eight), 4);
+                        auto lo = _mm256_unpacklo_epi32(left, right);       // L0 R0 L1 R1 | L4 R4 L5 R5
+                        auto hi = _mm256_unpackhi_epi32(left, right);       // L2 R2 L3 R3 | L6 R6 L7 R7
+                        auto packed = _mm256_packus_epi32(lo, hi);          // L0 R0 ... L7 R7
+                        auto d = dst[r] + 2 * x;
+                        if (count == 16)
+                        {
+                            _mm256_storeu_si256(reinterpret_cast<__m256i*>(d), packed);
+                        }
+                        else
+                        {
+                            _mm256_store_si256(reinterpret_cast<__m256i*>(tail), packed);
+                            std::copy(tail, tail + count, d);
+                        }
+                    }
+                }
+            }
+        }
+        return output;
+    }
+
+    /// AVX-512 version of `chroma_upscale_avx2` -- processes 32 pixels at a time (16 for bit depths 13..16)
+    ///   - requires AVX-512BW for the 16-bit operations
+    TEISKO_TARGET_AVX512
+    inline image<uint16_t> chroma_upscale_avx512(image<uint16_t> &input, int bits)
+    {
+        auto size = input.size();
+        if (size == roi_point(0))
+            return input;
+
+        auto output = image<uint16_t>(size * 2);
+        auto right_pad = (-size._x) & 31;
+        auto temp = input.make_borders(1, 1, 1, 1 + right_pad, REPLICATE);
+        auto stride_y = temp._skip_y;
+        alignas(64) uint16_t tail[64];
+
+        const __m512i three = _mm512_set1_epi16(3);
+        const __m512i zero = _mm512_setzero_si512();
+        const __m512i eight = _mm512_set1_epi32(8);
+        // The 32-bit operations are written in the masked form with all lanes selected,
+        // since GCC warns about the undefined pass-through vector of the unmasked intrinsics
+        const __mmask16 all = 0xffff;
+        // Gathers the 64-bit pairs of unpacklo/unpackhi back to pixel order
+        const __m512i first_half = _mm512_set_epi64(11, 10, 3, 2, 9, 8, 1, 0);
+        const __m512i second_half = _mm512_set_epi64(15, 14, 7, 6, 13, 12, 5, 4);
+
+        for (int j = 0; j < size._y; j++)
+        {
+            const uint16_t *src = &temp(j, 0);
+            uint16_t *dst[2] = { &output(j * 2, 0), &output(j * 2 + 1, 0) };
+            if (bits <= 12)
+            {
+                for (int x = 0; x < size._x; x += 32)
+                {
+                    __m512i sums[2][3];
+                    for (int k = 0; k < 3; k++)
+                    {
+                        auto ptr = src + x + k;
+                        auto mid = _mm512_mullo_epi16(_mm512_loadu_si512(ptr + stride_y), three);
+                        sums[0][k] = _mm512_add_epi16(_mm512_loadu_si512(ptr), mid);
+                        sums[1][k] = _mm512_add_epi16(_mm512_loadu_si512(ptr + 2 * stride_y), mid);
+                    }
+                    auto count = 2 * std::min(32, size._x - x);
+                    for (int r = 0; r < 2; r++)
+                    {
+                        auto center = _mm512_mullo_epi16(sums[r][1], three);
+                        auto left = _mm512_add_epi16(sums[r][0], center);
+                        auto right = _mm512_add_epi16(sums[r][2], center);
+                        left = _mm512_avg_epu16(_mm512_srli_epi16(left, 3), zero);
+                        right = _mm512_avg_epu16(_mm512_srli_epi16(right, 3), zero);
+                        auto lo = _mm512_unpacklo_epi16(left, right);       // pixels 0..3 | 8..11 | 16..19 | 24..27
+                        auto hi = _mm512_unpackhi_epi16(left, right);       // pixels 4..7 | 12..15 | 20..23 | 28..31
+                        auto first = _mm512_permutex2var_epi64(lo, first_half, hi);
+                        auto second = _mm512_permutex2var_epi64(lo, second_half, hi);
+                        auto d = dst[r] + 2 * x;
+                        if (count == 64)
+                        {
+                            _mm512_storeu_si512(d, first);
+                            _mm512_storeu_si512(d + 32, second);
+                        }
+                        else
+                        {
+                            _mm512_store_si512(tail, first);
+                            _mm512_store_si512(tail + 32, second);
+                            std::copy(tail, tail + count, d);
+                        }
+                    }
+                }
+            }
+            else
+            {
+                for (int x = 0; x < size._x; x += 16)
+                {
+                    __m512i sums[2][3];
+                    for (int k = 0; k < 3; k++)
+                    {
+                        auto ptr = src + x + k;
+                        auto top = _mm512_maskz_cvtepu16_epi32(all, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr)));
+                        auto mid = _mm512_maskz_cvtepu16_epi32(all, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr + stride_y)));
+                        auto bot = _mm512_maskz_cvtepu16_epi32(all, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr + 2 * stride_y)));
+                        mid = _mm512_add_epi32(mid, _mm512_add_epi32(mid, mid));
+                        sums[0][k] = _mm512_add_epi32(top, mid);
+                        sums[1][k] = _mm512_add_epi32(bot, mid);
+                    }
+                    auto count = 2 * std::min(16, size._x - x);
+                    for (int r = 0; r < 2; r++)
+                    {
+                        auto center = _mm512_add_epi32(sums[r][1], _mm512_add_epi32(sums[r][1], sums[r][1]));
+                        auto left = _mm512_add_epi32(sums[r][0], center);
+                        auto right = _mm512_add_epi32(sums[r][2], center);
+                        left = _mm512_add_epi32(left, eight);
+                        right = _mm512_add_epi32(right, eight);
+                        left = _mm512_mask_srli_epi32(left, all, left, 4);
+                        right = _mm512_mask_srli_epi32(right, all, right, 4);
+                        auto lo = _mm512_mask_unpacklo_epi32(left, all, left, right);
+                        auto hi = _mm512_mask_unpackhi_epi32(left, all, left, right);
+                        auto packed = _mm512_packus_epi32(lo, hi);          // L0 R0 ... L15 R15
+                        auto d = dst[r] + 2 * x;
+                        if (count == 32)
+                        {
+                            _mm512_storeu_si512(d, packed);
+                        }
+                        else
+                        {
+                            _mm512_store_si512(tail, packed);
+                            std::copy(tail, tail + count, d);
+                        }
+                    }
+                }
+            }
+        }
+        return output;
+    }
+
+    /// Chroma upscaling with the widest instruction set supported by the processor
+    /// All tiers produce bit exact results with `chroma_upscale`
+    /// \param  input   Chroma plane to be upscaled by 2x2
+    /// \param  bits    Bit depth of input -- depths over 12 use 32-bit arithmetic
+    ///                 (`chroma_upscale_asm_32` on the SSE4 tier)
+    /// \param  level   Highest tier to use -- e.g. for testing or benchmarking the narrower tiers
+    inline image<uint16_t> chroma_upscale_asm(image<uint16_t> &input, int bits,
+        simd_level_e level = detected_simd_level())
+    {
+        if (input.size() == roi_point(0))
+            return input;
+
+        switch (supported_simd_level(level))
+        {
+        case simd_level_e::avx512: return chroma_upscale_avx512(input, bits);
+        case simd_level_e::avx2: return chroma_upscale_avx2(input, bits);
+        case simd_level_e::sse4: return bits > 12 ? chroma_upscale_asm_32(input) : chroma_upscale_sse4(input, bits);
+        default: return chroma_upscale(input);
+        }
+    }
+
     // Calculates the matrix multiplication and clipping for yuv->rgb conversion
     // for `count * 8` number of successive items of 'uint16_t's
     //   r = Clamp(0, 1<<bits - 1, (y * m00 + (u-bias) * m01 + (v-bias) * m02 + 8192) >> 14)
@@ -391,6 +639,68 @@ namespace Teisko
         }
     }
 
+    /// AVX2 version of the above for `count * 16` items
+    ///  - madd, unpack and pack operate within 128-bit lanes, which keeps the items in order
+    template <int shift>
+    TEISKO_TARGET_AVX2
+    inline void yuv_to_rgb(__m256i *yr, __m256i *ug, __m256i *vb, __m256i *coeff, unsigned int count)
+    {
+        while (count-- > 0)
+        {
+            auto y_r = _mm256_loadu_si256(yr);
+            auto u_g = _mm256_sub_epi16(_mm256_loadu_si256(ug), coeff[8]);
+            auto v_b = _mm256_sub_epi16(_mm256_loadu_si256(vb), coeff[8]);
+            auto y_lo = _mm256_unpacklo_epi16(y_r, coeff[7]);
+            auto y_hi = _mm256_unpackhi_epi16(y_r, coeff[7]);
+            auto uv_lo = _mm256_unpacklo_epi16(u_g, v_b);
+            auto uv_hi = _mm256_unpackhi_epi16(u_g, v_b);
+            auto r0 = _mm256_add_epi32(_mm256_madd_epi16(y_lo, coeff[0]), _mm256_madd_epi16(uv_lo, coeff[1]));
+            auto r1 = _mm256_add_epi32(_mm256_madd_epi16(y_hi, coeff[0]), _mm256_madd_epi16(uv_hi, coeff[1]));
+            auto g0 = _mm256_add_epi32(_mm256_madd_epi16(y_lo, coeff[2]), _mm256_madd_epi16(uv_lo, coeff[3]));
+            auto g1 = _mm256_add_epi32(_mm256_madd_epi16(y_hi, coeff[2]), _mm256_madd_epi16(uv_hi, coeff[3]));
+            auto b0 = _mm256_add_epi32(_mm256_madd_epi16(y_lo, coeff[4]), _mm256_madd_epi16(uv_lo, coeff[5]));
+            auto b1 = _mm256_add_epi32(_mm256_madd_epi16(y_hi, coeff[4]), _mm256_madd_epi16(uv_hi, coeff[5]));
+            r0 = _mm256_packus_epi32(_mm256_srai_epi32(r0, shift), _mm256_srai_epi32(r1, shift));
+            g0 = _mm256_packus_epi32(_mm256_srai_epi32(g0, shift), _mm256_srai_epi32(g1, shift));
+            b0 = _mm256_packus_epi32(_mm256_srai_epi32(b0, shift), _mm256_srai_epi32(b1, shift));
+            _mm256_storeu_si256(yr++, _mm256_min_epu16(r0, coeff[6]));
+            _mm256_storeu_si256(ug++, _mm256_min_epu16(g0, coeff[6]));
+            _mm256_storeu_si256(vb++, _mm256_min_epu16(b0, coeff[6]));
+        }
+    }
+
+    /// AVX-512 version of the above for `count * 32` items
+    /// - the 32-bit shifts are written in the masked form with all lanes selected, since GCC
+    ///   warns about the undefined pass-through vector of the unmasked intrinsics
+    template <int shift>
+    TEISKO_TARGET_AVX512
+    inline void yuv_to_rgb(__m512i *yr, __m512i *ug, __m512i *vb, __m512i *coeff, unsigned int count)
+    {
+        const __mmask16 all = 0xffff;
+        while (count-- > 0)
+        {
+            auto y_r = _mm512_loadu_si512(yr);
+            auto u_g = _mm512_sub_epi16(_mm512_loadu_si512(ug), coeff[8]);
+            auto v_b = _mm512_sub_epi16(_mm512_loadu_si512(vb), coeff[8]);
+            auto y_lo = _mm512_unpacklo_epi16(y_r, coeff[7]);
+            auto y_hi = _mm512_unpackhi_epi16(y_r, coeff[7]);
+            auto uv_lo = _mm512_unpacklo_epi16(u_g, v_b);
+            auto uv_hi = _mm512_unpackhi_epi16(u_g, v_b);
+            auto r0 = _mm512_add_epi32(_mm512_madd_epi16(y_lo, coeff[0]), _mm512_madd_epi16(uv_lo, coeff[1]));
+            auto r1 = _mm512_add_epi32(_mm512_madd_epi16(y_hi, coeff[0]), _mm512_madd_epi16(uv_hi, coeff[1]));
+            auto g0 = _mm512_add_epi32(_mm512_madd_epi16(y_lo, coeff[2]), _mm512_madd_epi16(uv_lo, coeff[3]));
+            auto g1 = _mm512_add_epi32(_mm512_madd_epi16(y_hi, coeff[2]), _mm512_madd_epi16(uv_hi, coeff[3]));
+            auto b0 = _mm512_add_epi32(_mm512_madd_epi16(y_lo, coeff[4]), _mm512_madd_epi16(uv_lo, coeff[5]));
+            auto b1 = _mm512_add_epi32(_mm512_madd_epi16(y_hi, coeff[4]), _mm512_madd_epi16(uv_hi, coeff[5]));
+            r0 = _mm512_packus_epi32(_mm512_mask_srai_epi32(r0, all, r0, shift), _mm512_mask_srai_epi32(r1, all, r1, shift));
+            g0 = _mm512_packus_epi32(_mm512_mask_srai_epi32(g0, all, g0, shift), _mm512_mask_srai_epi32(g1, all, g1, shift));
+            b0 = _mm512_packus_epi32(_mm512_mask_srai_epi32(b0, all, b0, shift), _mm512_mask_srai_epi32(b1, all, b1, shift));
+            _mm512_storeu_si512(yr++, _mm512_min_epu16(r0, coeff[6]));
+            _mm512_storeu_si512(ug++, _mm512_min_epu16(g0, coeff[6]));
+            _mm512_storeu_si512(vb++, _mm512_min_epu16(b0, coeff[6]));
+        }
+    }
+
     /// Given coefficients with `shift` amount of fractional bits
     /// convert y,u,v inplace to r,g,b  clipped to `bits` number of bits
     template <int shift>
@@ -463,47 +773,128 @@ namespace Teisko
         }, u_g, v_b);
     }
 
+    /// SSE4 tier of `yuv_to_rgb_planar_asm` for `size` contiguous items
+    /// `coeffs` are the conversion matrix in s1q14 fixed point format
+    inline void yuv_to_rgb_planar_sse4(uint16_t *y_r, uint16_t *u_g, uint16_t *v_b, int size, const int *coeffs, int bits)
+    {
+        __m128i coeff[9] =
+        {
+            _mm_set1_epi32((coeffs[0] & 0xffff) | (1 << 16)),           // coeff[0] = m00 1
+            _mm_set1_epi32((coeffs[1] & 0xffff) | (coeffs[2] << 16)),   // coeff[1] = m01 m02
+            _mm_set1_epi32((coeffs[3] & 0xffff) | (1 << 16)),           // coeff[0] = m10 1
+            _mm_set1_epi32((coeffs[4] & 0xffff) | (coeffs[5] << 16)),   // coeff[1] = m11 m12
+            _mm_set1_epi32((coeffs[6] & 0xffff) | (1 << 16)),           // coeff[0] = m20 1
+            _mm_set1_epi32((coeffs[7] & 0xffff) | (coeffs[8] << 16)),   // coeff[1] = m21 m22
+            _mm_set1_epi16((1 << bits) - 1),                            // coeff[6] = 1023 x 8  == max_value
+            _mm_set1_epi16(1 << (14 - 1)),                              // coeff[7] = 1 << 13   == 0.5  in s1q14 fixed point format
+            _mm_set1_epi16(1 << (bits - 1))                             // coeff[8] = 512 x 8   ==  bias
+        };
+
+        // calculate as many elements as possible using assembler
+        yuv_to_rgb<14>(
+            reinterpret_cast<__m128i*>(y_r),
+            reinterpret_cast<__m128i*>(u_g),
+            reinterpret_cast<__m128i*>(v_b),
+            coeff, size / 8);
+
+        // and then iterate the rest of the items using the reference method
+        for (auto x = size & ~7; x < size; x++)
+            yuv_to_rgb<14>(y_r[x], u_g[x], v_b[x], coeffs, bits);
+    }
+
+    /// AVX2 tier of `yuv_to_rgb_planar_asm` for `size` contiguous items
+    TEISKO_TARGET_AVX2
+    inline void yuv_to_rgb_planar_avx2(uint16_t *y_r, uint16_t *u_g, uint16_t *v_b, int size, const int *coeffs, int bits)
+    {
+        __m256i coeff[9] =
+        {
+            _mm256_set1_epi32((coeffs[0] & 0xffff) | (1 << 16)),
+            _mm256_set1_epi32((coeffs[1] & 0xffff) | (coeffs[2] << 16)),
+            _mm256_set1_epi32((coeffs[3] & 0xffff) | (1 << 16)),
+            _mm256_set1_epi32((coeffs[4] & 0xffff) | (coeffs[5] << 16)),
+            _mm256_set1_epi32((coeffs[6] & 0xffff) | (1 << 16)),
+            _mm256_set1_epi32((coeffs[7] & 0xffff) | (coeffs[8] << 16)),
+            _mm256_set1_epi16(static_cast<short>((1 << bits) - 1)),
+            _mm256_set1_epi16(1 << (14 - 1)),
+            _mm256_set1_epi16(static_cast<short>(1 << (bits - 1)))
+        };
+
+        yuv_to_rgb<14>(
+            reinterpret_cast<__m256i*>(y_r),
+            reinterpret_cast<__m256i*>(u_g),
+            reinterpret_cast<__m256i*>(v_b),
+            coeff, size / 16);
+
+        for (auto x = size & ~15; x < size; x++)
+            yuv_to_rgb<14>(y_r[x], u_g[x], v_b[x], coeffs, bits);
+    }
+
+    /// AVX-512 tier of `yuv_to_rgb_planar_asm` for `size` contiguous items
+    TEISKO_TARGET_AVX512
+    inline void yuv_to_rgb_planar_avx512(uint16_t *y_r, uint16_t *u_g, uint16_t *v_b, int size, const int *coeffs, int bits)
+    {
+        __m512i coeff[9] =
+        {
+            _mm512_set1_epi32((coeffs[0] & 0xffff) | (1 << 16)),
+            _mm512_set1_epi32((coeffs[1] & 0xffff) | (coeffs[2] << 16)),
+            _mm512_set1_epi32((coeffs[3] & 0xffff) | (1 << 16)),
+            _mm512_set1_epi32((coeffs[4] & 0xffff) | (coeffs[5] << 16)),
+            _mm512_set1_epi32((coeffs[6] & 0xffff) | (1 << 16)),
+            _mm512_set1_epi32((coeffs[7] & 0xffff) | (coeffs[8] << 16)),
+            _mm512_set1_epi16(static_cast<short>((1 << bits) - 1)),
+            _mm512_set1_epi16(1 << (14 - 1)),
+            _mm512_set1_epi16(static_cast<short>(1 << (bits - 1)))
+        };
+
+        yuv_to_rgb<14>(
+            reinterpret_cast<__m512i*>(y_r),
+            reinterpret_cast<__m512i*>(u_g),
+            reinterpret_cast<__m512i*>(v_b),
+            coeff, size / 32);
+
+        for (auto x = size & ~31; x < size; x++)
+            yuv_to_rgb<14>(y_r[x], u_g[x], v_b[x], coeffs, bits);
+    }
+
+    /// Inplace color conversion of `size` contiguous items using at most the instruction set `level`
+    /// `coeffs` are the conversion matrix in s1q14 fixed point format
+    inline void yuv_to_rgb_contiguous(uint16_t *y_r, uint16_t *u_g, uint16_t *v_b, int size,
+        const int *coeffs, int bits, simd_level_e level)
+    {
+        switch (supported_simd_level(level))
+        {
+        case simd_level_e::avx512: yuv_to_rgb_planar_avx512(y_r, u_g, v_b, size, coeffs, bits); break;
+        case simd_level_e::avx2: yuv_to_rgb_planar_avx2(y_r, u_g, v_b, size, coeffs, bits); break;
+        case simd_level_e::sse4: yuv_to_rgb_planar_sse4(y_r, u_g, v_b, size, coeffs, bits); break;
+        default:
+            for (int x = 0; x < size; x++)
+                yuv_to_rgb<14>(y_r[x], u_g[x], v_b[x], coeffs, bits);
+        }
+    }
+
     /// Inplace color conversion -- YUV to RGB in three planes
     /// The output data is clipped to range 0..2^bits - 1
     /// This should work well for 8,10,12 bits of input
+    /// Contiguous planes are converted with the widest instruction set supported by the processor
+    /// (or at most `level`); all tiers produce bit exact results with `yuv_to_rgb_planar`
     inline void yuv_to_rgb_planar_asm(
         image<uint16_t> &y_r,
         image<uint16_t> &u_g,
         image<uint16_t> &v_b,
-        int bits, const double(&matrix)[9])
+        int bits, const double(&matrix)[9],
+        simd_level_e level = detected_simd_level())
     {
         if (!(y_r.size() == u_g.size() && y_r.size() == v_b.size()))
             throw std::runtime_error("Y, U and V planes mismatch in dimensions");
 
         auto coeffs = to_fixed_point<int, 14>(matrix);
         auto *data = coeffs.data();
+        level = supported_simd_level(level);
 
-        if (y_r.is_contiguous() && u_g.is_contiguous() && v_b.is_contiguous())
+        if (level != simd_level_e::scalar && y_r.is_contiguous() && u_g.is_contiguous() && v_b.is_contiguous())
         {
-            __m128i coeff[9] =
-            {
-                _mm_set1_epi32((coeffs[0] & 0xffff) | (1 << 16)),           // coeff[0] = m00 1
-                _mm_set1_epi32((coeffs[1] & 0xffff) | (coeffs[2] << 16)),   // coeff[1] = m01 m02
-                _mm_set1_epi32((coeffs[3] & 0xffff) | (1 << 16)),           // coeff[0] = m10 1
-                _mm_set1_epi32((coeffs[4] & 0xffff) | (coeffs[5] << 16)),   // coeff[1] = m11 m12
-                _mm_set1_epi32((coeffs[6] & 0xffff) | (1 << 16)),           // coeff[0] = m20 1
-                _mm_set1_epi32((coeffs[7] & 0xffff) | (coeffs[8] << 16)),   // coeff[1] = m21 m22
-                _mm_set1_epi16((1 << bits) - 1),                            // coeff[6] = 1023 x 8  == max_value
-                _mm_set1_epi16(1 << (14 - 1)),                              // coeff[7] = 1 << 13   == 0.5  in s1q14 fixed point format
-                _mm_set1_epi16(1 << (bits - 1))                             // coeff[8] = 512 x 8   ==  bias
-            };
-
-            // calculate as many elements as possible using assembler
             auto size = u_g._width * u_g._height;
-            yuv_to_rgb<14>(
-                reinterpret_cast<__m128i*>(y_r._begin),
-                reinterpret_cast<__m128i*>(u_g._begin),
-                reinterpret_cast<__m128i*>(v_b._begin),
-                coeff, size / 8);
-
-            // and then iterate the rest of the items using the reference method
-            for (auto x = size & ~7; x < size; x++)
-                yuv_to_rgb<14>(y_r._begin[x], u_g._begin[x], v_b._begin[x], data, bits);
+            yuv_to_rgb_contiguous(y_r._begin, u_g._begin, v_b._begin, size, data, bits, level);
         }
         else
         {
@@ -514,4 +905,109 @@ namespace Teisko
             }, u_g, v_b);
         }
     }
+
+    /// Upsamples chroma row `j` to two rows of `width` items at `out` and `out + width`
+    /// using the kernel of `chroma_upscale` -- `top` and `bot` are scratch of `c._width + 2` items
+    inline void chroma_upscale_row(const image<uint16_t> &c, int j, uint16_t *out, int width,
+        std::vector<int> &top, std::vector<int> &bot)
+    {
+        int cw = c._width;
+        int above = std::max(j - 1, 0);
+        int below = std::min(j + 1, c._height - 1);
+        // top = above + 3 * mid, bot = below + 3 * mid -- for columns -1 ... cw with replication
+        for (int i = -1; i <= cw; i++)
+        {
+            int x = std::min(std::max(i, 0), cw - 1);
+            int mid = 3 * c(j, x);
+            top[i + 1] = c(above, x) + mid;
+            bot[i + 1] = c(below, x) + mid;
+        }
+        for (int i = 0; i < cw; i++)
+        {
+            int top_mid = 3 * top[i + 1];
+            int bot_mid = 3 * bot[i + 1];
+            out[2 * i] = round_shift<uint16_t, 4>(top[i] + top_mid);
+            out[width + 2 * i] = round_shift<uint16_t, 4>(bot[i] + bot_mid);
+            if (2 * i + 1 < width)
+            {
+                out[2 * i + 1] = round_shift<uint16_t, 4>(top_mid + top[i + 2]);
+                out[width + 2 * i + 1] = round_shift<uint16_t, 4>(bot_mid + bot[i + 2]);
+            }
+        }
+    }
+
+    /// Single pass YUV 4:2:0 to RGB conversion
+    ///  - chroma is upsampled on the fly two output rows at a time -- the result is bit exact
+    ///    with `chroma_upscale` of U and V followed by `yuv_to_rgb_planar`
+    ///  - odd luma dimensions crop the last upsampled chroma row / column
+    ///  - row pairs are processed in parallel
+    /// \param  y           Luma plane
+    /// \param  u, v        Chroma planes of half the luma dimensions (rounded up)
+    /// \param  dst         Destination of luma dimensions in any layout and color order
+    /// \param  bits        Bit depth of input and output
+    /// \param  matrix      YUV to RGB conversion matrix
+    /// \param  threads     Number of threads (0 == hardware concurrency)
+    /// \param  level       Highest instruction set tier for the matrix multiplication
+    inline void yuv420_to_rgb(const image<uint16_t> &y, const image<uint16_t> &u, const image<uint16_t> &v,
+        rgb_image_s<uint16_t> &dst, int bits, const double(&matrix)[9], unsigned int threads = 0,
+        simd_level_e level = detected_simd_level())
+    {
+        if (!(u.size() == v.size()))
+            throw std::runtime_error("U and V planes mismatch in dimensions");
+        if (!(u.size() == (y.size() + 1) / 2))
+            throw std::runtime_error("Chroma planes are not subsampled by two");
+
+        image<uint16_t> channels[3] = { dst[rgb_color_e::red], dst[rgb_color_e::green], dst[rgb_color_e::blue] };
+        if (!(channels[0].size() == y.size()))
+            throw std::runtime_error("RGB image and Y plane mismatch in dimensions");
+        if (y.size() == roi_point(0))
+            return;
+
+        auto coeffs = to_fixed_point<int, 14>(matrix);
+        auto *data = coeffs.data();
+        int width = y._width;
+        int height = y._height;
+
+        parallel_for_bands(0, static_cast<int>(u._height), 1, [&](int first, int last)
+        {
+            // y, u and v planes of two rows each, converted in place
+            std::vector<uint16_t> buffer(6 * width);
+            std::vector<int> top(u._width + 2);
+            std::vector<int> bot(u._width + 2);
+            uint16_t *planes[3] = { buffer.data(), buffer.data() + 2 * width, buffer.data() + 4 * width };
+
+            for (int j = first; j < last; j++)
+            {
+                int rows = std::min(2, height - 2 * j);
+                for (int r = 0; r < rows; r++)
+                    for (int x = 0; x < width; x++)
+                        planes[0][r * width + x] = y(2 * j + r, x);
+                chroma_upscale_row(u, j, planes[1], width, top, bot);
+                chroma_upscale_row(v, j, planes[2], width, top, bot);
+                // The second row of each plane directly follows the first row
+                yuv_to_rgb_contiguous(planes[0], planes[1], planes[2], rows * width, data, bits, level);
+
+                for (int c = 0; c < 3; c++)
+                    for (int r = 0; r < rows; r++)
+                    {
+                        auto src = planes[c] + r * width;
+                        auto dst_row = &channels[c](2 * j + r, 0);
+                        auto skip = channels[c]._skip_x;
+                        for (int x = 0; x < width; x++, dst_row += skip)
+                            *dst_row = src[x];
+                    }
+            }
+        }, threads);
+    }
+
+    /// Single pass YUV 4:2:0 to RGB conversion to a new image of given layout and color order
+    inline rgb_image_s<uint16_t> yuv420_to_rgb(const image<uint16_t> &y, const image<uint16_t> &u,
+        const image<uint16_t> &v, int bits, const double(&matrix)[9],
+        rgb_layout_e layout = rgb_layout_e::paged, rgb_order_e order = rgb_order_e::rgb,
+        unsigned int threads = 0)
+    {
+        rgb_image_s<uint16_t> result(y.size(), layout, order);
+        yuv420_to_rgb(y, u, v, result, bits, matrix, threads);
+        return result;
+    }
 };
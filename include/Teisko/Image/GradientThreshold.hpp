@@ -0,0 +1,260 @@
+/*
+* Copyright (c) 2019, Intel Corporation
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the Intel Corporation nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#pragma once
+#include "Teisko/Algorithm/CpuFeatures.hpp"
+#include "Teisko/Algorithm/Parallel.hpp"
+#include "Teisko/Image/API.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#if (defined(WIN32) || defined(_WIN32))
+#include "intrin.h"
+#else
+// Linux
+#include "x86intrin.h"
+#endif
+
+namespace Teisko
+{
+    /// Coefficients of the 9 tap derivative filter: gradient = sum c[k] * (s[k] - s[-k]), k = 1..4
+    /// -- the coefficients sum to 8192 and the gradient is divided by 16384 (rounding towards zero),
+    /// keeping the squared magnitude of two gradients within int32_t
+    static const int gradient_taps[4] = { 2002, 2752, 2210, 1228 };
+
+    /// Squared gradient magnitude of pixel `x` of the row `rows[4]`
+    /// -- `rows` point to the rows -4...4 around the row and the columns are replicated at the borders
+    inline int32_t gradient_magnitude2(const uint16_t *const *rows, int x, int width)
+    {
+        auto center = rows[4];
+        int v = 0;
+        int h = 0;
+        for (int k = 1; k <= 4; k++)
+        {
+            auto left = std::max(0, x - k);
+            auto right = std::min(width - 1, x + k);
+            v += (rows[4 + k][x] - rows[4 - k][x]) * gradient_taps[k - 1];
+            h += (center[right] - center[left]) * gradient_taps[k - 1];
+        }
+        v /= 16384;
+        h /= 16384;
+        return v * v + h * h;
+    }
+
+    /// Squared gradient magnitudes of pixels x...x+count-1, eight at a time, when x-4...x+count+3 are inside the row
+    /// -- the pixels are biased to signed 16 bits, which leaves their differences intact, so that
+    ///    each pair of taps is a single multiply-add of (s[k], s[-k]) by (c[k], -c[k])
+    /// @returns    Number of pixels processed
+    inline int gradient_magnitude2_sse4(const uint16_t *const *rows, int x, int count, int32_t *dst)
+    {
+        const auto bias = _mm_set1_epi16(static_cast<short>(0x8000));
+        const auto round = _mm_set1_epi32(16383);
+        const auto low = _mm_set1_epi32(0xffff);
+        __m128i taps[4];
+        for (int k = 0; k < 4; k++)
+            taps[k] = _mm_set1_epi32((gradient_taps[k] & 0xffff) | static_cast<int>(static_cast<uint32_t>(-gradient_taps[k]) << 16));
+
+        auto load = [&bias](const uint16_t *src)
+        {
+            return _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)), bias);
+        };
+        auto divide = [&round](__m128i value)
+        {
+            return _mm_srai_epi32(_mm_add_epi32(value, _mm_and_si128(_mm_srai_epi32(value, 31), round)), 14);
+        };
+
+        int i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            auto center = rows[4] + x + i;
+            auto v_lo = _mm_setzero_si128(), v_hi = _mm_setzero_si128();
+            auto h_lo = _mm_setzero_si128(), h_hi = _mm_setzero_si128();
+            for (int k = 1; k <= 4; k++)
+            {
+                auto a = load(rows[4 + k] + x + i);
+                auto b = load(rows[4 - k] + x + i);
+                v_lo = _mm_add_epi32(v_lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), taps[k - 1]));
+                v_hi = _mm_add_epi32(v_hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), taps[k - 1]));
+                a = load(center + k);
+                b = load(center - k);
+                h_lo = _mm_add_epi32(h_lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), taps[k - 1]));
+                h_hi = _mm_add_epi32(h_hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), taps[k - 1]));
+            }
+            // pairs of (v, h) as 16 bits, squared and summed by a multiply-add
+            auto vh_lo = _mm_or_si128(_mm_and_si128(divide(v_lo), low), _mm_slli_epi32(divide(h_lo), 16));
+            auto vh_hi = _mm_or_si128(_mm_and_si128(divide(v_hi), low), _mm_slli_epi32(divide(h_hi), 16));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_madd_epi16(vh_lo, vh_lo));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4), _mm_madd_epi16(vh_hi, vh_hi));
+        }
+        return i;
+    }
+
+    /// Squared gradient magnitudes of pixels x...x+count-1, sixteen at a time
+    /// @returns    Number of pixels processed
+    TEISKO_TARGET_AVX2
+    inline int gradient_magnitude2_avx2(const uint16_t *const *rows, int x, int count, int32_t *dst)
+    {
+        const auto bias = _mm256_set1_epi16(static_cast<short>(0x8000));
+        const auto round = _mm256_set1_epi32(16383);
+        const auto low = _mm256_set1_epi32(0xffff);
+        __m256i taps[4];
+        for (int k = 0; k < 4; k++)
+            taps[k] = _mm256_set1_epi32((gradient_taps[k] & 0xffff) | static_cast<int>(static_cast<uint32_t>(-gradient_taps[k]) << 16));
+
+        int i = 0;
+        for (; i + 16 <= count; i += 16)
+        {
+            auto center = rows[4] + x + i;
+            auto v_lo = _mm256_setzero_si256(), v_hi = _mm256_setzero_si256();
+            auto h_lo = _mm256_setzero_si256(), h_hi = _mm256_setzero_si256();
+            for (int k = 1; k <= 4; k++)
+            {
+                auto a = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows[4 + k] + x + i)), bias);
+                auto b = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows[4 - k] + x + i)), bias);
+                v_lo = _mm256_add_epi32(v_lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), taps[k - 1]));
+                v_hi = _mm256_add_epi32(v_hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), taps[k - 1]));
+                a = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(center + k)), bias);
+                b = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(center - k)), bias);
+                h_lo = _mm256_add_epi32(h_lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), taps[k - 1]));
+                h_hi = _mm256_add_epi32(h_hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), taps[k - 1]));
+            }
+            __m256i vh[2];
+            __m256i v[2] = { v_lo, v_hi };
+            __m256i h[2] = { h_lo, h_hi };
+            for (int j = 0; j < 2; j++)
+            {
+                v[j] = _mm256_srai_epi32(_mm256_add_epi32(v[j], _mm256_and_si256(_mm256_srai_epi32(v[j], 31), round)), 14);
+                h[j] = _mm256_srai_epi32(_mm256_add_epi32(h[j], _mm256_and_si256(_mm256_srai_epi32(h[j], 31), round)), 14);
+                vh[j] = _mm256_or_si256(_mm256_and_si256(v[j], low), _mm256_slli_epi32(h[j], 16));
+                vh[j] = _mm256_madd_epi16(vh[j], vh[j]);
+            }
+            // unpacking works within 128-bit lanes: lo = pixels 0..3, 8..11 and hi = pixels 4..7, 12..15
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_permute2x128_si256(vh[0], vh[1], 0x20));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 8), _mm256_permute2x128_si256(vh[0], vh[1], 0x31));
+        }
+        return i;
+    }
+
+    /// Squared gradient magnitudes of a row with the columns replicated at the borders
+    inline void gradient_magnitude2_row(const uint16_t *const *rows, int width, int32_t *dst, simd_level_e level)
+    {
+        // The SIMD kernels process the pixels having all the taps inside the row
+        auto first = std::min(4, width);
+        auto count = std::max(0, width - 8);
+        int done = 0;
+        switch (supported_simd_level(level))
+        {
+        case simd_level_e::avx512:
+        case simd_level_e::avx2:
+            done = gradient_magnitude2_avx2(rows, first, count, dst + first);
+            done += gradient_magnitude2_sse4(rows, first + done, count - done, dst + first + done);
+            break;
+        case simd_level_e::sse4:
+            done = gradient_magnitude2_sse4(rows, first, count, dst + first);
+            break;
+        default:
+            break;
+        }
+        for (int x = 0; x < first; x++)
+            dst[x] = gradient_magnitude2(rows, x, width);
+        for (int x = first + done; x < width; x++)
+            dst[x] = gradient_magnitude2(rows, x, width);
+    }
+
+    /// @brief Quantifies an image by thresholding the gradient magnitude of a 9 tap derivative filter
+    /// @details  Matches the matlab reference, where W = normalized magnitude between 0..1
+    /// from hypot(img conv h, img conv h'):
+    ///     W = W.^(1./rolloffFactor);   %% rolloffFactor = 3
+    ///     W = (1 - W). / (1 + W);
+    ///     result = W < threshold
+    /// The rolloff is monotonic, so it is folded into a single threshold on the squared magnitude,
+    /// relative to the maximum squared magnitude of the image. The magnitudes are computed
+    /// twice by row bands -- first for the maximum and then for the mask -- instead of storing them.
+    /// @param img          Image to threshold -- the borders are replicated
+    /// @param threshold    Threshold of the rolloff transformed magnitude in 0..1
+    /// @param edges        Marks the edges i.e. `W >= threshold` instead of the flat areas `W < threshold`
+    /// @param threads      Maximum number of threads (0 == hardware concurrency)
+    /// @param level        Highest instruction set tier to use
+    /// @returns            Binary mask of the size of `img`
+    inline image<uint16_t> gradient_threshold(const image<uint16_t> &img, double threshold, bool edges = false,
+        unsigned int threads = 0, simd_level_e level = detected_simd_level())
+    {
+        auto src = img._skip_x == 1 ? img : img.convert_to<uint16_t>();
+        auto size = src.size();
+        auto result = image<uint16_t>(size);
+        if (size._x == 0 || size._y == 0)
+            return result;
+
+        // The rows -4...4 around row `y` with the rows replicated at the borders
+        auto get_rows = [&src, &size](int y, const uint16_t *(&rows)[9])
+        {
+            for (int i = 0; i < 9; i++)
+                rows[i] = &src(std::min(size._y - 1, std::max(0, y + i - 4)), 0);
+        };
+
+        int max_level = 0;
+        std::mutex max_lock;
+        parallel_for_bands(0, size._y, 1, [&](int first, int last)
+        {
+            std::vector<int32_t> magnitudes(size._x);
+            const uint16_t *rows[9];
+            int band_max = 0;
+            for (int y = first; y < last; y++)
+            {
+                get_rows(y, rows);
+                gradient_magnitude2_row(rows, size._x, magnitudes.data(), level);
+                band_max = std::max(band_max, *std::max_element(magnitudes.begin(), magnitudes.end()));
+            }
+            std::lock_guard<std::mutex> lock(max_lock);
+            max_level = std::max(max_level, band_max);
+        }, threads);
+
+        // we don't calculate sqrt of horizontal and vertical gradients, so we have to scale by
+        // exponent of six...
+        double rolloff = std::pow(std::abs(threshold - 1) / (threshold + 1), 6);
+        auto level_threshold = static_cast<int32_t>(std::lround(rolloff * max_level));
+
+        parallel_for_bands(0, size._y, 1, [&](int first, int last)
+        {
+            std::vector<int32_t> magnitudes(size._x);
+            const uint16_t *rows[9];
+            for (int y = first; y < last; y++)
+            {
+                get_rows(y, rows);
+                gradient_magnitude2_row(rows, size._x, magnitudes.data(), level);
+                auto dst = &result(y, 0);
+                for (int x = 0; x < size._x; x++)
+                    dst[x] = (magnitudes[x] < level_threshold) != edges;
+            }
+        }, threads);
+        return result;
+    }
+}
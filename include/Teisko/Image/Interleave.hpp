@@ -0,0 +1,345 @@
+/*
+* Copyright (c) 2019, Intel Corporation
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the Intel Corporation nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#pragma once
+#include "Teisko/Algorithm/CpuFeatures.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+#if (defined(WIN32) || defined(_WIN32))
+#include "intrin.h"
+#else
+// Linux
+#include "x86intrin.h"
+#endif
+
+namespace Teisko
+{
+    /// Byte shuffle masks to interleave `channels` planes of `bytes` sized elements
+    ///   - interleave[k][c] moves the bytes of plane `c` to their places in interleaved block `k`
+    ///   - deinterleave[c][k] moves the bytes of interleaved block `k` to their places in plane `c`
+    /// where a plane block is 16 bytes and an interleaved block is 16 bytes of `16 * channels`
+    template <int channels, int bytes>
+    struct interleave_masks_s
+    {
+        alignas(16) int8_t interleave[channels][channels][16];
+        alignas(16) int8_t deinterleave[channels][channels][16];
+
+        interleave_masks_s()
+        {
+            std::fill(&interleave[0][0][0], &interleave[0][0][0] + channels * channels * 16, int8_t(-128));
+            std::fill(&deinterleave[0][0][0], &deinterleave[0][0][0] + channels * channels * 16, int8_t(-128));
+            for (int g = 0; g < 16 * channels; g++)
+            {
+                int element = g / bytes;
+                int pixel = element / channels;
+                int c = element % channels;
+                int k = g / 16;
+                int src = pixel * bytes + g % bytes;
+                interleave[k][c][g % 16] = static_cast<int8_t>(src);
+                deinterleave[c][k][src] = static_cast<int8_t>(g % 16);
+            }
+        }
+
+        static const interleave_masks_s& get()
+        {
+            static const interleave_masks_s masks;
+            return masks;
+        }
+    };
+
+    /// Interleaves `blocks` * 16 bytes of each plane using SSSE3 byte shuffles
+    template <int channels, int bytes>
+    inline void interleave_sse4(const uint8_t *const *planes, uint8_t *dst, size_t blocks)
+    {
+        auto &masks = interleave_masks_s<channels, bytes>::get();
+        __m128i mask[channels][channels];
+        for (int k = 0; k < channels; k++)
+            for (int c = 0; c < channels; c++)
+                mask[k][c] = _mm_load_si128(reinterpret_cast<const __m128i*>(masks.interleave[k][c]));
+
+        for (size_t i = 0; i < blocks; i++)
+        {
+            __m128i src[channels];
+            for (int c = 0; c < channels; c++)
+                src[c] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[c] + 16 * i));
+            for (int k = 0; k < channels; k++)
+            {
+                auto result = _mm_shuffle_epi8(src[0], mask[k][0]);
+                for (int c = 1; c < channels; c++)
+                    result = _mm_or_si128(result, _mm_shuffle_epi8(src[c], mask[k][c]));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16 * (channels * i + k)), result);
+            }
+        }
+    }
+
+    /// Deinterleaves `blocks` * 16 * channels bytes to planes using SSSE3 byte shuffles
+    template <int channels, int bytes>
+    inline void deinterleave_sse4(const uint8_t *src, uint8_t *const *planes, size_t blocks)
+    {
+        auto &masks = interleave_masks_s<channels, bytes>::get();
+        __m128i mask[channels][channels];
+        for (int c = 0; c < channels; c++)
+            for (int k = 0; k < channels; k++)
+                mask[c][k] = _mm_load_si128(reinterpret_cast<const __m128i*>(masks.deinterleave[c][k]));
+
+        for (size_t i = 0; i < blocks; i++)
+        {
+            __m128i block[channels];
+            for (int k = 0; k < channels; k++)
+                block[k] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16 * (channels * i + k)));
+            for (int c = 0; c < channels; c++)
+            {
+                auto result = _mm_shuffle_epi8(block[0], mask[c][0]);
+                for (int k = 1; k < channels; k++)
+                    result = _mm_or_si128(result, _mm_shuffle_epi8(block[k], mask[c][k]));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[c] + 16 * i), result);
+            }
+        }
+    }
+
+    // The AVX2 kernels shuffle within 128-bit lanes: lane 0 handles the first 16 bytes of each
+    // plane and lane 1 the next 16 bytes. The lanes of the interleaved blocks are then
+    // permuted to / from memory order
+
+    /// Stores two lane-wise interleaved blocks in memory order
+    TEISKO_TARGET_AVX2
+    inline void store_interleaved_lanes(const __m256i(&block)[2], uint8_t *dst)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_permute2x128_si256(block[0], block[1], 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 32), _mm256_permute2x128_si256(block[0], block[1], 0x31));
+    }
+
+    /// Stores three lane-wise interleaved blocks in memory order
+    TEISKO_TARGET_AVX2
+    inline void store_interleaved_lanes(const __m256i(&block)[3], uint8_t *dst)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_permute2x128_si256(block[0], block[1], 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 32), _mm256_permute2x128_si256(block[2], block[0], 0x30));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 64), _mm256_permute2x128_si256(block[1], block[2], 0x31));
+    }
+
+    /// Stores four lane-wise interleaved blocks in memory order
+    TEISKO_TARGET_AVX2
+    inline void store_interleaved_lanes(const __m256i(&block)[4], uint8_t *dst)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm256_permute2x128_si256(block[0], block[1], 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 32), _mm256_permute2x128_si256(block[2], block[3], 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 64), _mm256_permute2x128_si256(block[0], block[1], 0x31));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 96), _mm256_permute2x128_si256(block[2], block[3], 0x31));
+    }
+
+    /// Loads 64 interleaved bytes to two blocks with the first 32 bytes in lane 0
+    TEISKO_TARGET_AVX2
+    inline void load_interleaved_lanes(const uint8_t *src, __m256i(&block)[2])
+    {
+        auto x0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+        auto x1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 32));
+        block[0] = _mm256_permute2x128_si256(x0, x1, 0x20);
+        block[1] = _mm256_permute2x128_si256(x0, x1, 0x31);
+    }
+
+    /// Loads 96 interleaved bytes to three blocks with the first 48 bytes in lane 0
+    TEISKO_TARGET_AVX2
+    inline void load_interleaved_lanes(const uint8_t *src, __m256i(&block)[3])
+    {
+        auto x0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+        auto x1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 32));
+        auto x2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 64));
+        block[0] = _mm256_permute2x128_si256(x0, x1, 0x30);
+        block[1] = _mm256_permute2x128_si256(x0, x2, 0x21);
+        block[2] = _mm256_permute2x128_si256(x1, x2, 0x30);
+    }
+
+    /// Loads 128 interleaved bytes to four blocks with the first 64 bytes in lane 0
+    TEISKO_TARGET_AVX2
+    inline void load_interleaved_lanes(const uint8_t *src, __m256i(&block)[4])
+    {
+        auto x0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src));
+        auto x1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 32));
+        auto x2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 64));
+        auto x3 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 96));
+        block[0] = _mm256_permute2x128_si256(x0, x2, 0x20);
+        block[1] = _mm256_permute2x128_si256(x0, x2, 0x31);
+        block[2] = _mm256_permute2x128_si256(x1, x3, 0x20);
+        block[3] = _mm256_permute2x128_si256(x1, x3, 0x31);
+    }
+
+    /// Interleaves `blocks` * 32 bytes of each plane using AVX2
+    template <int channels, int bytes>
+    TEISKO_TARGET_AVX2
+    inline void interleave_avx2(const uint8_t *const *planes, uint8_t *dst, size_t blocks)
+    {
+        auto &masks = interleave_masks_s<channels, bytes>::get();
+        __m256i mask[channels][channels];
+        for (int k = 0; k < channels; k++)
+            for (int c = 0; c < channels; c++)
+                mask[k][c] = _mm256_broadcastsi128_si256(
+                    _mm_load_si128(reinterpret_cast<const __m128i*>(masks.interleave[k][c])));
+
+        for (size_t i = 0; i < blocks; i++)
+        {
+            __m256i src[channels];
+            __m256i block[channels];
+            for (int c = 0; c < channels; c++)
+                src[c] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(planes[c] + 32 * i));
+            for (int k = 0; k < channels; k++)
+            {
+                block[k] = _mm256_shuffle_epi8(src[0], mask[k][0]);
+                for (int c = 1; c < channels; c++)
+                    block[k] = _mm256_or_si256(block[k], _mm256_shuffle_epi8(src[c], mask[k][c]));
+            }
+            store_interleaved_lanes(block, dst + 32 * channels * i);
+        }
+    }
+
+    /// Deinterleaves `blocks` * 32 * channels bytes to planes using AVX2
+    template <int channels, int bytes>
+    TEISKO_TARGET_AVX2
+    inline void deinterleave_avx2(const uint8_t *src, uint8_t *const *planes, size_t blocks)
+    {
+        auto &masks = interleave_masks_s<channels, bytes>::get();
+        __m256i mask[channels][channels];
+        for (int c = 0; c < channels; c++)
+            for (int k = 0; k < channels; k++)
+                mask[c][k] = _mm256_broadcastsi128_si256(
+                    _mm_load_si128(reinterpret_cast<const __m128i*>(masks.deinterleave[c][k])));
+
+        for (size_t i = 0; i < blocks; i++)
+        {
+            __m256i block[channels];
+            load_interleaved_lanes(src + 32 * channels * i, block);
+            for (int c = 0; c < channels; c++)
+            {
+                auto result = _mm256_shuffle_epi8(block[0], mask[c][0]);
+                for (int k = 1; k < channels; k++)
+                    result = _mm256_or_si256(result, _mm256_shuffle_epi8(block[k], mask[c][k]));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(planes[c] + 32 * i), result);
+            }
+        }
+    }
+
+    /// Interleaves with the SIMD kernels as many items as possible
+    /// \returns    Number of items per plane processed
+    template <int channels, int bytes>
+    inline size_t interleave_simd(const uint8_t *const *planes, uint8_t *dst, size_t count, simd_level_e level)
+    {
+        switch (supported_simd_level(level))
+        {
+        case simd_level_e::avx512:
+        case simd_level_e::avx2:
+            interleave_avx2<channels, bytes>(planes, dst, count * bytes / 32);
+            return count * bytes / 32 * 32 / bytes;
+        case simd_level_e::sse4:
+            interleave_sse4<channels, bytes>(planes, dst, count * bytes / 16);
+            return count * bytes / 16 * 16 / bytes;
+        default:
+            return 0;
+        }
+    }
+
+    /// Deinterleaves with the SIMD kernels as many items as possible
+    /// \returns    Number of items per plane processed
+    template <int channels, int bytes>
+    inline size_t deinterleave_simd(const uint8_t *src, uint8_t *const *planes, size_t count, simd_level_e level)
+    {
+        switch (supported_simd_level(level))
+        {
+        case simd_level_e::avx512:
+        case simd_level_e::avx2:
+            deinterleave_avx2<channels, bytes>(src, planes, count * bytes / 32);
+            return count * bytes / 32 * 32 / bytes;
+        case simd_level_e::sse4:
+            deinterleave_sse4<channels, bytes>(src, planes, count * bytes / 16);
+            return count * bytes / 16 * 16 / bytes;
+        default:
+            return 0;
+        }
+    }
+
+    /// \brief Interleaves 2, 3 or 4 planes: dst = a0 b0 [c0] [d0] a1 b1 [c1] [d1] ...
+    /// \param  planes      Pointers to `channels` planes of `count` items each
+    /// \param  channels    Number of planes (2, 3 or 4)
+    /// \param  dst         Destination of `count * channels` items -- must not overlap the planes
+    /// \param  count       Number of items in each plane
+    /// \param  level       Highest instruction set tier to use
+    template <typename T>
+    inline void interleave(const T *const *planes, int channels, T *dst, size_t count,
+        simd_level_e level = detected_simd_level())
+    {
+        if (channels < 2 || channels > 4)
+            throw std::invalid_argument("Only 2, 3 or 4 channels can be interleaved");
+
+        const uint8_t *bytes[4] = {};
+        for (int c = 0; c < channels; c++)
+            bytes[c] = reinterpret_cast<const uint8_t*>(planes[c]);
+        auto out = reinterpret_cast<uint8_t*>(dst);
+
+        // Elements of 1, 2, 4 or 8 bytes are moved with the SIMD kernels
+        const int size = 16 % sizeof(T) == 0 ? sizeof(T) : 1;
+        size_t done = 16 % sizeof(T) != 0 ? 0
+            : channels == 2 ? interleave_simd<2, size>(bytes, out, count, level)
+            : channels == 3 ? interleave_simd<3, size>(bytes, out, count, level)
+            : interleave_simd<4, size>(bytes, out, count, level);
+
+        for (size_t i = done; i < count; i++)
+            for (int c = 0; c < channels; c++)
+                dst[i * channels + c] = planes[c][i];
+    }
+
+    /// \brief Deinterleaves 2, 3 or 4 channels from src = a0 b0 [c0] [d0] a1 b1 [c1] [d1] ... to planes
+    /// \param  src         Source of `count * channels` items -- must not overlap the planes
+    /// \param  channels    Number of planes (2, 3 or 4)
+    /// \param  planes      Pointers to `channels` planes of `count` items each
+    /// \param  count       Number of items in each plane
+    /// \param  level       Highest instruction set tier to use
+    template <typename T>
+    inline void deinterleave(const T *src, int channels, T *const *planes, size_t count,
+        simd_level_e level = detected_simd_level())
+    {
+        if (channels < 2 || channels > 4)
+            throw std::invalid_argument("Only 2, 3 or 4 channels can be deinterleaved");
+
+        uint8_t *bytes[4] = {};
+        for (int c = 0; c < channels; c++)
+            bytes[c] = reinterpret_cast<uint8_t*>(planes[c]);
+        auto in = reinterpret_cast<const uint8_t*>(src);
+
+        const int size = 16 % sizeof(T) == 0 ? sizeof(T) : 1;
+        size_t done = 16 % sizeof(T) != 0 ? 0
+            : channels == 2 ? deinterleave_simd<2, size>(in, bytes, count, level)
+            : channels == 3 ? deinterleave_simd<3, size>(in, bytes, count, level)
+            : deinterleave_simd<4, size>(in, bytes, count, level);
+
+        for (size_t i = done; i < count; i++)
+            for (int c = 0; c < channels; c++)
+                planes[c][i] = src[i * channels + c];
+    }
+}
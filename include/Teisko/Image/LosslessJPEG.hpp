@@ -0,0 +1,544 @@
+/*
+* Copyright (c) 2019, Intel Corporation
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the Intel Corporation nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#pragma once
+
+#include "Teisko/Image/API.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace Teisko
+{
+    /// Lossless JPEG (ITU T.81 process 14, SOF3) as used by DNG for raw tiles
+    ///  - the encoder produces single component frames with predictor 1 and
+    ///    an optimized Huffman table
+    ///  - the decoder handles 1-4 interleaved components, predictors 1-7 and
+    ///    point transforms; restart intervals are not supported
+    ///  - components are interleaved within a scan line, so a frame of X samples
+    ///    and Nf components decodes to a tile of width X * Nf
+    namespace lossless_jpeg
+    {
+        enum markers
+        {
+            marker_sof3 = 0xffc3,
+            marker_dht = 0xffc4,
+            marker_soi = 0xffd8,
+            marker_eoi = 0xffd9,
+            marker_sos = 0xffda,
+            marker_dri = 0xffdd
+        };
+
+        /// Returns the difference category (number of significant bits) of a difference
+        inline int category(int diff)
+        {
+            int magnitude = diff < 0 ? -diff : diff;
+            int bits = 0;
+            while (magnitude)
+            {
+                bits++;
+                magnitude >>= 1;
+            }
+            return bits;
+        }
+
+        /// Canonical Huffman table -- BITS and HUFFVAL as in T.81 Annex C
+        struct huffman_table
+        {
+            uint8_t bits[17] = { 0 };               // bits[l] = number of codes of length l
+            std::vector<uint8_t> values;            // symbols in order of increasing code length
+
+            // Encoder side: code and length per symbol
+            uint16_t code[17] = { 0 };
+            uint8_t length[17] = { 0 };
+
+            // Decoder side: T.81 F.2.2.3 tables and an 8-bit lookahead table
+            int32_t max_code[18] = { 0 };
+            int32_t val_offset[17] = { 0 };
+            uint16_t lookahead[256] = { 0 };        // (length << 8) | symbol, zero if longer than 8
+
+            /// Builds an optimal length limited table from frequencies (T.81 Annex K.2)
+            static huffman_table from_histogram(const uint32_t(&histogram)[17])
+            {
+                const int reserved = 17;            // guarantees that no code consists of all ones
+                int64_t freq[18];
+                int code_size[18] = { 0 };
+                int others[18];
+                for (int i = 0; i < 17; i++)
+                    freq[i] = histogram[i];
+                freq[reserved] = 1;
+                std::fill(others, others + 18, -1);
+
+                for (;;)
+                {
+                    int v1 = -1, v2 = -1;
+                    for (int i = 0; i < 18; i++)
+                        if (freq[i] > 0 && (v1 < 0 || freq[i] <= freq[v1]))
+                            v1 = i;
+                    for (int i = 0; i < 18; i++)
+                        if (freq[i] > 0 && i != v1 && (v2 < 0 || freq[i] <= freq[v2]))
+                            v2 = i;
+                    if (v2 < 0)
+                        break;
+
+                    freq[v1] += freq[v2];
+                    freq[v2] = 0;
+                    for (code_size[v1]++; others[v1] >= 0; code_size[v1]++)
+                        v1 = others[v1];
+                    others[v1] = v2;
+                    for (code_size[v2]++; others[v2] >= 0; code_size[v2]++)
+                        v2 = others[v2];
+                }
+
+                int count[40] = { 0 };
+                for (int i = 0; i < 18; i++)
+                    if (code_size[i])
+                        count[code_size[i]]++;
+
+                // Limit the code lengths to 16 bits (T.81 Figure K.3)
+                for (int i = 39; i > 16; i--)
+                {
+                    while (count[i] > 0)
+                    {
+                        int j = i - 2;
+                        while (count[j] == 0)
+                            j--;
+                        count[i] -= 2;
+                        count[i - 1]++;
+                        count[j + 1] += 2;
+                        count[j]--;
+                    }
+                }
+                // Remove the reserved code from the longest codes
+                int longest = 16;
+                while (count[longest] == 0)
+                    longest--;
+                count[longest]--;
+
+                huffman_table table;
+                for (int i = 1; i <= 16; i++)
+                    table.bits[i] = static_cast<uint8_t>(count[i]);
+                // Symbols are sorted by their unconstrained code length; the reserved
+                // symbol has the lowest frequency and thus the longest code
+                for (int len = 1; len < 40; len++)
+                    for (int i = 0; i < 17; i++)
+                        if (code_size[i] == len)
+                            table.values.push_back(static_cast<uint8_t>(i));
+                table.build();
+                return table;
+            }
+
+            /// Generates the encoding and decoding tables from bits and values
+            void build()
+            {
+                uint32_t next_code = 0;
+                size_t k = 0;
+                std::fill(lookahead, lookahead + 256, 0);
+                for (int len = 1; len <= 16; len++)
+                {
+                    val_offset[len] = static_cast<int32_t>(k) - static_cast<int32_t>(next_code);
+                    for (int i = 0; i < bits[len]; i++, k++, next_code++)
+                    {
+                        // Over-subscribed lengths and the all ones 16-bit code are invalid
+                        if (k >= values.size() || next_code >= (1u << len) ||
+                            (len == 16 && next_code == 0xffff))
+                            throw std::runtime_error("Invalid Huffman table");
+                        auto symbol = values[k];
+                        if (symbol <= 16)
+                        {
+                            code[symbol] = static_cast<uint16_t>(next_code);
+                            length[symbol] = static_cast<uint8_t>(len);
+                        }
+                        if (len <= 8)
+                        {
+                            auto first = next_code << (8 - len);
+                            auto last = (next_code + 1) << (8 - len);
+                            for (auto j = first; j < last; j++)
+                                lookahead[j] = static_cast<uint16_t>((len << 8) | symbol);
+                        }
+                    }
+                    max_code[len] = bits[len] ? static_cast<int32_t>(next_code) - 1 : -1;
+                    next_code <<= 1;
+                }
+                max_code[17] = 0x7fffffff;
+            }
+        };
+
+        /// Writes bits MSB first with 0xff byte stuffing
+        struct bit_writer
+        {
+            std::vector<uint8_t> &out;
+            uint32_t buffer = 0;
+            int count = 0;
+
+            explicit bit_writer(std::vector<uint8_t> &output) : out(output) { }
+
+            void put(uint32_t value, int bits)
+            {
+                if (bits == 0)
+                    return;
+                buffer = (buffer << bits) | (value & ((1u << bits) - 1));
+                count += bits;
+                while (count >= 8)
+                {
+                    count -= 8;
+                    auto byte = static_cast<uint8_t>(buffer >> count);
+                    out.push_back(byte);
+                    if (byte == 0xff)
+                        out.push_back(0);
+                }
+            }
+
+            /// Pads the last byte with ones
+            void flush()
+            {
+                if (count > 0)
+                    put(0x7f, 8 - count);
+            }
+        };
+
+        /// Reads bits MSB first removing the 0xff byte stuffing
+        struct bit_reader
+        {
+            const uint8_t *ptr;
+            const uint8_t *end;
+            uint64_t buffer = 0;
+            int count = 0;
+
+            bit_reader(const uint8_t *first, const uint8_t *last) : ptr(first), end(last) { }
+
+            void fill()
+            {
+                while (count <= 56)
+                {
+                    uint8_t byte = 0;
+                    // a marker or end of data feeds zeros
+                    if (ptr < end && !(ptr[0] == 0xff && (ptr + 1 >= end || ptr[1] != 0)))
+                    {
+                        byte = *ptr++;
+                        if (byte == 0xff)
+                            ptr++;      // skip the stuffed zero
+                    }
+                    buffer |= static_cast<uint64_t>(byte) << (56 - count);
+                    count += 8;
+                }
+            }
+
+            uint32_t peek(int bits)
+            {
+                if (count < bits)
+                    fill();
+                return static_cast<uint32_t>(buffer >> (64 - bits));
+            }
+
+            void skip(int bits)
+            {
+                buffer <<= bits;
+                count -= bits;
+            }
+
+            uint32_t get(int bits)
+            {
+                if (bits == 0)
+                    return 0;
+                auto value = peek(bits);
+                skip(bits);
+                return value;
+            }
+
+            int decode(const huffman_table &table)
+            {
+                auto entry = table.lookahead[peek(8)];
+                if (entry)
+                {
+                    skip(entry >> 8);
+                    return entry & 0xff;
+                }
+                int len = 1;
+                int32_t code = static_cast<int32_t>(get(1));
+                while (code > table.max_code[len])
+                {
+                    if (++len > 16)
+                        throw std::runtime_error("Corrupted lossless JPEG data");
+                    code = (code << 1) | static_cast<int32_t>(get(1));
+                }
+                return table.values[table.val_offset[len] + code];
+            }
+
+            /// Reads the difference of a given category (T.81 F.2.2.1 EXTEND)
+            int difference(int ssss)
+            {
+                if (ssss == 16)
+                    return 32768;
+                auto value = static_cast<int>(get(ssss));
+                return value < (1 << (ssss - 1)) ? value - (1 << ssss) + 1 : value;
+            }
+        };
+
+        inline void put_marker(std::vector<uint8_t> &out, uint16_t marker, uint16_t length = 0)
+        {
+            out.push_back(static_cast<uint8_t>(marker >> 8));
+            out.push_back(static_cast<uint8_t>(marker & 0xff));
+            if (length)
+            {
+                out.push_back(static_cast<uint8_t>(length >> 8));
+                out.push_back(static_cast<uint8_t>(length & 0xff));
+            }
+        }
+
+        /// Returns the modulo 2^16 difference between sample and prediction
+        inline int modular_difference(int sample, int prediction)
+        {
+            int diff = (sample - prediction) & 0xffff;
+            return diff > 32768 ? diff - 65536 : diff;
+        }
+
+        /// \brief  encode      Encodes an image as a single component lossless JPEG frame
+        /// \param  src         Image to encode (up to 65535 x 65535)
+        /// \param  precision   Sample precision in bits (2-16)
+        /// \returns            JPEG stream from SOI to EOI
+        inline std::vector<uint8_t> encode(image<uint16_t> &src, int precision = 16)
+        {
+            if (precision < 2 || precision > 16)
+                throw std::invalid_argument("Lossless JPEG precision must be between 2 and 16");
+            int height = src._height;
+            int width = src._width;
+            if (height < 1 || width < 1 || height > 65535 || width > 65535)
+                throw std::invalid_argument("Invalid lossless JPEG frame size");
+
+            // Pass 1 -- predictor 1 differences and their histogram
+            std::vector<int> diffs(static_cast<size_t>(height) * width);
+            uint32_t histogram[17] = { 0 };
+            const int initial = 1 << (precision - 1);
+            auto d = diffs.data();
+            for (int y = 0; y < height; y++)
+            {
+                auto row = &src(y, 0);
+                int prediction = y == 0 ? initial : src(y - 1, 0);
+                for (int x = 0; x < width; x++)
+                {
+                    int sample = row[x * src._skip_x];
+                    int diff = modular_difference(sample, prediction);
+                    histogram[category(diff)]++;
+                    *d++ = diff;
+                    prediction = sample;
+                }
+            }
+
+            auto table = huffman_table::from_histogram(histogram);
+
+            std::vector<uint8_t> out;
+            out.reserve(diffs.size() + 256);
+            put_marker(out, marker_soi);
+
+            put_marker(out, marker_dht, static_cast<uint16_t>(2 + 1 + 16 + table.values.size()));
+            out.push_back(0);       // Tc = 0, Th = 0
+            out.insert(out.end(), table.bits + 1, table.bits + 17);
+            out.insert(out.end(), table.values.begin(), table.values.end());
+
+            put_marker(out, marker_sof3, 11);
+            out.push_back(static_cast<uint8_t>(precision));
+            out.push_back(static_cast<uint8_t>(height >> 8));
+            out.push_back(static_cast<uint8_t>(height & 0xff));
+            out.push_back(static_cast<uint8_t>(width >> 8));
+            out.push_back(static_cast<uint8_t>(width & 0xff));
+            out.insert(out.end(), { 1, 0, 0x11, 0 });          // Nf, C, H/V, Tq
+
+            put_marker(out, marker_sos, 8);
+            out.insert(out.end(), { 1, 0, 0, 1, 0, 0 });       // Ns, Cs, Td/Ta, Ss=predictor, Se, Ah/Al
+
+            // Pass 2 -- entropy coding
+            bit_writer writer(out);
+            for (auto diff : diffs)
+            {
+                auto ssss = category(diff);
+                writer.put(table.code[ssss], table.length[ssss]);
+                if (ssss && ssss < 16)
+                    writer.put(static_cast<uint32_t>(diff < 0 ? diff - 1 : diff), ssss);
+            }
+            writer.flush();
+            put_marker(out, marker_eoi);
+            return out;
+        }
+
+        /// \brief  decode      Decodes a lossless JPEG frame into an image (view)
+        /// \param  data        Pointer to the JPEG stream
+        /// \param  size        Length of the JPEG stream
+        /// \param  dst         Destination; samples outside the view are decoded and discarded
+        ///                     while an empty view receives the full frame -- throws if the
+        ///                     frame is smaller than the view
+        inline void decode(const uint8_t *data, size_t size, image<uint16_t> &dst)
+        {
+            const uint8_t *ptr = data;
+            const uint8_t *end = data + size;
+            auto get16 = [&ptr, end]()
+            {
+                if (ptr + 2 > end)
+                    throw std::runtime_error("Truncated lossless JPEG stream");
+                int value = (ptr[0] << 8) | ptr[1];
+                ptr += 2;
+                return value;
+            };
+
+            if (get16() != marker_soi)
+                throw std::runtime_error("Missing JPEG SOI marker");
+
+            huffman_table tables[4];
+            bool defined[4] = { false, false, false, false };
+            int precision = 0, height = 0, width = 0, components = 0;
+            int table_of[4] = { 0 };
+
+            for (;;)
+            {
+                int marker = get16();
+                int length = get16() - 2;
+                if (length < 0 || ptr + length > end)
+                    throw std::runtime_error("Truncated lossless JPEG segment");
+                const uint8_t *segment = ptr;
+                ptr += length;
+
+                if (marker == marker_dht)
+                {
+                    for (const uint8_t *s = segment; s < segment + length;)
+                    {
+                        if (s + 17 > segment + length)
+                            throw std::runtime_error("Invalid Huffman table");
+                        auto &table = tables[s[0] & 3];
+                        table = huffman_table();
+                        int total = 0;
+                        for (int i = 1; i <= 16; i++)
+                            total += table.bits[i] = s[i];
+                        if (s + 17 + total > segment + length)
+                            throw std::runtime_error("Invalid Huffman table");
+                        table.values.assign(s + 17, s + 17 + total);
+                        table.build();
+                        defined[s[0] & 3] = true;
+                        s += 17 + total;
+                    }
+                }
+                else if (marker == marker_sof3)
+                {
+                    if (length < 6)
+                        throw std::runtime_error("Invalid SOF3 segment");
+                    precision = segment[0];
+                    height = (segment[1] << 8) | segment[2];
+                    width = (segment[3] << 8) | segment[4];
+                    components = segment[5];
+                    if (components < 1 || components > 4 || precision < 2 || precision > 16 ||
+                        length < 6 + 3 * components)
+                        throw std::runtime_error("Unsupported lossless JPEG frame");
+                }
+                else if (marker == marker_dri)
+                {
+                    if (length >= 2 && (segment[0] | segment[1]))
+                        throw std::runtime_error("Lossless JPEG restart intervals are not supported");
+                }
+                else if (marker == marker_sos)
+                {
+                    if (components == 0 || length < 1 || segment[0] != components || length < 4 + 2 * components)
+                        throw std::runtime_error("Unsupported lossless JPEG scan");
+                    for (int i = 0; i < components; i++)
+                    {
+                        table_of[i] = (segment[2 + 2 * i] >> 4) & 3;
+                        if (!defined[table_of[i]])
+                            throw std::runtime_error("Lossless JPEG scan uses an undefined Huffman table");
+                    }
+                    int predictor = segment[1 + 2 * components];
+                    int point_transform = segment[3 + 2 * components] & 15;
+                    if (predictor < 1 || predictor > 7)
+                        throw std::runtime_error("Unsupported lossless JPEG predictor");
+                    if (point_transform >= precision)
+                        throw std::runtime_error("Unsupported lossless JPEG scan");
+
+                    int row_width = width * components;
+                    if (dst._width == 0 && dst._height == 0)
+                        dst = image<uint16_t>(height, row_width);
+                    if (row_width < dst._width || height < dst._height)
+                        throw std::runtime_error("Lossless JPEG frame does not cover the destination");
+                    int out_width = dst._width;
+                    int out_height = dst._height;
+
+                    std::vector<int> rows(2 * static_cast<size_t>(row_width));
+                    int *prev = rows.data();
+                    int *curr = prev + row_width;
+                    const int mask = (1 << (precision - point_transform)) - 1;
+                    const int initial = 1 << (precision - point_transform - 1);
+
+                    bit_reader reader(ptr, end);
+                    for (int y = 0; y < height; y++)
+                    {
+                        for (int x = 0; x < row_width; x++)
+                        {
+                            int c = x % components;
+                            int prediction;
+                            if (x < components)
+                                prediction = y == 0 ? initial : prev[x];
+                            else if (y == 0)
+                                prediction = curr[x - components];
+                            else
+                            {
+                                int ra = curr[x - components];
+                                int rb = prev[x];
+                                int rc = prev[x - components];
+                                switch (predictor)
+                                {
+                                case 1: prediction = ra; break;
+                                case 2: prediction = rb; break;
+                                case 3: prediction = rc; break;
+                                case 4: prediction = ra + rb - rc; break;
+                                case 5: prediction = ra + ((rb - rc) >> 1); break;
+                                case 6: prediction = rb + ((ra - rc) >> 1); break;
+                                default: prediction = (ra + rb) >> 1; break;
+                                }
+                            }
+                            int ssss = reader.decode(tables[table_of[c]]);
+                            if (ssss > 16)
+                                throw std::runtime_error("Corrupted lossless JPEG data");
+                            int diff = ssss ? reader.difference(ssss) : 0;
+                            curr[x] = (prediction + diff) & mask;
+                        }
+                        if (y < out_height)
+                        {
+                            auto row = &dst(y, 0);
+                            for (int x = 0; x < out_width; x++)
+                                row[x * dst._skip_x] = static_cast<uint16_t>(curr[x] << point_transform);
+                        }
+                        std::swap(prev, curr);
+                    }
+                    return;
+                }
+                else if (marker == marker_eoi || (marker & 0xff00) != 0xff00)
+                {
+                    throw std::runtime_error("Lossless JPEG stream without a scan");
+                }
+                // all other segments (APPn, COM, ...) are skipped
+            }
+        }
+    }
+}
@@ -0,0 +1,396 @@
+/*
+* Copyright (c) 2019, Intel Corporation
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the Intel Corporation nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#pragma once
+#include "Teisko/Algorithm/CpuFeatures.hpp"
+#include "Teisko/Image/API.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#if (defined(WIN32) || defined(_WIN32))
+#include "intrin.h"
+#else
+// Linux
+#include "x86intrin.h"
+#endif
+
+/// Morphological filters with rectangular structuring elements
+///
+/// The minimum (erosion) and maximum (dilation) over a `height` x `width` window are separable
+/// and each one dimensional pass uses the van Herk / Gil-Werman algorithm: the line is split
+/// into blocks of the window length, a running extremum is accumulated forward and backward
+/// within each block, and every window is then the extremum of one backward and one forward
+/// value -- three comparisons per pixel regardless of the window size.
+///
+/// The vertical pass works on whole rows, which makes it vectorized across the columns.
+/// The filters stream over the image keeping only `2 * height + 1` rows of state, so that
+/// opening and closing feed the rows of the first filter directly to the second one.
+///
+/// The window of a pixel at (y, x) spans rows y - (height - 1) / 2 ... and columns
+/// x - (width - 1) / 2 ... and is clipped to the image, matching `image<T>::filter`
+/// with mirrored (MIRROR_EVEN) borders.
+namespace Teisko
+{
+    /// Elementwise minimum or maximum of two values
+    template <bool is_max, typename T>
+    inline T extremum(T a, T b)
+    {
+        return is_max ? std::max(a, b) : std::min(a, b);
+    }
+
+    /// The value not affecting `extremum<is_max>`, used for the pixels outside the image
+    template <bool is_max, typename T>
+    inline T extremum_identity()
+    {
+        return is_max ? std::numeric_limits<T>::lowest() : std::numeric_limits<T>::max();
+    }
+
+    /// Elementwise extremum of two rows of uint16_t, eight items at a time
+    /// \returns    Number of items processed
+    template <bool is_max>
+    inline size_t extremum_rows_sse4(const uint16_t *a, const uint16_t *b, uint16_t *dst, size_t count)
+    {
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+            auto y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), is_max ? _mm_max_epu16(x, y) : _mm_min_epu16(x, y));
+        }
+        return i;
+    }
+
+    /// Elementwise extremum of two rows of uint16_t, sixteen items at a time
+    /// \returns    Number of items processed
+    template <bool is_max>
+    TEISKO_TARGET_AVX2
+    inline size_t extremum_rows_avx2(const uint16_t *a, const uint16_t *b, uint16_t *dst, size_t count)
+    {
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16)
+        {
+            auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+            auto y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), is_max ? _mm256_max_epu16(x, y) : _mm256_min_epu16(x, y));
+        }
+        return i;
+    }
+
+    /// Elementwise extremum with the SIMD kernels -- other types than uint16_t are left to the caller
+    /// \returns    Number of items processed
+    template <bool is_max, typename T>
+    inline size_t extremum_rows_simd(const T *, const T *, T *, size_t, simd_level_e)
+    {
+        return 0;
+    }
+
+    template <bool is_max>
+    inline size_t extremum_rows_simd(const uint16_t *a, const uint16_t *b, uint16_t *dst, size_t count, simd_level_e level)
+    {
+        switch (supported_simd_level(level))
+        {
+        case simd_level_e::avx512:
+        case simd_level_e::avx2:
+            return extremum_rows_avx2<is_max>(a, b, dst, count);
+        case simd_level_e::sse4:
+            return extremum_rows_sse4<is_max>(a, b, dst, count);
+        default:
+            return 0;
+        }
+    }
+
+    /// Elementwise extremum of two rows: dst[i] = extremum(a[i], b[i]) -- dst may alias a or b
+    template <bool is_max, typename T>
+    inline void extremum_rows(const T *a, const T *b, T *dst, size_t count, simd_level_e level)
+    {
+        for (auto i = extremum_rows_simd<is_max>(a, b, dst, count, level); i < count; i++)
+            dst[i] = extremum<is_max>(a[i], b[i]);
+    }
+
+    /// @brief Streaming minimum or maximum filter of a rectangular window
+    /// @details  Source rows are pushed in order and each filtered row is passed to a callback
+    /// `emit(const T *row)` as soon as the rows below it are known; `finish` flushes the
+    /// rows at the bottom border. The emitted row is valid only during the callback.
+    template <typename T, bool is_max>
+    struct extremum_filter_s
+    {
+        /// @param width            Width of the rows
+        /// @param kernel_height    Height of the window
+        /// @param kernel_width     Width of the window
+        /// @param level            Highest instruction set tier to use
+        extremum_filter_s(int width, int kernel_height, int kernel_width,
+            simd_level_e level = detected_simd_level())
+            : _width(width)
+            , _kernel_height(kernel_height)
+            , _kernel_width(kernel_width)
+            , _top((kernel_height - 1) >> 1)
+            , _left((kernel_width - 1) >> 1)
+            , _level(level)
+        {
+            if (width <= 0 || kernel_height <= 0 || kernel_width <= 0)
+                throw std::invalid_argument("Row width and window dimensions must be positive");
+
+            // The padded line is a whole number of blocks covering the windows of all pixels
+            auto blocks = (width + kernel_width - 1 + kernel_width - 1) / kernel_width;
+            auto identity = extremum_identity<is_max, T>();
+            _line.assign(static_cast<size_t>(blocks * kernel_width), identity);
+            _forward.resize(_line.size());
+            _backward.resize(_line.size());
+            _blocks.resize(static_cast<size_t>(2 * kernel_height * width));
+            _running.resize(static_cast<size_t>(width));
+            _output.resize(static_cast<size_t>(width));
+            _identity.assign(static_cast<size_t>(width), identity);
+        }
+
+        /// Filters the next source row of `_width` items `skip_x` apart
+        template <typename Emit>
+        void push(const T *src, int skip_x, Emit &&emit)
+        {
+            if (_pushed == 0)
+            {
+                for (int i = 0; i < _top; i++)
+                    push_vertical(_identity.data(), emit);
+            }
+            _pushed++;
+            filter_horizontal(src, skip_x, slot(_padded));
+            push_vertical(nullptr, emit);
+        }
+
+        /// Pushes the rows below the image -- every source row has been emitted on return
+        template <typename Emit>
+        void finish(Emit &&emit)
+        {
+            while (_emitted < _pushed)
+                push_vertical(_identity.data(), emit);
+        }
+
+    private:
+        int _width;
+        int _kernel_height;
+        int _kernel_width;
+        int _top;
+        int _left;
+        simd_level_e _level;
+        int _pushed = 0;            // source rows pushed
+        int _padded = 0;            // rows pushed including the rows above the image
+        int _emitted = 0;           // rows emitted
+        std::vector<T> _line;       // source row padded with identities
+        std::vector<T> _forward;    // forward extrema of the padded source row within each block
+        std::vector<T> _backward;   // backward extrema of the padded source row within each block
+        std::vector<T> _blocks;     // two blocks of `kernel_height` rows, turned into backward extrema
+        std::vector<T> _running;    // forward extremum of the current block
+        std::vector<T> _output;     // filtered row
+        std::vector<T> _identity;   // a row outside the image
+
+        // Row `row` of the blocks, which alternate between even and odd blocks
+        T* slot(int row)
+        {
+            auto block = (row / _kernel_height) & 1;
+            auto index = block * _kernel_height + row % _kernel_height;
+            return _blocks.data() + static_cast<size_t>(index) * _width;
+        }
+
+        // Windowed extremum of a single row
+        void filter_horizontal(const T *src, int skip_x, T *dst)
+        {
+            if (_kernel_width == 1)
+            {
+                for (int x = 0; x < _width; x++)
+                    dst[x] = src[x * skip_x];
+                return;
+            }
+            auto line = _line.data();
+            auto forward = _forward.data();
+            auto backward = _backward.data();
+            for (int x = 0; x < _width; x++)
+                line[_left + x] = src[x * skip_x];
+
+            auto k = _kernel_width;
+            auto size = static_cast<int>(_line.size());
+            for (int b = 0; b < size; b += k)
+            {
+                forward[b] = line[b];
+                for (int x = b + 1; x < b + k; x++)
+                    forward[x] = extremum<is_max>(forward[x - 1], line[x]);
+                backward[b + k - 1] = line[b + k - 1];
+                for (int x = b + k - 2; x >= b; x--)
+                    backward[x] = extremum<is_max>(line[x], backward[x + 1]);
+            }
+            // The window starting at `x` spans the end of one block and the start of the next
+            extremum_rows<is_max>(backward, forward + k - 1, dst, static_cast<size_t>(_width), _level);
+        }
+
+        // Accepts the next padded row already filtered horizontally to its slot,
+        // or copied from `src` when it is not null
+        //  - row `i` completes the output of row `i - kernel_height + 1`
+        template <typename Emit>
+        void push_vertical(const T *src, Emit &emit)
+        {
+            auto k = _kernel_height;
+            auto i = _padded++;
+            auto j = i % k;
+            auto row = slot(i);
+            auto width = static_cast<size_t>(_width);
+            if (src)
+                std::copy(src, src + width, row);
+
+            // Until the block is complete, the window of `y` starts inside the previous block,
+            // already turned into backward extrema, and ends at the forward extremum of this block
+            auto y = i - k + 1;
+            if (j < k - 1)
+            {
+                const T *forward = row;
+                if (j > 0)
+                {
+                    forward = _running.data();
+                    extremum_rows<is_max>(j == 1 ? slot(i - 1) : forward, row, _running.data(), width, _level);
+                }
+                if (y >= 0)
+                {
+                    extremum_rows<is_max>(slot(y), forward, _output.data(), width, _level);
+                    _emitted++;
+                    emit(static_cast<const T*>(_output.data()));
+                }
+                return;
+            }
+
+            // The block is complete: turn it into backward extrema, the first of which is the window of `y`
+            for (int r = i - 1; r >= y; r--)
+                extremum_rows<is_max>(slot(r), slot(r + 1), slot(r), width, _level);
+            if (y >= 0)
+            {
+                _emitted++;
+                emit(static_cast<const T*>(slot(y)));
+            }
+        }
+    };
+
+    /// Writes the emitted rows to consecutive rows of an image
+    template <typename T>
+    struct extremum_filter_sink_s
+    {
+        image<T> &dst;
+        int row;
+        void operator()(const T *src)
+        {
+            auto width = dst.size()._x;
+            for (int x = 0; x < width; x++)
+                dst(row, x) = src[x];
+            row++;
+        }
+    };
+
+    /// @brief Minimum (is_max = false) or maximum (is_max = true) filter of a rectangular window
+    /// @param src      Image to filter
+    /// @param height   Height of the window
+    /// @param width    Width of the window
+    /// @param level    Highest instruction set tier to use
+    /// @returns        A new image of the same size
+    template <bool is_max, typename T>
+    inline image<T> extremum_filter(const image<T> &src, int height, int width,
+        simd_level_e level = detected_simd_level())
+    {
+        auto dst = image<T>(src.size());
+        if (dst.size()._x == 0 || dst.size()._y == 0)
+            return dst;
+
+        extremum_filter_s<T, is_max> filter(dst.size()._x, height, width, level);
+        auto sink = extremum_filter_sink_s<T>{ dst, 0 };
+        for (int y = 0; y < dst.size()._y; y++)
+            filter.push(&src(y, 0), src._skip_x, sink);
+        filter.finish(sink);
+        return dst;
+    }
+
+    /// @brief A minimum filter followed by a maximum filter (is_max = false) or vice versa
+    /// @details  The rows of the first filter are streamed to the second one as they complete
+    /// @param src      Image to filter
+    /// @param height   Height of the window
+    /// @param width    Width of the window
+    /// @param level    Highest instruction set tier to use
+    /// @returns        A new image of the same size
+    template <bool is_max, typename T>
+    inline image<T> extremum_filter_pair(const image<T> &src, int height, int width,
+        simd_level_e level = detected_simd_level())
+    {
+        auto dst = image<T>(src.size());
+        if (dst.size()._x == 0 || dst.size()._y == 0)
+            return dst;
+
+        extremum_filter_s<T, is_max> first(dst.size()._x, height, width, level);
+        extremum_filter_s<T, !is_max> second(dst.size()._x, height, width, level);
+        auto sink = extremum_filter_sink_s<T>{ dst, 0 };
+        auto chain = [&second, &sink](const T *row)
+        {
+            second.push(row, 1, sink);
+        };
+        for (int y = 0; y < dst.size()._y; y++)
+            first.push(&src(y, 0), src._skip_x, chain);
+        first.finish(chain);
+        second.finish(sink);
+        return dst;
+    }
+
+    /// @brief Erosion: minimum of the `height` x `width` window around each pixel
+    template <typename T>
+    inline image<T> erode(const image<T> &src, int height, int width,
+        simd_level_e level = detected_simd_level())
+    {
+        return extremum_filter<false>(src, height, width, level);
+    }
+
+    /// @brief Dilation: maximum of the `height` x `width` window around each pixel
+    template <typename T>
+    inline image<T> dilate(const image<T> &src, int height, int width,
+        simd_level_e level = detected_simd_level())
+    {
+        return extremum_filter<true>(src, height, width, level);
+    }
+
+    /// @brief Opening: erosion followed by dilation with the same window
+    /// -- removes bright details smaller than the window
+    template <typename T>
+    inline image<T> morphological_open(const image<T> &src, int height, int width,
+        simd_level_e level = detected_simd_level())
+    {
+        return extremum_filter_pair<false>(src, height, width, level);
+    }
+
+    /// @brief Closing: dilation followed by erosion with the same window
+    /// -- removes dark details smaller than the window
+    template <typename T>
+    inline image<T> morphological_close(const image<T> &src, int height, int width,
+        simd_level_e level = detected_simd_level())
+    {
+        return extremum_filter_pair<true>(src, height, width, level);
+    }
+}
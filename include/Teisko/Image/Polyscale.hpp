@@ -26,9 +26,14 @@
 */
 
 #pragma once
+#include "Teisko/Algorithm/CpuFeatures.hpp"
+#include "Teisko/Algorithm/Parallel.hpp"
 #include "Teisko/Algorithm/ReduceTo.hpp"
 #include "Teisko/Image/API.hpp"
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
+#include <utility>
 #include <vector>
 
 namespace Teisko
@@ -61,97 +66,72 @@ namespace Teisko
             return *this;
         }
 
-        grid_2d transpose()
-        {
-            grid_2d<T> trans(_rows, _cols);
-            for (size_t j = 0; j < _rows; j++)
-            {
-                for (size_t i = 0; i < _cols; i++)
-                {
-                    trans._grid[i * trans._cols + j] = _grid[j * _cols + i];
-                }
-            }
-            return trans;
-        }
-
         image<T> to_view()
         {
             return image<T>((uint32_t)_rows, (uint32_t)_cols, _grid.data());
         }
+    };
 
-        /// Multiply this * B
-        template <typename V>
-        grid_2d mul_mm(grid_2d<V> &B) const
+    /// Evaluates the 1-D polynomial sum(coeffs[p] * x^p), p = 0..degree, with Horner's rule
+    /// at `count` abscissas `x`; the SIMD tiers do the same multiplies and adds per lane
+    /// and are bit exact with the scalar version
+    inline void horner_row_scalar(const double *x, double *out, size_t count, const double *coeffs, int degree)
+    {
+        for (size_t i = 0; i < count; i++)
         {
-            auto &A = *this;
-            grid_2d output(B._cols, A._rows);
-            auto Bt = B.transpose();
-
-            auto t = 64; // Cache line
-            for (size_t j = 0; j < B._cols; j += t)
-            {
-                for (size_t k = 0; k < A._cols; k += t)
-                {
-                    for (size_t i = 0; i < A._rows; i += t)
-                    {
-                        for (size_t ii = i; ii < std::min((size_t)i + t, A._rows); ii++)
-                        {
-                            for (size_t jj = j; jj < std::min((size_t)j + t, B._cols); jj++)
-                            {
-                                auto tmp = output._grid[ii * output._cols + jj];
-                                for (size_t kk = k; kk < std::min((size_t)k + t, A._cols); kk++)
-                                {
-                                    auto product = A._grid[ii *A._cols + kk] * Bt._grid[jj * Bt._cols + kk];
-                                    if (!std::isnan(product))
-                                        tmp += product;
-                                }
-                                output._grid[ii *output._cols + jj] = tmp;
-                            }
-                        }
-                    }
-                }
-            }
-            return output;
+            auto acc = coeffs[degree];
+            for (int p = degree - 1; p >= 0; p--)
+                acc = acc * x[i] + coeffs[p];
+            out[i] = acc;
         }
+    }
 
-        // Matrix multiplication by its transpose, A * At
-        grid_2d mul_mm() const
+    inline void horner_row_sse4(const double *x, double *out, size_t count, const double *coeffs, int degree)
+    {
+        size_t i = 0;
+        for (; i + 2 <= count; i += 2)
         {
-            auto &A = *this;
-            grid_2d<double> output(A._rows, A._rows);
+            auto xi = _mm_loadu_pd(x + i);
+            auto acc = _mm_set1_pd(coeffs[degree]);
+            for (int p = degree - 1; p >= 0; p--)
+                acc = _mm_add_pd(_mm_mul_pd(acc, xi), _mm_set1_pd(coeffs[p]));
+            _mm_storeu_pd(out + i, acc);
+        }
+        horner_row_scalar(x + i, out + i, count - i, coeffs, degree);
+    }
 
-            auto t = 64; // Cache line
-            for (size_t j = 0; j < A._rows; j += t)
-            {
-                for (size_t k = 0; k < A._cols; k += t)
-                {
-                    for (size_t i = 0; i < A._rows; i += t)
-                    {
-                        for (size_t ii = i; ii < std::min((size_t)i + t, A._rows); ii++)
-                        {
-                            for (size_t jj = j; jj < std::min((size_t)j + t, A._rows); jj++)
-                            {
-                                auto tmp = output._grid[ii * output._cols + jj];
-                                for (size_t kk = k; kk < std::min((size_t)k + t, A._cols); kk++)
-                                {
-                                    auto product = A._grid[ii *A._cols + kk] * A._grid[jj * A._cols + kk];
-                                    if (!std::isnan(product))
-                                        tmp += product;
-                                }
-                                output._grid[ii *output._cols + jj] = tmp;
-                            }
-                        }
-                    }
-                }
-            }
-            return output;
+    TEISKO_TARGET_AVX2
+    inline void horner_row_avx2(const double *x, double *out, size_t count, const double *coeffs, int degree)
+    {
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            auto xi = _mm256_loadu_pd(x + i);
+            auto acc = _mm256_set1_pd(coeffs[degree]);
+            for (int p = degree - 1; p >= 0; p--)
+                acc = _mm256_add_pd(_mm256_mul_pd(acc, xi), _mm256_set1_pd(coeffs[p]));
+            _mm256_storeu_pd(out + i, acc);
         }
-    };
+        horner_row_scalar(x + i, out + i, count - i, coeffs, degree);
+    }
 
-    struct poly_coeffs
+    inline void horner_row(const double *x, double *out, size_t count, const double *coeffs, int degree,
+        simd_level_e level = detected_simd_level())
     {
-        double x, y, x2, y2, x3, y3;
-    };
+        switch (supported_simd_level(level))
+        {
+        case simd_level_e::avx512:
+        case simd_level_e::avx2:
+            horner_row_avx2(x, out, count, coeffs, degree);
+            break;
+        case simd_level_e::sse4:
+            horner_row_sse4(x, out, count, coeffs, degree);
+            break;
+        default:
+            horner_row_scalar(x, out, count, coeffs, degree);
+            break;
+        }
+    }
 
     template<typename T>
     class scaler_2d
@@ -179,25 +159,43 @@ namespace Teisko
 
         poly_scaler_2d(int coeffs) : num_coeff(coeffs)
         {
-            LU = grid_2d<double>(num_coeff, num_coeff);
             x = std::vector<double>(num_coeff);
         }
 
         void poly_fit_2d(image<T> &input);
-        void interp(image<T> &output);
+
+        /// Evaluates the fitted model at every pixel of `output`
+        /// The surface is collapsed per row to a polynomial in x, which is evaluated
+        /// with Horner's rule across the row; rows are processed in parallel
+        /// \param output      Destination image, whose size defines the sampling grid
+        /// \param threads     Maximum number of threads (0 == hardware concurrency)
+        /// \param level       Highest instruction set tier used by the row evaluation
+        void interp(image<T> &output, unsigned int threads = 0, simd_level_e level = detected_simd_level());
 
     protected:
         // Polynomial scale protected members
         int num_coeff;
 
-        void lu_decomposition(grid_2d<double> &A);
-        void lu_solve();
-        virtual void get_basis_function(double* ptr, const poly_coeffs &coeffs) = 0;
-        virtual void set_polynomial_value(T &ptr, std::vector<double> &arr, const poly_coeffs &coeffs) = 0;
+        /// Exponents (p, q) of each basis term x^p * y^q in the order of the fitted coefficients
+        /// Default is the graded order 1, x, y, x2, xy, y2, x3, x2y, ...
+        virtual std::vector<std::pair<int, int>> get_basis_exponents()
+        {
+            std::vector<std::pair<int, int>> exponents;
+            for (int degree = 0; static_cast<int>(exponents.size()) < num_coeff; degree++)
+            {
+                for (int q = 0; q <= degree && static_cast<int>(exponents.size()) < num_coeff; q++)
+                    exponents.emplace_back(degree - q, q);
+            }
+            return exponents;
+        }
 
-        grid_2d<double> LU;
-        grid_2d<double> b;
         std::vector<double> x;
+
+    private:
+        /// Solves the symmetric positive semidefinite system a * solution = b (a is n x n, row major)
+        /// Without pivoting fails on a vanishing pivot; with pivoting truncates to the numerical rank
+        static bool ldlt_solve(std::vector<double> a, std::vector<double> b,
+            std::vector<double> &solution, bool pivoting);
     };
 
     // Computes 3th order polynomial model for 2d grid
@@ -211,39 +209,6 @@ namespace Teisko
         poly_3_scaler_2d() : poly_scaler_2d<T>(10)
         {
         }
-
-    protected:
-        virtual void get_basis_function(double* ptr, const poly_coeffs &coeffs)
-        {
-            ptr[0] = 1.0;
-            ptr[1] = coeffs.x;
-            ptr[2] = coeffs.y;
-            ptr[3] = coeffs.x2;
-            ptr[4] = coeffs.x * coeffs.y;
-            ptr[5] = coeffs.y2;
-            ptr[6] = coeffs.x3;
-            ptr[7] = coeffs.x2 * coeffs.y;
-            ptr[8] = coeffs.x * coeffs.y2;
-            ptr[9] = coeffs.y3;
-        }
-        virtual void set_polynomial_value(T &ptr, std::vector<double> &arr, const poly_coeffs &coeffs)
-        {
-            ptr = reduce_to<T>(get_cubic_polynomial_value(arr, coeffs));
-        }
-
-        static double get_cubic_polynomial_value(std::vector<double> &arr, const poly_coeffs &coeffs)
-        {
-            return arr[0] +
-                arr[1] * coeffs.x +
-                arr[2] * coeffs.y +
-                arr[3] * coeffs.x2 +
-                arr[4] * coeffs.x * coeffs.y +
-                arr[5] * coeffs.y2 +
-                arr[6] * coeffs.x3 +
-                arr[7] * coeffs.x2 * coeffs.y +
-                arr[8] * coeffs.x * coeffs.y2 +
-                arr[9] * coeffs.y3;
-        }
     };
 
     // Computes 4th order polynomial model for 2d grid
@@ -257,48 +222,6 @@ namespace Teisko
         poly_4_scaler_2d() : poly_scaler_2d<T>(15)
         {
         }
-
-    protected:
-        virtual void get_basis_function(double* ptr, const poly_coeffs &coeffs)
-        {
-            ptr[0] = 1.0;
-            ptr[1] = coeffs.x;
-            ptr[2] = coeffs.y;
-            ptr[3] = coeffs.x2;
-            ptr[4] = (coeffs.x * coeffs.y);
-            ptr[5] = coeffs.y2;
-            ptr[6] = coeffs.x3;
-            ptr[7] = coeffs.x2 * coeffs.y;
-            ptr[8] = coeffs.x * coeffs.y2;
-            ptr[9] = coeffs.y3;
-            ptr[10] = coeffs.x3 * coeffs.x;
-            ptr[11] = coeffs.x3 * coeffs.y;
-            ptr[12] = coeffs.x2 * coeffs.y2;
-            ptr[13] = coeffs.x * coeffs.y3;
-            ptr[14] = coeffs.y3 * coeffs.y;
-        }
-        virtual void set_polynomial_value(T &ptr, std::vector<double> &arr, const poly_coeffs &coeffs)
-        {
-            ptr = reduce_to<T>(get_quadric_polynomial_value(arr, coeffs));
-        }
-        static double get_quadric_polynomial_value(std::vector<double> &arr, const poly_coeffs &coeffs)
-        {
-            return arr[0] +
-                arr[1] * coeffs.x +
-                arr[2] * coeffs.y +
-                arr[3] * coeffs.x2 +
-                arr[4] * coeffs.x * coeffs.y +
-                arr[5] * coeffs.y2 +
-                arr[6] * coeffs.x3 +
-                arr[7] * coeffs.x2 * coeffs.y +
-                arr[8] * coeffs.x * coeffs.y2 +
-                arr[9] * coeffs.y3 +
-                arr[10] * coeffs.x3 * coeffs.x +
-                arr[11] * coeffs.x3 * coeffs.y +
-                arr[12] * coeffs.x2 * coeffs.y2 +
-                arr[13] * coeffs.x * coeffs.y3 +
-                arr[14] * coeffs.y3 * coeffs.y;
-        }
     };
 
     template <typename T>
@@ -306,9 +229,13 @@ namespace Teisko
     {
         size_t cols = input._width;
         size_t rows = input._height;
-        poly_coeffs coeffs;
-        // Basis function
-        grid_2d<double> A(num_coeff, cols * rows);
+        auto exponents = get_basis_exponents();
+
+        int max_power = 0;
+        for (auto &e : exponents)
+            max_power = std::max(max_power, std::max(e.first, e.second));
+        // A'A needs products of two basis terms, A'b only the terms themselves
+        int moments = 2 * max_power + 1;
 
         // Fit model as center symmetric
         auto h2 = (rows - 1) * 0.5;
@@ -316,125 +243,196 @@ namespace Teisko
         auto inv_h2 = h2 == 0.0 ? 0.0 : 1.0 / h2;
         auto inv_w2 = w2 == 0.0 ? 0.0 : 1.0 / w2;
 
+        // The basis is separable: x^p is shared by every row, so tabulate it once
+        std::vector<double> x_powers(cols * moments);
+        for (size_t i = 0; i < cols; i++)
+        {
+            auto xi = (2 * i - w2) * inv_w2;
+            auto power = 1.0;
+            for (int p = 0; p < moments; p++, power *= xi)
+                x_powers[i * moments + p] = power;
+        }
+
+        // sum_xy(p,q) = sum(x^p * y^q), sum_xyz(p,q) = sum(x^p * y^q * z) over valid samples
+        std::vector<double> sum_xy(moments * moments);
+        std::vector<double> sum_xyz(moments * moments);
+        std::vector<double> row_x(moments);
+        std::vector<double> row_xz(moments);
+
         for (size_t j = 0; j < rows; j++)
         {
-            coeffs.y = (2 * j - h2) * inv_h2;
-            coeffs.y2 = coeffs.y * coeffs.y;
-            coeffs.y3 = coeffs.y2 * coeffs.y;
+            std::fill(row_x.begin(), row_x.end(), 0.0);
+            std::fill(row_xz.begin(), row_xz.end(), 0.0);
             for (size_t i = 0; i < cols; i++)
             {
-                coeffs.x = (2 * i - w2) * inv_w2;
-                coeffs.x2 = coeffs.x * coeffs.x;
-                coeffs.x3 = coeffs.x2 * coeffs.x;
-                get_basis_function(&A._grid[j * cols * num_coeff + i * num_coeff], coeffs);
+                auto z = static_cast<double>(input(static_cast<int>(j), static_cast<int>(i)));
+                // NaN marks a sample excluded from the fit
+                if (std::isnan(z))
+                    continue;
+                auto xp = &x_powers[i * moments];
+                for (int p = 0; p < moments; p++)
+                    row_x[p] += xp[p];
+                for (int p = 0; p <= max_power; p++)
+                    row_xz[p] += xp[p] * z;
             }
-        }
-
-        auto A_trans = A.transpose();
-        auto product = A_trans.mul_mm();    // A_trans * A
-        lu_decomposition(product);
 
-        // Treat input as vector for matrix multiplication
-        grid_2d<T> InputAsVector(input);
-        InputAsVector._rows *= InputAsVector._cols;
-        InputAsVector._cols = 1;
+            auto yj = (2 * j - h2) * inv_h2;
+            auto power = 1.0;
+            for (int q = 0; q < moments; q++, power *= yj)
+            {
+                for (int p = 0; p < moments; p++)
+                    sum_xy[p * moments + q] += row_x[p] * power;
+                for (int p = 0; p <= max_power; p++)
+                    sum_xyz[p * moments + q] += row_xz[p] * power;
+            }
+        }
 
-        // b = A' * grid(:)
-        b = A_trans.mul_mm(InputAsVector);
+        // A'A(m,n) = sum(x^(pm+pn) * y^(qm+qn)), b(m) = sum(x^pm * y^qm * z)
+        std::vector<double> normal(num_coeff * num_coeff);
+        std::vector<double> rhs(num_coeff);
+        for (int m = 0; m < num_coeff; m++)
+        {
+            auto &em = exponents[m];
+            for (int n = 0; n < num_coeff; n++)
+            {
+                auto &en = exponents[n];
+                normal[m * num_coeff + n] = sum_xy[(em.first + en.first) * moments + em.second + en.second];
+            }
+            rhs[m] = sum_xyz[em.first * moments + em.second];
+        }
 
-        lu_solve();
+        // LDL' for the well posed case; diagonal pivoting when too few
+        // valid samples or a degenerate grid leave A'A singular
+        if (!ldlt_solve(normal, rhs, x, false))
+            ldlt_solve(normal, rhs, x, true);
     }
 
     template <typename T>
-    void poly_scaler_2d<T>::lu_decomposition(grid_2d<double> &A)
+    bool poly_scaler_2d<T>::ldlt_solve(std::vector<double> a, std::vector<double> b,
+        std::vector<double> &solution, bool pivoting)
     {
-        auto w = A._cols;
-
-        for (size_t k = 0; k < w; k++)
+        const double tolerance = 1e-12;
+        auto n = static_cast<int>(b.size());
+        std::vector<int> order(n);
+        double max_diagonal = 0.0;
+        for (int i = 0; i < n; i++)
         {
-            // U(k,k) = A(k,k);
-            LU._grid[w*k + k] = A._grid[w*k + k];
-            for (size_t j = k + 1; j < w; j++)
-            {
-                // L(k,j) = A(k,j) / U(k,k);
-                LU._grid[w*j + k] = A._grid[w*j + k] / (double)LU._grid[w*k + k];
+            order[i] = i;
+            max_diagonal = std::max(max_diagonal, std::fabs(a[i * n + i]));
+        }
 
-                // U(j,k) = A(j,k);
-                LU._grid[w*k + j] = A._grid[w*k + j];
-            }
-            for (size_t j = k + 1; j < w; j++)
+        // Outer product LDL' in place: L below the diagonal, D on it
+        int rank = n;
+        for (int k = 0; k < n; k++)
+        {
+            int pivot = k;
+            if (pivoting)
             {
-                for (size_t i = k + 1; i < w; i++)
+                for (int i = k + 1; i < n; i++)
+                    if (a[i * n + i] > a[pivot * n + pivot])
+                        pivot = i;
+                if (pivot != k)
                 {
-                    // A(i,j) = A(i, j) - L(k, j) * U(i, k);
-                    A._grid[w*j + i] -= LU._grid[w*j + k] * LU._grid[w*k + i];
+                    for (int i = 0; i < n; i++)
+                        std::swap(a[k * n + i], a[pivot * n + i]);
+                    for (int i = 0; i < n; i++)
+                        std::swap(a[i * n + k], a[i * n + pivot]);
+                    std::swap(order[k], order[pivot]);
+                    std::swap(b[k], b[pivot]);
                 }
             }
-        }
-    }
 
-    template <typename T>
-    void poly_scaler_2d<T>::lu_solve()
-    {
-        std::vector<double> y(num_coeff);
-
-        for (auto j = 0; j < num_coeff; j++)
-        {
-            double sigma = 0.0;
-            for (auto i = 0; i <= j - 1; i++)
+            auto d = a[k * n + k];
+            if (!(d > tolerance * max_diagonal))
             {
-                sigma += LU._grid[num_coeff * j + i] * y[i];
+                if (!pivoting)
+                    return false;
+                // The remaining columns are dependent on the first k ones
+                rank = k;
+                break;
             }
-            y[j] = b._grid[j] - sigma;
-        }
-
-        for (int j = num_coeff - 1; j >= 0; j--)
-        {
-            double sigma = 0.0;
-            for (auto i = j + 1; i < num_coeff; i++)
+            for (int i = k + 1; i < n; i++)
             {
-                sigma += LU._grid[j * num_coeff + i] * x[i];
+                auto l = a[i * n + k] / d;
+                for (int j = k + 1; j <= i; j++)
+                {
+                    a[i * n + j] -= l * a[j * n + k];
+                    a[j * n + i] = a[i * n + j];
+                }
             }
-            x[j] = (y[j] - sigma) / LU._grid[num_coeff * j + j];
+            for (int i = k + 1; i < n; i++)
+                a[i * n + k] /= d;
         }
+
+        // Solve L D L' z = b over the leading rank x rank block, the rest of z is zero
+        for (int i = 0; i < rank; i++)
+            for (int j = 0; j < i; j++)
+                b[i] -= a[i * n + j] * b[j];
+        for (int i = 0; i < rank; i++)
+            b[i] /= a[i * n + i];
+        for (int i = rank - 1; i >= 0; i--)
+            for (int j = i + 1; j < rank; j++)
+                b[i] -= a[j * n + i] * b[j];
+
+        solution.assign(n, 0.0);
+        for (int i = 0; i < rank; i++)
+            solution[order[i]] = b[i];
+        return true;
     }
 
     template <typename T>
-    void poly_scaler_2d<T>::interp(image<T> &output)
+    void poly_scaler_2d<T>::interp(image<T> &output, unsigned int threads, simd_level_e level)
     {
-        poly_coeffs coeffs;
-
         auto h2 = (output._height - 1) * 0.5;
         auto w2 = (output._width - 1) * 0.5;
-        auto rows = output._height;
-        auto cols = output._width;
+        auto rows = static_cast<int>(output._height);
+        auto cols = static_cast<size_t>(output._width);
 
-        for (decltype(rows) i = 0; i < rows; i++)
-        {
-            // Code working, Aki to optimize the runtime speed
-            coeffs.y = (2 * i - h2) / h2;
-            coeffs.y2 = coeffs.y * coeffs.y;
-            coeffs.y3 = coeffs.y2 * coeffs.y;
+        auto exponents = get_basis_exponents();
+        int degree = 0;
+        for (auto &e : exponents)
+            degree = std::max(degree, std::max(e.first, e.second));
 
-            T *ptr = &output.at(i, 0);
-            int skipx = output._skip_x;
+        std::vector<double> xs(cols);
+        for (size_t j = 0; j < cols; j++)
+            xs[j] = (2 * j - w2) / w2;
 
-            for (decltype(cols) j = 0; j < cols; j++)
-            {
-                coeffs.x = (2 * j - w2) / w2;
-                coeffs.x2 = coeffs.x * coeffs.x;
-                coeffs.x3 = coeffs.x2 * coeffs.x;
+        // Small grids (e.g. the fit itself) are not worth starting threads for
+        const size_t min_pixels_per_thread = 16384;
+        if (rows * cols < min_pixels_per_thread)
+            threads = 1;
+
+        parallel_for_bands(0, rows, 1, [&](int first, int last)
+        {
+            std::vector<double> row_coeffs(degree + 1);
+            std::vector<double> values(cols);
+            std::vector<double> y_powers(degree + 1);
 
-                set_polynomial_value(*ptr, x, coeffs);
-                ptr += skipx;
+            for (int i = first; i < last; i++)
+            {
+                // Coefficient of x^p on this row: sum of x[m] * y^q over the terms x^p * y^q
+                auto y = (2 * i - h2) / h2;
+                y_powers[0] = 1.0;
+                for (int q = 1; q <= degree; q++)
+                    y_powers[q] = y_powers[q - 1] * y;
+                std::fill(row_coeffs.begin(), row_coeffs.end(), 0.0);
+                for (int m = 0; m < num_coeff; m++)
+                    row_coeffs[exponents[m].first] += x[m] * y_powers[exponents[m].second];
+
+                horner_row(xs.data(), values.data(), cols, row_coeffs.data(), degree, level);
+
+                T *ptr = &output.at(i, 0);
+                int skipx = output._skip_x;
+                for (size_t j = 0; j < cols; j++, ptr += skipx)
+                    *ptr = reduce_to<T>(values[j]);
             }
-        }
+        }, threads);
     }
 
     template <typename T>
     void poly_scaler_2d<T>::scale(image<T> &input, image<T> &output)
     {
-        // LU decomposition
+        // Least squares fit of the polynomial model
         poly_fit_2d(input);
 
         // Do resizing
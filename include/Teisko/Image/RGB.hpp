@@ -28,7 +28,9 @@
 
 #pragma once
 #include "Teisko/Image/API.hpp"
+#include "Teisko/Image/Interleave.hpp"
 #include <map>
+#include <vector>
 namespace Teisko
 {
     /// <summary>
@@ -148,12 +150,135 @@ namespace Teisko
             }
         }
 
+        /// <summary>Returns the dimensions of a single channel</summary>
+        roi_point size() const { return _size; }
+
+        /// <summary>Returns the physical layout of the image</summary>
+        rgb_layout_e layout() const { return _layout; }
+
+        /// <summary>Returns a self contained copy of the image in another layout</summary>
+        /// <param name="layout">Layout of the copy; the color order is preserved</param>
+        /// <returns>Converted image</returns>
+        rgb_image_s to_layout(rgb_layout_e layout) const
+        {
+            rgb_image_s result(_size, layout);
+            result._pattern = _pattern;
+            copy_channels(*this, result);
+            return result;
+        }
+
+        /// <summary>Converts the image to another layout in place</summary>
+        /// <remarks>
+        /// The existing buffer is reused when the container sizes of the layouts match.
+        /// Tiled and interleaved images are converted one row at a time; conversions from and to
+        /// paged layout need a temporary copy of the image. When the container size changes,
+        /// a self contained image is reallocated; views to external data throw instead.
+        /// </remarks>
+        /// <param name="layout">New layout</param>
+        /// <returns>Reference to self</returns>
+        rgb_image_s& convert_layout(rgb_layout_e layout)
+        {
+            if (layout == _layout)
+                return *this;
+
+            auto new_size = layout_to_size(layout, _size);
+            bool same_size = _img.is_contiguous() && new_size._x * new_size._y == _img._width * _img._height;
+            if (!same_size)
+            {
+                if (!_img._owned)
+                    throw std::runtime_error("Layout conversion would resize an external image");
+                return *this = to_layout(layout);
+            }
+
+            T *data = _img._begin;
+            if (_layout != rgb_layout_e::paged && layout != rgb_layout_e::paged)
+            {
+                // Each container row holds one pixel row in both layouts
+                std::vector<T> row(_img._width);
+                for (int y = 0; y < _size._y; y++)
+                {
+                    std::copy(&_img(y, 0), &_img(y, 0) + _img._width, row.data());
+                    rgb_image_s src(roi_point(_size._x, 1), row.data(), _layout);
+                    rgb_image_s dst(roi_point(_size._x, 1), &_img(y, 0), layout);
+                    copy_channels(src, dst);
+                }
+            }
+            else
+            {
+                std::vector<T> copy(data, data + new_size._x * new_size._y);
+                rgb_image_s src(_size, copy.data(), _layout);
+                rgb_image_s dst(_size, data, layout);
+                copy_channels(src, dst);
+            }
+
+            auto owned = _img._owned;
+            _img = image<T>(new_size, data);
+            _img._owned = owned;
+            _layout = layout;
+            return *this;
+        }
+
     private:
         roi_point _size{};        ///<! Dimension of a single channel
         rgb_layout_e _layout;     ///<! Physical layout of image
         std::vector<rgb_color_e>  _pattern; ///<! Color codes of individual channels
         image<T> _img;            ///<! Container holding all channels
 
+        /// <summary>Returns pointer to the first item of channel `c` on row `y`</summary>
+        /// <remarks>The items of interleaved layouts are three elements apart</remarks>
+        T* channel_row(int c, int y) const
+        {
+            switch (_layout)
+            {
+            case rgb_layout_e::paged:
+                return &_img(_size._y * c + y, 0);
+            case rgb_layout_e::tiled:
+                return &_img(y, _size._x * c);
+            default:
+                return &_img(y, c);
+            }
+        }
+
+        static bool is_interleaved(rgb_layout_e layout)
+        {
+            return layout == rgb_layout_e::interleaved || layout == rgb_layout_e::interleaved_stride_4;
+        }
+
+        /// <summary>Copies the channels between images of equal size and color order</summary>
+        /// <param name="src">Source image</param>
+        /// <param name="dst">Destination image -- must not overlap the source</param>
+        static void copy_channels(const rgb_image_s &src, rgb_image_s &dst)
+        {
+            auto width = static_cast<size_t>(src._size._x);
+            if (width == 0)
+                return;
+
+            for (int y = 0; y < src._size._y; y++)
+            {
+                T *src_planes[3] = { src.channel_row(0, y), src.channel_row(1, y), src.channel_row(2, y) };
+                T *dst_planes[3] = { dst.channel_row(0, y), dst.channel_row(1, y), dst.channel_row(2, y) };
+                bool src_interleaved = is_interleaved(src._layout);
+                bool dst_interleaved = is_interleaved(dst._layout);
+                if (src_interleaved && dst_interleaved)
+                {
+                    std::copy(src_planes[0], src_planes[0] + 3 * width, dst_planes[0]);
+                }
+                else if (src_interleaved)
+                {
+                    deinterleave(src_planes[0], 3, dst_planes, width);
+                }
+                else if (dst_interleaved)
+                {
+                    interleave(src_planes, 3, dst_planes[0], width);
+                }
+                else
+                {
+                    for (int c = 0; c < 3; c++)
+                        std::copy(src_planes[c], src_planes[c] + width, dst_planes[c]);
+                }
+            }
+        }
+
         /// <summary>Calculates container size for given layout</summary>
         /// <param name="layout">Internal layout of RGB image</param>
         /// <param name="size">Dimensions of (single color) in RGB image</param>
@@ -29,6 +29,9 @@
 #pragma once
 
 #include "Teisko/Image/API.hpp"
+#include "Teisko/Algorithm/Parallel.hpp"
+#include <algorithm>
+#include <cctype>       // std::tolower
 #include <cstdint>      // uint16_t, uint32_t etc
 #include <cstring>      // memcpy
 #include <iterator>
@@ -39,6 +42,18 @@
 #include <map>
 #include <fstream>
 #include <exception>
+#include <limits>
+#include <stdexcept>
+#include <sys/stat.h>   // stat -- file size and modification time for tiff_index
+
+#if (defined(WIN32) || defined(_WIN32))
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>    // FindFirstFile
+#else
+#include <dirent.h>     // opendir
+#endif
 
 namespace Teisko
 {
@@ -51,11 +66,15 @@ namespace Teisko
         tag_bits_per_sample = 0x102,
         tag_compression_method = 0x103,
         /**/    tag_compression_method_uncompressed = 1,
+        /**/    tag_compression_method_lossless_jpeg = 7,   // DNG: lossless JPEG (SOF3)
         tag_photometric_interpretation = 0x106,
         /**/    tag_photometric_interpretation_bayer = 1,
         /**/    tag_photometric_interpretation_rgb = 2,
         /**/    tag_photometric_interpretation_yuv = 6,
+        /**/    tag_photometric_interpretation_cfa = 32803, // TIFF/EP and DNG color filter array
         tag_image_description = 0x10e,              // ASCII - support not ready
+        tag_make = 0x010f,
+        tag_model = 0x0110,
         tag_strip_offsets = 0x0111,
         tag_orientation = 0x0112,
         /**/    tag_orientation_top_left = 1,
@@ -73,8 +92,11 @@ namespace Teisko
         tag_software = 0x131,
         tag_date_and_time = 0x132,
         tag_predictor = 0x013d,
+        tag_tile_width = 0x0142,
+        tag_tile_length = 0x0143,
         tag_tile_offsets = 0x0144,
         tag_tile_byte_counts = 0x0145,
+        tag_sub_ifds = 0x014a,                  // Offsets to child IFDs -- DNG raw data
         tag_sample_format = 0x153,
         /**/    tag_sample_format_unsigned = 1,
         /// Minimal set of extended tags required for YCbCr file
@@ -84,13 +106,30 @@ namespace Teisko
         /**/    tag_ycbcr_positioning_center = 1,
         tag_reference_blackwhite = 0x214,         // 6 rationals
         tag_xmp = 0x02bc,
+        tag_cfa_repeat_pattern_dim = 0x828d,    // Short[2]: rows, columns
+        tag_cfa_pattern = 0x828e,               // Byte[rows * columns]: index to cfa plane color
         tag_iptc_metadata = 0x83bb,             // Undefined or Byte
         tag_photoshop = 0x8649,
+        tag_exif_exposure_time = 0x829a,        // Rational, seconds -- stored in Exif IFD
+        tag_exif_f_number = 0x829d,
         tag_exif_ifd = 0x8769,                  // Offset to Exif IFD: [count][tags * M][next]
         tag_icc_profile = 0x8773,
+        tag_exif_iso_speed = 0x8827,            // Short, a.k.a. PhotographicSensitivity (gain)
+        tag_exif_date_time_original = 0x9003,
         tag_exif_colorspace = 0xa001,
         tag_exif_pixel_x_dimension = 0xa002,
-        tag_exif_pixel_y_dimension = 0xa003
+        tag_exif_pixel_y_dimension = 0xa003,
+        /// DNG specific tags
+        tag_dng_version = 0xc612,               // Byte[4]
+        tag_dng_backward_version = 0xc613,
+        tag_unique_camera_model = 0xc614,       // ASCII, required by DNG
+        tag_cfa_plane_color = 0xc616,           // Byte[planes]: 0 = red, 1 = green, 2 = blue...
+        tag_cfa_layout = 0xc617,
+        /**/    tag_cfa_layout_rectangular = 1,
+        tag_linearization_table = 0xc618,       // Short[N]
+        tag_black_level_repeat_dim = 0xc619,    // Short[2]: rows, columns
+        tag_black_level = 0xc61a,               // Short, Long or Rational[rows * columns]
+        tag_white_level = 0xc61d                // Short or Long
     };
 
     enum tiff_tag_types
@@ -140,7 +179,7 @@ namespace Teisko
     }
 
     /// Extracts 16-bit word to native format
-    static uint16_t get_short(uint8_t *data, bool is_bigendian)
+    static uint16_t get_short(const uint8_t *data, bool is_bigendian)
     {
         return is_bigendian ?
             ((uint16_t)data[0] << 8) | ((uint16_t)data[1] << 0) :
@@ -148,7 +187,7 @@ namespace Teisko
     }
 
     /// Extracts 32-bit word to native format
-    static uint32_t get_int(uint8_t *data, bool is_bigendian)
+    static uint32_t get_int(const uint8_t *data, bool is_bigendian)
     {
         return is_bigendian ?
             ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
@@ -172,6 +211,16 @@ namespace Teisko
         else
             out.put(data & 0xff).put((data >> 8) & 0xff).put((data >> 16) & 0xff).put(data >> 24);
     }
+    /// Returns the length of a seekable stream (or 0) keeping the read position
+    static uint64_t stream_length(std::istream &stream)
+    {
+        stream.clear();
+        auto position = stream.tellg();
+        stream.seekg(0, std::ios::end);
+        auto end = stream.tellg();
+        stream.seekg(position);
+        return end < 0 ? 0 : static_cast<uint64_t>(end);
+    }
 
     /// container class for all tags in Tiff file
     /// Contains ID, type and value
@@ -191,12 +240,12 @@ namespace Teisko
         { }
 
         /// Construct a tag from input stream
-        tiff_tag_base(std::vector<uint8_t> stream, uint32_t offset, bool is_bigendian = false)
+        tiff_tag_base(const std::vector<uint8_t> &stream, uint32_t offset, bool is_bigendian = false)
         {
             if (offset + tiff_tag_size > stream.size())
                 throw std::runtime_error("Offset points outside of tiff data");
 
-            uint8_t *dptr = stream.data();
+            const uint8_t *dptr = stream.data();
 
             _id = get_short(dptr + offset, is_bigendian);
             _type = get_short(dptr + offset + 2, is_bigendian);
@@ -206,8 +255,7 @@ namespace Teisko
             // Validate type and get length of elementary unit
             _swap_length = element_size(_type);
 
-            uint32_t total_size = _swap_length * _count;
-            total_size <<= (_type == RATIONAL || _type == SRATIONAL) ? 1 : 0;
+            uint32_t total_size = value_size(_type, _count);
 
             offset += 8;
             if (total_size > 4)
@@ -216,13 +264,26 @@ namespace Teisko
             if (offset + total_size > stream.size())
                 throw std::runtime_error("Offset to values points outside of tiff data");
 
-            uint32_t swap_mask = is_native(is_bigendian) ? 0 : _swap_length - 1;
-            _additional_data = std::vector<uint8_t>(total_size);
-            uint8_t *dptr_dst = _additional_data.data();
+            assign(dptr + offset, total_size, is_bigendian);
+        }
 
-            // copy the string byte per byte, swapping byte order when necessary
-            for (uint32_t i = 0; i < total_size; i++)
-                dptr_dst[i] = dptr[offset + (i ^ swap_mask)];
+        /// Construct a tag from an already located directory entry
+        /// \param  values       Pointer to value_size(type, count) bytes in file byte order
+        tiff_tag_base(uint16_t id, uint16_t type, uint32_t count, const uint8_t *values, bool is_bigendian)
+            : _id(id)
+            , _type(type)
+            , _count(count)
+            , _offset(0)
+            , _swap_length(element_size(type))
+        {
+            assign(values, value_size(type, count), is_bigendian);
+        }
+
+        /// Returns the number of bytes occupied by `count` items of type `type`
+        static uint32_t value_size(uint16_t type, uint32_t count)
+        {
+            uint32_t total_size = element_size(type) * count;
+            return total_size << ((type == RATIONAL || type == SRATIONAL) ? 1 : 0);
         }
 
         /// Return tag value as string
@@ -234,6 +295,12 @@ namespace Teisko
         /// Return tag ID
         tiff_tags tag() const { return (tiff_tags)_id; }
 
+        /// Return tag type
+        tiff_tag_types type() const { return (tiff_tag_types)_type; }
+
+        /// Return number of items (or pairs of items for rational types)
+        uint32_t count() const { return _count; }
+
         /// Places tag data into tiff section pointed by 'offset'
         /// if the data doesn't fit in the fixed length tag structure
         void fix_offset(uint32_t &offset)
@@ -253,14 +320,21 @@ namespace Teisko
             if (sz <= 4)
                 return;
 
-            uint8_t *dptr = _additional_data.data();
+            write_values(stream, is_bigendian);
+
+            if (sz & 1)
+                stream.put(0);      // Pad to word boundary
+        }
+
+        /// Writes all the values (without padding) in the requested byte order
+        void write_values(std::ostream &stream, bool is_bigendian) const
+        {
+            uint32_t sz = (uint32_t)_additional_data.size();
+            const uint8_t *dptr = _additional_data.data();
             uint32_t swap_mask = is_native(is_bigendian) ? 0 : _swap_length - 1;
 
             for (uint32_t i = 0; i < sz; i++)
                 stream.put(dptr[i ^ swap_mask]);
-
-            if (sz & 1)
-                stream.put(0);      // Pad to word boundary
         }
 
         // Writes ID/TYPE/COUNT and OFFSET to output stream
@@ -293,6 +367,17 @@ namespace Teisko
         // Validates type -- throws on error
         // Returns size of elementary unit
         inline static int element_size(uint16_t type);
+
+        // Copies the values byte per byte, swapping byte order when necessary
+        void assign(const uint8_t *values, uint32_t total_size, bool is_bigendian)
+        {
+            uint32_t swap_mask = is_native(is_bigendian) ? 0 : _swap_length - 1;
+            _additional_data = std::vector<uint8_t>(total_size);
+            uint8_t *dptr_dst = _additional_data.data();
+
+            for (uint32_t i = 0; i < total_size; i++)
+                dptr_dst[i] = values[i ^ swap_mask];
+        }
     };
 
     // We can't achieve real run time polymorphism with this approach
@@ -486,6 +571,34 @@ namespace Teisko
             for (auto &t : tags)
                 add_tag(std::move(t));
         }
+        /// Adds a tag to the exif directory
+        void add_exif_tag(tiff_tag_base &&tag)
+        {
+            _exif[tag.tag()] = tag;
+        }
+
+        /// Returns the content of an exif tag as a string
+        std::string exif_tag_as_string(tiff_tags id)
+        {
+            auto it = _exif.find(id);
+            if (it == _exif.end())
+                return "";
+            return it->second.to_string();
+        }
+
+        /// Replaces the serialized image data with pre-formatted strips or tiles
+        /// The offset and byte count tags are generated when the file is written
+        void set_image_data(std::vector<std::vector<uint8_t>> &&chunks, bool is_tiled)
+        {
+            _strips = std::move(chunks);
+            erase_tag(tag_strip_offsets);
+            erase_tag(tag_strip_byte_counts);
+            erase_tag(tag_tile_offsets);
+            erase_tag(tag_tile_byte_counts);
+            if (is_tiled)
+                add_tag(tiff_tag<LONG>(tag_tile_byte_counts, std::vector<uint32_t>(_strips.size())));
+        }
+
         /// Removes tag from directory
         void erase_tag(tiff_tags id)
         {
@@ -1021,4 +1134,618 @@ namespace Teisko
             put_int(out_stream, 0, is_network_order);
         }
     };
-};
\ No newline at end of file
+
+    /// Metadata-only reader for the primary IFD and the exif IFD of a tiff file
+    /// - the 8-byte header, the directories and the small out-of-line tag values
+    ///   are fetched with a few positioned reads -- the image data is never read
+    /// - directory entries are kept in file byte order and decoded to tiff_tag_base
+    ///   only when queried
+    /// - values larger than `max_value_size` (e.g. strip tables or icc profiles)
+    ///   are deferred until explicitly requested with `read_values`
+    struct tiff_metadata
+    {
+        tiff_metadata() = default;
+
+        /// Scans the metadata from an opened stream
+        explicit tiff_metadata(std::istream &input, uint32_t max_value_size = 256)
+        {
+            read(input, max_value_size);
+        }
+
+        /// Scans the header and the directories -- returns false if the stream is not a tiff
+        bool read(std::istream &input, uint32_t max_value_size = 256)
+        {
+            _ifd.clear();
+            _exif.clear();
+            _is_valid = false;
+
+            uint8_t header[8];
+            if (!read_at(input, 0, 8, header))
+                return false;
+
+            auto byte_order = get_short(header, false);
+            if (byte_order == 0x4d4d && get_short(header + 2, true) == 42)
+                is_network_order = true;
+            else if (byte_order == 0x4949 && get_short(header + 2, false) == 42)
+                is_network_order = false;
+            else
+                return false;
+
+            if (!read_directory(input, get_int(header + 4, is_network_order), _ifd))
+                return false;
+            _is_valid = true;
+
+            // The offset to exif IFD is a single LONG, which is always stored inline
+            auto exif = tag_as_vector(tag_exif_ifd);
+            if (exif.size() == 1)
+                read_directory(input, static_cast<uint32_t>(exif[0]), _exif);
+
+            std::vector<entry_s*> pending;
+            for (auto dir : { &_ifd, &_exif })
+                for (auto &x : *dir)
+                    if (!x.second.is_loaded && x.second.size <= max_value_size)
+                        pending.push_back(&x.second);
+            load_values(input, pending);
+            return true;
+        }
+
+        /// Fetches the deferred values of the listed tags from the same stream
+        void read_values(std::istream &input, const std::vector<tiff_tags> &ids)
+        {
+            std::vector<entry_s*> pending;
+            for (auto id : ids)
+            {
+                auto entry = find(id);
+                if (entry && !entry->is_loaded)
+                    pending.push_back(entry);
+            }
+            load_values(input, pending);
+        }
+
+        /// Scans a child directory (e.g. one of `tag_sub_ifds`) of the same file
+        tiff_metadata sub_directory(std::istream &input, uint32_t offset, uint32_t max_value_size = 256) const
+        {
+            tiff_metadata result;
+            result.is_network_order = is_network_order;
+            result._is_valid = result.read_directory(input, offset, result._ifd);
+            std::vector<entry_s*> pending;
+            for (auto &x : result._ifd)
+                if (!x.second.is_loaded && x.second.size <= max_value_size)
+                    pending.push_back(&x.second);
+            load_values(input, pending);
+            return result;
+        }
+
+        /// Returns true if the stream contained a valid tiff header and the primary IFD
+        bool is_valid() const { return _is_valid; }
+
+        /// Returns true if the file is in Motorola (network) byte order
+        bool is_big_endian() const { return is_network_order; }
+
+        /// Returns a vector of all tags in the primary IFD
+        std::vector<tiff_tags> tags() const { return keys(_ifd); }
+
+        /// Returns a vector of all tags in the exif IFD
+        std::vector<tiff_tags> exif_tags() const { return keys(_exif); }
+
+        /// Returns true if the tag exists in either directory and its value has been read
+        bool has_value(tiff_tags id) const
+        {
+            auto entry = find(id);
+            return entry != nullptr && entry->is_loaded;
+        }
+
+        /// Decodes a tag from the primary or the exif IFD
+        /// Throws if the tag is missing or its value has been deferred
+        tiff_tag_base tag(tiff_tags id) const
+        {
+            auto entry = find(id);
+            if (entry == nullptr || !entry->is_loaded)
+                throw std::runtime_error("Tag value is not available");
+            return tiff_tag_base((uint16_t)id, entry->type, entry->count, entry->raw.data(), is_network_order);
+        }
+
+        /// Returns the content of a tag as a string (or empty string)
+        std::string tag_as_string(tiff_tags id) const
+        {
+            return has_value(id) ? tag(id).to_string() : "";
+        }
+
+        /// Returns tag values as a vector (or an empty vector)
+        template <typename T = int>
+        std::vector<T> tag_as_vector(tiff_tags id) const
+        {
+            return has_value(id) ? tag(id).template value<T>() : std::vector<T>();
+        }
+
+    private:
+        // A directory entry with the values in file byte order
+        struct entry_s
+        {
+            uint16_t type;
+            uint32_t count;
+            uint32_t offset;            // offset to out-of-line values
+            uint32_t size;              // size of the values in bytes
+            bool is_loaded;
+            std::vector<uint8_t> raw;
+        };
+
+        bool is_network_order = false;
+        bool _is_valid = false;
+        std::map<tiff_tags, entry_s> _ifd;
+        std::map<tiff_tags, entry_s> _exif;
+
+        static std::vector<tiff_tags> keys(const std::map<tiff_tags, entry_s> &dir)
+        {
+            std::vector<tiff_tags> result;
+            result.reserve(dir.size());
+            for (auto &x : dir)
+                result.push_back(x.first);
+            return result;
+        }
+
+        const entry_s* find(tiff_tags id) const
+        {
+            auto it = _ifd.find(id);
+            if (it != _ifd.end())
+                return &it->second;
+            it = _exif.find(id);
+            return it != _exif.end() ? &it->second : nullptr;
+        }
+
+        entry_s* find(tiff_tags id)
+        {
+            return const_cast<entry_s*>(static_cast<const tiff_metadata*>(this)->find(id));
+        }
+
+        /// Positioned read of `size` bytes -- returns false on short read
+        static bool read_at(std::istream &input, uint64_t offset, uint64_t size, uint8_t *dst)
+        {
+            input.clear();
+            input.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+            input.read(reinterpret_cast<char*>(dst), static_cast<std::streamsize>(size));
+            return input.gcount() == static_cast<std::streamsize>(size);
+        }
+
+        /// Reads a directory with two reads: the entry count, then the entries
+        bool read_directory(std::istream &input, uint32_t offset, std::map<tiff_tags, entry_s> &dir)
+        {
+            uint8_t count_bytes[2];
+            if (offset == 0 || !read_at(input, offset, 2, count_bytes))
+                return false;
+
+            auto ifd_count = get_short(count_bytes, is_network_order);
+            std::vector<uint8_t> entries(ifd_count * tiff_tag_size);
+            if (!read_at(input, offset + 2, (uint32_t)entries.size(), entries.data()))
+                return false;
+
+            for (uint32_t i = 0; i < ifd_count; i++)
+            {
+                const uint8_t *dptr = entries.data() + i * tiff_tag_size;
+                auto type = get_short(dptr + 2, is_network_order);
+                auto count = get_int(dptr + 4, is_network_order);
+                // Skip unknown types and counts that would overflow a 32-bit file
+                if (type < BYTE || type > DOUBLE || count > 0x1fffffff)
+                    continue;
+
+                auto size = tiff_tag_base::value_size(type, count);
+                entry_s entry = { type, count, 0, size, false, {} };
+                if (size <= 4)
+                {
+                    entry.raw.assign(dptr + 8, dptr + 8 + size);
+                    entry.is_loaded = true;
+                }
+                else
+                {
+                    // the values are allocated only when they are loaded
+                    entry.offset = get_int(dptr + 8, is_network_order);
+                }
+                dir[(tiff_tags)get_short(dptr, is_network_order)] = std::move(entry);
+            }
+            return true;
+        }
+
+        /// Reads the values of the pending entries, coalescing nearby values to single reads
+        /// - values extending past the end of the stream (e.g. of corrupt counts) are not loaded
+        static void load_values(std::istream &input, std::vector<entry_s*> &pending)
+        {
+            const uint64_t max_gap = 512;
+            auto length = stream_length(input);
+            auto value_end = [](const entry_s *entry) { return (uint64_t)entry->offset + entry->size; };
+            pending.erase(std::remove_if(pending.begin(), pending.end(),
+                [&](const entry_s *entry) { return value_end(entry) > length; }), pending.end());
+            std::sort(pending.begin(), pending.end(),
+                [](const entry_s *a, const entry_s *b) { return a->offset < b->offset; });
+
+            std::vector<uint8_t> span;
+            for (size_t first = 0; first < pending.size();)
+            {
+                uint64_t begin = pending[first]->offset;
+                uint64_t end = value_end(pending[first]);
+                size_t last = first + 1;
+                while (last < pending.size() && pending[last]->offset <= end + max_gap)
+                {
+                    end = std::max(end, value_end(pending[last]));
+                    last++;
+                }
+
+                span.resize(static_cast<size_t>(end - begin));
+                if (read_at(input, begin, end - begin, span.data()))
+                {
+                    for (size_t i = first; i < last; i++)
+                    {
+                        auto &entry = *pending[i];
+                        auto src = span.data() + (entry.offset - begin);
+                        entry.raw.assign(src, src + entry.size);
+                        entry.is_loaded = true;
+                    }
+                }
+                first = last;
+            }
+        }
+    };
+
+    /// Compact, persistent index of tiff metadata for large collections of files
+    /// - files are scanned in parallel with `tiff_metadata`
+    /// - the index can be saved and loaded; files with unchanged size and modification
+    ///   time are not re-read when the index is refreshed
+    struct tiff_index
+    {
+        /// Indexed metadata of a single file
+        struct record_s
+        {
+            std::string path;
+            uint64_t file_size;
+            int64_t modified;                       // seconds since epoch
+            std::map<tiff_tags, tiff_tag_base> tags;    // primary and exif tags merged
+
+            /// Returns the content of a tag as a string (or empty string)
+            std::string tag_as_string(tiff_tags id) const
+            {
+                auto it = tags.find(id);
+                if (it == tags.end())
+                    return "";
+                auto tag = it->second;
+                return tag.to_string();
+            }
+
+            /// Returns tag values as a vector (or an empty vector)
+            template <typename T = int>
+            std::vector<T> tag_as_vector(tiff_tags id) const
+            {
+                auto it = tags.find(id);
+                if (it == tags.end())
+                    return std::vector<T>();
+                auto tag = it->second;
+                return tag.template value<T>();
+            }
+        };
+
+        /// The set of tags useful for searching captures
+        static std::vector<tiff_tags> default_tags()
+        {
+            return {
+                tag_image_width, tag_image_height, tag_bits_per_sample,
+                tag_photometric_interpretation, tag_image_description,
+                tag_make, tag_model, tag_date_and_time,
+                tag_exif_exposure_time, tag_exif_f_number, tag_exif_iso_speed,
+                tag_exif_date_time_original
+            };
+        }
+
+        /// Creates an index storing the listed tags -- empty list stores all small tags
+        explicit tiff_index(std::vector<tiff_tags> indexed_tags = default_tags())
+            : _indexed_tags(std::move(indexed_tags))
+        {
+            std::sort(_indexed_tags.begin(), _indexed_tags.end());
+        }
+
+        /// Returns all indexed files sorted by path
+        const std::vector<record_s>& records() const { return _records; }
+
+        /// Returns all records matching a predicate `bool pred(const record_s &)`
+        template <typename predicate>
+        std::vector<const record_s*> find_if(predicate pred) const
+        {
+            std::vector<const record_s*> result;
+            for (auto &r : _records)
+                if (pred(r))
+                    result.push_back(&r);
+            return result;
+        }
+
+        /// \brief  scan        Replaces the index with the metadata of given files
+        /// \param  files       Paths of the files to index; non-tiff files are skipped
+        /// \param  threads     Number of threads (0 == hardware concurrency)
+        /// \returns            Number of files actually read -- unchanged files are reused
+        size_t scan(const std::vector<std::string> &files, unsigned int threads = 0)
+        {
+            std::map<std::string, const record_s*> previous;
+            for (auto &r : _records)
+                previous[r.path] = &r;
+
+            std::vector<record_s> result(files.size());
+            std::vector<char> is_valid(files.size(), 0);
+            std::vector<size_t> pending;
+            for (size_t i = 0; i < files.size(); i++)
+            {
+                auto &r = result[i];
+                r.path = files[i];
+                if (!file_status(r.path, r.file_size, r.modified))
+                    continue;
+                auto it = previous.find(r.path);
+                if (it != previous.end() &&
+                    it->second->file_size == r.file_size && it->second->modified == r.modified)
+                {
+                    r.tags = it->second->tags;
+                    is_valid[i] = 1;
+                }
+                else
+                {
+                    pending.push_back(i);
+                }
+            }
+
+            parallel_for(size_t(0), pending.size(), [&](size_t k)
+            {
+                auto idx = pending[k];
+                is_valid[idx] = read_record(result[idx]) ? 1 : 0;
+            }, threads);
+
+            _records.clear();
+            for (size_t i = 0; i < files.size(); i++)
+                if (is_valid[i])
+                    _records.push_back(std::move(result[i]));
+            std::sort(_records.begin(), _records.end(),
+                [](const record_s &a, const record_s &b) { return a.path < b.path; });
+            return pending.size();
+        }
+
+        /// Replaces the index with all *.tif, *.tiff and *.dng files under `root`
+        size_t scan_directory(const std::string &root, bool recursive = true, unsigned int threads = 0)
+        {
+            auto files = list_files(root, recursive);
+            files.erase(std::remove_if(files.begin(), files.end(), [](const std::string &name)
+            {
+                auto dot = name.find_last_of('.');
+                if (dot == std::string::npos)
+                    return true;
+                auto ext = name.substr(dot + 1);
+                std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return (char)std::tolower(c); });
+                return ext != "tif" && ext != "tiff" && ext != "dng";
+            }), files.end());
+            return scan(files, threads);
+        }
+
+        /// Serializes the index as little endian binary stream
+        void save(std::ostream &out) const
+        {
+            out.write(index_magic(), 4);
+            put_int(out, index_version, false);
+            put_int(out, (uint32_t)_indexed_tags.size(), false);
+            for (auto id : _indexed_tags)
+                put_short(out, (uint16_t)id, false);
+            put_int(out, (uint32_t)_records.size(), false);
+            for (auto &r : _records)
+            {
+                put_int(out, (uint32_t)r.path.size(), false);
+                out.write(r.path.data(), r.path.size());
+                put_int(out, (uint32_t)r.file_size, false);
+                put_int(out, (uint32_t)(r.file_size >> 32), false);
+                put_int(out, (uint32_t)r.modified, false);
+                put_int(out, (uint32_t)((uint64_t)r.modified >> 32), false);
+                put_short(out, (uint16_t)r.tags.size(), false);
+                for (auto &t : r.tags)
+                {
+                    put_short(out, (uint16_t)t.first, false);
+                    put_short(out, (uint16_t)t.second.type(), false);
+                    put_int(out, t.second.count(), false);
+                    t.second.write_values(out, false);
+                }
+            }
+        }
+
+        /// Deserializes an index written by `save` -- throws on format mismatch
+        /// Records indexed with a different tag set are kept, but re-read on next scan
+        void load(std::istream &in)
+        {
+            char magic[4] = { 0 };
+            in.read(magic, 4);
+            if (!std::equal(magic, magic + 4, index_magic()) || read_int(in) != index_version)
+                throw std::runtime_error("Not a tiff index stream");
+
+            // Each count is checked against the rest of the stream before allocating anything
+            auto length = stream_length(in);
+            auto check_remaining = [&in, length](uint64_t size)
+            {
+                auto position = in.tellg();
+                auto remaining = position < 0 ? 0 : length - std::min(length, static_cast<uint64_t>(position));
+                if (!in || size > remaining)
+                    throw std::runtime_error("Truncated tiff index stream");
+            };
+            auto read_count = [&in, &check_remaining](uint64_t item_size)
+            {
+                uint64_t count = read_int(in);
+                check_remaining(count * item_size);
+                return static_cast<size_t>(count);
+            };
+
+            std::vector<tiff_tags> stored_tags(read_count(2));
+            for (auto &id : stored_tags)
+                id = (tiff_tags)read_short(in);
+            bool is_reusable = stored_tags == _indexed_tags;
+
+            // path length, file size, modification time and tag count
+            const uint64_t min_record_size = 4 + 8 + 8 + 2;
+            std::vector<record_s> records(read_count(min_record_size));
+            std::vector<uint8_t> values;
+            for (auto &r : records)
+            {
+                r.path.resize(read_count(1));
+                in.read(&r.path[0], r.path.size());
+                r.file_size = read_int(in);
+                r.file_size |= (uint64_t)read_int(in) << 32;
+                uint64_t modified = read_int(in);
+                modified |= (uint64_t)read_int(in) << 32;
+                r.modified = is_reusable ? (int64_t)modified : std::numeric_limits<int64_t>::min();
+                auto tag_count = read_short(in);
+                for (uint16_t i = 0; i < tag_count; i++)
+                {
+                    auto id = read_short(in);
+                    auto type = read_short(in);
+                    auto count = read_int(in);
+                    if (type < BYTE || type > DOUBLE || count > 0x1fffffff)
+                        throw std::runtime_error("Corrupted tiff index");
+                    auto size = tiff_tag_base::value_size(type, count);
+                    check_remaining(size);
+                    values.resize(size);
+                    in.read(reinterpret_cast<char*>(values.data()), values.size());
+                    r.tags[(tiff_tags)id] = tiff_tag_base(id, type, count, values.data(), false);
+                }
+                if (!in)
+                    throw std::runtime_error("Truncated tiff index stream");
+            }
+            _records = std::move(records);
+        }
+
+        /// Lists regular files under `root` in sorted order
+        /// Symbolic links to directories are not followed
+        static std::vector<std::string> list_files(const std::string &root, bool recursive = true)
+        {
+            std::vector<std::string> result;
+            std::vector<std::string> folders(1, root);
+            while (!folders.empty())
+            {
+                auto folder = folders.back();
+                folders.pop_back();
+                list_folder(folder, result, recursive ? &folders : nullptr);
+            }
+            std::sort(result.begin(), result.end());
+            return result;
+        }
+
+    private:
+        std::vector<tiff_tags> _indexed_tags;
+        std::vector<record_s> _records;
+
+        static const char* index_magic() { return "TKIX"; }
+        static const uint32_t index_version = 1;
+
+        /// Reads the indexed tags from a single file -- returns false for non-tiff files
+        bool read_record(record_s &record) const
+        {
+            try
+            {
+                std::ifstream file(record.path, std::ios::binary);
+                tiff_metadata metadata;
+                // With explicit tag list, only the values of the listed tags are read
+                if (!metadata.read(file, _indexed_tags.empty() ? 256 : 0))
+                    return false;
+                auto ids = _indexed_tags;
+                if (ids.empty())
+                {
+                    ids = metadata.tags();
+                    auto exif = metadata.exif_tags();
+                    ids.insert(ids.end(), exif.begin(), exif.end());
+                }
+                else
+                {
+                    metadata.read_values(file, ids);
+                }
+                for (auto id : ids)
+                    if (metadata.has_value(id))
+                        record.tags[id] = metadata.tag(id);
+                return true;
+            }
+            catch (std::exception &)
+            {
+                return false;
+            }
+        }
+
+        static bool file_status(const std::string &path, uint64_t &size, int64_t &modified)
+        {
+#if (defined(WIN32) || defined(_WIN32))
+            struct _stat64 st;
+            if (_stat64(path.c_str(), &st) != 0)
+                return false;
+#else
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0)
+                return false;
+#endif
+            size = (uint64_t)st.st_size;
+            modified = (int64_t)st.st_mtime;
+            return true;
+        }
+
+        static void list_folder(const std::string &folder, std::vector<std::string> &files,
+            std::vector<std::string> *subfolders)
+        {
+#if (defined(WIN32) || defined(_WIN32))
+            WIN32_FIND_DATAA data;
+            auto handle = FindFirstFileA((folder + "\\*").c_str(), &data);
+            if (handle == INVALID_HANDLE_VALUE)
+                return;
+            do
+            {
+                std::string name = data.cFileName;
+                if (name == "." || name == "..")
+                    continue;
+                if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                {
+                    // Junctions and directory links may point back to an ancestor
+                    if (subfolders && !(data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT))
+                        subfolders->push_back(folder + "\\" + name);
+                }
+                else
+                {
+                    files.push_back(folder + "\\" + name);
+                }
+            } while (FindNextFileA(handle, &data));
+            FindClose(handle);
+#else
+            auto dir = opendir(folder.c_str());
+            if (dir == nullptr)
+                return;
+            while (auto entry = readdir(dir))
+            {
+                std::string name = entry->d_name;
+                if (name == "." || name == "..")
+                    continue;
+                auto path = folder + "/" + name;
+                // Symbolic links are followed to files only; a link to an ancestor would loop
+                struct stat st;
+                if (lstat(path.c_str(), &st) != 0)
+                    continue;
+                if (S_ISLNK(st.st_mode) && (stat(path.c_str(), &st) != 0 || S_ISDIR(st.st_mode)))
+                    continue;
+                if (S_ISDIR(st.st_mode))
+                {
+                    if (subfolders)
+                        subfolders->push_back(path);
+                }
+                else if (S_ISREG(st.st_mode))
+                {
+                    files.push_back(path);
+                }
+            }
+            closedir(dir);
+#endif
+        }
+
+        static uint32_t read_int(std::istream &in)
+        {
+            uint8_t data[4] = { 0 };
+            in.read(reinterpret_cast<char*>(data), 4);
+            return get_int(data, false);
+        }
+
+        static uint16_t read_short(std::istream &in)
+        {
+            uint8_t data[2] = { 0 };
+            in.read(reinterpret_cast<char*>(data), 2);
+            return get_short(data, false);
+        }
+    };
+};
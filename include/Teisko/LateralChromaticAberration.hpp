@@ -31,6 +31,7 @@
 #include "Teisko/Algorithm/DelaunayTriangulation.hpp"
 #include "Teisko/Algorithm/LinearSpace.hpp"
 #include "Teisko/Image/API.hpp"       // bayer_image_s
+#include "Teisko/Image/GradientThreshold.hpp"
 #include "Teisko/LensShading.hpp"     // use lensshading_grid as container
 #include <cstdint>
 #include <vector>
@@ -170,47 +171,6 @@ namespace Teisko
             return ratio > 0.5;             // empirical constant 0.5 for regular enough shape
         }
 
-        // Quantifies image by threshold after edge detection
-        // - horizontal + vertical filtering with 9 tap kernel
-        void gradient_threshold(image<uint16_t> &img, double threshold = 0.4)
-        {
-            // from matlab where W = normalized magnitude between 0..1 from hypot(img conv h, img conv h')
-            // W = W.^(1./rolloffFactor);   %% rolloffFactor = 3
-            // W = (1 - W). / (1 + W);
-            // W(W < weightCutoff) = floorOfW;
-            // result = W < threshold
-            // we don't calculate sqrt of horizontal and vertical gradients, so we have to scale by
-            // exponent of six...
-            double y = std::pow(std::abs(threshold - 1) / (threshold + 1), 6);
-
-            auto temp_dst = image<int>(img.size());
-            auto temp_src = img.make_borders(4, 4, 4, 4, REPLICATE);
-            auto center = temp_src.region(temp_dst.size(), roi_point(4));
-            int stride = temp_src._skip_y;
-            int max_level = 0;
-            temp_dst.foreach([stride, &max_level](int &dst, uint16_t &src)
-            {
-                uint16_t *s = &src;
-                int v =
-                    (s[stride * 4] - s[-stride * 4]) * 1228 +
-                    (s[stride * 3] - s[-stride * 3]) * 2210 +
-                    (s[stride * 2] - s[-stride * 2]) * 2752 +
-                    (s[stride * 1] - s[-stride * 1]) * 2002;        // sum = 8192
-                int h =
-                    (s[4] - s[-4]) * 1228 +
-                    (s[3] - s[-3]) * 2210 +
-                    (s[2] - s[-2]) * 2752 +
-                    (s[1] - s[-1]) * 2002;
-                v /= 16384;   // max sum of 'v' is +-65535 * 8192
-                h /= 16384;   // -- we have to divide by 2 in order of not to overflow 'dst'
-                dst = v*v + h*h;
-                if (dst > max_level)
-                    max_level = dst;
-            }, center);
-            max_level = std::lround(y * max_level);
-            img.foreach([max_level](uint16_t &dst, int &src) { dst = src >= max_level; }, temp_dst);
-        }
-
         std::vector<region_props> get_valid_features(image<uint16_t> &channel)
         {
             std::vector<double> gaussian_7x7 = { 0.0702, 0.1311, 0.1907, 0.2161, 0.1907, 0.1311, 0.0702 };
@@ -218,7 +178,7 @@ namespace Teisko
             auto resampled = channel.convert_to();      // take a copy
             filter_separable(resampled, gaussian_7x7, REPLICATE);
 
-            gradient_threshold(resampled, 0.4);
+            resampled = gradient_threshold(resampled, 0.4, true);
 
             auto count = bwlabel(resampled);
             int labels = 0;
@@ -171,8 +171,9 @@ namespace Teisko
 
         // Calculates the shading grid and chromaticity for a preprocessed image
         // - image should have black level and rgb-ir contamination removed
-        template <typename T>
-        lensshading_grid<double> calculate_grid(bayer_image_s<T> &image)
+        // - accepts bayer_image_s<T> or planar_bayer_image<T>
+        template <typename T, template <typename> class bayer_type>
+        lensshading_grid<double> calculate_grid(bayer_type<T> &image)
         {
             const double grid_mean_threshold = 0.5;    // Rejects 25% + 25% of outliers
             model_setup(get_channel_dim(image), image._layout);
@@ -30,19 +30,30 @@
 #include "Teisko/Image/API.hpp"
 #include "Teisko/Image/RGB.hpp"
 #include "Teisko/Image/Algorithms.hpp"
+#include "Teisko/Image/GradientThreshold.hpp"
+#include "Teisko/Image/Morphology.hpp"
 #include "Teisko/Preprocessing.hpp"
 #include "Teisko/Algorithm/VectorMedian.hpp"
 #include "Teisko/Algorithm/TrimmedMean.hpp"
 #include "Teisko/Algorithm/NelderMead.hpp"
+#include "Teisko/Algorithm/Parallel.hpp"
+#include "Teisko/Algorithm/PointGrid.hpp"
 
 #include <cstdint>
 #include <vector>
 #include <map>
 #include <array>
-#include <list>
 #include <string>
 #include <algorithm>
 #include <numeric>
+#include <iterator>
+#include <atomic>
+
+#if (defined(WIN32) || defined(_WIN32))
+#include "intrin.h"
+#else
+#include "x86intrin.h"
+#endif
 
 namespace Teisko
 {
@@ -64,7 +75,7 @@ namespace Teisko
             return *this;
         }
         // returns true std (or unscaled variance if normalization or sqrt is not needed)
-        double operator() (bool scaled = true)
+        double operator() (bool scaled = true) const
         {
             if (scaled)
                 return n <= 1 ? 0 : std::sqrt((sum2 - (sum*sum) / (double)n) / (double)(n - 1));
@@ -72,6 +83,401 @@ namespace Teisko
         }
     };
 
+    // Diagonal length differences of barrel corrected quads, two quads at a time
+    //  - `dx`, `dy` and `r2` point to four arrays (one per corner) of offsets from `center`
+    //    and of their squared lengths
+    //  - returns the number of quads processed
+    inline size_t barrel_differences_sse4(const double *const *dx, const double *const *dy, const double *const *r2,
+        size_t quads, point_xy center, double alpha_per_r2, double *diffs)
+    {
+        auto alpha = _mm_set1_pd(alpha_per_r2);
+        auto one = _mm_set1_pd(1.0);
+        auto cx = _mm_set1_pd(center.x);
+        auto cy = _mm_set1_pd(center.y);
+        size_t i = 0;
+        for (; i + 2 <= quads; i += 2)
+        {
+            __m128d x[4], y[4];
+            for (int c = 0; c < 4; c++)
+            {
+                auto scale = _mm_add_pd(one, _mm_mul_pd(alpha, _mm_loadu_pd(r2[c] + i)));
+                x[c] = _mm_add_pd(cx, _mm_div_pd(_mm_loadu_pd(dx[c] + i), scale));
+                y[c] = _mm_add_pd(cy, _mm_div_pd(_mm_loadu_pd(dy[c] + i), scale));
+            }
+            auto x02 = _mm_sub_pd(x[0], x[2]);
+            auto y02 = _mm_sub_pd(y[0], y[2]);
+            auto x13 = _mm_sub_pd(x[1], x[3]);
+            auto y13 = _mm_sub_pd(y[1], y[3]);
+            auto d02 = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(x02, x02), _mm_mul_pd(y02, y02)));
+            auto d13 = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(x13, x13), _mm_mul_pd(y13, y13)));
+            _mm_storeu_pd(diffs + i, _mm_sub_pd(d02, d13));
+        }
+        return i;
+    }
+
+    // Diagonal length differences of barrel corrected quads, four quads at a time
+    TEISKO_TARGET_AVX2
+    inline size_t barrel_differences_avx2(const double *const *dx, const double *const *dy, const double *const *r2,
+        size_t quads, point_xy center, double alpha_per_r2, double *diffs)
+    {
+        auto alpha = _mm256_set1_pd(alpha_per_r2);
+        auto one = _mm256_set1_pd(1.0);
+        auto cx = _mm256_set1_pd(center.x);
+        auto cy = _mm256_set1_pd(center.y);
+        size_t i = 0;
+        for (; i + 4 <= quads; i += 4)
+        {
+            __m256d x[4], y[4];
+            for (int c = 0; c < 4; c++)
+            {
+                // separate multiply and add: a fused operation would round differently from the scalar code
+                auto scale = _mm256_add_pd(one, _mm256_mul_pd(alpha, _mm256_loadu_pd(r2[c] + i)));
+                x[c] = _mm256_add_pd(cx, _mm256_div_pd(_mm256_loadu_pd(dx[c] + i), scale));
+                y[c] = _mm256_add_pd(cy, _mm256_div_pd(_mm256_loadu_pd(dy[c] + i), scale));
+            }
+            auto x02 = _mm256_sub_pd(x[0], x[2]);
+            auto y02 = _mm256_sub_pd(y[0], y[2]);
+            auto x13 = _mm256_sub_pd(x[1], x[3]);
+            auto y13 = _mm256_sub_pd(y[1], y[3]);
+            auto d02 = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(x02, x02), _mm256_mul_pd(y02, y02)));
+            auto d13 = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(x13, x13), _mm256_mul_pd(y13, y13)));
+            _mm256_storeu_pd(diffs + i, _mm256_sub_pd(d02, d13));
+        }
+        return i;
+    }
+
+    // Squareness estimate of a set of quads as a function of barrel correction
+    //  - the corners are stored in structure of arrays layout as offsets from the correction
+    //    center together with their squared radii, so that one evaluation is a single pass
+    //    without copying or allocating
+    //  - each evaluation matches barrel correcting the corners and computing the standard
+    //    deviation of the diagonal length differences, bit by bit
+    struct barrel_squareness_s
+    {
+        // `corners` holds four corners per quad; `center` is the center of the distortion
+        // `level` is the highest instruction set tier used for the evaluation
+        barrel_squareness_s(const std::vector<point_xy> &corners, point_xy center,
+            simd_level_e level = detected_simd_level())
+            : _center(center)
+            , _quads(corners.size() % 4 ? 0 : corners.size() / 4)
+            , _level(supported_simd_level(level))
+            , _soa(static_cast<size_t>(fields) * 4 * _quads + _quads)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                auto x = column(raw_x, c), y = column(raw_y, c);
+                auto dx = column(delta_x, c), dy = column(delta_y, c), r2 = column(radius2, c);
+                for (size_t i = 0; i < _quads; i++)
+                {
+                    auto &p = corners[i * 4 + c];
+                    auto d = p - center;
+                    x[i] = p.x;
+                    y[i] = p.y;
+                    dx[i] = d.x;
+                    dy[i] = d.y;
+                    r2[i] = norm2(d);
+                }
+            }
+        }
+
+        // Returns the standard deviation of the diagonal differences after correcting
+        // each corner `p` to center + (p - center) / (1 + alpha_per_r2 * |p - center|^2)
+        double operator()(double alpha_per_r2)
+        {
+            if (_quads == 0)
+                return 0.0;
+
+            auto diffs = column(fields, 0);
+            if (alpha_per_r2 != 0.0)
+                corrected_differences(alpha_per_r2, diffs);
+            else
+            {
+                const double *x[4] = { column(raw_x, 0), column(raw_x, 1), column(raw_x, 2), column(raw_x, 3) };
+                const double *y[4] = { column(raw_y, 0), column(raw_y, 1), column(raw_y, 2), column(raw_y, 3) };
+                for (size_t i = 0; i < _quads; i++)
+                {
+                    diffs[i] =
+                        norm(point_xy(x[0][i], y[0][i]) - point_xy(x[2][i], y[2][i])) -
+                        norm(point_xy(x[1][i], y[1][i]) - point_xy(x[3][i], y[3][i]));
+                }
+            }
+
+            variance_s squareness;
+            for (size_t i = 0; i < _quads; i++)
+                squareness += diffs[i];
+            return squareness();
+        }
+
+        // Returns alpha in [-3.2 : 0.1 : 3.2] minimizing the squareness for alpha_per_r2 = alpha / |center|^2
+        //  - every local minimum of a coarse scan (each 4th step) is refined by golden section
+        //    search over the steps around it, followed by descent to the nearest local minimum
+        //  - equals the first minimum of an exhaustive scan unless the cost has several minima
+        //    closer than the coarse step to each other
+        double best_alpha()
+        {
+            const int max_step = 32;
+            const int coarse_step = 4;
+            const double step = 0.1;
+            auto r2 = norm2(_center);
+            std::array<double, 2 * max_step + 1> cost;
+            cost.fill(-1.0);
+            auto evaluate = [&](int k)
+            {
+                auto &c = cost[k + max_step];
+                if (c < 0)
+                    c = (*this)((k * step) / r2);
+                return c;
+            };
+
+            int best = max_step + 1;
+            for (int k = -max_step; k <= max_step; k += coarse_step)
+            {
+                auto is_local_minimum =
+                    (k == -max_step || evaluate(k) <= evaluate(k - coarse_step)) &&
+                    (k == max_step || evaluate(k) < evaluate(k + coarse_step));
+                if (!is_local_minimum)
+                    continue;
+
+                // golden section over the integer steps, keeping the lower one on ties
+                const double inv_phi = 0.6180339887498949;
+                int lo = std::max(-max_step, k - coarse_step);
+                int hi = std::min(max_step, k + coarse_step);
+                while (hi - lo > 2)
+                {
+                    int offset = static_cast<int>(std::lround((hi - lo) * inv_phi));
+                    int a = hi - offset;
+                    int b = std::max(lo + offset, a + 1);
+                    if (evaluate(a) <= evaluate(b))
+                        hi = b;
+                    else
+                        lo = a;
+                }
+                int local = lo;
+                for (int j = lo + 1; j <= hi; j++)
+                {
+                    if (evaluate(j) < evaluate(local))
+                        local = j;
+                }
+                while (local > -max_step && evaluate(local - 1) <= evaluate(local))
+                    --local;
+                while (local < max_step && evaluate(local + 1) < evaluate(local))
+                    ++local;
+
+                if (best > max_step || evaluate(local) < evaluate(best) ||
+                    (evaluate(local) == evaluate(best) && local < best))
+                    best = local;
+            }
+            // no minimum among non-finite costs
+            return best > max_step ? 0.0 : best * step;
+        }
+
+        // Number of quads
+        size_t size() const { return _quads; }
+
+    private:
+        point_xy _center;
+        size_t _quads;
+        simd_level_e _level;
+        // One buffer of columns: for each field the four corners of all quads,
+        // followed by the diagonal differences of each quad
+        enum field_e { raw_x, raw_y, delta_x, delta_y, radius2, fields };
+        std::vector<double> _soa;
+
+        double *column(int field, int corner) { return _soa.data() + (field * 4 + corner) * _quads; }
+
+        void corrected_differences(double alpha_per_r2, double *diffs)
+        {
+            const double *dx[4] = { column(delta_x, 0), column(delta_x, 1), column(delta_x, 2), column(delta_x, 3) };
+            const double *dy[4] = { column(delta_y, 0), column(delta_y, 1), column(delta_y, 2), column(delta_y, 3) };
+            const double *r2[4] = { column(radius2, 0), column(radius2, 1), column(radius2, 2), column(radius2, 3) };
+            size_t i = 0;
+            if (_level >= simd_level_e::avx2)
+                i = barrel_differences_avx2(dx, dy, r2, _quads, _center, alpha_per_r2, diffs);
+            else if (_level >= simd_level_e::sse4)
+                i = barrel_differences_sse4(dx, dy, r2, _quads, _center, alpha_per_r2, diffs);
+            for (; i < _quads; i++)
+            {
+                point_xy p[4];
+                for (int c = 0; c < 4; c++)
+                    p[c] = _center + point_xy(dx[c][i], dy[c][i]) / (1 + alpha_per_r2 * r2[c][i]);
+                diffs[i] = norm(p[0] - p[2]) - norm(p[1] - p[3]);
+            }
+        }
+    };
+
+    // Number of harmonics of the centroid distance signature compared to the model of a square
+    const int square_harmonics = 16;
+
+    // Accumulates the harmonics of the centroid distance signature `d` of `size` points
+    //  - `trigs` holds the interleaved cosines and sines of 2 * pi * i / size
+    //  - harmonic k is the sum of d[n] * trigs[(k * n) mod size] accumulated in the order of `n`,
+    //    a pair of (cos, sin) terms at a time, which matches the scalar loop bit by bit
+    inline void signature_harmonics_sse4(const double *d, size_t size, const double *trigs,
+        double (&harmonics)[square_harmonics][2])
+    {
+        __m128d sum[square_harmonics];
+        size_t idx[square_harmonics];
+        for (int k = 0; k < square_harmonics; k++)
+        {
+            sum[k] = _mm_setzero_pd();
+            idx[k] = 0;
+        }
+        for (size_t n = 0; n < size; n++)
+        {
+            auto distance = _mm_set1_pd(d[n]);
+            for (int k = 0; k < square_harmonics; k++)
+            {
+                sum[k] = _mm_add_pd(sum[k], _mm_mul_pd(distance, _mm_loadu_pd(trigs + 2 * idx[k])));
+                idx[k] += k;
+                idx[k] -= idx[k] >= size ? size : 0;
+            }
+        }
+        for (int k = 0; k < square_harmonics; k++)
+            _mm_storeu_pd(harmonics[k], sum[k]);
+    }
+
+    // Accumulates the harmonics of the centroid distance signature, two harmonics at a time
+    TEISKO_TARGET_AVX2
+    inline void signature_harmonics_avx2(const double *d, size_t size, const double *trigs,
+        double (&harmonics)[square_harmonics][2])
+    {
+        const int pairs = square_harmonics / 2;
+        __m256d sum[pairs];
+        size_t idx[square_harmonics];
+        for (int k = 0; k < pairs; k++)
+            sum[k] = _mm256_setzero_pd();
+        for (int k = 0; k < square_harmonics; k++)
+            idx[k] = 0;
+        for (size_t n = 0; n < size; n++)
+        {
+            auto distance = _mm256_set1_pd(d[n]);
+            for (int k = 0; k < pairs; k++)
+            {
+                auto lo = _mm_loadu_pd(trigs + 2 * idx[2 * k]);
+                auto hi = _mm_loadu_pd(trigs + 2 * idx[2 * k + 1]);
+                auto terms = _mm256_insertf128_pd(_mm256_castpd128_pd256(lo), hi, 1);
+                sum[k] = _mm256_add_pd(sum[k], _mm256_mul_pd(distance, terms));
+            }
+            for (int k = 0; k < square_harmonics; k++)
+            {
+                idx[k] += k;
+                idx[k] -= idx[k] >= size ? size : 0;
+            }
+        }
+        for (int k = 0; k < pairs; k++)
+        {
+            _mm_storeu_pd(harmonics[2 * k], _mm256_castpd256_pd128(sum[k]));
+            _mm_storeu_pd(harmonics[2 * k + 1], _mm256_extractf128_pd(sum[k], 1));
+        }
+    }
+
+    // Scores the squareness of closed paths by matching the spectrum of their centroid distance
+    // signature to a precalculated model of a square, returning the root mean square error
+    //  - the distances are computed once per path and all harmonics accumulated in a single pass
+    //  - the trigonometric table depends only on the path length and is kept for the next path:
+    //    scoring paths in the order of their length builds each table once
+    struct square_spectrum_s
+    {
+        square_spectrum_s(simd_level_e level = detected_simd_level())
+            : _level(supported_simd_level(level))
+        {
+        }
+
+        // Returns the rms error of the spectrum of `path` around `centroid` or -1 for short paths
+        double operator()(const std::vector<point_xy> &path, point_xy centroid)
+        {
+            auto sz = path.size();
+            if (sz < 32)
+                return -1.0;
+
+            if (_size != sz)
+            {
+                // make a lookup table for the sines and cosines
+                _size = sz;
+                _trigs.resize(2 * sz);
+                double angle = 6.283185307179586 / sz;
+                for (size_t i = 0; i < sz; i++)
+                {
+                    _trigs[2 * i] = std::cos(angle * i);
+                    _trigs[2 * i + 1] = std::sin(angle * i);
+                }
+            }
+
+            _distances.resize(sz);
+            for (size_t i = 0; i < sz; i++)
+                _distances[i] = norm(path[i] - centroid);
+
+            double harmonics[square_harmonics][2];
+            if (_level >= simd_level_e::avx2)
+                signature_harmonics_avx2(_distances.data(), sz, _trigs.data(), harmonics);
+            else if (_level >= simd_level_e::sse4)
+                signature_harmonics_sse4(_distances.data(), sz, _trigs.data(), harmonics);
+            else
+            {
+                for (int k = 0; k < square_harmonics; k++)
+                {
+                    harmonics[k][0] = harmonics[k][1] = 0.0;
+                    size_t idx = 0;
+                    for (size_t n = 0; n < sz; n++)
+                    {
+                        harmonics[k][0] += _distances[n] * _trigs[2 * idx];
+                        harmonics[k][1] += _distances[n] * _trigs[2 * idx + 1];
+                        idx += k;
+                        if (idx >= sz)
+                            idx -= sz;
+                    }
+                }
+            }
+
+            const double sqFFT[square_harmonics - 1] = {  // first term is 1.0 after normalization
+                0.0010871038, 0.0012745257, 0.0019206153, 0.0760958988, 0.0007661686,
+                0.0000199350, 0.0005197369, 0.0158663285, 0.0003992480, 0.0000085283,
+                0.0003177932, 0.0070672313, 0.0002918863, 0.0000040173, 0.0002226015
+            };
+
+            double rms = 0.0;
+            double scale = 1.0 / norm(point_xy(harmonics[0][0], harmonics[0][1]));
+            for (int i = 0; i < square_harmonics - 1; i++)
+            {
+                auto diff = sqFFT[i] - norm(point_xy(harmonics[i + 1][0], harmonics[i + 1][1])) * scale;
+                rms += diff * diff;
+            }
+            return std::sqrt(rms * (2.0 / (2 * square_harmonics - 1)));  // 31 items contribute to the "mean"
+        }
+
+    private:
+        simd_level_e _level;
+        size_t _size = 0;               // path length of the trigonometric table
+        std::vector<double> _trigs;     // interleaved cos, sin of 2 * pi * i / _size
+        std::vector<double> _distances; // centroid distance signature
+    };
+
+    /// Edge functions of the triangle a, b, c along a row of pixels starting at `p`
+    /// - the pixel p + (k, 0) is inside the triangle, if `inside()` after k calls to `next()`
+    /// - the weights are accumulated incrementally, so the pixels on the edges are
+    ///   settled identically by every rasterizer scanning the rows from the same `p`
+    struct triangle_edges_s
+    {
+        double d_a, d_b, d_c;       // delta between each x-increment
+        double w_a, w_b, w_c;       // barycentric weight at the current pixel
+
+        triangle_edges_s(point_xy a, point_xy b, point_xy c, point_xy p)
+            : d_a(b.y - c.y), d_b(c.y - a.y), d_c(a.y - b.y)
+            , w_a(d_a * (p.x - b.x) + (c.x - b.x) * (p.y - b.y))
+            , w_b(d_b * (p.x - c.x) + (a.x - c.x) * (p.y - c.y))
+            , w_c(d_c * (p.x - a.x) + (b.x - a.x) * (p.y - a.y))
+        { }
+
+        bool inside() const { return w_a >= 0 && w_b >= 0 && w_c >= 0; }
+
+        void next()
+        {
+            w_a += d_a;
+            w_b += d_b;
+            w_c += d_c;
+        }
+    };
+
     /// Fills the inside of triangle given in points a,b and c with function `void func(T &pixel);`
     /// To the rectangular canvas located between `offset` ... `offset + canvas.size()`
     template <typename T, typename fill_function>
@@ -80,30 +486,18 @@ namespace Teisko
         // the canvas is logically contained between `offset` to `offset + canvas.size()`
         for (decltype(canvas._height) y = 0; y < canvas._height; y++)
         {
-            auto p = point_xy(offset._x, y + offset._y);
-            // delta between each x-increment
-            auto d_a = b.y - c.y;
-            auto d_b = c.y - a.y;
-            auto d_c = a.y - b.y;
-            // barycentric weight at each line
-            auto w_a = d_a * (p.x - b.x) + (c.x - b.x) * (p.y - b.y);
-            auto w_b = d_b * (p.x - c.x) + (a.x - c.x) * (p.y - c.y);
-            auto w_c = d_c * (p.x - a.x) + (b.x - a.x) * (p.y - a.y);
-            for (decltype(canvas._width) x = 0; x < canvas._width; x++, w_a += d_a, w_b += d_b, w_c += d_c)
-            {
-                if (w_a >= 0 && w_b >= 0 && w_c >= 0)
+            auto edges = triangle_edges_s(a, b, c, point_xy(offset._x, y + offset._y));
+            for (decltype(canvas._width) x = 0; x < canvas._width; x++, edges.next())
+            {
+                if (edges.inside())
                     func(canvas(y, x));
             }
         }
     }
 
-    // Special case of polygon fill -- handles quads (by splitting them to two triangles)
-    // - calculates the signed distance of all points in ROI to all polygon edges
-    // - for convex quads/polygons, a point is inside if the signed distance >= 0 for all edges
-    // - for non-convex quad, the point is inside, if the point is inside either of the triangles
-    //   - the triangle must be split along the vertex forming non-right turning angle
-    template <typename T>
-    inline void quad_fill(image<T> &canvas, std::vector<point_xy> &quad, roi_point offset = { 0, 0 })
+    /// Selects the triangulation of a quad for `quad_fill` -- the quad is split to the triangles
+    /// quad[0], quad[1], quad[2 + i] and quad[0 + i], quad[2], quad[3], where i is the result
+    inline int quad_triangulation(const point_xy *quad)
     {
         // test for an angle between poins a-b-p being a monotonically right turning
         // - a quad (or any other polygon) can be fan-triangulated from the unique concave vertex
@@ -114,16 +508,38 @@ namespace Teisko
             return d.x * p.y > d.y * p.x;
         };
 
-        auto sz = quad.size();
-        if (sz != 4)
-            throw std::runtime_error("This function only handles quads");
-
         // Two possible triangulations -- split along the concave (or 180 degree) angle
         // if that doesn't exists, either triangulation is OK
         // The other triangulation happens between points 0,1,2/0,2,3
         // The other with points 0,1,3/1,2,3
-        auto i = (!turns_right(quad[3], quad[0], quad[1]) || !turns_right(quad[1], quad[2], quad[3]))
+        return (!turns_right(quad[3], quad[0], quad[1]) || !turns_right(quad[1], quad[2], quad[3]))
             ? 0 : 1;
+    }
+
+    /// Returns the bounding box of a quad rounded outwards to integral `top_left`, `bot_right`
+    inline void quad_bounds(const point_xy *quad, roi_point &top_left, roi_point &bot_right)
+    {
+        auto min_x = std::floor(std::min({ quad[0].x, quad[1].x, quad[2].x, quad[3].x }));
+        auto max_x = std::ceil(std::max({ quad[0].x, quad[1].x, quad[2].x, quad[3].x }));
+        auto min_y = std::floor(std::min({ quad[0].y, quad[1].y, quad[2].y, quad[3].y }));
+        auto max_y = std::ceil(std::max({ quad[0].y, quad[1].y, quad[2].y, quad[3].y }));
+        top_left = roi_point(min_x, min_y);
+        bot_right = roi_point(max_x, max_y);
+    }
+
+    // Special case of polygon fill -- handles quads (by splitting them to two triangles)
+    // - calculates the signed distance of all points in ROI to all polygon edges
+    // - for convex quads/polygons, a point is inside if the signed distance >= 0 for all edges
+    // - for non-convex quad, the point is inside, if the point is inside either of the triangles
+    //   - the triangle must be split along the vertex forming non-right turning angle
+    template <typename T>
+    inline void quad_fill(image<T> &canvas, std::vector<point_xy> &quad, roi_point offset = { 0, 0 })
+    {
+        auto sz = quad.size();
+        if (sz != 4)
+            throw std::runtime_error("This function only handles quads");
+
+        auto i = quad_triangulation(quad.data());
         triangle_fill(canvas, offset, quad[0], quad[1], quad[2 + i], [](T &x){ x = 1; });
         triangle_fill(canvas, offset, quad[0 + i], quad[2], quad[3], [](T &x){ x = 1; });
     };
@@ -163,13 +579,10 @@ namespace Teisko
         if (quad.size() != 4)
             throw std::runtime_error("Expecting a quad as polygon");
 
-        auto min_x = std::floor(std::min({ quad[0].x, quad[1].x, quad[2].x, quad[3].x }));
-        auto max_x = std::ceil(std::max({ quad[0].x, quad[1].x, quad[2].x, quad[3].x }));
-        auto min_y = std::floor(std::min({ quad[0].y, quad[1].y, quad[2].y, quad[3].y }));
-        auto max_y = std::ceil(std::max({ quad[0].y, quad[1].y, quad[2].y, quad[3].y }));
-
-        auto top_left = clamp_to(lower_multiple(roi_point(min_x, min_y), sensor_dimensions), size);
-        auto bot_right = clamp_to(upper_multiple(roi_point(max_x, max_y), sensor_dimensions), size);
+        roi_point top_left, bot_right;
+        quad_bounds(quad.data(), top_left, bot_right);
+        top_left = clamp_to(lower_multiple(top_left, sensor_dimensions), size);
+        bot_right = clamp_to(upper_multiple(bot_right, sensor_dimensions), size);
 
         auto output = image<T>(bot_right - top_left).fill(0);
         quad_fill(output, quad, top_left);
@@ -218,6 +631,203 @@ namespace Teisko
         return data.size() == 0 ? 0.0 : trimmed_mean(data, save_proportion);
     }
 
+    /// Statistics of the pixels covered by one patch
+    struct patch_statistics_s
+    {
+        size_t count = 0;           // number of pixels
+        double mean = 0.0;
+        double deviation = 0.0;     // sample standard deviation
+        double trimmed_mean = 0.0;  // mean of the middle `save_proportion` of the sorted pixels
+        double minimum = 0.0;
+        double maximum = 0.0;
+    };
+
+    /// Scanline rasterization of a set of quads to horizontal pixel spans
+    /// - covers the same pixels as `get_patch_stencil`: the pixels inside either of the two
+    ///   triangles of `quad_fill` evaluated by `triangle_edges_s` over the same bounding box
+    /// - the spans of all quads are kept in row order, so that the statistics of every patch
+    ///   are gathered in a single pass over a channel without stencil images
+    struct patch_spans_s
+    {
+        struct span_s
+        {
+            int y;
+            int x0;         // first pixel
+            int x1;         // one past the last pixel
+            int index;      // index of the polygon
+        };
+
+        std::vector<span_s> spans;      // ordered by row, then by polygon
+        std::vector<size_t> counts;     // number of pixels in each polygon
+
+        /// Rasterizes `polygons` (each a quad) scaled by `scale` within an image of `size`
+        patch_spans_s(roi_point size, const std::vector<std::vector<point_xy>> &polygons,
+            point_xy scale = point_xy(1.0, 1.0))
+            : counts(polygons.size(), 0)
+        {
+            for (size_t i = 0; i < polygons.size(); i++)
+            {
+                if (polygons[i].size() != 4)
+                    throw std::runtime_error("Expecting a quad as polygon");
+                auto &polygon = polygons[i];
+                point_xy quad[4] = { polygon[0] * scale, polygon[1] * scale, polygon[2] * scale, polygon[3] * scale };
+                add_quad(size, quad, static_cast<int>(i));
+            }
+            // Stable counting sort of the spans by row
+            std::vector<size_t> row_start(static_cast<size_t>(std::max(0, size._y)) + 1, 0);
+            for (auto &span : spans)
+                row_start[span.y + 1]++;
+            for (size_t y = 1; y < row_start.size(); y++)
+                row_start[y] += row_start[y - 1];
+            std::vector<span_s> sorted(spans.size());
+            for (auto &span : spans)
+                sorted[row_start[span.y]++] = span;
+            spans.swap(sorted);
+        }
+
+        /// Returns the statistics of each polygon over `channel`
+        /// - `channel` must be (at least) of the size given at construction
+        template <typename T>
+        std::vector<patch_statistics_s> statistics(const image<T> &channel, double save_proportion = 0.5) const
+        {
+            // All pixels are gathered to one buffer, where each patch has a contiguous range
+            std::vector<size_t> first(counts.size() + 1, 0);
+            for (size_t i = 0; i < counts.size(); i++)
+                first[i + 1] = first[i] + counts[i];
+            std::vector<T> values(first.back());
+            auto next = first;
+
+            std::vector<variance_s> moments(counts.size());
+            std::vector<patch_statistics_s> result(counts.size());
+            for (auto &span : spans)
+            {
+                auto &m = moments[span.index];
+                auto &r = result[span.index];
+                auto dst = values.data() + next[span.index];
+                for (int x = span.x0; x < span.x1; x++)
+                {
+                    auto value = channel(span.y, x);
+                    *dst++ = value;
+                    m += static_cast<double>(value);
+                    if (r.count++ == 0)
+                        r.minimum = r.maximum = static_cast<double>(value);
+                    r.minimum = std::min(r.minimum, static_cast<double>(value));
+                    r.maximum = std::max(r.maximum, static_cast<double>(value));
+                }
+                next[span.index] += span.x1 - span.x0;
+            }
+
+            for (size_t i = 0; i < counts.size(); i++)
+            {
+                auto &r = result[i];
+                if (r.count == 0)
+                    continue;
+                r.mean = moments[i].sum / static_cast<double>(r.count);
+                r.deviation = moments[i]();
+                r.trimmed_mean = trimmed_mean(values.begin() + first[i], values.begin() + first[i + 1], save_proportion);
+            }
+            return result;
+        }
+
+        /// Returns the running mean and variance of each polygon over `channel`
+        /// - a lighter pass than `statistics`, which does not gather the pixel values
+        /// - the spans can be translated by `offset`, clipping them to the channel
+        /// - `row_step` > 1 samples only every row_step'th row
+        template <typename T>
+        std::vector<variance_s> moments(const image<T> &channel, roi_point offset = roi_point(0, 0),
+            int row_step = 1) const
+        {
+            // integral pixels are summed exactly, which also vectorizes
+            typedef typename std::conditional<std::is_integral<T>::value, uint64_t, double>::type sum_type;
+            auto size = channel.size();
+            std::vector<variance_s> result(counts.size());
+            for (auto &span : spans)
+            {
+                auto y = span.y + offset._y;
+                auto x0 = std::max(0, span.x0 + offset._x);
+                auto x1 = std::min(size._x, span.x1 + offset._x);
+                if (span.y % row_step || y < 0 || y >= size._y || x0 >= x1)
+                    continue;
+                sum_type sum = 0;
+                sum_type sum2 = 0;
+                auto row = &channel(y, x0);
+                auto skip = channel._skip_x;
+                auto width = x1 - x0;
+                if (skip == 1)
+                {
+                    for (int x = 0; x < width; x++)
+                    {
+                        auto value = static_cast<sum_type>(row[x]);
+                        sum += value;
+                        sum2 += value * value;
+                    }
+                }
+                else
+                {
+                    for (int x = 0; x < width; x++)
+                    {
+                        auto value = static_cast<sum_type>(row[x * skip]);
+                        sum += value;
+                        sum2 += value * value;
+                    }
+                }
+                auto &m = result[span.index];
+                m.sum += static_cast<double>(sum);
+                m.sum2 += static_cast<double>(sum2);
+                m.n += static_cast<size_t>(width);
+            }
+            return result;
+        }
+
+    private:
+        void add_span(int y, int x0, int x1, int index)
+        {
+            if (x0 >= x1)
+                return;
+            spans.push_back({ y, x0, x1, index });
+            counts[index] += static_cast<size_t>(x1 - x0);
+        }
+
+        void add_quad(roi_point size, const point_xy *quad, int index)
+        {
+            roi_point top_left, bot_right;
+            quad_bounds(quad, top_left, bot_right);
+            top_left = clamp_to(top_left, size);
+            bot_right = clamp_to(bot_right, size);
+            auto i = quad_triangulation(quad);
+
+            // The rows of `quad_fill` on a canvas located at `top_left`
+            for (int y = top_left._y; y < bot_right._y; y++)
+            {
+                auto p = point_xy(top_left._x, y);
+                auto first = triangle_edges_s(quad[0], quad[1], quad[2 + i], p);
+                auto second = triangle_edges_s(quad[0 + i], quad[2], quad[3], p);
+                auto x0 = top_left._x;
+                for (int x = top_left._x; x < bot_right._x; x++, first.next(), second.next())
+                {
+                    if (!first.inside() && !second.inside())
+                    {
+                        add_span(y, x0, x, index);
+                        x0 = x + 1;
+                    }
+                }
+                add_span(y, x0, bot_right._x, index);
+            }
+        }
+    };
+
+    /// Returns the statistics of each patch in `polygons` over `channel`
+    ///  - the polygons can have an optional scaling factor
+    template <typename T>
+    std::vector<patch_statistics_s> get_patch_statistics(
+        const image<T> &channel,
+        const std::vector<std::vector<point_xy>> &polygons,
+        point_xy scale = point_xy(1.0, 1.0),
+        double save_proportion = 0.5)
+    {
+        return patch_spans_s(channel.size(), polygons, scale).statistics(channel, save_proportion);
+    }
+
     /// Get data from a channel based on a vector of polygons
     ///  - the polygons can have an optional scaling factor
     template <typename U = double, typename image_type>
@@ -227,21 +837,47 @@ namespace Teisko
         point_xy scale = point_xy(1.0, 1.0))
     {
         auto result = std::vector<U>();
-        std::transform(polygons.begin(), polygons.end(), std::back_inserter(result),
-            [&scale, &channel](std::vector<point_xy> quad)
-        {
-            for (auto &point : quad)
-                point = point * scale;
-            auto offset = roi_point(0, 0);
-            auto stencil = get_patch_stencil(channel.size(), quad, offset);
-            return reduce_to<U>(get_patch_trimmed_mean(channel.region(stencil.size(), offset), stencil));
-        });
+        for (auto &patch : get_patch_statistics(channel, polygons, scale))
+            result.push_back(reduce_to<U>(patch.trimmed_mean));
         return result;
     }
 
+    /// Layout of a chart of `columns` x `rows` square patches on a regular grid
+    ///  - the patches are numbered in row major order
+    ///  - `ramp` lists patches from the darkest to the brightest; a located chart is accepted,
+    ///    when their intensities are strictly increasing (in either direction of the chart).
+    ///    Charts without a ramp are accepted, when the patches are uniform compared to the
+    ///    differences between them -- this leaves the order of the patches ambiguous
+    ///    up to a rotation of 180 degrees (or 90 degrees for square charts)
+    struct chart_geometry_s
+    {
+        int columns;
+        int rows;
+        std::vector<int> ramp;
+
+        /// Default ctor -- the 6x4 Macbeth chart validated by the neutral patches 18..23
+        chart_geometry_s() : chart_geometry_s(6, 4, { 23, 22, 21, 20, 19, 18 }) { }
+
+        /// Any other chart, e.g. chart_geometry_s(14, 10) for ColorChecker SG or chart_geometry_s(10, 10)
+        chart_geometry_s(int columns, int rows, std::vector<int> ramp = {})
+            : columns(columns), rows(rows), ramp(ramp)
+        {
+            if (columns < 2 || rows < 2)
+                throw std::runtime_error("Chart should have at least 2x2 patches");
+            for (auto patch : ramp)
+                if (patch < 0 || patch >= patches())
+                    throw std::runtime_error("Chart ramp refers to a patch outside the chart");
+            if (ramp.size() == 1)
+                throw std::runtime_error("Chart ramp should have at least 2 patches");
+        }
+
+        /// Number of patches in the chart
+        int patches() const { return columns * rows; }
+    };
 
     /// macbeth_chart is a class holding and finding polygonal patches
     /// from images and extracting patch values from images based on the polygons
+    /// - the chart is the 6x4 Macbeth chart by default, or any chart described by a `chart_geometry_s`
     class macbeth_chart
     {
     public:
@@ -249,56 +885,168 @@ namespace Teisko
 
         /// Default ctor -- set patch fill ratio controlling the size of generated polygons
         ///  - 0.0 = point, 1.0 = patches share corners, 0.65 = default
-        macbeth_chart(double patch_fill_ratio = 0.65) : fill_ratio(patch_fill_ratio)
+        ///  - threads = maximum number of threads evaluating the candidates (0 == hardware concurrency)
+        macbeth_chart(double patch_fill_ratio = 0.65, unsigned int threads = 0)
+            : macbeth_chart(chart_geometry_s(), patch_fill_ratio, threads)
+        {
+        }
+
+        /// Ctor for a chart of given geometry
+        macbeth_chart(chart_geometry_s layout, double patch_fill_ratio = 0.65, unsigned int threads = 0)
+            : geometry(layout), fill_ratio(patch_fill_ratio), threads(threads)
         {
             if (patch_fill_ratio < 0.0 || patch_fill_ratio > 1.0)
                 throw std::runtime_error("Macbeth chart fill ratio should be between 0 and 1");
-       }
+        }
 
-        /// Returns true, if the chart contains 24 polygons
+        /// Returns true, if the chart contains a polygon for each patch (24 for Macbeth chart)
         bool is_valid() {
-            const int chart_size = 4 * 6;
-            return polygons.size() == chart_size;
+            return polygons.size() == static_cast<size_t>(geometry.patches());
         }
 
+        /// Returns the layout of the chart
+        const chart_geometry_s &chart_geometry() const { return geometry; }
+
         /// Locates a Macbeth chart from a bayer_image
+        /// - large 2x2 RGB sensor images are reduced to the detection resolution directly
+        ///   by averaging the luminance of CFA quads; others are demosaiced first
         macbeth_chart& find(bayer_image_s<uint16_t> &img)
         {
-            auto green = demosaic_bilinear(img, color_info_e::green, MIRROR_EVEN);
-            auto red = demosaic_bilinear(img, color_info_e::red, MIRROR_EVEN);
-            auto blue = demosaic_bilinear(img, color_info_e::blue, MIRROR_EVEN);
-            return find(green, red, blue);
+            int prescaling_factor = 1;
+            auto gray_scale = detection_image(img, prescaling_factor);
+            tracked = false;
+            detect_macbeth_chart(gray_scale, prescaling_factor);
+            return *this;
         }
 
         /// Locates a Macbeth chart from an RGB image
         template <typename T>
         macbeth_chart& find(rgb_image_s<T> &img)
         {
-            auto green = img[rgb_color_e::green].template convert_to<uint16_t>();
-            auto red = img[rgb_color_e::red].template convert_to<uint16_t>();
-            auto blue = img[rgb_color_e::blue].template convert_to<uint16_t>();
-            return find(green, red, blue);
+            auto gray_scale = detection_image(img);
+            tracked = false;
+            detect_macbeth_chart(gray_scale);
+            return *this;
         }
 
         /// Locates a Macbeth chart from a single gray scale (or R,G,B) channel
         template <typename T>
         macbeth_chart& find(image<T> &img)
         {
+            tracked = false;
             detect_macbeth_chart(img.template convert_to<uint16_t>());
             return *this;
         }
 
+        /// Tracks the chart located from a previous frame (held in `polygons`) to a new frame
+        /// - the previous polygons are verified against the new frame after a local search
+        ///   for their best translation; the chart is detected from scratch with `find`
+        ///   only when there is no previous chart, or when the verification fails
+        /// - unlike `find`, a failed detection does not keep the previous chart
+        macbeth_chart& track(bayer_image_s<uint16_t> &img)
+        {
+            int prescaling_factor = 1;
+            auto gray_scale = detection_image(img, prescaling_factor);
+            track_or_detect(gray_scale, prescaling_factor);
+            return *this;
+        }
+
+        /// Tracks the chart located from a previous frame to a new RGB frame
+        template <typename T>
+        macbeth_chart& track(rgb_image_s<T> &img)
+        {
+            track_or_detect(detection_image(img), 1);
+            return *this;
+        }
+
+        /// Tracks the chart located from a previous frame to a new gray scale (or R,G,B) frame
+        template <typename T>
+        macbeth_chart& track(image<T> &img)
+        {
+            track_or_detect(img.template convert_to<uint16_t>(), 1);
+            return *this;
+        }
+
+        /// Returns true, if the last call to `track` verified the previous chart
+        /// without detecting it from scratch
+        bool is_tracked() const { return tracked; }
+
+        /// Locates several charts (of same or different geometries) from a bayer image
+        /// - the image is thresholded and labeled once for all charts; the features are then
+        ///   fitted to each chart in the order of `charts`, excluding the features of the charts
+        ///   located earlier, so that also several charts of the same geometry are found
+        /// - the thread count of the first chart applies to the shared detection
+        static void find_all(std::vector<macbeth_chart> &charts, bayer_image_s<uint16_t> &img)
+        {
+            if (charts.empty())
+                return;
+            int prescaling_factor = 1;
+            auto gray_scale = charts[0].detection_image(img, prescaling_factor);
+            detect_charts(charts, gray_scale, prescaling_factor);
+        }
+
+        /// Locates several charts from an RGB image
+        template <typename T>
+        static void find_all(std::vector<macbeth_chart> &charts, rgb_image_s<T> &img)
+        {
+            if (charts.empty())
+                return;
+            detect_charts(charts, charts[0].detection_image(img), 1);
+        }
+
+        /// Locates several charts from a single gray scale (or R,G,B) channel
+        template <typename T>
+        static void find_all(std::vector<macbeth_chart> &charts, image<T> &img)
+        {
+            detect_charts(charts, img.template convert_to<uint16_t>(), 1);
+        }
+
     private:
+        chart_geometry_s geometry;
         double fill_ratio;
+        unsigned int threads;
+        bool tracked = false;
+
+        // Returns a gray scale image for detection and the ratio of the image size to it
+        // - large 2x2 RGB sensor images are reduced by averaging the luminance of CFA quads,
+        //   when the scale to the 1MP range is even; other scales can't be reached by
+        //   whole quads, and those images are demosaiced and resized as RGB images
+        image<uint16_t> detection_image(bayer_image_s<uint16_t> &img, int &prescaling_factor)
+        {
+            auto scale = get_1MP_range_scale(img._img.size());
+            if (scale >= 2 && scale % 2 == 0 && img._layout.is_2x2_sensor())
+            {
+                auto quads = scale / 2;
+                prescaling_factor = scale;
+                return bayer_luminance_subsample(img, quads, threads);
+            }
+
+            prescaling_factor = 1;
+            auto rgb = demosaic_bilinear_rgb(img, MIRROR_EVEN, rgb_layout_e::paged, threads);
+            auto green = rgb[rgb_color_e::green];
+            auto red = rgb[rgb_color_e::red];
+            auto blue = rgb[rgb_color_e::blue];
+            return average_channels(green, red, blue);
+        }
+
+        template <typename T>
+        image<uint16_t> detection_image(rgb_image_s<T> &img)
+        {
+            auto green = img[rgb_color_e::green].template convert_to<uint16_t>();
+            auto red = img[rgb_color_e::red].template convert_to<uint16_t>();
+            auto blue = img[rgb_color_e::blue].template convert_to<uint16_t>();
+            return average_channels(green, red, blue);
+        }
+
         /// Sums up R,G,B channels to locate the macbeth chart
         /// With this prototype being private we save the burden of checking that channel dimensions match
-        macbeth_chart& find(image<uint16_t> &green, image<uint16_t> &red, image<uint16_t> &blue)
+        static image<uint16_t> average_channels(image<uint16_t> &green, image<uint16_t> &red, image<uint16_t> &blue)
         {
             green.foreach([](uint16_t &g, uint16_t &r, uint16_t &b)
             {
                 g = static_cast<uint16_t>((g + r + b) / 3);
             }, red, blue);
-            return find(green);
+            return green;
         }
 
         // Properties of located features
@@ -349,75 +1097,31 @@ namespace Teisko
                 corners.push_back(parallels[1]);
             }
 
-            double calculate_squareness()
+            // Matches the centroid distance curve of the feature perimeter to precalculated
+            // model of a square in FFT domain, returning the root mean square error (or -1 for short paths)
+            double calculate_squareness(square_spectrum_s &spectrum)
             {
-                // Matches the centroid distance curve of the feature perimeter to precalculated
-                // model of a square in FFT domain, returning the root mean square error
-                fft_rms = -1.0;
-                auto sz = path.size();
-                if (sz < 32)
-                    return fft_rms;
-
-                // make a lookup table for the sines and cosines
-                double angle = 6.283185307179586 / sz;
-                std::vector<point_xy> trigs(sz);
-                for (size_t i = 0; i < sz; i++)
-                    trigs[i] = { std::cos(angle * i), std::sin(angle * i) };
-
-                const int fft_points = 16;
-                const double sqFFT[fft_points - 1] = {  // first term is 1.0 after normalization
-                    0.0010871038, 0.0012745257, 0.0019206153, 0.0760958988, 0.0007661686,
-                    0.0000199350, 0.0005197369, 0.0158663285, 0.0003992480, 0.0000085283,
-                    0.0003177932, 0.0070672313, 0.0002918863, 0.0000040173, 0.0002226015
-                };
-
-                std::vector<double> fft_magnitude;  // evaluate FFT at 1 + 15 points
-                for (size_t i = 0; i < fft_points; i++)
-                {
-                    size_t idx = 0;
-                    point_xy fft_item;
-                    for (auto &p : path)
-                    {
-                        auto term = norm(p - centroid) * trigs[idx];
-                        fft_item += term;
-                        idx += i;
-                        if (idx >= sz)
-                            idx -= sz;
-                    }
-                    fft_magnitude.emplace_back(norm(fft_item));
-                }
-
-                double rms = 0.0;
-                double scale = 1.0 / fft_magnitude[0];
-                for (int i = 0; i < fft_points - 1; i++)
-                {
-                    auto diff = sqFFT[i] - fft_magnitude[i + 1] * scale;
-                    rms += diff * diff;
-                }
-                fft_rms = std::sqrt(rms * (2.0 / (2 * fft_points - 1)));  // 31 items contribute to the "mean"
-
+                fft_rms = spectrum(path, centroid);
                 return fft_rms;
             }
 
-            // Matches a feature to all other features in a container
+            // Finds the distance to the closest other feature indexed by their centroids
             // (dismissing those that have identical coordinates)
-            double find_minimum_distance(std::list<feature_s> &contours)
+            double find_minimum_distance(const point_grid_s &centroids)
             {
-                minimum_distance = -1.0;
-                for (auto &feature : contours)
-                {
-                    auto dist2 = norm2(centroid - feature.centroid);
-                    if (dist2 == 0.0)
-                        continue;       // comparing to self results in zero distance
-                    if (minimum_distance < 0 || dist2 < minimum_distance)
-                        minimum_distance = dist2;
-                }
+                minimum_distance = centroids.nearest_distance2(centroid);
                 if (minimum_distance >= 0)
                     minimum_distance = std::sqrt(minimum_distance);
 
                 return minimum_distance;
             }
 
+            // Squared centroid distance beyond which no other feature is connected to this one
+            double connection_radius2() const
+            {
+                return 3 * std::min(norm2(corners[0] - corners[2]), norm2(corners[1] - corners[3]));
+            }
+
             // Return true if two features are close enough and have about same size (+50%)
             bool is_connected(const feature_s &other) const
             {
@@ -427,9 +1131,9 @@ namespace Teisko
                    std::swap(min_area, max_area);
                 if (min_area * 1.5 < max_area)
                     return false;
-                auto max_dist = std::min(norm2(corners[0] - corners[2]), norm2(corners[1] - corners[3]));
-                if (norm2(centroid - other.centroid) > 3 * max_dist)
+                if (norm2(centroid - other.centroid) > connection_radius2())
                     return false;
+                auto max_dist = std::min(norm2(corners[0] - corners[2]), norm2(corners[1] - corners[3]));
                 for (auto c0: corners)
                     for (auto c1 : other.corners)
                     {
@@ -489,60 +1193,15 @@ namespace Teisko
             }
         };
 
-        // Quantifies image by threshold after edge detection
-        // - horizontal + vertical filtering with 9 tap kernel
-        image<uint16_t> gradient_threshold(image<uint16_t> &img, double threshold = 0.3)
-        {
-            // from matlab where W = normalized magnitude between 0..1 from hypot(img conv h, img conv h')
-            // W = W.^(1./rolloffFactor);   %% rolloffFactor = 3
-            // W = (1 - W). / (1 + W);
-            // W(W < weightCutoff) = floorOfW;
-            // result = W < threshold
-            // we don't calculate sqrt of horizontal and vertical gradients, so we have to scale by
-            // exponent of six...
-            double y = std::pow(std::abs(threshold - 1) / (threshold + 1), 6);
-
-            auto temp_dst = image<int>(img.size());
-            auto temp_src = img.make_borders(4, 4, 4, 4, REPLICATE);
-            auto center = temp_src.region(temp_dst.size(), roi_point(4));
-            int stride = temp_src._skip_y;
-            int max_level = 0;
-            temp_dst.foreach([stride, &max_level](int &dst, uint16_t &src)
-            {
-                uint16_t *s = &src;
-                int v =
-                    (s[stride * 4] - s[-stride * 4]) * 1228 +
-                    (s[stride * 3] - s[-stride * 3]) * 2210 +
-                    (s[stride * 2] - s[-stride * 2]) * 2752 +
-                    (s[stride * 1] - s[-stride * 1]) * 2002;        // sum = 8192
-                int h =
-                    (s[4] - s[-4]) * 1228 +
-                    (s[3] - s[-3]) * 2210 +
-                    (s[2] - s[-2]) * 2752 +
-                    (s[1] - s[-1]) * 2002;
-                v /= 16384;   // max sum of 'v' is +-65535 * 8192
-                h /= 16384;   // -- we have to divide by 2 in order of not to overflow 'dst'
-                dst = v*v + h*h;
-                if (dst > max_level)
-                    max_level = dst;
-            }, center);
-            max_level = std::lround(y * max_level);
-            return temp_dst.transform<uint16_t>([max_level](int &src) -> uint16_t { return src < max_level; });
-        }
-
+        // widens the white areas of a bw image by the 3x3 maximum
         image<uint16_t> image_open(image<uint16_t> &img)
         {
-            return img.filter<3, 3>([](support<3, 3, uint16_t> &data) { return data.maximum(); });
-        }
-
-        image<uint16_t> image_close(image<uint16_t> &img)
-        {
-            return img.filter<3, 3>([](support<3, 3, uint16_t> &data) { return data.minimum(); });
+            return dilate(img, 3, 3);
         }
 
         bool is_full_row_missing(std::vector<int> &indices, size_t start_index)
         {
-            for (size_t i = 0; i < 6; i++)
+            for (size_t i = 0; i < static_cast<size_t>(geometry.columns); i++)
                 if (start_index + i >= indices.size() || indices[start_index + i] >= 0)
                     return false;
             return true;
@@ -556,21 +1215,61 @@ namespace Teisko
                 indices[i] = tmp[(i + start_index) % tmp_size];
         }
 
+        // Checks that every row and column of the grid holds a located feature
+        // - charts without a ramp have nothing else tying the grid to the features,
+        //   as the extrapolated patches off the chart may well be uniform
+        bool is_grid_spanned(std::vector<int> &indices)
+        {
+            std::vector<bool> columns(geometry.columns, false);
+            std::vector<bool> rows(geometry.rows, false);
+            for (size_t i = 0; i < indices.size(); i++)
+            {
+                if (indices[i] >= 0)
+                {
+                    columns[i % geometry.columns] = true;
+                    rows[i / geometry.columns] = true;
+                }
+            }
+            return std::find(columns.begin(), columns.end(), false) == columns.end() &&
+                std::find(rows.begin(), rows.end(), false) == rows.end();
+        }
+
         bool is_increasing_sequence(std::vector<double> &data)
         {
-            if (data.size() != 24)
+            if (data.size() != static_cast<size_t>(geometry.patches()))
                 return false;
-            for (int i = 0; i < 5; i++)
-                if (data[22-i] <= data[23-i])
+            auto &ramp = geometry.ramp;
+            for (size_t i = 1; i < ramp.size(); i++)
+                if (data[ramp[i]] <= data[ramp[i - 1]])
                     return false;
             return true;
         }
 
+        // Checks that the patches are uniform compared to the variation between the patches
+        static bool are_patches_uniform(const std::vector<variance_s> &patches)
+        {
+            variance_s between;
+            double within = 0.0;
+            for (auto &patch : patches)
+            {
+                if (patch.n < 2)
+                    return false;
+                between += patch.sum / patch.n;
+                within += patch();
+            }
+            within /= patches.size();
+            return within < 0.5 * between();
+        }
+
         // Checks that the detection in "polygon" / "point"
         // has been able to locate an increasing sequence of intensities
-        // from patches 23,22,21,20,19 and 18
+        // from the ramp patches (23,22,21,20,19 and 18 of Macbeth chart)
+        // - or uniform patches for charts without a ramp
         bool validate_grid(image<uint16_t> &item, double scale)
         {
+            if (geometry.ramp.empty())
+                return are_patches_uniform(patch_spans_s(item.size(), polygons, point_xy(scale, scale)).moments(item));
+
             auto result = get_patch_trimmed_mean(item, polygons, point_xy(scale, scale));
             if (is_increasing_sequence(result))
                 return true;
@@ -606,162 +1305,409 @@ namespace Teisko
             img = img.template filter<3, 3>([](support<3, 3, T> &support) { return support.median(); }, REPLICATE);
         }
 
+        // Thresholded and labeled features of an image shared by the detection of all charts
+        // - candidates are the features of a few thresholding attempts in the order of decreasing count
+        struct detection_s
+        {
+            int scale;                                          // ratio of original image size to `filtered`
+            image<uint16_t> filtered;                           // the image for validating the charts
+            std::vector<std::vector<feature_s>> candidates;     // the features of each attempt
+        };
+
         // actual implementation --
         // receives one channel (or a gray scale channel)
-        // - prescaling_factor = 2 for bayer_image_s and 1 for RGB images
-        void detect_macbeth_chart(image<uint16_t> gray_scale)
+        // - prescaling_factor is the ratio of the original image size to the size of `gray_scale`
+        void detect_macbeth_chart(image<uint16_t> gray_scale, int prescaling_factor = 1)
         {
-            // The image is first rescaled to ~1000 x 750 range
-            auto scale = resize_image_to_1MP_range(gray_scale);
-            std::list<std::list<feature_s>> contours_candidates;  // make a few attempts at locating contours
+            auto detection = detect_features(gray_scale, prescaling_factor, geometry.patches());
+            locate_chart(std::move(detection.candidates), detection.filtered, detection.scale);
+        }
 
-            auto bw_img_without_filtering = adaptive_threshold<uint16_t>(gray_scale);
-            contours_candidates.emplace_back(find_square_candidates(bw_img_without_filtering));
+        // Locates each chart in turn from the features of one detection pass
+        // - the features close to the patches of a located chart are removed from the candidates
+        static void detect_charts(std::vector<macbeth_chart> &charts, image<uint16_t> gray_scale, int prescaling_factor)
+        {
+            if (charts.empty())
+                return;
+
+            // The smallest chart has the largest patches to accept as features
+            auto min_patches = charts[0].geometry.patches();
+            for (auto &chart : charts)
+                min_patches = std::min(min_patches, chart.geometry.patches());
+
+            auto detection = charts[0].detect_features(gray_scale, prescaling_factor, min_patches);
+            for (size_t i = 0; i < charts.size(); i++)
+            {
+                auto &chart = charts[i];
+                chart.tracked = false;
+                if (i + 1 == charts.size())
+                {
+                    chart.locate_chart(std::move(detection.candidates), detection.filtered, detection.scale);
+                    break;
+                }
+                chart.locate_chart(detection.candidates, detection.filtered, detection.scale);
+                if (chart.is_valid())
+                    chart.exclude_features(detection);
+            }
+        }
+
+        // Thresholds the image a few ways and labels the square features of each
+        // - the features must fit `patches` times within the image
+        // - the four thresholded candidates are built concurrently
+        detection_s detect_features(image<uint16_t> &gray_scale, int prescaling_factor, int patches)
+        {
+            detection_s detection;
+            // The image is first rescaled to ~1000 x 750 range
+            detection.scale = prescaling_factor * resize_image_to_1MP_range(gray_scale);
+            auto &candidates = detection.candidates;
+            candidates.resize(4);       // make a few attempts at locating contours
 
             // Image is filtered depending on the size with median and/or box filter (up to 2x)?
             // - the filtering should be more adaptive
             // - images with sharp edges / no gap between patches suffer from filtering
             // - images with high noise require more filtering
+            auto &filtered = detection.filtered;
+            filtered = gray_scale.convert_to<uint16_t>();
 
-            image_blur(gray_scale, (gray_scale._height + 256) / 512);
-
-            if (gray_scale._height > 300)
-                median_filter_3x3(gray_scale);
+            // The two tasks of each stage run concurrently; a stage nested in a task
+            // gets its share of the thread budget instead of the whole budget
+            auto nested_threads = std::max(1u, (threads == 0 ? default_thread_count() : threads) / 2);
+            parallel_for(0, 2, [&](int task)
+            {
+                if (task == 0)
+                {
+                    auto bw_img_without_filtering = adaptive_threshold<uint16_t>(gray_scale);
+                    candidates[0] = find_square_candidates(bw_img_without_filtering, patches);
+                    return;
+                }
+                image_blur(filtered, (filtered._height + 256) / 512);
 
-            // This seems to work quite fine for dark images
-            auto bw_img = adaptive_threshold<uint16_t>(gray_scale);
-            contours_candidates.emplace_back(find_square_candidates(bw_img));
+                if (filtered._height > 300)
+                    median_filter_3x3(filtered);
+            }, threads);
 
-            // Occasionally the image should be morphologically opened/closed
-            // Closing by 5x5 support, then opening by 5x5 support is found empirically
-            // to work in few cases in the offline image database of 4000+ images
-            auto bw_copy = image_close(bw_img);
-            bw_copy = image_close(bw_copy);
-            bw_copy = image_open(bw_copy);
-            bw_copy = image_open(bw_copy);
-            contours_candidates.emplace_back(find_square_candidates(bw_copy));
+            parallel_for(0, 2, [&](int task)
+            {
+                if (task == 0)
+                {
+                    // This seems to work quite fine for dark images
+                    auto bw_img = adaptive_threshold<uint16_t>(filtered);
+                    candidates[1] = find_square_candidates(bw_img, patches);
+
+                    // Occasionally the image should be morphologically opened/closed
+                    // Closing by 5x5 support, then opening by 5x5 support is found empirically
+                    // to work in few cases in the offline image database of 4000+ images
+                    //  - i.e. the 3x3 minimum twice followed by the 3x3 maximum twice, which is
+                    //    the 5x5 minimum followed by the 5x5 maximum
+                    auto bw_copy = morphological_open(bw_img, 5, 5);
+                    candidates[2] = find_square_candidates(bw_copy, patches);
+                    return;
+                }
+                // and this seems to work quite fine for noisy images
+                // We call image_open, because gradient threshold will typically produce quite wide borders
+                // - we widen the squares inside these borders
+                auto bw_img = gradient_threshold(filtered, 0.3, false, nested_threads);
+                bw_img = image_open(bw_img);
+                candidates[3] = find_square_candidates(bw_img, patches);
+            }, threads);
+
+            sort_candidates(candidates);
+            return detection;
+        }
 
-            // and this seems to work quite fine for noisy images
-            // We call image_open, because gradient threshold will typically produce quite wide borders
-            // - we widen the squares inside these borders
-            bw_img = gradient_threshold(gray_scale);
-            bw_img = image_open(bw_img);
-            contours_candidates.emplace_back(find_square_candidates(bw_img));
+        static void sort_candidates(std::vector<std::vector<feature_s>> &candidates)
+        {
+            std::stable_sort(candidates.begin(), candidates.end(),
+                [](const std::vector<feature_s> &a, const std::vector<feature_s> &b)
+            {
+                return a.size() > b.size();
+            });
+        }
 
-            sort_list_of_list_by_size(contours_candidates);
-            for (auto &contours : contours_candidates)
+        // Locates the chart from the candidate features of `gray_scale` scaled down by `scale`
+        // - the candidates are evaluated concurrently; the result is that of the first
+        //   candidate (in the order of decreasing feature count) that validates
+        void locate_chart(std::vector<std::vector<feature_s>> candidates, image<uint16_t> &gray_scale, int scale)
+        {
+            // Each candidate is evaluated by its own copy of the detector
+            // - a candidate gives up, once a candidate of higher priority has validated
+            auto count = static_cast<int>(candidates.size());
+            std::vector<macbeth_chart> workers(count, *this);
+            for (auto &worker : workers)
+                worker.threads = 1;     // the candidates already run concurrently
+            std::atomic<int> best(count);
+            parallel_for(0, count, [&](int i)
             {
-                point_xy center(bw_img._width * 0.5, bw_img._height * 0.5);
+                if (workers[i].evaluate_candidate(candidates[i], gray_scale, scale, best, i))
+                {
+                    auto current = best.load();
+                    while (i < current && !best.compare_exchange_weak(current, i))
+                        ;
+                }
+            }, threads);
 
-                auto contours_all = contours;
+            if (best < count)
+            {
+                polygons = workers[best].polygons;
+                return;
+            }
 
-                // Iterate over all groups of adjacent features (starting from the largest group)
-                auto groups = find_adjacent_features(contours);
+            // otherwise return without finding a chart
+            // - as when evaluating the candidates one by one, a previous result is kept
+            //   unless a candidate got as far as replacing (and then clearing) the polygons
+            for (auto &worker : workers)
+            {
+                if (worker.polygons.empty())
+                    polygons.clear();
+            }
+        }
 
-                // Estimate global barrel correction from one connected group (at a time)
-                // When the group is of proper size, we can try to use that as a global solution
-                for (auto &g : groups)
+        // Removes the candidate features within half a patch pitch from the patches of the chart
+        void exclude_features(detection_s &detection)
+        {
+            auto centers = patch_centers(1.0 / detection.scale);
+            auto radius = 0.5 * patch_pitch(centers);
+            point_grid_s grid(centers);
+            for (auto &features : detection.candidates)
+            {
+                features.erase(std::remove_if(features.begin(), features.end(), [&](const feature_s &feature)
                 {
-                    if (g.size() <= 2 || g.size() > 24)
-                        continue;
+                    return grid.nearest_distance2(feature.centroid) < radius * radius;
+                }), features.end());
+            }
+            sort_candidates(detection.candidates);
+        }
 
-                    double alpha = g.size() < 5 ? 0.0 : estimate_barrel_distortion(g, center);
-                    auto alpha_per_r2 = alpha / norm2(center);
+        void track_or_detect(image<uint16_t> gray_scale, int prescaling_factor)
+        {
+            tracked = is_valid() && track_chart(gray_scale, prescaling_factor);
+            if (!tracked)
+            {
+                polygons.clear();   // the previous chart is not in this frame
+                detect_macbeth_chart(gray_scale, prescaling_factor);
+            }
+        }
 
-                    // take a copy of all contours, or the current connected group if it is large enough
-                    contours = g.size() >= 8 && contours_all.size() > 24 ? g : contours_all;
+        // Returns the average of the vertices of each polygon multiplied by `scale`
+        std::vector<point_xy> patch_centers(double scale)
+        {
+            auto centers = std::vector<point_xy>();
+            for (auto &polygon : polygons)
+            {
+                point_xy sum(0, 0);
+                for (auto &p : polygon)
+                    sum += p;
+                centers.push_back(sum * (scale / polygon.size()));
+            }
+            return centers;
+        }
 
-                    // Apply the correction...
-                    for (auto &feature : contours)
+        // Returns the median distance of horizontally adjacent patch centers
+        double patch_pitch(const std::vector<point_xy> &centers)
+        {
+            std::vector<double> distances;
+            auto columns = static_cast<size_t>(geometry.columns);
+            for (size_t i = 0; i + 1 < centers.size(); i++)
+            {
+                if (i % columns != columns - 1)
+                    distances.push_back(norm(centers[i + 1] - centers[i]));
+            }
+            return vector_median(distances);
+        }
+
+        // Verifies the polygons of a previous frame against a new frame
+        // - the polygons are translated to minimize the sum of pixel deviations within the patches,
+        //   searched coarse to fine (in steps of powers of two) up to half a patch pitch
+        // - the translated chart is accepted, when the patches are uniform compared to the
+        //   differences between them, and when the grid validates
+        // - returns false leaving the polygons intact otherwise
+        bool track_chart(image<uint16_t> gray_scale, int prescaling_factor)
+        {
+            auto scale = prescaling_factor * resize_image_to_1MP_range(gray_scale);
+            auto inv_scale = 1.0 / scale;
+            auto size = gray_scale.size();
+
+            // The pitch of the patches at the detection resolution
+            auto pitch = patch_pitch(patch_centers(inv_scale));
+            auto max_shift = static_cast<int>(pitch * 0.5);
+
+            // The cost is evaluated on every other row of the translated spans of the previous chart
+            auto spans = patch_spans_s(size, polygons, point_xy(inv_scale, inv_scale));
+            std::map<std::pair<int, int>, double> costs;
+            auto cost = [&](roi_point shift)
+            {
+                auto key = std::make_pair(shift._x, shift._y);
+                auto it = costs.find(key);
+                if (it != costs.end())
+                    return it->second;
+                double sum = 0.0;
+                for (auto &patch : spans.moments(gray_scale, shift, 2))
+                    sum += patch.n > 1 ? patch() : std::numeric_limits<double>::infinity();
+                return costs[key] = sum;
+            };
+
+            // A shift must improve the cost by some margin, so that noise doesn't move a chart
+            // within the area where all its polygons are on uniform patches
+            const double margin = 0.95;
+            auto best = roi_point(0, 0);
+            auto best_cost = cost(best);
+            int step = 1;
+            while (step * 2 <= max_shift)
+                step *= 2;
+            for (; step >= 1; step /= 2)
+            {
+                for (bool moved = true; moved; )
+                {
+                    moved = false;
+                    auto center = best;
+                    for (int dy = -step; dy <= step; dy += step)
                     {
-                        barrel_correction(feature.centroid, center, alpha_per_r2);
-                        barrel_correction(feature.path, center, alpha_per_r2);
+                        for (int dx = -step; dx <= step; dx += step)
+                        {
+                            auto shift = center + roi_point(dx, dy);
+                            if (std::abs(shift._x) > max_shift || std::abs(shift._y) > max_shift)
+                                continue;
+                            auto c = cost(shift);
+                            if (c < best_cost * margin)
+                            {
+                                best = shift;
+                                best_cost = c;
+                                moved = true;
+                            }
+                        }
                     }
+                }
+            }
+
+            // The patches must be uniform compared to the variation between the patches
+            if (!are_patches_uniform(spans.moments(gray_scale, best)))
+                return false;
+
+            auto previous = polygons;
+            auto offset = point_xy(best._x, best._y) * static_cast<double>(scale);
+            for (auto &polygon : polygons)
+                for (auto &p : polygon)
+                    p += offset;
+            if (validate_grid(gray_scale, inv_scale))
+                return true;
+            polygons = previous;
+            return false;
+        }
+
+        // Tries to locate the chart from one set of candidate features
+        // - returns true with the `polygons` set on success
+        // - returns false early when `best` is already of higher priority than `priority`
+        bool evaluate_candidate(std::vector<feature_s> &contours, image<uint16_t> &gray_scale, int scale,
+            const std::atomic<int> &best, int priority)
+        {
+            point_xy center(gray_scale._width * 0.5, gray_scale._height * 0.5);
+            auto patches = static_cast<size_t>(geometry.patches());
+
+            auto contours_all = contours;
+
+            // Iterate over all groups of adjacent features (starting from the largest group)
+            auto groups = find_adjacent_features(contours);
+
+            // Estimate global barrel correction from one connected group (at a time)
+            // When the group is of proper size, we can try to use that as a global solution
+            for (auto &g : groups)
+            {
+                if (best.load() < priority)
+                    return false;
+
+                if (g.size() <= 2 || g.size() > patches)
+                    continue;
+
+                double alpha = g.size() < 5 ? 0.0 : estimate_barrel_distortion(g, center);
+                auto alpha_per_r2 = alpha / norm2(center);
+
+                // take a copy of all contours, or the current connected group if it is large enough
+                contours = g.size() >= 8 && contours_all.size() > patches ? g : contours_all;
+
+                // Apply the correction...
+                for (auto &feature : contours)
+                {
+                    barrel_correction(feature.centroid, center, alpha_per_r2);
+                    barrel_correction(feature.path, center, alpha_per_r2);
+                }
 
-                    if (!remove_non_squares(contours))
-                        continue;
+                if (!remove_non_squares(contours))
+                    continue;
 
-                    if (!remove_by_mismatched_pathlengths(contours))
-                        continue;
+                if (!remove_by_mismatched_pathlengths(contours))
+                    continue;
 
-                    auto median_centroid_distance = remove_by_centroid_distance(contours);
+                auto median_centroid_distance = remove_by_centroid_distance(contours);
 
-                    if (median_centroid_distance < 0)
-                        continue;
+                if (median_centroid_distance < 0)
+                    continue;
 
-                    auto angle = find_representative_angle(contours);
+                auto angle = find_representative_angle(contours);
 
-                    std::vector<point_xy> centroids;
-                    for (auto &feature : contours)
-                        centroids.emplace_back(feature.centroid * scale);
+                std::vector<point_xy> centroids;
+                for (auto &feature : contours)
+                    centroids.emplace_back(feature.centroid * scale);
 
-                    auto scaled_center = center * scale;
-                    auto indices = fit_centroids_to_grid(centroids, angle, median_centroid_distance * scale, scaled_center);
-                    if (indices.size() == 0)
-                        continue;
+                auto scaled_center = center * scale;
+                auto indices = fit_centroids_to_grid(centroids, angle, median_centroid_distance * scale, scaled_center);
+                if (indices.size() == 0)
+                    continue;
 
-                    // Try at most two places...
-                    for (int i = 0; i < 2; i++)
+                // Try at most two places...
+                for (int i = 0; i < 2; i++)
+                {
+                    auto points = fill_missing_items(centroids, indices);
+                    if (points.size() == patches && (!geometry.ramp.empty() || is_grid_spanned(indices)))
                     {
-                        auto points = fill_missing_items(centroids, indices);
-                        if (points.size() == 24)
-                        {
-                            calculate_polygons(points, scaled_center, alpha / norm2(scaled_center));
-                            if (validate_grid(gray_scale, 1.0 / scale))
-                                return;
-                        }
-                        if (is_full_row_missing(indices, 0))
-                            shift_indices(indices, 6);
-                        else if (is_full_row_missing(indices, 18))
-                            shift_indices(indices, 18);
-                        else break;
+                        calculate_polygons(points, scaled_center, alpha / norm2(scaled_center));
+                        if (validate_grid(gray_scale, 1.0 / scale))
+                            return true;
                     }
-                    polygons.clear();
+                    auto last_row = patches - geometry.columns;
+                    if (is_full_row_missing(indices, 0))
+                        shift_indices(indices, static_cast<size_t>(geometry.columns));
+                    else if (is_full_row_missing(indices, last_row))
+                        shift_indices(indices, last_row);
+                    else break;
                 }
+                polygons.clear();
             }
-            // return without finding a chart
+            return false;
         }
 
         // downscales image data to about 1000 x 750 size -- returns the integer scaling factor
         // target size is predetermined by author of the algorithm
         int resize_image_to_1MP_range(image<uint16_t> &img)
         {
-            int scale = 1;
-            auto size = img.size();
-            if ((size._y > 750) || (size._x > 1000))
-            {
-                scale = std::lround((size._y / 750.0 + size._x / 1000.0) * 0.5);
-                if (scale <= 1)
-                    return 1;
+            auto scale = get_1MP_range_scale(img.size());
+            if (scale > 1)
                 img = resize_image(img, point_xy(1.0 / scale, 1.0 / scale));
-                return scale;
-            }
             return scale;
         }
 
+        // returns the integer downscaling factor of an image of `size` to about 1000 x 750
+        static int get_1MP_range_scale(roi_point size)
+        {
+            if ((size._y > 750) || (size._x > 1000))
+                return std::max(1, static_cast<int>(std::lround((size._y / 750.0 + size._x / 1000.0) * 0.5)));
+            return 1;
+        }
+
         // modifies image data from grayscale to bw with local thresholding:
         // paints flat areas with white, where flat is described as
         // maximum of 3x3 neighborhood is not larger than X * minimum of 3x3 neighborhood
         template <typename U, typename T>
         image<U> adaptive_threshold(image<T> &img)
         {
-            // erode
+            auto min3x3 = erode(img, 3, 3);
+            auto max3x3 = dilate(img, 3, 3);
             uint64_t sum_min = 0;
-            auto min3x3 = img.template filter<3, 3>([&sum_min](support<3, 3, T> &pixels)
-            {
-                auto mn = pixels.minimum();
-                sum_min += static_cast<uint64_t>(mn);
-                return mn;
-            });
-
-            // dilate
             uint64_t sum_max = 0;
-            auto max3x3 = img.template filter<3, 3>([&sum_max](support<3, 3, T> &pixels)
+            min3x3.foreach([&sum_min, &sum_max](T &mn, T &mx)
             {
-                auto mx = pixels.maximum();
+                sum_min += static_cast<uint64_t>(mn);
                 sum_max += static_cast<uint64_t>(mx);
-                return mx;
-            });
+            }, max3x3);
 
             // we could also use ratio = 1.333;
             // initial guess of threshold is the ratio of averaged mx and mn (e.g. 1.02)
@@ -793,12 +1739,13 @@ namespace Teisko
 
         // Given a bw image, returns descriptor for all connected (white) areas
         // of correct size and reasonable squareness (area to perimeter ratio)
-        std::list<feature_s> find_square_candidates(image<uint16_t> &bw_img)
+        // - a feature can cover at most 1/patches of the image
+        std::vector<feature_s> find_square_candidates(image<uint16_t> &bw_img, int patches)
         {
             // Prune out items based on area or squareness area/perimeter
             // Actual formula:  0.65 <= 4piA / p^2 <= 1.05
             //  - then we invert this to get limits for the min/max perimeter length
-            double max_area = (bw_img._width * bw_img._height) / 24.0;
+            double max_area = (bw_img._width * bw_img._height) / static_cast<double>(patches);
             double min_area = std::min(100.0, max_area / 100.0);
             double max_perimeter = std::sqrt(19.3329 * max_area) * 1.5;
             double min_perimeter = std::sqrt(11.9680 * min_area) * (1.0 / 1.5);
@@ -806,7 +1753,7 @@ namespace Teisko
             bwlabel(bw_img);
             std::vector<roi_point> path;
             path.reserve(10000);
-            std::list<feature_s> passed;
+            std::vector<feature_s> passed;
             uint16_t next_label = 1;
             for (auto j = 0; j < bw_img._height; j++)
             {
@@ -832,41 +1779,19 @@ namespace Teisko
             return passed;
         }
 
-        // Given multiple lists, sort them the longest list first
-        void sort_list_of_list_by_size(std::list<std::list<feature_s>> &list_of_list)
+        // Moves the content in feature vector 'feats' to groups of adjacent items
+        // - see find_adjacent_groups for the order of the groups and their members
+        std::vector<std::vector<feature_s>> find_adjacent_features(std::vector<feature_s> &feats)
         {
-            // Then sort by number of features in each group
-            list_of_list.sort([](const std::list<feature_s> &a, const std::list<feature_s> &b)
+            auto groups = find_adjacent_groups(feats);
+            std::vector<std::vector<feature_s>> results(groups.size());
+            for (size_t g = 0; g < groups.size(); g++)
             {
-                return a.size() > b.size();
-            });
-        }
-
-        // Moves the content in feature list 'feats' to lists of adjacent items
-        // Complexity: O(N^2)
-        std::list<std::list<feature_s>> find_adjacent_features(std::list<feature_s> &feats)
-        {
-            std::list<std::list<feature_s>> results;
-            while (feats.size())
-            {
-                // move one (first) item from feature list to a new group
-                results.push_back(std::list<feature_s>());
-                auto &group = results.back();
-                group.splice(group.begin(), feats, feats.begin());
-
-                // Move new members from features to the group
-                for (auto it = group.begin(); it != group.end(); ++it)
-                {
-                    for (auto it2 = feats.begin(); it2 != feats.end();)
-                    {
-                        auto next = std::next(it2);
-                        if (it->is_connected(*it2))
-                            group.splice(group.end(), feats, it2);
-                        it2 = next;
-                    }
-                }
+                results[g].reserve(groups[g].size());
+                for (auto i : groups[g])
+                    results[g].push_back(std::move(feats[i]));
             }
-            sort_list_of_list_by_size(results);
+            feats.clear();
             return results;
         }
 
@@ -915,24 +1840,7 @@ namespace Teisko
             }
         }
 
-        // calculates a squareness estimate of group of 4-sided polygons
-        // the two diagonals in a perfect square have equal lengths
-        // - minimizing variance of the diagonal difference provides a good estimate of overall squareness
-        double squareness_estimate(std::vector<point_xy> &corners)
-        {
-            variance_s squareness;
-            auto sz = corners.size();
-            if (sz == 0 || sz % 4)
-                return 0.0;
-
-            for (decltype(sz) i = 0; i < sz; i += 4)
-                squareness += norm(corners[i] - corners[i + 2]) - norm(corners[i + 1] - corners[i + 3]);
-
-            return squareness();
-        }
-
-
-        std::vector<point_xy> extract_corners(std::list<feature_s> &contours)
+        std::vector<point_xy> extract_corners(std::vector<feature_s> &contours)
         {
             std::vector<point_xy> output;
             output.reserve(contours.size() * 4);
@@ -949,14 +1857,15 @@ namespace Teisko
         // The contours are scanned to detect four extreme points
         //  - the best alpha minimizes the STD (or variance) of the angles between the corners
         //  - ideally all corners are 90 degrees - thus the variance and mean are both zero
-        double estimate_barrel_distortion(std::list<feature_s> &contours, point_xy center)
+        double estimate_barrel_distortion(std::vector<feature_s> &contours, point_xy center)
         {
             // Checks if all elements in a 2x2 neighborhood are missing
-            auto is_empty_quad = [](std::vector<int> &indices, int offset)
+            auto columns = geometry.columns;
+            auto is_empty_quad = [columns](std::vector<int> &indices, int offset)
             {
                 return
                     indices[offset + 0] < 0 && indices[offset + 1] < 0 &&
-                    indices[offset + 6] < 0 && indices[offset + 7] < 0;
+                    indices[offset + columns] < 0 && indices[offset + columns + 1] < 0;
             };
 
             auto angle = find_representative_angle(contours);
@@ -968,45 +1877,42 @@ namespace Teisko
             auto median_distance = get_centroid_median_distance(contours);
 
             auto indices = fit_centroids_to_grid(centroids, angle, median_distance, center);
-            if (indices.size() != 24)
+            if (indices.size() != static_cast<size_t>(geometry.patches()))
                 return 0.0;
 
             // check that there's representation in all 4 corners
-            if (is_empty_quad(indices, 0) || is_empty_quad(indices, 4) ||
-                is_empty_quad(indices, 12) || is_empty_quad(indices, 16))
+            auto last_row = geometry.patches() - 2 * columns;
+            if (is_empty_quad(indices, 0) || is_empty_quad(indices, columns - 2) ||
+                is_empty_quad(indices, last_row) || is_empty_quad(indices, last_row + columns - 2))
                 return 0.0;
 
             auto corners = extract_corners(contours);
             if (corners.empty())
                 return 0.0;
 
-            std::vector<double> measure;
-            std::vector<double> alphas;
-
-            // Loop for a range of doubles in [-3.2 : 0.1 : 3.2] inclusive
-            // this seems to be a practical range of allowed distortion
-            for (int k = -32; k <= 32; k++)
-            {
-                auto alpha = k * 0.1;
-                auto distorted = corners;
-                barrel_correction(distorted, center, alpha / norm2(center));
-                measure.push_back(squareness_estimate(distorted));
-                alphas.push_back(alpha);
-            }
-            auto it = std::min_element(measure.begin(), measure.end());
-            auto idx = std::distance(measure.begin(), it);
-            return alphas[idx];
+            // The practical range of allowed distortion is [-3.2 : 0.1 : 3.2]
+            return barrel_squareness_s(corners, center).best_alpha();
         }
 
         // Using FFT method, removes all non squares from the set of features
         // Returns false for empty set
-        bool remove_non_squares(std::list<feature_s> &contours)
+        bool remove_non_squares(std::vector<feature_s> &contours)
         {
-            contours.remove_if([](feature_s &f) {
-                const double threshold = 0.02;      // empirical value
-                auto rms = f.calculate_squareness();
-                return rms < 0 || rms > threshold;
+            // Scoring by path length shares the trigonometric table of equally long paths
+            std::vector<size_t> order(contours.size());
+            std::iota(order.begin(), order.end(), size_t(0));
+            std::stable_sort(order.begin(), order.end(), [&contours](size_t a, size_t b)
+            {
+                return contours[a].path.size() < contours[b].path.size();
             });
+            square_spectrum_s spectrum;
+            for (auto i : order)
+                contours[i].calculate_squareness(spectrum);
+
+            contours.erase(std::remove_if(contours.begin(), contours.end(), [](feature_s &f) {
+                const double threshold = 0.02;      // empirical value
+                return f.fft_rms < 0 || f.fft_rms > threshold;
+            }), contours.end());
             return !contours.empty();
         }
 
@@ -1024,15 +1930,16 @@ namespace Teisko
         }
 
         // Finds the median length of the feature
-        // - when there are more than 24 items, the item lenghts are binned to three bin histogram
-        //   then we locate those features, that count less than 24
-        // - this is mostly needed for images with both a 6x4 macbeth and some 10x10 chart
+        // - when there are more items than patches, the item lenghts are binned to three bin histogram
+        //   then we locate those features, that count at most the patches
+        // - this is mostly needed for images with several charts of different patch sizes
         double locate_typical_feature_length(std::vector<double> &sorted_lengths)
         {
             auto nonzero_paths = sorted_lengths.size();
+            auto patches = geometry.patches();
             double typical_length = 0;
 
-            if (nonzero_paths <= 24)
+            if (nonzero_paths <= static_cast<size_t>(patches))
             {
                 auto clip = (nonzero_paths + 2) >> 2;
                 auto first = sorted_lengths.begin() + clip - 1;
@@ -1042,7 +1949,7 @@ namespace Teisko
             }
             else
             {
-                // make a histogram of three bins, locating the maximum count that is less than 25
+                // make a histogram of three bins, locating the maximum count that is at most the patches
                 // and the corresponding bin value
                 // the original version in matlab locates the maximum size -- which is probably untested
                 double diff = sorted_lengths.back() - sorted_lengths.front();
@@ -1060,7 +1967,7 @@ namespace Teisko
                 int max_count = 0;
                 for (int i = 0; i < 3; i++)
                 {
-                    if (bins[i] <= 24 && bins[i] > max_count)
+                    if (bins[i] <= patches && bins[i] > max_count)
                     {
                         max_count = bins[i];
                         typical_length = avg[i] / bins[i];
@@ -1071,12 +1978,17 @@ namespace Teisko
         }
 
         // Locates the median of (minimum) distance across a group of contours
-        double get_centroid_median_distance(std::list<feature_s> &contours)
+        double get_centroid_median_distance(std::vector<feature_s> &contours)
         {
-            std::vector<double> minimum_centroid_distance;
+            std::vector<point_xy> centroids;
+            centroids.reserve(contours.size());
+            for (auto &feature : contours)
+                centroids.push_back(feature.centroid);
+            point_grid_s grid(centroids);
 
+            std::vector<double> minimum_centroid_distance;
             for (auto &feature : contours)
-                minimum_centroid_distance.push_back(feature.find_minimum_distance(contours));
+                minimum_centroid_distance.push_back(feature.find_minimum_distance(grid));
 
             return vector_median(minimum_centroid_distance);
         }
@@ -1084,7 +1996,7 @@ namespace Teisko
         // removes features too far from other features
         //  - this will remove isolated squares, however that should
         //  not be a problem with the local thresholding algorithm
-        double remove_by_centroid_distance(std::list<feature_s> &contours)
+        double remove_by_centroid_distance(std::vector<feature_s> &contours)
         {
             // multiplier = 1.1 * sqrt(2) == 1.55536
             auto median_centroid_distance = get_centroid_median_distance(contours);
@@ -1092,10 +2004,10 @@ namespace Teisko
                 return median_centroid_distance;
 
             auto max_centroid_distance = 1.5556 * median_centroid_distance;
-            contours.remove_if([=](const feature_s &feature)
+            contours.erase(std::remove_if(contours.begin(), contours.end(), [=](const feature_s &feature)
             {
                 return feature.minimum_distance > max_centroid_distance;
-            });
+            }), contours.end());
 
             if (contours.empty())
                 return -1.0;
@@ -1104,7 +2016,7 @@ namespace Teisko
         }
 
         // removes features with path length outside the expected mean
-        bool remove_by_mismatched_pathlengths(std::list<feature_s> &contours)
+        bool remove_by_mismatched_pathlengths(std::vector<feature_s> &contours)
         {
             std::vector<double> path_lengths;
             // Store the path length both in the feature and in a vector to be sorted
@@ -1124,17 +2036,17 @@ namespace Teisko
             auto typical_length = locate_typical_feature_length(path_lengths);
             auto max_difference = 0.25 * typical_length;
 
-            contours.remove_if([=](const feature_s &feature)
+            contours.erase(std::remove_if(contours.begin(), contours.end(), [=](const feature_s &feature)
             {
                 return std::abs(feature.corrected_path_length - typical_length) > max_difference;
-            });
+            }), contours.end());
             return !contours.empty();
         }
 
         // Finds rotation angle of the feature set by binning all edges of the feature set
         // to a histogram. Gives angles between +-90 degrees occasionally rotating almost perfectly
         // axis aligned chart by 90 degrees -- this is then compensated in grid fitting
-        double find_representative_angle(std::list<feature_s> &contours)
+        double find_representative_angle(std::vector<feature_s> &contours)
         {
             // We expect the angles to deviate by multiples of 90 degrees.
             // By binning the angles by 60 degrees we ensure that there will be enough samples
@@ -1205,7 +2117,8 @@ namespace Teisko
                 result[items[i].second] = group_number;
             }
             middle_of_groups.emplace_back(vector_median(group));
-            if (middle_of_groups.size() <= 1 || middle_of_groups.size() > 6)
+            auto max_groups = static_cast<size_t>(std::max(geometry.columns, geometry.rows));
+            if (middle_of_groups.size() <= 1 || middle_of_groups.size() > max_groups)
                 return{};
 
             // Calculate the typical true distances within the groups
@@ -1232,7 +2145,7 @@ namespace Teisko
             return result;
         }
 
-        // places N centroids in a grid of 6x4 points
+        // places N centroids in a grid of columns x rows points (6x4 for Macbeth chart)
         //  - the unoccupied slots have index -1
         //  - returns empty vector on failure
         std::vector<int> fit_centroids_to_grid(std::vector<point_xy> &centroids, double angle, double centroid_distance, point_xy center)
@@ -1244,20 +2157,24 @@ namespace Teisko
             if (hist_x.size() == 0 || hist_y.size() != hist_x.size())
                 return{};
 
-            auto result = std::vector<int>(24, -1);
+            auto columns = geometry.columns;
+            auto rows = geometry.rows;
+            auto result = std::vector<int>(geometry.patches(), -1);
             // In case we have toggled the histograms, we also need to invert one of the axis
             // (toggling means transposing, toggle + invert means rotation)
-            auto must_swap = *std::max_element(hist_x.begin(), hist_x.end()) < *std::max_element(hist_y.begin(), hist_y.end());
+            // - the longer axis of the features is aligned with the longer axis of the chart
+            auto must_swap = (*std::max_element(hist_x.begin(), hist_x.end()) <
+                *std::max_element(hist_y.begin(), hist_y.end())) != (columns < rows);
             if (must_swap)
                 std::swap(hist_x, hist_y);
 
             for (size_t i = 0; i < hist_x.size(); i++)
             {
-                int y = must_swap ? 3 - hist_y[i] : hist_y[i];
+                int y = must_swap ? rows - 1 - hist_y[i] : hist_y[i];
                 int x = hist_x[i];
-                if (y < 0 || y > 3 || x < 0 || x > 5)
+                if (y < 0 || y >= rows || x < 0 || x >= columns)
                     return{};       // illegal indexing
-                int idx = x + y * 6;
+                int idx = x + y * columns;
                 if (result[idx] >= 0)
                     return{};       // pigeon slot full
                 result[idx] = static_cast<int>(i);
@@ -1268,24 +2185,26 @@ namespace Teisko
         // locates missing items from an axis-aligned grid
         std::vector<point_xy> fill_missing_items(std::vector<point_xy> &centroids, std::vector<int> &indices)
         {
-            std::vector<point_xy> grid(24);
+            auto columns = geometry.columns;
+            auto rows = geometry.rows;
+            std::vector<point_xy> grid(geometry.patches());
 
             // calculate some statistics
-            int hist_x[6] = { 0 };
-            int hist_y[4] = { 0 };
+            std::vector<int> hist_x(columns, 0);
+            std::vector<int> hist_y(rows, 0);
             std::vector<roi_point> must_reconstruct;
-            for (int j = 0; j < 4; j++)
+            for (int j = 0; j < rows; j++)
             {
-                for (int i = 0; i < 6; i++)
+                for (int i = 0; i < columns; i++)
                 {
-                    int idx = indices[i + j * 6];
+                    int idx = indices[i + j * columns];
                     if (idx < 0)
                         must_reconstruct.emplace_back(i, j);
                     else
                     {
                         hist_x[i]++;
                         hist_y[j]++;
-                        grid[i + j * 6] = centroids[idx];
+                        grid[i + j * columns] = centroids[idx];
                     }
                 }
             }
@@ -1323,8 +2242,8 @@ namespace Teisko
                 if (hist_x[best_item._x] >= 2)
                 {
                     parametric_model vertical;
-                    for (int y = 0; y < 4; y++)
-                        vertical.add_pt(grid[best_item._x + y * 6], y);
+                    for (int y = 0; y < rows; y++)
+                        vertical.add_pt(grid[best_item._x + y * columns], y);
 
                     ++count;
                     interpolated += vertical(best_item._y);
@@ -1333,15 +2252,15 @@ namespace Teisko
                 if (hist_y[best_item._y] >= 2)
                 {
                     parametric_model horizontal;
-                    for (int x = 0; x < 6; x++)
-                        horizontal.add_pt(grid[best_item._y * 6 + x], x);
+                    for (int x = 0; x < columns; x++)
+                        horizontal.add_pt(grid[best_item._y * columns + x], x);
                     ++count;
                     interpolated += horizontal(best_item._x);
                 }
 
                 interpolated *= (count == 2 ? 0.5 : 1.0);
 
-                grid[best_item._x + best_item._y * 6] = interpolated;
+                grid[best_item._x + best_item._y * columns] = interpolated;
                 hist_x[best_item._x]++;
                 hist_y[best_item._y]++;
             }
@@ -1403,19 +2322,19 @@ namespace Teisko
         // --*---*---*---*---*---*--  line 3
         // Sample those at int n= 0..5 +- 0.3, forming 12 vertical parametric models
         //   - sample those 12 parametric models at y={0,1,2,3} +- s
-        //     to acquire 6x4 polygons
+        //     to acquire 6x4 polygons (or columns x rows polygons of other charts)
         //   - inverse barrel correct the polygons to remap back to (distorted) screen coordinates
         void calculate_polygons(std::vector<point_xy> &centers, point_xy scaled_center, double alpha_per_r2)
         {
             const double s = fill_ratio * 0.5;
-            const int grid_height = 4;
-            const int grid_width = 6;
-            parametric_model horizontal_lines[grid_height];
+            const int grid_height = geometry.rows;
+            const int grid_width = geometry.columns;
+            std::vector<parametric_model> horizontal_lines(grid_height);
             for (int y = 0; y < grid_height; y++)
                 for (int x = 0; x < grid_width; x++)
                     horizontal_lines[y].add_pt(centers[x + y * grid_width], x);
 
-            parametric_model vertical_lines[grid_width * 2];
+            std::vector<parametric_model> vertical_lines(grid_width * 2);
             for (int y = 0; y < grid_height; y++)
             {
                 for (int x = 0; x < grid_width; x++)
@@ -1449,15 +2368,22 @@ namespace Teisko
         }
 
         // generates the (undistorted) coordinates for x = {0..5}, y= {0..3} from homography matrix
-        static point_xy point_reconstruction_function(point_xy p, double *a)
+        // - `origin` is the center of the chart: (2.5, 1.5) for Macbeth chart
+        static point_xy point_reconstruction_function(point_xy p, point_xy origin, double *a)
         {
-            p = p * 2 + point_xy(-5, -3);
+            p = (p - origin) * 2;
             auto z = a[6] * p.x + a[7] * p.y + a[8];
             auto x = a[0] * p.x + a[1] * p.y + a[2];
             auto y = a[3] * p.x + a[4] * p.y + a[5];
             return point_xy(x / z, y / z);
         }
 
+        // The center of the chart in patch coordinates
+        static point_xy chart_origin(const chart_geometry_s &geometry)
+        {
+            return point_xy((geometry.columns - 1) * 0.5, (geometry.rows - 1) * 0.5);
+        }
+
         // Models the rotation/perspective transform of the macbeth chart as a function of x={0-5}, y={0-3} to screen
         // - suffers from remaining distortion after the barrel correction
         // - attempts to make a combined corrector with alpha/optical center estimator tried but failed
@@ -1466,30 +2392,33 @@ namespace Teisko
             struct homography_solver
             {
                 std::vector<point_xy> data;
+                chart_geometry_s geometry;
 
-                homography_solver(std::vector<point_xy> &grid) : data(grid) { }
+                homography_solver(std::vector<point_xy> &grid, chart_geometry_s &geometry) : data(grid), geometry(geometry) { }
                 double operator() (double *a)
                 {
                     double sum = 0.0;
                     int idx = 0;
                     auto const zero = point_xy(0, 0);
-                    for (int i = 0; i < 4; i++)
+                    auto origin = chart_origin(geometry);
+                    for (int i = 0; i < geometry.rows; i++)
                     {
-                        for (int j = 0; j < 6; j++)
+                        for (int j = 0; j < geometry.columns; j++)
                         {
                             if (data[idx] == zero)
                                 continue;
-                            auto projected = point_reconstruction_function(point_xy(j,i), a);
+                            auto projected = point_reconstruction_function(point_xy(j,i), origin, a);
                             sum += norm2(data[idx] - projected);
                             idx++;
                         }
                     }
                     return sum;
                 }
-            } my_solver(grid);
+            } my_solver(grid, geometry);
+            auto origin = chart_origin(geometry);
             auto initial_values = std::vector<double>({
-                median_distance / 2, 0, mins.x + median_distance * 2.5,
-                0.0, median_distance / 2, mins.y + median_distance * 1.5,
+                median_distance / 2, 0, mins.x + median_distance * origin.x,
+                0.0, median_distance / 2, mins.y + median_distance * origin.y,
                 0, 0, 1.0 });
             auto result = nelder_mead_simplex(initial_values, my_solver, { 1500 });
             return result.second;
@@ -1506,13 +2435,14 @@ namespace Teisko
             });
 
             std::vector<point_xy> polygon;
-            for (int i = 0; i < 4; i++)
+            auto origin = chart_origin(geometry);
+            for (int i = 0; i < geometry.rows; i++)
             {
-                for (int j = 0; j < 6; j++)
+                for (int j = 0; j < geometry.columns; j++)
                 {
                     polygon = patch;
                     for (auto &p : polygon)
-                        p = point_reconstruction_function(point_xy(j, i) + p, homography.data());
+                        p = point_reconstruction_function(point_xy(j, i) + p, origin, homography.data());
 
                     inverse_barrel(polygon, scaled_center, alpha_per_r2);
 
@@ -0,0 +1,217 @@
+/*
+* Copyright (c) 2019, Intel Corporation
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the Intel Corporation nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#pragma once
+#include "Teisko/Algorithm/Parallel.hpp"
+#include "Teisko/BayerImage.hpp"
+#include "Teisko/Image/Interleave.hpp"
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+namespace Teisko
+{
+    /// Bayer image with each CFA channel stored contiguously
+    /// - channel `i` of a WxH sensor layout holds the pixels of `bayer_image_s<T>[i]`
+    /// - all planes share one buffer of (channels * channel_height) x channel_width pixels
+    /// - provides the same channel interface as bayer_image_s (range for, operator [], _layout)
+    ///   so per-channel algorithms run on unit stride data
+    template <typename T>
+    class planar_bayer_image
+    {
+    public:
+        // functions allowing planar_bayer_image<T> to be range for looped
+        // by channels:  -- use as `for (auto i: image)`
+        channel_iterator begin() {
+            return channel_iterator{ 0 };
+        }
+        channel_iterator end() {
+            return channel_iterator{ _layout.get_channels() };
+        }
+
+        // Returns Ith sub-channel of image as a contiguous view
+        image<T> operator [](uint32_t i)
+        {
+            if (i >= _layout.get_channels())
+                throw std::runtime_error("Invalid channel index");
+            return _planes.region(_channel_dim._y, _channel_dim._x, i * _channel_dim._y, 0);
+        }
+
+        /// Returns the first channel of given color
+        image<T> operator [](color_info_e color)
+        {
+            int idx = _layout.locate_color(color);
+            if (idx < 0)
+                throw std::runtime_error("Invalid color channel queried");
+            return (*this)[static_cast<uint32_t>(idx)];
+        }
+
+        // Creates a new self contained image for a sensor of height x width pixels
+        planar_bayer_image(int height, int width, bayer_pattern_e color_info)
+            : _layout(color_info)
+        {
+            allocate(height, width);
+        }
+
+        // Splits a bayer image to planes
+        explicit planar_bayer_image(bayer_image_s<T> &src, unsigned int threads = 0,
+            simd_level_e level = detected_simd_level())
+            : _layout(src._layout)
+        {
+            allocate(src._img._height, src._img._width);
+            split(src, threads, level);
+        }
+
+        // Copy constructor takes deep copy
+        planar_bayer_image(const planar_bayer_image &other)
+            : _planes(other._planes.convert_to()), _layout(other._layout)
+            , _channel_dim(other._channel_dim), _dim(other._dim)
+        { }
+
+        // Assignment operator deep copies data
+        planar_bayer_image& operator=(const planar_bayer_image &other)
+        {
+            _planes = other._planes.convert_to();
+            _layout = other._layout;
+            _channel_dim = other._channel_dim;
+            _dim = other._dim;
+            return *this;
+        }
+
+        /// Copies the channels of `src` to the planes
+        /// - `src` must have the same layout and size as this image
+        void split(bayer_image_s<T> &src, unsigned int threads = 0, simd_level_e level = detected_simd_level())
+        {
+            check_compatible(src);
+            transfer(src, true, threads, level);
+        }
+
+        /// Copies the planes back to the CFA positions of `dst`
+        /// - `dst` must have the same layout and size as this image
+        void merge(bayer_image_s<T> &dst, unsigned int threads = 0, simd_level_e level = detected_simd_level())
+        {
+            check_compatible(dst);
+            transfer(dst, false, threads, level);
+        }
+
+        /// Returns a new self contained bayer image with the planes interleaved back
+        bayer_image_s<T> to_bayer(unsigned int threads = 0, simd_level_e level = detected_simd_level())
+        {
+            bayer_image_s<T> result(_dim._y, _dim._x, static_cast<bayer_pattern_e>(_layout));
+            merge(result, threads, level);
+            return result;
+        }
+
+        /// Size of the sensor in pixels (e.g. 4208 x 3120)
+        roi_point get_dim() const { return _dim; }
+
+        /// Size of a single color channel
+        roi_point get_channel_dim() const { return _channel_dim; }
+
+        image<T> _planes;
+        bayer_info_s _layout;
+
+    private:
+        roi_point _channel_dim;
+        roi_point _dim;
+
+        void allocate(int height, int width)
+        {
+            auto w = static_cast<int>(_layout.get_width());
+            auto h = static_cast<int>(_layout.get_height());
+            if (w == 0 || h == 0)
+                throw std::runtime_error("Division by Bayer pattern size 0");
+            _dim = roi_point(width, height);
+            _channel_dim = roi_point(width / w, height / h);
+            _planes = image<T>(static_cast<int>(_layout.get_channels()) * _channel_dim._y, _channel_dim._x);
+        }
+
+        void check_compatible(bayer_image_s<T> &other)
+        {
+            if (!(other._layout == _layout) ||
+                static_cast<int>(other._img._width) != _dim._x ||
+                static_cast<int>(other._img._height) != _dim._y)
+                throw std::runtime_error("Bayer image layout or size doesn't match the planar image");
+        }
+
+        /// Moves the pixels between the planes and the interleaved CFA rows
+        /// Each sensor row of a WxH layout is split to (or merged from) W planes,
+        /// which for W = 2 (2x2 Bayer) or 4 (4x2 DP, 4x4 RGB-IR) uses the SIMD kernels
+        void transfer(bayer_image_s<T> &bayer, bool to_planes, unsigned int threads, simd_level_e level)
+        {
+            auto w_chans = static_cast<int>(_layout.get_width());
+            auto h_chans = static_cast<int>(_layout.get_height());
+            auto width = static_cast<size_t>(_channel_dim._x);
+            auto &img = bayer._img;
+            bool unit_stride = img._skip_x == 1;
+
+            parallel_for_bands(0, _channel_dim._y, 16, [&](int first, int last)
+            {
+                std::vector<T*> planes(w_chans);
+                for (int y = first; y < last; y++)
+                {
+                    for (int r = 0; r < h_chans; r++)
+                    {
+                        for (int c = 0; c < w_chans; c++)
+                            planes[c] = &_planes.at((r * w_chans + c) * _channel_dim._y + y, 0);
+
+                        T *row = &img.at(y * h_chans + r, 0);
+                        if (unit_stride && w_chans >= 2 && w_chans <= 4)
+                        {
+                            if (to_planes)
+                                deinterleave(row, w_chans, planes.data(), width, level);
+                            else
+                                interleave(planes.data(), w_chans, row, width, level);
+                            continue;
+                        }
+
+                        for (size_t x = 0; x < width; x++)
+                        {
+                            for (int c = 0; c < w_chans; c++)
+                            {
+                                auto &pixel = row[(x * w_chans + c) * img._skip_x];
+                                if (to_planes)
+                                    planes[c][x] = pixel;
+                                else
+                                    pixel = planes[c][x];
+                            }
+                        }
+                    }
+                }
+            }, threads);
+        }
+    };
+
+    // returns image dimension in pixels (e.g. 4208 x 3120)
+    template <typename T>
+    inline roi_point get_dim(planar_bayer_image<T> &img) { return img.get_dim(); }
+
+    // returns image dimension of a single color channel of planar raw image
+    template <typename T>
+    inline roi_point get_channel_dim(planar_bayer_image<T> &img) { return img.get_channel_dim(); }
+}
@@ -33,9 +33,12 @@
 #include "Teisko/Image/Algorithms.hpp"
 #include "Teisko/BayerImage.hpp"
 #include "Teisko/BayerInfo.hpp"
+#include "Teisko/PlanarBayerImage.hpp"
 #include "Teisko/Chromaticity.hpp"
+#include "Teisko/Algorithm/CpuFeatures.hpp"
 #include "Teisko/Algorithm/Interpolate.hpp"     // needed by black_level_model
 #include "Teisko/Algorithm/ConvexHull.hpp"
+#include "Teisko/Algorithm/Parallel.hpp"
 #include "Teisko/Algorithm/VectorMedian.hpp"
 
 #include <cstdint>
@@ -237,6 +240,338 @@ namespace Teisko
         return copy.region(size, dims);
     }
 
+    /// Returns the I, H, V, X or O average of pixel `m` without modifying the image
+    /// - matches kernel_function<T, kernel>::func exactly
+    template <typename T>
+    T demosaic_kernel_value(const T *m, int skipy, kernel_functions_e kernel)
+    {
+        switch (kernel)
+        {
+        case kernel_functions_e::H: return round_shift<T, 1>(m[-1] + m[1]);
+        case kernel_functions_e::V: return round_shift<T, 1>(m[-skipy] + m[skipy]);
+        case kernel_functions_e::X: return round_shift<T, 2>(m[-skipy - 1] + m[-skipy + 1] + m[skipy - 1] + m[skipy + 1]);
+        case kernel_functions_e::O: return round_shift<T, 2>(m[-skipy] + m[skipy] + m[-1] + m[1]);
+        default: return m[0];
+        }
+    }
+
+    /// Rounded average of four 16-bit vectors computed in 32 bits: (a + b + c + d + 2) >> 2
+    inline __m128i average4_epu16_sse4(__m128i a, __m128i b, __m128i c, __m128i d)
+    {
+        auto zero = _mm_setzero_si128();
+        auto two = _mm_set1_epi32(2);
+        auto lo = _mm_add_epi32(_mm_add_epi32(_mm_unpacklo_epi16(a, zero), _mm_unpacklo_epi16(b, zero)),
+            _mm_add_epi32(_mm_unpacklo_epi16(c, zero), _mm_unpacklo_epi16(d, zero)));
+        auto hi = _mm_add_epi32(_mm_add_epi32(_mm_unpackhi_epi16(a, zero), _mm_unpackhi_epi16(b, zero)),
+            _mm_add_epi32(_mm_unpackhi_epi16(c, zero), _mm_unpackhi_epi16(d, zero)));
+        lo = _mm_srli_epi32(_mm_add_epi32(lo, two), 2);
+        hi = _mm_srli_epi32(_mm_add_epi32(hi, two), 2);
+        return _mm_packus_epi32(lo, hi);
+    }
+
+    inline __m128i demosaic_kernel_sse4(const uint16_t *m, int skipy, kernel_functions_e kernel)
+    {
+        auto at = [m](int offset) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(m + offset)); };
+        switch (kernel)
+        {
+        case kernel_functions_e::H: return _mm_avg_epu16(at(-1), at(1));
+        case kernel_functions_e::V: return _mm_avg_epu16(at(-skipy), at(skipy));
+        case kernel_functions_e::X: return average4_epu16_sse4(at(-skipy - 1), at(-skipy + 1), at(skipy - 1), at(skipy + 1));
+        case kernel_functions_e::O: return average4_epu16_sse4(at(-skipy), at(skipy), at(-1), at(1));
+        default: return at(0);
+        }
+    }
+
+    TEISKO_TARGET_AVX2
+    inline __m256i average4_epu16_avx2(__m256i a, __m256i b, __m256i c, __m256i d)
+    {
+        auto zero = _mm256_setzero_si256();
+        auto two = _mm256_set1_epi32(2);
+        auto lo = _mm256_add_epi32(_mm256_add_epi32(_mm256_unpacklo_epi16(a, zero), _mm256_unpacklo_epi16(b, zero)),
+            _mm256_add_epi32(_mm256_unpacklo_epi16(c, zero), _mm256_unpacklo_epi16(d, zero)));
+        auto hi = _mm256_add_epi32(_mm256_add_epi32(_mm256_unpackhi_epi16(a, zero), _mm256_unpackhi_epi16(b, zero)),
+            _mm256_add_epi32(_mm256_unpackhi_epi16(c, zero), _mm256_unpackhi_epi16(d, zero)));
+        lo = _mm256_srli_epi32(_mm256_add_epi32(lo, two), 2);
+        hi = _mm256_srli_epi32(_mm256_add_epi32(hi, two), 2);
+        // unpack and pack both work within 128-bit lanes, so the pixel order is preserved
+        return _mm256_packus_epi32(lo, hi);
+    }
+
+    TEISKO_TARGET_AVX2
+    inline __m256i load_epu16_avx2(const uint16_t *m)
+    {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(m));
+    }
+
+    TEISKO_TARGET_AVX2
+    inline __m256i demosaic_kernel_avx2(const uint16_t *m, int skipy, kernel_functions_e kernel)
+    {
+        switch (kernel)
+        {
+        case kernel_functions_e::H: return _mm256_avg_epu16(load_epu16_avx2(m - 1), load_epu16_avx2(m + 1));
+        case kernel_functions_e::V: return _mm256_avg_epu16(load_epu16_avx2(m - skipy), load_epu16_avx2(m + skipy));
+        case kernel_functions_e::X:
+            return average4_epu16_avx2(load_epu16_avx2(m - skipy - 1), load_epu16_avx2(m - skipy + 1),
+                load_epu16_avx2(m + skipy - 1), load_epu16_avx2(m + skipy + 1));
+        case kernel_functions_e::O:
+            return average4_epu16_avx2(load_epu16_avx2(m - skipy), load_epu16_avx2(m + skipy),
+                load_epu16_avx2(m - 1), load_epu16_avx2(m + 1));
+        default: return load_epu16_avx2(m);
+        }
+    }
+
+    /// Demosaics 8 pixels at a time applying `even` kernel to even and `odd` kernel to odd columns
+    /// \returns    Number of pixels processed
+    inline int demosaic_row_sse4(const uint16_t *src, int skipy, uint16_t *dst, int count,
+        kernel_functions_e even, kernel_functions_e odd)
+    {
+        auto odd_mask = _mm_set1_epi32(static_cast<int>(0xffff0000u));
+        int x = 0;
+        for (; x + 8 <= count; x += 8)
+        {
+            auto e = demosaic_kernel_sse4(src + x, skipy, even);
+            auto o = even == odd ? e : demosaic_kernel_sse4(src + x, skipy, odd);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_blendv_epi8(e, o, odd_mask));
+        }
+        return x;
+    }
+
+    TEISKO_TARGET_AVX2
+    inline int demosaic_row_avx2(const uint16_t *src, int skipy, uint16_t *dst, int count,
+        kernel_functions_e even, kernel_functions_e odd)
+    {
+        auto odd_mask = _mm256_set1_epi32(static_cast<int>(0xffff0000u));
+        int x = 0;
+        for (; x + 16 <= count; x += 16)
+        {
+            auto e = demosaic_kernel_avx2(src + x, skipy, even);
+            auto o = even == odd ? e : demosaic_kernel_avx2(src + x, skipy, odd);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), _mm256_blendv_epi8(e, o, odd_mask));
+        }
+        return x;
+    }
+
+    /// Vectorized part of a demosaiced row -- only 16-bit pixels have SIMD kernels
+    /// \returns    Number of pixels processed
+    template <typename T>
+    int demosaic_row_simd(const T *, int, T *, int, kernel_functions_e, kernel_functions_e, simd_level_e)
+    {
+        return 0;
+    }
+
+    inline int demosaic_row_simd(const uint16_t *src, int skipy, uint16_t *dst, int count,
+        kernel_functions_e even, kernel_functions_e odd, simd_level_e level)
+    {
+        switch (supported_simd_level(level))
+        {
+        case simd_level_e::avx512:
+        case simd_level_e::avx2:
+            return demosaic_row_avx2(src, skipy, dst, count, even, odd);
+        case simd_level_e::sse4:
+            return demosaic_row_sse4(src, skipy, dst, count, even, odd);
+        default:
+            return 0;
+        }
+    }
+
+    /// \brief  Demosaics R, G and B from a bayer image using simple bilinear interpolation
+    /// Produces the same channels as three calls of demosaic_bilinear, but with a single
+    /// bordered copy of the input (plus one per R/B for 4x4 RGB-IR patterns) and a single
+    /// pass over the output, which is split to row bands processed in parallel
+    /// \param input       2x2 or 4x4 bayer image
+    /// \param rep_scheme  Border replication scheme
+    /// \param layout      Layout of the returned image
+    /// \param threads     Maximum number of threads (0 == hardware concurrency)
+    /// \param level       Highest instruction set tier to use for 16-bit pixels
+    template <typename T>
+    rgb_image_s<T> demosaic_bilinear_rgb(bayer_image_s<T> &input, uint32_t rep_scheme = ZERO_PAD,
+        rgb_layout_e layout = rgb_layout_e::paged, unsigned int threads = 0,
+        simd_level_e level = detected_simd_level())
+    {
+        if (input._layout.is_dp_4x2_sensor())
+            throw std::runtime_error("4x2 bayer images must be reduced to 2x2 format first");
+
+        auto dims = get_dim(input._layout);
+        auto size = input._img.size();
+        auto bordered = input._img.make_borders(dims, rep_scheme);
+        rgb_image_s<T> result(size, layout);
+
+        auto const I = kernel_functions_e::I;
+        auto const H = kernel_functions_e::H;
+        auto const V = kernel_functions_e::V;
+        auto const X1 = kernel_functions_e::X;
+        auto const O = kernel_functions_e::O;
+
+        struct channel_s
+        {
+            image<T> mosaic;                // bordered source having `color` at one or two pixels per quad
+            image<T> output;
+            kernel_functions_e kernels[4];  // top left, top right, bottom left, bottom right
+        } channels[3];
+
+        const color_info_e colors[3] = { color_info_e::red, color_info_e::green, color_info_e::blue };
+        const rgb_color_e targets[3] = { rgb_color_e::red, rgb_color_e::green, rgb_color_e::blue };
+        for (int c = 0; c < 3; c++)
+        {
+            auto &ch = channels[c];
+            auto channel = colors[c];
+            // 4x4 patterns get the missing R or B reconstructed to a copy of their own
+            ch.mosaic = input._layout.is_4x4_ir_sensor() && channel != color_info_e::green
+                ? bordered.convert_to()
+                : bordered;
+            auto pattern = reconstruct_cfa_bilinear(ch.mosaic, input._layout, channel, rep_scheme);
+            ch.output = result[targets[c]];
+
+            kernel_functions_e quad[4];
+            if (channel == pattern[0] && channel == pattern[3])
+                quad[0] = I, quad[1] = O, quad[2] = O, quad[3] = I;
+            else if (channel == pattern[1] && channel == pattern[2])
+                quad[0] = O, quad[1] = I, quad[2] = I, quad[3] = O;
+            else if (channel == pattern[0])
+                quad[0] = I, quad[1] = H, quad[2] = V, quad[3] = X1;
+            else if (channel == pattern[1])
+                quad[0] = H, quad[1] = I, quad[2] = X1, quad[3] = V;
+            else if (channel == pattern[2])
+                quad[0] = V, quad[1] = X1, quad[2] = I, quad[3] = H;
+            else if (channel == pattern[3])
+                quad[0] = X1, quad[1] = V, quad[2] = H, quad[3] = I;
+            else
+                throw std::runtime_error("Unrecognized bayer pattern");
+            std::copy(quad, quad + 4, ch.kernels);
+        }
+
+        auto width = static_cast<int>(size._x);
+        parallel_for_bands(0, static_cast<int>(size._y), 2, [&](int first, int last)
+        {
+            std::vector<T> row(width);
+            for (int y = first; y < last; y++)
+            {
+                for (auto &ch : channels)
+                {
+                    auto skipy = ch.mosaic._skip_y;
+                    const T *src = &ch.mosaic.at(y + dims._y, dims._x);
+                    auto even = ch.kernels[(y & 1) * 2];
+                    auto odd = ch.kernels[(y & 1) * 2 + 1];
+                    T *dst = &ch.output.at(y, 0);
+                    bool contiguous = ch.output._skip_x == 1;
+                    T *out = contiguous ? dst : row.data();
+
+                    auto x = demosaic_row_simd(src, skipy, out, width, even, odd, level);
+                    for (; x < width; x++)
+                        out[x] = demosaic_kernel_value(src + x, skipy, x & 1 ? odd : even);
+
+                    if (!contiguous)
+                    {
+                        for (x = 0; x < width; x++)
+                            dst[x * ch.output._skip_x] = row[x];
+                    }
+                }
+            }
+        }, threads);
+
+        return result;
+    }
+
+    /// Adds the weighted quads of one sensor row to `sums` -- 4 quads at a time
+    /// \returns Number of quads processed
+    inline int accumulate_quad_row_sse4(const uint16_t *row, int quads, int even_shift, int odd_shift, uint32_t *sums)
+    {
+        auto low_half = _mm_set1_epi32(0xffff);
+        auto even_count = _mm_cvtsi32_si128(even_shift);
+        auto odd_count = _mm_cvtsi32_si128(odd_shift);
+        int x = 0;
+        for (; x + 4 <= quads; x += 4)
+        {
+            auto pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + 2 * x));
+            auto even = _mm_sll_epi32(_mm_and_si128(pixels, low_half), even_count);
+            auto odd = _mm_sll_epi32(_mm_srli_epi32(pixels, 16), odd_count);
+            auto dst = reinterpret_cast<__m128i*>(sums + x);
+            _mm_storeu_si128(dst, _mm_add_epi32(_mm_loadu_si128(dst), _mm_add_epi32(even, odd)));
+        }
+        return x;
+    }
+
+    /// AVX2 version of `accumulate_quad_row_sse4` -- 8 quads at a time
+    TEISKO_TARGET_AVX2
+    inline int accumulate_quad_row_avx2(const uint16_t *row, int quads, int even_shift, int odd_shift, uint32_t *sums)
+    {
+        auto low_half = _mm256_set1_epi32(0xffff);
+        auto even_count = _mm_cvtsi32_si128(even_shift);
+        auto odd_count = _mm_cvtsi32_si128(odd_shift);
+        int x = 0;
+        for (; x + 8 <= quads; x += 8)
+        {
+            auto pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + 2 * x));
+            auto even = _mm256_sll_epi32(_mm256_and_si256(pixels, low_half), even_count);
+            auto odd = _mm256_sll_epi32(_mm256_srli_epi32(pixels, 16), odd_count);
+            auto dst = reinterpret_cast<__m256i*>(sums + x);
+            _mm256_storeu_si256(dst, _mm256_add_epi32(_mm256_loadu_si256(dst), _mm256_add_epi32(even, odd)));
+        }
+        return x;
+    }
+
+    /// Returns the luminance (R + G + B) / 3 of a 2x2 bayer image averaged over blocks of
+    /// `quads` x `quads` CFA quads, where G is the mean of the two green pixels of a quad
+    /// - the result is 1 / (2 * quads) of the image size; incomplete blocks are ignored
+    /// - R,G,B are not demosaiced: the result equals the area average of (2R + G1 + G2 + 2B) / 6
+    /// \param img     Bayer image of rggb, grbg, gbrg or bggr layout
+    /// \param quads   Width and height of the averaged block in quads
+    /// \param threads Maximum number of threads (0 == hardware concurrency)
+    /// \param level   Highest instruction set tier to use
+    inline image<uint16_t> bayer_luminance_subsample(bayer_image_s<uint16_t> &img, int quads,
+        unsigned int threads = 0, simd_level_e level = detected_simd_level())
+    {
+        if (!img._layout.is_2x2_sensor())
+            throw std::invalid_argument("Luminance subsampling needs a 2x2 RGB bayer layout");
+        if (quads < 1 || quads > 64)
+            throw std::invalid_argument("Unsupported block size in bayer_luminance_subsample");
+
+        auto quad_width = static_cast<int>(img._img._width) / 2;
+        auto output = image<uint16_t>(static_cast<int>(img._img._height) / (2 * quads), quad_width / quads);
+        auto width = static_cast<int>(output._width);
+        auto used_quads = width * quads;
+        auto divisor = static_cast<uint32_t>(6 * quads * quads);
+
+        // Red and blue are weighted by two (shift by one), the greens by one
+        int shifts[4];
+        for (int i = 0; i < 4; i++)
+            shifts[i] = img._layout[i] == color_info_e::green ? 0 : 1;
+
+        level = supported_simd_level(level);
+        bool contiguous = img._img._skip_x == 1;
+
+        parallel_for(0, static_cast<int>(output._height), [&](int y)
+        {
+            std::vector<uint32_t> sums(used_quads, 0);
+            for (int j = 0; j < 2 * quads; j++)
+            {
+                auto sensor_y = y * 2 * quads + j;
+                auto row = &img._img.at(sensor_y, 0);
+                auto even_shift = shifts[(j & 1) * 2];
+                auto odd_shift = shifts[(j & 1) * 2 + 1];
+                int x = 0;
+                if (contiguous && level >= simd_level_e::avx2)
+                    x = accumulate_quad_row_avx2(row, used_quads, even_shift, odd_shift, sums.data());
+                else if (contiguous && level >= simd_level_e::sse4)
+                    x = accumulate_quad_row_sse4(row, used_quads, even_shift, odd_shift, sums.data());
+                for (; x < used_quads; x++)
+                {
+                    auto even = static_cast<uint32_t>(row[2 * x * img._img._skip_x]);
+                    auto odd = static_cast<uint32_t>(row[(2 * x + 1) * img._img._skip_x]);
+                    sums[x] += (even << even_shift) + (odd << odd_shift);
+                }
+            }
+            for (int x = 0; x < width; x++)
+            {
+                uint32_t sum = 0;
+                for (int i = 0; i < quads; i++)
+                    sum += sums[x * quads + i];
+                output(y, x) = static_cast<uint16_t>((sum + divisor / 2) / divisor);
+            }
+        }, threads);
+        return output;
+    }
+
     // Top level function to perform I,X or O(2) function to all 4x4 subpixels in SVE pattern
     // There are 16 functions, but only 8 of those are independent
     template <typename T,
@@ -360,8 +695,9 @@ namespace Teisko
     /// \param  img         image to calculate
     /// \param  pattern     String encoding of Bayer sensor order e.g. "RGGB"
     /// \returns    Chromaticity R/G B/G and I/G
-    template <typename T>
-    chromaticity get_flatfield_white_point(bayer_image_s<T> &b_img)
+    /// Accepts bayer_image_s<T> or planar_bayer_image<T>
+    template <typename T, template <typename> class bayer_type>
+    chromaticity get_flatfield_white_point(bayer_type<T> &b_img)
     {
         using pixel_type = T;
         chromaticity_factory_f statistics{};
@@ -409,26 +745,57 @@ namespace Teisko
     };
 
     /// \brief  Domain specific Black Level Interpolator with two dimensions
+    /// The grid points are compiled to a flat table on every change, so the lookups
+    /// are read only and can be shared between threads
     struct black_level_model : private interpolate_x_dim<float>
     {
         using type = float;
+
+        black_level_model() : _compiled(*this) { }
+
         /// Add data at a grid point
         black_level_model& set(type ag, type exp, std::vector<type> data)
         {
             interpolate_x_dim<type>::set({ ag, exp }, data);
+            _compiled = compiled_interpolate_x_dim<type>(*this);
             return *this;
         }
 
         /// Interpolates the model data by at point
-        std::vector<type> get(type ag, type exp)
+        std::vector<type> get(type ag, type exp) const
+        {
+            std::vector<type> result(_compiled.max_leaf_size());
+            result.resize(get(ag, exp, result.data()));
+            return result;
+        }
+
+        /// Interpolates the model data at point without allocations
+        /// \param out     Buffer of at least `max_size()` items
+        /// \returns       Number of items written
+        size_t get(type ag, type exp, type *out) const
+        {
+            const type keys[2] = { ag, exp };
+            return _compiled.lookup(keys, 2, out);
+        }
+
+        /// Interpolates the model data at `count` (ag, exp) pairs
+        /// \param out     Buffer of `count` * `max_size()` items -- one block per pair
+        void get(const type *ag_exp_pairs, size_t count, type *out, size_t *sizes = nullptr) const
         {
-            return interpolate_x_dim<type>::get({ ag, exp });
+            _compiled.lookup(ag_exp_pairs, 2, count, out, sizes);
         }
+
+        /// Returns the maximum number of items returned by a lookup
+        size_t max_size() const { return _compiled.max_leaf_size(); }
+
+    private:
+        compiled_interpolate_x_dim<type> _compiled;
     };
 
     /// Removes black level from teisko_image<T> with associated bayer_info
-    template <typename T, typename U>
-    static void remove_black_level(bayer_image_s<T> &img, std::vector<U> &black_level)
+    /// Accepts bayer_image_s<T> or planar_bayer_image<T>
+    template <typename T, typename U, template <typename> class bayer_type>
+    static void remove_black_level(bayer_type<T> &img, std::vector<U> &black_level)
     {
         if (black_level.size() == 0)
             return;
@@ -469,6 +836,13 @@ namespace Teisko
         {}
     };
 
+    /// Method of resampling the contamination grids to channel resolution
+    enum class ir_weight_interpolation_e
+    {
+        polynomial,     ///< 4th order polynomial fit of the grid -- full resolution weights are cached
+        bilinear        ///< Weights are interpolated from the grid on the fly while removing
+    };
+
     /// Container and algorithm for RGB IR Contamination Removal
     ///  - dependencies to:  image<T>
     ///                      polynomial (up)scaling / modeling
@@ -511,14 +885,17 @@ namespace Teisko
                     return true;
             }
             _rgb_ir.push_back(data_point);
+            clear_cache();
 
             return true;
         }
 
         /// \brief Removes the IR contamination from image
         /// \param img      Image to modify with black level removed
-        template <typename T>
-        void remove_ir_contamination(bayer_image_s<T> &img)
+        ///                 -- bayer_image_s<T> or planar_bayer_image<T>
+        /// \param threads  Maximum number of threads used by bilinear interpolation (0 == hardware concurrency)
+        template <typename T, template <typename> class bayer_type>
+        void remove_ir_contamination(bayer_type<T> &img, unsigned int threads = 0)
         {
             //  Step 0:  Determine the IR channels for the layout
             //  Step 1:  Calculate image chromaticities
@@ -556,19 +933,20 @@ namespace Teisko
             }
 
             // Calculate Image Chromaticity
-            chromaticity white_point = get_flatfield_white_point(img);
+            chromaticity white_point = quantize(get_flatfield_white_point(img));
 
-            // Interpolate the grids in Chromaticity space
-            auto interpolated_grid = interpolate(white_point);
+            // Interpolate the grids in Chromaticity space and upscale them to bayer image dimensions
+            // - or fetch the upscaled grid cached earlier for the same white point
+            auto bilinear = _weight_interpolation == ir_weight_interpolation_e::bilinear;
+            auto computed_grid = bilinear ? interpolate(white_point) : rgb_ir_struct{};
+            auto &correction_grid = bilinear ? computed_grid
+                : get_upscaled_grid(white_point, get_channel_dim(img), computed_grid);
 
-            if (interpolated_grid._grid_data.size() == 0)
+            if (correction_grid._grid_data.size() == 0)
                 throw std::runtime_error("Interpolation by white point failed");
 
-            // Upscale IR to bayer image dimensions
-            auto upscaled_grid = upscale(interpolated_grid, get_channel_dim(img));
-
             // get the top 2x2, 4x2 or 4x4 portion of the grid indices
-            auto correction_grid_remapped = remap_4x4_vector(upscaled_grid._grid_indices, img._layout);
+            auto correction_grid_remapped = remap_4x4_vector(correction_grid._grid_indices, img._layout);
 
             //  Step 4:  Remove IR contamination from the image data (J = I - wX),
             //                                                  where J = restored pixel value
@@ -583,7 +961,13 @@ namespace Teisko
 
                 auto color_chan = img[i];   // channel needing contamination removal
                 auto ir_channel = img[ir_ch_indices[i]];    // IR channel
-                auto ir_contamination = get_channel(upscaled_grid, correction_grid_ind);
+                auto ir_contamination = get_channel(correction_grid, correction_grid_ind);
+
+                if (bilinear)
+                {
+                    remove_bilinear(color_chan, ir_channel, ir_contamination, threads);
+                    continue;
+                }
 
                 color_chan.foreach([](T &dst, T &ir, float &weight)
                 {
@@ -600,10 +984,126 @@ namespace Teisko
             return _channel_count > 0 && _rgb_ir.size() > 0;
         }
 
+        /// Discards the cached full resolution grids
+        /// -- must be called after modifying `_rgb_ir` directly
+        void clear_cache() { _upscaled.clear(); }
+
+        /// Returns the number of cached full resolution grids
+        size_t cached_grid_count() const { return _upscaled.size(); }
+
         std::vector<rgb_ir_struct> _rgb_ir;      ///< Stored data
 
+        /// Resampling method of the interpolated grid
+        ir_weight_interpolation_e _weight_interpolation = ir_weight_interpolation_e::polynomial;
+        /// Quantization step of the image white point -- with the cache enabled, images with
+        /// the same quantized white point share the upscaled grid, which is then interpolated
+        /// at the quantized white point; zero (default) uses the exact white point
+        double _white_point_step = 0.0;
+        /// Maximum number of cached full resolution grids -- zero (default) disables the cache:
+        /// the grid is then upscaled for every image and the model is not modified.
+        /// Enable the cache for sequences of frames, whose (quantized) white points repeat
+        size_t _max_cached_grids = 0;
+
     private:
         uint32_t _channel_count;                 ///< For internal use -- updated from first ADD
+        std::vector<rgb_ir_struct> _upscaled;    ///< Upscaled grids by white point, oldest first
+
+        chromaticity quantize(chromaticity white_point)
+        {
+            if (_white_point_step <= 0)
+                return white_point;
+            auto step = _white_point_step;
+            auto q = [step](double x) { return std::round(x / step) * step; };
+            return chromaticity(q(white_point._r_per_g), q(white_point._b_per_g), q(white_point._i_per_g));
+        }
+
+        // Returns the interpolated grid upscaled to channel resolution -- either from the cache,
+        // or computed to the cache, or to `computed` when the cache is disabled
+        rgb_ir_struct& get_upscaled_grid(chromaticity white_point, roi_point size, rgb_ir_struct &computed)
+        {
+            if (_max_cached_grids > 0)
+            {
+                for (auto &grid : _upscaled)
+                {
+                    if (grid._chromaticity == white_point &&
+                        grid._grid_width == (uint32_t)size._x && grid._grid_height == (uint32_t)size._y)
+                        return grid;
+                }
+            }
+
+            auto interpolated_grid = interpolate(white_point);
+            if (interpolated_grid._grid_data.size() == 0)
+                throw std::runtime_error("Interpolation by white point failed");
+
+            if (_max_cached_grids == 0)
+            {
+                computed = upscale(interpolated_grid, size);
+                return computed;
+            }
+            while (_upscaled.size() >= _max_cached_grids)
+                _upscaled.erase(_upscaled.begin());
+            _upscaled.push_back(upscale(interpolated_grid, size));
+            return _upscaled.back();
+        }
+
+        // Removes the contamination with weights bilinearly interpolated from the coarse grid
+        // - the grid corners are aligned to the channel corners as in polynomial scaling
+        template <typename T>
+        static void remove_bilinear(image<T> &color_chan, image<T> &ir_channel, image<float> grid, unsigned int threads)
+        {
+            auto grid_width = static_cast<int>(grid._width);
+            auto grid_height = static_cast<int>(grid._height);
+            auto width = static_cast<int>(color_chan._width);
+            auto height = static_cast<int>(color_chan._height);
+
+            // Returns the left sample and the fractional position of `i` in range 0..size-1
+            auto sample_position = [](int i, int size, int grid_size, float &frac)
+            {
+                if (size < 2 || grid_size < 2)
+                {
+                    frac = 0.0f;
+                    return 0;
+                }
+                auto pos = static_cast<double>(i) * (grid_size - 1) / (size - 1);
+                auto left = std::min(static_cast<int>(pos), grid_size - 2);
+                frac = static_cast<float>(pos - left);
+                return left;
+            };
+
+            std::vector<int> left(width);
+            std::vector<float> frac_x(width);
+            for (int x = 0; x < width; x++)
+                left[x] = sample_position(x, width, grid_width, frac_x[x]);
+            auto right_offset = grid_width > 1 ? 1 : 0;
+            auto down_offset = grid_height > 1 ? 1 : 0;
+
+            parallel_for_bands(0, height, 1, [&](int first, int last)
+            {
+                std::vector<float> grid_row(grid_width);
+                for (int y = first; y < last; y++)
+                {
+                    float frac_y;
+                    auto top = sample_position(y, height, grid_height, frac_y);
+                    for (int x = 0; x < grid_width; x++)
+                    {
+                        auto a = grid(top, x);
+                        grid_row[x] = a + frac_y * (grid(top + down_offset, x) - a);
+                    }
+
+                    auto dst = &color_chan(y, 0);
+                    auto ir = &ir_channel(y, 0);
+                    for (int x = 0; x < width; x++)
+                    {
+                        auto a = grid_row[left[x]];
+                        auto weight = a + frac_x[x] * (grid_row[left[x] + right_offset] - a);
+                        auto ir_reduction = static_cast<float>(ir[x * ir_channel._skip_x]) * weight;
+                        auto &d = dst[x * color_chan._skip_x];
+                        auto pixel = static_cast<float>(d);
+                        d = (pixel < ir_reduction) ? (T)0 : reduce_to<T>(pixel - ir_reduction);
+                    }
+                }
+            }, threads);
+        }
 
         // Interprets contamination removal grid as Teisko image
         image<float> get_channel(rgb_ir_struct &orig, uint32_t channel)
@@ -745,27 +1245,76 @@ namespace Teisko
 
         linearization_s() = default;
 
-        void linearize(bayer_image_s<uint16_t> &img, int max_val = 65535)
+        /// Prepares the LUTs of a layout and output range for `linearize`
+        /// Tables compiled from earlier `grid_indices` or `knee_points` are discarded
+        void compile(bayer_info_s &layout, int max_val = 65535)
+        {
+            _compiled.erase(std::remove_if(_compiled.begin(), _compiled.end(),
+                [this](const compiled_lut_s &lut) { return !is_compiled_from(lut); }), _compiled.end());
+            if (find_compiled(layout, max_val) == nullptr)
+                _compiled.push_back(compile_lut(layout, max_val));
+        }
+
+        /// Applies the per channel transfer functions to the image
+        /// Uses the LUTs prepared by `compile` while `grid_indices` and `knee_points`
+        /// stay the same, otherwise compiles them for this call only
+        /// \param img     Image to linearize in place
+        /// \param max_val Maximum output value
+        /// \param threads Maximum number of threads (0 == hardware concurrency)
+        /// \param level   Highest instruction set tier to use
+        void linearize(bayer_image_s<uint16_t> &img, int max_val = 65535, unsigned int threads = 0,
+            simd_level_e level = detected_simd_level()) const
         {
             if (grid_indices.size() != 16 || knee_points.size() == 0)
                 return;
 
-            for (auto ch : img) // loop over channel indices
+            compiled_lut_s local;
+            auto found = find_compiled(img._layout, max_val);
+            if (found == nullptr)
             {
-                auto lut = make_lut(img, ch, max_val);
-                auto size = lut.size();
-                if (size == 0)
-                    continue;
-                auto chan = img[ch];
-
-                uint16_t *lut_ptr = &lut[0];
-                uint16_t max_x = static_cast<uint16_t>(size - 1);
-                chan.foreach([lut_ptr, max_x](uint16_t &d) { d = lut_ptr[d > max_x ? max_x : d]; });
+                local = compile_lut(img._layout, max_val);
+                found = &local;
             }
+            auto &compiled = *found;
+            auto w = static_cast<int>(img._layout.get_width());
+            auto h = static_cast<int>(img._layout.get_height());
+            auto width = static_cast<int>(img._img._width);
+            bool use_simd = img._img._skip_x == 1 && 8 % w == 0 &&
+                supported_simd_level(level) >= simd_level_e::avx2;
+
+            parallel_for_bands(0, static_cast<int>(img._img._height), 1, [&](int first, int last)
+            {
+                for (int y = first; y < last; y++)
+                {
+                    auto row_channel = (y % h) * w;
+                    auto row = &img._img.at(y, 0);
+                    int x = 0;
+                    if (use_simd)
+                        x = apply_lut_row_avx2(row, width, compiled.table.data(),
+                            &compiled.offset[row_channel], &compiled.max_index[row_channel], w);
+
+                    for (; x < width; x++)
+                    {
+                        auto ch = row_channel + x % w;
+                        auto offset = compiled.offset[ch];
+                        if (offset < 0)
+                            continue;
+                        auto &d = row[x * img._img._skip_x];
+                        auto max_x = compiled.max_index[ch];
+                        d = compiled.table[offset + (d > max_x ? max_x : d)];
+                    }
+                }
+            }, threads);
         }
 
         // Convert the knee points to LUT
-        std::vector<uint16_t> make_lut(bayer_image_s<uint16_t> &img, int channel, int max_output)
+        std::vector<uint16_t> make_lut(bayer_image_s<uint16_t> &img, int channel, int max_output) const
+        {
+            return make_lut(img._layout, channel, max_output);
+        }
+
+        // Convert the knee points to LUT for a channel of given sensor layout
+        std::vector<uint16_t> make_lut(bayer_info_s &layout, int channel, int max_output) const
         {
             auto clip = [](int val, int max_val)
             {
@@ -774,7 +1323,7 @@ namespace Teisko
             if (grid_indices.size() != 16)
                 return{};
 
-            auto grid = remap_4x4_vector(grid_indices, img._layout);
+            auto grid = remap_4x4_vector(grid_indices, layout);
             if (channel < 0 || channel >= static_cast<int>(grid.size()) ||
                 grid[channel] < 0 || static_cast<size_t>(grid[channel]) > knee_points.size())
                 return{};
@@ -808,6 +1357,211 @@ namespace Teisko
             lut.back() = static_cast<uint16_t>(clip(kneepoints.back()._y, max_output));
             return lut;
         }
+
+    private:
+        /// LUTs of all channels of a layout concatenated to a single table
+        struct compiled_lut_s
+        {
+            bayer_pattern_e layout;
+            int max_output;
+            std::vector<int8_t> grid_indices;                   // inputs the table was made from
+            std::vector<std::vector<roi_point>> knee_points;
+            std::vector<uint16_t> table;                        // one padding item for 32-bit gathers
+            std::vector<int32_t> offset;                        // start of channel LUT or -1 for identity
+            std::vector<int32_t> max_index;                     // last valid index of channel LUT
+        };
+        std::vector<compiled_lut_s> _compiled;
+
+        bool is_compiled_from(const compiled_lut_s &lut) const
+        {
+            if (lut.grid_indices != grid_indices || lut.knee_points.size() != knee_points.size())
+                return false;
+            for (size_t i = 0; i < knee_points.size(); i++)
+            {
+                auto &a = lut.knee_points[i];
+                auto &b = knee_points[i];
+                if (a.size() != b.size())
+                    return false;
+                for (size_t j = 0; j < a.size(); j++)
+                    if (a[j]._x != b[j]._x || a[j]._y != b[j]._y)
+                        return false;
+            }
+            return true;
+        }
+
+        const compiled_lut_s *find_compiled(bayer_info_s &layout, int max_output) const
+        {
+            auto pattern = static_cast<bayer_pattern_e>(layout);
+            for (auto &lut : _compiled)
+                if (lut.layout == pattern && lut.max_output == max_output && is_compiled_from(lut))
+                    return &lut;
+            return nullptr;
+        }
+
+        compiled_lut_s compile_lut(bayer_info_s &layout, int max_output) const
+        {
+            auto pattern = static_cast<bayer_pattern_e>(layout);
+            compiled_lut_s lut{ pattern, max_output, grid_indices, knee_points, {}, {}, {} };
+            // Channels sharing a knee point set share the LUT
+            auto grid = remap_4x4_vector(grid_indices, layout);
+            std::map<int, int32_t> offset_by_set;
+            for (auto ch : layout)
+            {
+                auto channel_lut = make_lut(layout, static_cast<int>(ch), max_output);
+                if (channel_lut.empty())
+                {
+                    lut.offset.push_back(-1);
+                    lut.max_index.push_back(0);
+                    continue;
+                }
+                auto it = offset_by_set.find(grid[ch]);
+                if (it == offset_by_set.end())
+                {
+                    it = offset_by_set.emplace(grid[ch], static_cast<int32_t>(lut.table.size())).first;
+                    lut.table.insert(lut.table.end(), channel_lut.begin(), channel_lut.end());
+                }
+                lut.offset.push_back(it->second);
+                lut.max_index.push_back(static_cast<int32_t>(channel_lut.size() - 1));
+            }
+            lut.table.push_back(0);
+            return lut;
+        }
+
+        /// Linearizes 8 pixels at a time with 32-bit gathers from the concatenated table
+        /// - `offset` and `max_index` point to the `w` channels of the row, where w divides 8
+        /// \returns Number of pixels processed
+        TEISKO_TARGET_AVX2
+        static int apply_lut_row_avx2(uint16_t *row, int count, const uint16_t *table,
+            const int32_t *offset, const int32_t *max_index, int w)
+        {
+            alignas(32) int32_t offsets[8];
+            alignas(32) int32_t max_indices[8];
+            alignas(32) int32_t keep[8];
+            for (int i = 0; i < 8; i++)
+            {
+                auto identity = offset[i % w] < 0;
+                offsets[i] = identity ? 0 : offset[i % w];
+                max_indices[i] = identity ? 0 : max_index[i % w];
+                keep[i] = identity ? -1 : 0;
+            }
+            auto base = _mm256_load_si256(reinterpret_cast<const __m256i*>(offsets));
+            auto max_x = _mm256_load_si256(reinterpret_cast<const __m256i*>(max_indices));
+            auto keep_mask = _mm256_load_si256(reinterpret_cast<const __m256i*>(keep));
+            auto low_half = _mm256_set1_epi32(0xffff);
+
+            int x = 0;
+            for (; x + 8 <= count; x += 8)
+            {
+                auto pixels = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x)));
+                auto index = _mm256_add_epi32(_mm256_min_epi32(pixels, max_x), base);
+                auto value = _mm256_i32gather_epi32(reinterpret_cast<const int*>(table), index, 2);
+                value = _mm256_blendv_epi8(_mm256_and_si256(value, low_half), pixels, keep_mask);
+                // pack within lanes and collect the two low quad words
+                auto packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(value, value), 0x08);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(row + x), _mm256_castsi256_si128(packed));
+            }
+            return x;
+        }
+    };
+
+    /// Resolution at which the LSC gain reference is low pass filtered
+    enum class lsc_gain_mode_e
+    {
+        full_resolution,    ///< median7x7 and gaussian35x35 at channel resolution
+        pyramid             ///< block median reduction, equivalent gaussian at low resolution
+    };
+
+    /// Low pass filtered flat field channel at reduced resolution
+    /// - sampled bilinearly at the pixel centers of the full resolution channel
+    /// - on smooth flat fields the resulting gains deviate less than 1% from the full
+    ///   resolution gains, where the deviation is largest at the image corners
+    struct lsc_pyramid_reference_s
+    {
+        image<float> _reference;        ///< Filtered flat field at 1/factor resolution
+        float _max_value;               ///< Maximum of the filtered flat field
+        std::vector<int> _x0, _y0;      ///< Sample left / above of each channel column / row
+        std::vector<int> _x1, _y1;      ///< Sample right / below of each channel column / row
+        std::vector<float> _fx, _fy;    ///< Weight of the right / lower sample
+
+        /// Reduces `channel` by block medians of `factor` x `factor` pixels and filters
+        /// the result with a gaussian, whose support and sigma are those of gaussian35x35 / factor
+        template <typename T>
+        lsc_pyramid_reference_s(image<T> &channel, int factor)
+            : _reference((channel._height + factor - 1) / factor, (channel._width + factor - 1) / factor)
+            , _max_value(0.0f)
+        {
+            auto height = static_cast<int>(channel._height);
+            auto width = static_cast<int>(channel._width);
+            std::vector<float> block;
+            for (int y = 0; y < static_cast<int>(_reference._height); y++)
+            {
+                for (int x = 0; x < static_cast<int>(_reference._width); x++)
+                {
+                    block.clear();
+                    for (int j = y * factor; j < std::min((y + 1) * factor, height); j++)
+                        for (int i = x * factor; i < std::min((x + 1) * factor, width); i++)
+                            block.push_back(static_cast<float>(channel(j, i)));
+                    auto mid = block.begin() + block.size() / 2;
+                    std::nth_element(block.begin(), mid, block.end());
+                    _reference(y, x) = *mid;
+                }
+            }
+
+            filter_separable(_reference, make_kernel(factor), REPLICATE);
+            _max_value = (float)_reference.foreach(maximum_f<float>{});
+
+            sample_positions(width, factor, static_cast<int>(_reference._width), _x0, _x1, _fx);
+            sample_positions(height, factor, static_cast<int>(_reference._height), _y0, _y1, _fy);
+        }
+
+        /// Returns true if a channel of given size is large enough to be filtered at 1/factor resolution
+        static bool is_applicable(roi_point channel_size, int factor)
+        {
+            if (factor < 2)
+                return false;
+            auto taps = static_cast<int>(make_kernel(factor).size());
+            return (channel_size._x + factor - 1) / factor >= taps &&
+                (channel_size._y + factor - 1) / factor >= taps;
+        }
+
+        /// Bilinearly interpolated reference at channel pixel (y, x)
+        float operator()(int y, int x)
+        {
+            auto top = _reference(_y0[y], _x0[x]) + _fx[x] * (_reference(_y0[y], _x1[x]) - _reference(_y0[y], _x0[x]));
+            auto bot = _reference(_y1[y], _x0[x]) + _fx[x] * (_reference(_y1[y], _x1[x]) - _reference(_y1[y], _x0[x]));
+            return top + _fy[y] * (bot - top);
+        }
+
+    private:
+        // Truncated at +-17 pixels with sigma 12 at full resolution
+        static std::vector<double> make_kernel(int factor)
+        {
+            auto half = std::max(1, static_cast<int>(std::lround(17.0 / factor)));
+            auto sigma = 12.0 / factor;
+            std::vector<double> kernel(2 * half + 1);
+            double sum = 0;
+            for (int i = -half; i <= half; i++)
+                sum += kernel[i + half] = std::exp(-0.5 * i * i / (sigma * sigma));
+            for (auto &k : kernel)
+                k /= sum;
+            return kernel;
+        }
+
+        static void sample_positions(int size, int factor, int reduced_size,
+            std::vector<int> &first, std::vector<int> &second, std::vector<float> &frac)
+        {
+            first.resize(size);
+            second.resize(size);
+            frac.resize(size);
+            // The half samples at the borders are extrapolated linearly from the two outermost samples
+            for (int i = 0; i < size; i++)
+            {
+                auto pos = (i + 0.5) / factor - 0.5;
+                first[i] = std::min(std::max(static_cast<int>(std::floor(pos)), 0), std::max(reduced_size - 2, 0));
+                second[i] = std::min(first[i] + 1, reduced_size - 1);
+                frac[i] = second[i] == first[i] ? 0.0f : static_cast<float>(pos - first[i]);
+            }
+        }
     };
 
     // Commonly used preprocessing operations for
@@ -823,6 +1577,8 @@ namespace Teisko
         black_level_model bl_model{};
         float saturation{ 1023.0f };    // for 10-bit sensor
         uint16_t sve_matrix{ 0 };       // longest exposure
+        lsc_gain_mode_e lsc_mode{ lsc_gain_mode_e::full_resolution };
+        int lsc_pyramid_factor{ 4 };    // channel pixels per reference sample in pyramid mode
 
         /// Reconstructs MD, SVE-MD and SVE images
         bool sve_md_demosaic_bilinear(bayer_image_s<uint16_t> &img)
@@ -1288,45 +2044,404 @@ namespace Teisko
                 auto chan = img_ff[i];
                 auto dst_chan = img[i];
 
-                auto medi = median7x7(chan, SYMMETRIC);
-                gaussian35x35(medi, REPLICATE);
+                if (is_lsc_pyramid(chan.size()))
+                {
+                    auto reference = lsc_pyramid_reference_s(chan, lsc_pyramid_factor);
+                    auto maxitem = reference._max_value;
+                    parallel_for_bands(0, static_cast<int>(dst_chan._height), 1, [&](int first, int last)
+                    {
+                        for (int y = first; y < last; y++)
+                            for (int x = 0; x < static_cast<int>(dst_chan._width); x++)
+                            {
+                                auto &dst = dst_chan(y, x);
+                                dst = reduce_to<T>(lsc_gain(maxitem, reference(y, x)) * dst);
+                            }
+                    });
+                    continue;
+                }
 
-                auto maxitem = (float)(T)medi.foreach(maximum_f<T>{});
+                float maxitem;
+                auto medi = lsc_gain_reference(chan, maxitem);
 
                 dst_chan.foreach([maxitem](T &dst, T&src)
                 {
-                    float gain = maxitem / (float)src;
-                    if (gain > 10.0f)
-                        gain = 16.0f;
-                    dst = reduce_to<T>(gain * dst);
+                    dst = reduce_to<T>(lsc_gain(maxitem, (float)src) * dst);
                 }, medi);
             }
         }
+
+        /// Returns true if the LSC reference of a channel of given size is computed in pyramid mode
+        /// - too small channels are filtered at full resolution
+        bool is_lsc_pyramid(roi_point channel_size)
+        {
+            return lsc_mode == lsc_gain_mode_e::pyramid &&
+                lsc_pyramid_reference_s::is_applicable(channel_size, lsc_pyramid_factor);
+        }
+
+        /// Low pass filtered flat field channel, whose reciprocal scaled by `max_value` is the LSC gain
+        template <typename T>
+        static image<T> lsc_gain_reference(image<T> &channel, float &max_value)
+        {
+            auto medi = median7x7(channel, SYMMETRIC);
+            gaussian35x35(medi, REPLICATE);
+            max_value = (float)(T)medi.foreach(maximum_f<T>{});
+            return medi;
+        }
+
+        /// LSC gain of a pixel whose low pass filtered reference value is `reference`
+        static float lsc_gain(float max_value, float reference)
+        {
+            float gain = max_value / reference;
+            if (gain > 10.0f)
+                gain = 16.0f;
+            return gain;
+        }
     };
 
 
-    inline image<uint16_t> median_subsample_7x7(image<uint16_t> &big)
+    /// Preprocessing of preprocessor_s compiled for one sensor layout, analog gain and exposure
+    /// Produces bit identical results with the preprocessor_s functions, but
+    ///  - the point operations (linearization, black level, stretch and saturation) are
+    ///    fused into a single pass over the raw data and split to row bands between threads
+    ///  - the LSC reference channels are filtered in parallel and the gain, the saturation
+    ///    clamp, DP reduction and the conversion back to T are fused into a second pass
+    ///  - IR contamination removal and the CFA / SVE reconstructions run in between as before
+    ///    over the whole frame -- they are not tiled, since the IR removal depends on the
+    ///    white point of the whole image and the LSC gain on the maximum of each reference
+    /// The preprocessor_s must outlive the pipeline
+    template <typename T>
+    class preprocess_pipeline_s
+    {
+    public:
+        preprocess_pipeline_s(preprocessor_s &config, bayer_info_s layout,
+            float ag = 1.0f, float exp = 300.0f, unsigned int threads = 0)
+            : _config(&config)
+            , _layout(layout)
+            , _threads(threads)
+            , _saturation(config.saturation)
+        {
+            int multiplier = _layout.is_dp_4x2_sensor() ? 2 : 1;
+            auto bl = _config->get_black_level(_layout, ag, exp);
+            for (auto i : _layout)
+            {
+                _offset.push_back(bl[i]);
+                _stretch.push_back(_saturation / (_saturation - multiplier * bl[i]));
+            }
+            _luts.resize(_layout.get_channels());
+        }
+
+        /// Adds the linearization to the point operations -- equivalent to calling
+        /// `linearization.linearize(img, max_val)` before preprocessing
+        void set_linearization(linearization_s &linearization, int max_val = 65535)
+        {
+            if (!std::is_integral<T>::value)
+                throw std::invalid_argument("Linearization needs integral pixel type");
+            for (auto i : _layout)
+                _luts[i] = linearization.make_lut(_layout, static_cast<int>(i), max_val);
+        }
+
+        /// Same as preprocessor_s::preprocess_fn1
+        void preprocess_fn1(bayer_image_s<T> &image)
+        {
+            check_layout(image);
+            point_pass(image, image);
+        }
+
+        /// Same as preprocessor_s::preprocess_fn3a
+        void preprocess_fn3a(bayer_image_s<T> &ff_img)
+        {
+            check_layout(ff_img);
+            auto img = stretched_copy(ff_img);
+            reconstruct(img);
+            finish(ff_img, img, lsc_references(img));
+        }
+
+        /// Same as preprocessor_s::preprocess_fn3b
+        void preprocess_fn3b(bayer_image_s<T> &ccc_img, bayer_image_s<T> &ff_image)
+        {
+            check_layout(ccc_img);
+            check_layout(ff_image);
+            if (!ccc_img.matches_by_size_and_type(ff_image))
+                throw std::runtime_error("Flat field image must match the image by size and type");
+            auto img = stretched_copy(ccc_img);
+            auto img_pair = stretched_copy(ff_image);
+            reconstruct(img);
+            reconstruct(img_pair);
+            finish(ccc_img, img, lsc_references(img_pair));
+        }
+
+    private:
+        preprocessor_s *_config;
+        bayer_info_s _layout;
+        unsigned int _threads;
+        float _saturation;
+        std::vector<float> _offset;                 // black level per channel
+        std::vector<float> _stretch;                // multiplier per channel
+        std::vector<std::vector<uint16_t>> _luts;   // linearization per channel (or empty)
+
+        struct lsc_reference_s
+        {
+            std::vector<image<float>> channels;
+            std::vector<float> max_values;
+            std::vector<lsc_pyramid_reference_s> pyramids;  // used instead of channels in pyramid mode
+        };
+
+        void check_layout(bayer_image_s<T> &image)
+        {
+            if (!(image._layout == _layout))
+                throw std::runtime_error("Image layout doesn't match the compiled pipeline");
+        }
+
+        /// Linearization, black level removal and stretching between 0 and saturation
+        template <typename U>
+        void point_pass(bayer_image_s<T> &src, bayer_image_s<U> &dst)
+        {
+            auto w = static_cast<int>(_layout.get_width());
+            auto h = static_cast<int>(_layout.get_height());
+            auto width = static_cast<int>(src._img._width);
+            auto sat = _saturation;
+
+            parallel_for_bands(0, static_cast<int>(src._img._height), 1, [&](int first, int last)
+            {
+                for (int y = first; y < last; y++)
+                {
+                    auto row_channel = (y % h) * w;
+                    const T *s = &src._img.at(y, 0);
+                    U *d = &dst._img.at(y, 0);
+                    int sx = src._img._skip_x;
+                    int dx = dst._img._skip_x;
+                    for (int x = 0; x < width; x++)
+                    {
+                        auto ch = row_channel + x % w;
+                        T pixel = s[x * sx];
+                        auto &lut = _luts[ch];
+                        if (!lut.empty())
+                            pixel = linearize(pixel, lut);
+                        auto result = ((float)pixel - _offset[ch]) * _stretch[ch];
+                        if (result < 0)
+                            result = 0;
+                        if (result > sat)
+                            result = sat;
+                        d[x * dx] = (U)result;
+                    }
+                }
+            }, _threads);
+        }
+
+        template <typename U = T>
+        static typename std::enable_if<std::is_integral<U>::value, T>::type
+            linearize(T pixel, const std::vector<uint16_t> &lut)
+        {
+            auto max_x = lut.size() - 1;
+            auto index = static_cast<size_t>(pixel);
+            return static_cast<T>(lut[index > max_x ? max_x : index]);
+        }
+
+        template <typename U = T>
+        static typename std::enable_if<!std::is_integral<U>::value, T>::type
+            linearize(T pixel, const std::vector<uint16_t> &)
+        {
+            return pixel;
+        }
+
+        bayer_image_s<float> stretched_copy(bayer_image_s<T> &src)
+        {
+            bayer_image_s<float> img(src._img._height, src._img._width, static_cast<bayer_pattern_e>(_layout));
+            point_pass(src, img);
+            return img;
+        }
+
+        /// The neighborhood operations changing the layout -- identical to preprocessor_s
+        void reconstruct(bayer_image_s<float> &img)
+        {
+            _config->rgb_ir_model.remove_ir_contamination(img);
+            _config->reconstruct_bayer_cfa(img);
+            _config->sve_demosaic_nearest_neighbor(img);
+        }
+
+        lsc_reference_s lsc_references(bayer_image_s<float> &img)
+        {
+            lsc_reference_s result;
+            auto channels = img._layout.get_channels();
+            if (_config->is_lsc_pyramid(img[0].size()))
+            {
+                for (auto i : img)
+                {
+                    auto chan = img[i];
+                    result.pyramids.emplace_back(chan, _config->lsc_pyramid_factor);
+                    result.max_values.push_back(result.pyramids.back()._max_value);
+                }
+                return result;
+            }
+            result.channels.resize(channels);
+            result.max_values.resize(channels);
+            parallel_for(0u, channels, [&](uint32_t i)
+            {
+                auto chan = img[i];
+                result.channels[i] = preprocessor_s::lsc_gain_reference(chan, result.max_values[i]);
+            }, _threads);
+            return result;
+        }
+
+        /// LSC gain, saturation and DP reduction, writing the result to `dst` as T
+        void finish(bayer_image_s<T> &dst, bayer_image_s<float> &img, lsc_reference_s refs)
+        {
+            auto &layout = img._layout;
+            auto w = static_cast<int>(layout.get_width());
+            auto h = static_cast<int>(layout.get_height());
+            bool is_dp = layout.is_dp_4x2_sensor();
+            auto height = static_cast<int>(img._img._height);
+            auto width = static_cast<int>(img._img._width) / (is_dp ? 2 : 1);
+            auto sat = _saturation;
+
+            image<T> output(height, width);
+            parallel_for_bands(0, height, 1, [&](int first, int last)
+            {
+                for (int y = first; y < last; y++)
+                {
+                    auto row_channel = (y % h) * w;
+                    auto gained = [&](int x)
+                    {
+                        auto ch = row_channel + x % w;
+                        auto reference = refs.pyramids.empty()
+                            ? refs.channels[ch](y / h, x / w)
+                            : refs.pyramids[ch](y / h, x / w);
+                        return reduce_to<float>(preprocessor_s::lsc_gain(refs.max_values[ch], reference) * img._img(y, x));
+                    };
+                    for (int x = 0; x < width; x++)
+                    {
+                        float pixel;
+                        if (is_dp)
+                        {
+                            pixel = gained(2 * x);
+                            pixel += gained(2 * x + 1);
+                        }
+                        else
+                        {
+                            pixel = gained(x);
+                        }
+                        if (pixel > sat)
+                            pixel = sat;
+                        output(y, x) = (T)pixel;
+                    }
+                }
+            }, _threads);
+
+            dst._img = output;
+            dst._layout = is_dp
+                ? bayer_info_s(_config->reduce_dp_layout(layout))
+                : layout;
+        }
+    };
+
+    /// Selects the k:th smallest value of 8 blocks at a time by the bit-plane method
+    /// - `elements` holds the n items of the blocks interleaved, biased by 0x8000
+    ///   to allow signed comparison, i.e. elements[8 * i + lane] = block[lane][i] ^ 0x8000
+    /// - each bit of the result is set, if less than k + 1 elements are smaller than the result so far
+    inline void block_select_sse4(const uint16_t *elements, int n, int k, uint16_t *result)
+    {
+        auto bias = _mm_set1_epi16(static_cast<short>(0x8000));
+        auto limit = _mm_set1_epi16(static_cast<short>(k + 1));
+        auto selected = _mm_setzero_si128();
+        for (int bit = 15; bit >= 0; bit--)
+        {
+            auto candidate = _mm_or_si128(selected, _mm_set1_epi16(static_cast<short>(1 << bit)));
+            auto biased = _mm_xor_si128(candidate, bias);
+            auto count = _mm_setzero_si128();
+            for (int i = 0; i < n; i++)
+            {
+                auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(elements + 8 * i));
+                count = _mm_sub_epi16(count, _mm_cmpgt_epi16(biased, v));
+            }
+            selected = _mm_blendv_epi8(selected, candidate, _mm_cmpgt_epi16(limit, count));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(result), selected);
+    }
+
+    /// AVX2 version of `block_select_sse4` -- processes 16 blocks at a time
+    TEISKO_TARGET_AVX2
+    inline void block_select_avx2(const uint16_t *elements, int n, int k, uint16_t *result)
     {
-        auto block_size = roi_point(7,7);
+        auto bias = _mm256_set1_epi16(static_cast<short>(0x8000));
+        auto limit = _mm256_set1_epi16(static_cast<short>(k + 1));
+        auto selected = _mm256_setzero_si256();
+        for (int bit = 15; bit >= 0; bit--)
+        {
+            auto candidate = _mm256_or_si256(selected, _mm256_set1_epi16(static_cast<short>(1 << bit)));
+            auto biased = _mm256_xor_si256(candidate, bias);
+            auto count = _mm256_setzero_si256();
+            for (int i = 0; i < n; i++)
+            {
+                auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(elements + 16 * i));
+                count = _mm256_sub_epi16(count, _mm256_cmpgt_epi16(biased, v));
+            }
+            selected = _mm256_blendv_epi8(selected, candidate, _mm256_cmpgt_epi16(limit, count));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(result), selected);
+    }
+
+    /// Subsamples the image by the medians of non-overlapping blocks
+    /// - the median is the item (w * h) / 2 of the sorted block; incomplete blocks are ignored
+    /// - the blocks of a row are processed 8 or 16 at a time, and the rows in parallel
+    /// \param big         Image to subsample
+    /// \param block_size  Width and height of each block -- blocks of at most 32767 pixels
+    /// \param threads     Maximum number of threads (0 == hardware concurrency)
+    /// \param level       Highest instruction set tier to use
+    inline image<uint16_t> median_subsample(image<uint16_t> &big, roi_point block_size,
+        unsigned int threads = 0, simd_level_e level = detected_simd_level())
+    {
+        if (block_size._x <= 0 || block_size._y <= 0 || block_size._x * block_size._y > 32767)
+            throw std::invalid_argument("Unsupported block size in median_subsample");
+
         auto output = image<uint16_t>(big.size() / block_size);
-        int skipx = big._skip_x;
-        int skipy = big._skip_y;
-        output.foreach([skipx, skipy](uint16_t &dst, uint16_t &src)
-        {
-            uint16_t arr[49];
-            uint16_t *s = &src;
-            uint16_t *a = &arr[0];
-            for (int y = 0; y < 7; y++, s += skipy)
+        const int n = block_size._x * block_size._y;
+        const int k = n / 2;
+        const int width = static_cast<int>(output._width);
+        level = supported_simd_level(level);
+        const int lanes = level >= simd_level_e::avx2 ? 16 : level >= simd_level_e::sse4 ? 8 : 1;
+
+        parallel_for(0, static_cast<int>(output._height), [&](int y)
+        {
+            std::vector<uint16_t> elements(n * lanes);
+            uint16_t selected[16];
+            int x = 0;
+            if (lanes > 1)
             {
-                for (int x = 0; x < 7; x++)
-                    *a++ = s[x * skipx];
+                for (; x + lanes <= width; x += lanes)
+                {
+                    for (int lane = 0; lane < lanes; lane++)
+                    {
+                        auto dst = elements.data() + lane;
+                        for (int j = 0; j < block_size._y; j++)
+                            for (int i = 0; i < block_size._x; i++, dst += lanes)
+                                *dst = big(y * block_size._y + j, (x + lane) * block_size._x + i) ^ 0x8000;
+                    }
+                    if (lanes == 16)
+                        block_select_avx2(elements.data(), n, k, selected);
+                    else
+                        block_select_sse4(elements.data(), n, k, selected);
+                    for (int lane = 0; lane < lanes; lane++)
+                        output(y, x + lane) = selected[lane];
+                }
             }
-            std::sort(arr, arr + 49);
-            dst = arr[24];
-        }, big.subview(block_size));
+            for (; x < width; x++)
+            {
+                auto dst = elements.begin();
+                for (int j = 0; j < block_size._y; j++)
+                    for (int i = 0; i < block_size._x; i++)
+                        *dst++ = big(y * block_size._y + j, x * block_size._x + i);
+                std::nth_element(elements.begin(), elements.begin() + k, elements.begin() + n);
+                output(y, x) = elements[k];
+            }
+        }, threads);
         return output;
     }
 
+    inline image<uint16_t> median_subsample_7x7(image<uint16_t> &big)
+    {
+        return median_subsample(big, roi_point(7, 7));
+    }
+
     /// Calculates the convex hull of R/G, B/G chromaticity coordinates
     /// from a (preprocessed) image
     /// The gamut points are quantized to 8q8 format -- and as such they
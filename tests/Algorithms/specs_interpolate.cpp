@@ -89,6 +89,71 @@ namespace teisto_interpolate_tests
         }
     }
 
+    SCENARIO("Interpolation tree can be compiled to a flat table")
+    {
+        GIVEN("A three dimensional tree with irregular keys, a single branch and a partial branch")
+        {
+            std::mt19937 rng(3);
+            std::uniform_real_distribution<float> value(-100.0f, 100.0f);
+            auto tree = interpolate_x_dim<float>{};
+            for (float x : { 1.0f, 2.0f, 8.0f })
+                for (float y : { -3.0f, 0.5f, 4.0f, 9.0f })
+                    for (float z : { 100.0f, 400.0f })
+                    {
+                        std::vector<float> data = { value(rng), value(rng), value(rng) };
+                        tree.set({ x, y, z }, data);
+                    }
+            std::vector<float> single = { 1.0f, 2.0f, 3.0f };
+            tree.set({ 20.0f, 1.0f, 50.0f }, single);
+            std::vector<float> partial = { 7.0f, 8.0f, 9.0f };
+            tree.set({ 30.0f }, partial);
+
+            auto compiled = compiled_interpolate_x_dim<float>(tree);
+
+            WHEN("The tree and the compiled table are queried at grid points and between them")
+            {
+                std::uniform_real_distribution<float> key_x(-5.0f, 40.0f);
+                std::uniform_real_distribution<float> key_y(-10.0f, 15.0f);
+                std::uniform_real_distribution<float> key_z(0.0f, 600.0f);
+                std::vector<std::vector<float>> queries = { { 2.0f, 4.0f, 100.0f }, { 8.0f, -3.0f, 400.0f }, { 2.0f }, { } };
+                for (int i = 0; i < 200; i++)
+                    queries.push_back({ key_x(rng), key_y(rng), key_z(rng) });
+
+                THEN("The results are bit exact")
+                {
+                    REQUIRE(compiled.max_leaf_size() == 3);
+                    for (auto &keys : queries)
+                    {
+                        auto expected = tree.get(keys);
+                        std::vector<float> result(compiled.max_leaf_size());
+                        result.resize(compiled.lookup(keys.data(), keys.size(), result.data()));
+                        INFO("keys " << (keys.size() ? keys[0] : 0.0f) << " " << (keys.size() > 1 ? keys[1] : 0.0f));
+                        REQUIRE(result.size() == expected.size());
+                        for (size_t i = 0; i < result.size(); i++)
+                            CHECK(result[i] == expected[i]);
+                    }
+                }
+                AND_THEN("Batched queries match the single queries")
+                {
+                    std::vector<float> keys;
+                    for (size_t i = 4; i < queries.size(); i++)
+                        keys.insert(keys.end(), queries[i].begin(), queries[i].end());
+                    auto count = queries.size() - 4;
+                    std::vector<float> batch(count * 3);
+                    std::vector<size_t> sizes(count);
+                    compiled.lookup(keys.data(), 3, count, batch.data(), sizes.data());
+                    for (size_t i = 0; i < count; i++)
+                    {
+                        float single_result[3];
+                        CHECK(sizes[i] == compiled.lookup(queries[i + 4].data(), 3, single_result));
+                        for (size_t j = 0; j < sizes[i]; j++)
+                            CHECK(batch[i * 3 + j] == single_result[j]);
+                    }
+                }
+            }
+        }
+    }
+
     SCENARIO("Interpolation in Matlab style", "[interp1d]")
     {
         GIVEN("A few sample values and sampling points")
@@ -0,0 +1,236 @@
+/*
+* Copyright (c) 2019, Intel Corporation
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the Intel Corporation nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "Teisko/Algorithm/PointGrid.hpp"
+#include "catch.hpp"
+#include <list>
+#include <random>
+
+/// \page libcalc_specs_point_grid Specs: Teisko point grid
+///
+/// \snippet this snippet-specs-point-grid
+
+/// [snippet-specs-point-grid]
+using namespace Teisko;
+
+namespace libcalc_point_grid_tests
+{
+    // Reference for nearest_distance2 by exhaustive search
+    double brute_force_nearest_distance2(const std::vector<point_xy> &points, point_xy p)
+    {
+        double best = -1.0;
+        for (auto &q : points)
+        {
+            auto dist2 = norm2(q - p);
+            if (dist2 != 0.0 && (best < 0 || dist2 < best))
+                best = dist2;
+        }
+        return best;
+    }
+
+    std::vector<point_xy> point_sets(int set, std::mt19937 &rng)
+    {
+        std::uniform_real_distribution<double> coord(-50.0, 250.0);
+        std::normal_distribution<double> cluster(0.0, 2.0);
+        std::vector<point_xy> points;
+        for (int i = 0; i < 500; i++)
+        {
+            if (set == 0)       // uniformly spread
+                points.emplace_back(coord(rng), coord(rng));
+            else if (set == 1)  // a few tight clusters with duplicates
+                points.emplace_back(std::round(cluster(rng)) + 100 * (i % 3), std::round(cluster(rng)));
+            else                // all on a horizontal line
+                points.emplace_back(coord(rng), 7.0);
+        }
+        return points;
+    }
+
+    SCENARIO("Point grid queries match the exhaustive search")
+    {
+        GIVEN("Uniform, clustered and collinear point sets")
+        {
+            std::mt19937 rng(1234);
+            std::uniform_real_distribution<double> query(-100.0, 300.0);
+            std::uniform_real_distribution<double> radius(0.0, 40.0);
+
+            THEN("Radius queries visit exactly the points within the radius")
+            {
+                for (int set = 0; set < 3; set++)
+                {
+                    INFO("point set " << set);
+                    auto points = point_sets(set, rng);
+                    point_grid_s grid(points);
+                    REQUIRE(grid.size() == points.size());
+                    for (int k = 0; k < 200; k++)
+                    {
+                        // query from the points themselves and from arbitrary locations
+                        auto p = k % 2 ? points[k] : point_xy(query(rng), query(rng));
+                        auto r2 = radius(rng) * radius(rng);
+                        std::vector<size_t> found;
+                        grid.for_each_within(p, r2, [&](size_t i) { found.push_back(i); });
+                        std::sort(found.begin(), found.end());
+
+                        std::vector<size_t> expected;
+                        for (size_t i = 0; i < points.size(); i++)
+                            if (norm2(points[i] - p) <= r2)
+                                expected.push_back(i);
+                        CHECK(found == expected);
+                    }
+                }
+            }
+
+            THEN("Nearest neighbor queries skip coinciding points and find the closest one")
+            {
+                for (int set = 0; set < 3; set++)
+                {
+                    INFO("point set " << set);
+                    auto points = point_sets(set, rng);
+                    point_grid_s grid(points);
+                    for (int k = 0; k < 200; k++)
+                    {
+                        auto p = k % 2 ? points[k] : point_xy(query(rng), query(rng));
+                        CHECK(grid.nearest_distance2(p) == brute_force_nearest_distance2(points, p));
+                    }
+                }
+            }
+        }
+
+        GIVEN("Degenerate point sets")
+        {
+            THEN("An empty set has no neighbors and a single point has no other points")
+            {
+                std::vector<point_xy> none;
+                point_grid_s empty_grid(none);
+                CHECK(empty_grid.nearest_distance2(point_xy(1.0, 2.0)) == -1.0);
+
+                std::vector<point_xy> one = { point_xy(3.0, 4.0) };
+                point_grid_s single(one);
+                CHECK(single.nearest_distance2(one[0]) == -1.0);
+                CHECK(single.nearest_distance2(point_xy(0.0, 0.0)) == 25.0);
+            }
+        }
+    }
+
+    // A square blob connected to blobs of similar size within its own (asymmetric) radius
+    struct blob_s
+    {
+        point_xy centroid;
+        double side;
+        size_t index;
+
+        double connection_radius2() const { return 3 * side * side; }
+        bool is_connected(const blob_s &other) const
+        {
+            auto ratio = side > other.side ? side / other.side : other.side / side;
+            return ratio < 1.25 && norm2(centroid - other.centroid) <= connection_radius2();
+        }
+    };
+
+    // Reference grouping by splicing lists -- the O(N^2) algorithm replaced by find_adjacent_groups
+    std::vector<std::vector<size_t>> list_adjacent_groups(const std::vector<blob_s> &blobs)
+    {
+        std::list<blob_s> feats(blobs.begin(), blobs.end());
+        std::list<std::list<blob_s>> results;
+        while (feats.size())
+        {
+            results.push_back(std::list<blob_s>());
+            auto &group = results.back();
+            group.splice(group.begin(), feats, feats.begin());
+            for (auto it = group.begin(); it != group.end(); ++it)
+            {
+                for (auto it2 = feats.begin(); it2 != feats.end();)
+                {
+                    auto next = std::next(it2);
+                    if (it->is_connected(*it2))
+                        group.splice(group.end(), feats, it2);
+                    it2 = next;
+                }
+            }
+        }
+        results.sort([](const std::list<blob_s> &a, const std::list<blob_s> &b)
+        {
+            return a.size() > b.size();
+        });
+
+        std::vector<std::vector<size_t>> groups;
+        for (auto &group : results)
+        {
+            groups.emplace_back();
+            for (auto &blob : group)
+                groups.back().push_back(blob.index);
+        }
+        return groups;
+    }
+
+    SCENARIO("Grouping adjacent items matches the list splicing algorithm")
+    {
+        GIVEN("Charts of similar blobs among scattered blobs of random size")
+        {
+            std::mt19937 rng(4321);
+            std::uniform_real_distribution<double> jitter(-1.5, 1.5);
+            std::uniform_real_distribution<double> coord(0.0, 1000.0);
+            std::uniform_real_distribution<double> side(4.0, 40.0);
+
+            std::vector<blob_s> blobs;
+            for (int i = 0; i < 576; i++)
+            {
+                blob_s blob;
+                if (i % 3 == 0)
+                {
+                    // a 6x4 chart of 20 pixel patches with a 30 pixel pitch at one of 8 locations in a row
+                    auto patch = (i / 3) % 24;
+                    auto chart = (i / 72) % 8;
+                    blob.centroid = point_xy(250.0 * chart + 30.0 * (patch % 6) + jitter(rng),
+                        500.0 + 30.0 * (patch / 6) + jitter(rng));
+                    blob.side = 20.0 + jitter(rng);
+                }
+                else
+                {
+                    blob.centroid = point_xy(coord(rng), coord(rng));
+                    blob.side = side(rng);
+                }
+                blob.index = blobs.size();
+                blobs.push_back(blob);
+            }
+
+            WHEN("The blobs are grouped")
+            {
+                auto groups = find_adjacent_groups(blobs);
+                auto expected = list_adjacent_groups(blobs);
+
+                THEN("The groups and their members are in the same order")
+                {
+                    REQUIRE(expected.size() > 1);
+                    REQUIRE(expected[0].size() > 24);
+                    CHECK(groups == expected);
+                }
+            }
+        }
+    }
+}
+/// [snippet-specs-point-grid]
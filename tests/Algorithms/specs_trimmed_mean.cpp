@@ -94,6 +94,28 @@ namespace libcalc_trimmed_mean_tests
         }
     }
 
+    SCENARIO("Trimmed mean of a range selects the middle items without sorting")
+    {
+        GIVEN("A vector of ten items in a scrambled order")
+        {
+            auto ten_items = std::vector<int>({ 90, 13, 1, 10001, 11, 3, 12, 9, 91, 10 });
+            WHEN("The trimmed mean is calculated from the range with an increasing proportion of items")
+            {
+                THEN("The result matches the trimmed mean of the vector")
+                {
+                    for (auto percentage = 0; percentage <= 100; percentage += 5)
+                    {
+                        auto data = ten_items;
+                        auto sorted = ten_items;
+                        INFO("percentage " << percentage);
+                        CHECK(trimmed_mean(data.begin(), data.end(), percentage / 100.0)
+                            == trimmed_mean(sorted, percentage / 100.0));
+                    }
+                }
+            }
+        }
+    }
+
     SCENARIO("Trimmed mean can be calculated from a histogram")
     {
         GIVEN("A population of 10 items and it's matching histogram")
@@ -337,6 +337,122 @@ SCENARIO("All SIMD/Non simd chroma upscaling variants produce equal results")
     }
 }
 
+SCENARIO("All instruction set tiers of chroma upscaling and yuv to rgb conversion are bit exact")
+{
+    static const double ycc2rgb_bt709[9] = {
+        1.00000000000000000000, 0.00000000000000000000, 1.57472635664535240000,
+        0.99999999999999989000, -0.18728134594285878000, -0.46819459633465549000,
+        1.00000000000000000000, 1.85563960703714900000, 0.00000000000000000000
+    };
+    auto levels = { simd_level_e::scalar, simd_level_e::sse4, simd_level_e::avx2, simd_level_e::avx512 };
+    std::mt19937 rng(2019);
+
+    GIVEN("Random images of sizes not divisible by any vector width")
+    {
+        auto widths = std::vector<int>({ 1, 2, 7, 15, 16, 17, 31, 33, 64, 97 });
+        auto heights = std::vector<int>({ 1, 3 });
+        for (auto bits : { 8, 12, 13, 16 })
+        {
+            std::uniform_int_distribution<int> dist(0, (1 << bits) - 1);
+            for (auto width : widths)
+            {
+                for (auto height : heights)
+                {
+                    auto img = image<uint16_t>(height, width);
+                    img.foreach([&](uint16_t &pix) { pix = static_cast<uint16_t>(dist(rng)); });
+                    auto reference = chroma_upscale(img).to_vector();
+
+                    for (auto level : levels)
+                    {
+                        if (supported_simd_level(level) != level)
+                            continue;
+                        INFO("bits=" << bits << " width=" << width << " height=" << height << " level=" << (int)level);
+                        CHECK(chroma_upscale_asm(img, bits, level).to_vector() == reference);
+                    }
+                }
+            }
+        }
+
+        for (auto bits : { 8, 10, 12 })
+        {
+            std::uniform_int_distribution<int> dist(0, (1 << bits) - 1);
+            for (auto width : { 1, 31, 157 })
+            {
+                const int height = 5;
+                auto data = std::vector<uint16_t>(width * height * 3);
+                for (auto &pix : data)
+                    pix = static_cast<uint16_t>(dist(rng));
+                auto reference = data;
+                auto r = image<uint16_t>(height, width, reference.data());
+                auto g = image<uint16_t>(height, width, reference.data() + height * width);
+                auto b = image<uint16_t>(height, width, reference.data() + 2 * height * width);
+                yuv_to_rgb_planar(r, g, b, bits, ycc2rgb_bt709);
+
+                for (auto level : levels)
+                {
+                    if (supported_simd_level(level) != level)
+                        continue;
+                    auto copy = data;
+                    auto y = image<uint16_t>(height, width, copy.data());
+                    auto u = image<uint16_t>(height, width, copy.data() + height * width);
+                    auto v = image<uint16_t>(height, width, copy.data() + 2 * height * width);
+                    yuv_to_rgb_planar_asm(y, u, v, bits, ycc2rgb_bt709, level);
+                    INFO("bits=" << bits << " width=" << width << " level=" << (int)level);
+                    CHECK(copy == reference);
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("YUV 4:2:0 is converted to RGB in a single pass")
+{
+    static const double ycc2rgb_bt709[9] = {
+        1.00000000000000000000, 0.00000000000000000000, 1.57472635664535240000,
+        0.99999999999999989000, -0.18728134594285878000, -0.46819459633465549000,
+        1.00000000000000000000, 1.85563960703714900000, 0.00000000000000000000
+    };
+    const int bits = 10;
+    std::mt19937 rng(420);
+    std::uniform_int_distribution<int> dist(0, (1 << bits) - 1);
+
+    GIVEN("Random Y, U and V planes of even and odd luma sizes")
+    {
+        WHEN("The reference is computed by upscaling the chroma planes and converting three planes")
+        {
+            THEN("The single pass conversion matches in every layout and color order")
+            {
+                for (auto size : { roi_point(1, 1), roi_point(2, 2), roi_point(37, 19), roi_point(64, 48), roi_point(33, 6) })
+                {
+                    auto chroma_size = (size + 1) / 2;
+                    image<uint16_t> y(size), u(chroma_size), v(chroma_size);
+                    for (auto *plane : { &y, &u, &v })
+                        plane->foreach([&](uint16_t &pix) { pix = static_cast<uint16_t>(dist(rng)); });
+
+                    image<uint16_t> r(size), g(size), b(size);
+                    r.init_from(y);
+                    g.init_from(chroma_upscale(u).region(size));
+                    b.init_from(chroma_upscale(v).region(size));
+                    yuv_to_rgb_planar(r, g, b, bits, ycc2rgb_bt709);
+
+                    for (auto layout : { rgb_layout_e::paged, rgb_layout_e::tiled,
+                        rgb_layout_e::interleaved, rgb_layout_e::interleaved_stride_4 })
+                    {
+                        for (auto order : { rgb_order_e::rgb, rgb_order_e::bgr })
+                        {
+                            auto rgb = yuv420_to_rgb(y, u, v, bits, ycc2rgb_bt709, layout, order, 3);
+                            INFO("size=" << size._x << "x" << size._y << " layout=" << (int)layout << " order=" << (int)order);
+                            CHECK(rgb[rgb_color_e::red].to_vector() == r.to_vector());
+                            CHECK(rgb[rgb_color_e::green].to_vector() == g.to_vector());
+                            CHECK(rgb[rgb_color_e::blue].to_vector() == b.to_vector());
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
 SCENARIO("RGB inline assembly color conversion produces equal results to reference version")
 {
     static const double ycc2rgb_bt709[9] = {
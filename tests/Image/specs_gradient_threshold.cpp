@@ -0,0 +1,132 @@
+/*
+* Copyright (c) 2019, Intel Corporation
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the Intel Corporation nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "Teisko/Image/GradientThreshold.hpp"
+#include "catch.hpp"
+#include <random>
+#include <vector>
+
+using namespace Teisko;
+
+namespace
+{
+    // The gradient threshold of the detectors before the shared kernel: a 9 tap filter of
+    // the image with replicated borders, storing the squared magnitudes
+    image<uint16_t> reference_gradient_threshold(image<uint16_t> &img, double threshold, bool edges)
+    {
+        double y = std::pow(std::abs(threshold - 1) / (threshold + 1), 6);
+
+        auto temp_dst = image<int>(img.size());
+        auto temp_src = img.make_borders(4, 4, 4, 4, REPLICATE);
+        auto center = temp_src.region(temp_dst.size(), roi_point(4));
+        int stride = temp_src._skip_y;
+        int max_level = 0;
+        temp_dst.foreach([stride, &max_level](int &dst, uint16_t &src)
+        {
+            uint16_t *s = &src;
+            int v =
+                (s[stride * 4] - s[-stride * 4]) * 1228 +
+                (s[stride * 3] - s[-stride * 3]) * 2210 +
+                (s[stride * 2] - s[-stride * 2]) * 2752 +
+                (s[stride * 1] - s[-stride * 1]) * 2002;
+            int h =
+                (s[4] - s[-4]) * 1228 +
+                (s[3] - s[-3]) * 2210 +
+                (s[2] - s[-2]) * 2752 +
+                (s[1] - s[-1]) * 2002;
+            v /= 16384;
+            h /= 16384;
+            dst = v*v + h*h;
+            if (dst > max_level)
+                max_level = dst;
+        }, center);
+        max_level = std::lround(y * max_level);
+        return temp_dst.transform<uint16_t>([max_level, edges](int &src) -> uint16_t
+        {
+            return (src < max_level) != edges;
+        });
+    }
+}
+
+SCENARIO("Gradient threshold computes the 9 tap gradient magnitude exactly at each instruction set tier")
+{
+    GIVEN("Random images of various sizes with full range of 16-bit values")
+    {
+        std::mt19937 rng(48);
+        auto sizes = std::vector<roi_point>({ { 1, 1 }, { 7, 5 }, { 8, 9 }, { 9, 3 }, { 50, 33 }, { 37, 100 } });
+        THEN("The masks of flat areas and edges match the reference")
+        {
+            for (auto size : sizes)
+            {
+                auto img = image<uint16_t>(size);
+                // A mix of smooth areas and extreme steps exercising the full range of the sums
+                std::uniform_int_distribution<int> dist(0, 65535);
+                std::bernoulli_distribution extreme(0.3);
+                img.foreach([&](uint16_t &x) { x = extreme(rng) ? (rng() & 1) * 65535 : static_cast<uint16_t>(dist(rng)); });
+
+                for (auto threshold : { 0.3, 0.4 })
+                {
+                    for (auto edges : { false, true })
+                    {
+                        auto expected = reference_gradient_threshold(img, threshold, edges).to_vector();
+                        for (auto level : { simd_level_e::scalar, simd_level_e::sse4, simd_level_e::avx2 })
+                        {
+                            for (auto threads : { 1u, 3u })
+                            {
+                                INFO("image " << size._x << "x" << size._y << ", threshold " << threshold
+                                    << ", edges " << edges << ", level " << static_cast<int>(level) << ", threads " << threads);
+                                CHECK(gradient_threshold(img, threshold, edges, threads, level).to_vector() == expected);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    GIVEN("A smooth image with a bright square and a non-contiguous view of it")
+    {
+        auto img = image<uint16_t>(40, 60);
+        img.foreach([](uint16_t &x) { x = 1000; });
+        img.region(16, 20, 12, 20).fill(3000);
+        auto view = img.transpose();
+        THEN("Only the borders of the square are marked as edges")
+        {
+            auto mask = gradient_threshold(img, 0.3, true);
+            CHECK(mask(20, 30) == 0);
+            CHECK(mask(2, 2) == 0);
+            CHECK(mask(12, 30) == 1);
+            CHECK(mask(20, 20) == 1);
+        }
+        THEN("The view is thresholded like a contiguous copy")
+        {
+            auto copy = view.convert_to<uint16_t>();
+            CHECK(gradient_threshold(view, 0.3).to_vector() == reference_gradient_threshold(copy, 0.3, false).to_vector());
+        }
+    }
+}
@@ -0,0 +1,182 @@
+/*
+* Copyright (c) 2019, Intel Corporation
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the Intel Corporation nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "Teisko/Image/LosslessJPEG.hpp"
+#include "catch.hpp"
+
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+using namespace Teisko;
+
+SCENARIO("Lossless jpeg encoding is reversible")
+{
+    GIVEN("Random 16-bit images of different sizes")
+    {
+        std::mt19937 rng(1234);
+        std::uniform_int_distribution<int> dist(0, 65535);
+        for (auto size : { roi_point(1, 1), roi_point(7, 3), roi_point(64, 32), roi_point(33, 65) })
+        {
+            image<uint16_t> img(size._y, size._x);
+            img.foreach([&](uint16_t &pix) { pix = static_cast<uint16_t>(dist(rng)); });
+
+            WHEN("The image is encoded and decoded")
+            {
+                auto data = lossless_jpeg::encode(img);
+                image<uint16_t> decoded;
+                lossless_jpeg::decode(data.data(), data.size(), decoded);
+
+                THEN("The decoded image is identical to the original")
+                {
+                    REQUIRE(decoded._width == img._width);
+                    REQUIRE(decoded._height == img._height);
+                    int errors = 0;
+                    decoded.foreach([&errors](uint16_t &a, uint16_t &b) { errors += a != b; }, img);
+                    CHECK(errors == 0);
+                }
+            }
+        }
+    }
+
+    GIVEN("A smooth 12-bit image and an image with maximal differences")
+    {
+        image<uint16_t> smooth(40, 50);
+        image<uint16_t> extreme(4, 8);
+        for (int y = 0; y < smooth._height; y++)
+            for (int x = 0; x < smooth._width; x++)
+                smooth(y, x) = static_cast<uint16_t>(x * 40 + y * 20);
+        for (int y = 0; y < extreme._height; y++)
+            for (int x = 0; x < extreme._width; x++)
+                extreme(y, x) = ((x + y) & 1) ? 0 : 32768;     // difference of +/- 32768
+
+        WHEN("The images are encoded and decoded")
+        {
+            auto smooth_data = lossless_jpeg::encode(smooth, 12);
+            auto extreme_data = lossless_jpeg::encode(extreme);
+            image<uint16_t> smooth_out, extreme_out;
+            lossless_jpeg::decode(smooth_data.data(), smooth_data.size(), smooth_out);
+            lossless_jpeg::decode(extreme_data.data(), extreme_data.size(), extreme_out);
+
+            THEN("The smooth image compresses well and both images are reconstructed")
+            {
+                CHECK(smooth_data.size() < static_cast<size_t>(smooth._width * smooth._height));
+                int errors = 0;
+                smooth_out.foreach([&errors](uint16_t &a, uint16_t &b) { errors += a != b; }, smooth);
+                extreme_out.foreach([&errors](uint16_t &a, uint16_t &b) { errors += a != b; }, extreme);
+                CHECK(errors == 0);
+            }
+        }
+    }
+
+    GIVEN("A truncated stream")
+    {
+        image<uint16_t> img(8, 8);
+        img.fill(100);
+        auto data = lossless_jpeg::encode(img);
+        THEN("Decoding throws")
+        {
+            image<uint16_t> decoded;
+            CHECK_THROWS(lossless_jpeg::decode(data.data(), 10, decoded));
+        }
+    }
+
+    GIVEN("A frame smaller than the destination view")
+    {
+        image<uint16_t> img(8, 8);
+        img.fill(100);
+        auto data = lossless_jpeg::encode(img);
+        THEN("Decoding throws for a view that is taller or wider than the frame")
+        {
+            image<uint16_t> taller(9, 8);
+            image<uint16_t> wider(8, 9);
+            CHECK_THROWS_WITH(lossless_jpeg::decode(data.data(), data.size(), taller),
+                "Lossless JPEG frame does not cover the destination");
+            CHECK_THROWS_WITH(lossless_jpeg::decode(data.data(), data.size(), wider),
+                "Lossless JPEG frame does not cover the destination");
+        }
+    }
+
+    GIVEN("A scan header whose point transform is not below the precision")
+    {
+        image<uint16_t> img(8, 8);
+        img.fill(100);
+        auto data = lossless_jpeg::encode(img, 12);
+        size_t sos = 0;
+        while (sos + 1 < data.size() && !(data[sos] == 0xff && data[sos + 1] == 0xda))
+            sos++;
+        REQUIRE(sos + 1 < data.size());
+        // FFDA, length, components, (selector, tables) per component, predictor, Se, Ah/Al
+        auto components = data[sos + 4];
+        auto &point_transform = data[sos + 5 + 2 * components + 2];
+
+        THEN("Decoding throws for point transforms of 12 and 15")
+        {
+            for (int pt : { 12, 15 })
+            {
+                point_transform = static_cast<uint8_t>(pt);
+                image<uint16_t> decoded;
+                CHECK_THROWS_WITH(lossless_jpeg::decode(data.data(), data.size(), decoded),
+                    "Unsupported lossless JPEG scan");
+            }
+        }
+    }
+
+    GIVEN("A Huffman table with more length 1 codes than fit in one bit")
+    {
+        // SOI, DHT (Tc/Th = 0, five codes of length 1, symbols 0-4)
+        std::vector<uint8_t> data = { 0xff, 0xd8, 0xff, 0xc4, 0x00, 0x18, 0x00, 5 };
+        data.insert(data.end(), 15, 0);
+        data.insert(data.end(), { 0, 1, 2, 3, 4 });
+        THEN("Decoding throws")
+        {
+            image<uint16_t> decoded;
+            CHECK_THROWS_WITH(lossless_jpeg::decode(data.data(), data.size(), decoded),
+                "Invalid Huffman table");
+        }
+    }
+
+    GIVEN("A scan that selects a Huffman table the stream does not define")
+    {
+        image<uint16_t> img(8, 8);
+        img.fill(100);
+        auto data = lossless_jpeg::encode(img);
+        size_t sos = 0;
+        while (sos + 1 < data.size() && !(data[sos] == 0xff && data[sos + 1] == 0xda))
+            sos++;
+        REQUIRE(sos + 1 < data.size());
+        data[sos + 6] = 0x10;       // Td = 1 for the first component
+        THEN("Decoding throws")
+        {
+            image<uint16_t> decoded;
+            CHECK_THROWS_WITH(lossless_jpeg::decode(data.data(), data.size(), decoded),
+                "Lossless JPEG scan uses an undefined Huffman table");
+        }
+    }
+}
@@ -0,0 +1,154 @@
+/*
+* Copyright (c) 2019, Intel Corporation
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the Intel Corporation nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "Teisko/Image/Morphology.hpp"
+#include "catch.hpp"
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace Teisko;
+
+namespace
+{
+    // Extremum of the window around each pixel clipped to the image, one pixel at a time
+    template <bool is_max, typename T>
+    image<T> reference_extremum(const image<T> &src, int height, int width)
+    {
+        auto rows = src.size()._y;
+        auto cols = src.size()._x;
+        auto dst = image<T>(src.size());
+        for (int y = 0; y < rows; y++)
+        {
+            for (int x = 0; x < cols; x++)
+            {
+                auto value = src(y, x);
+                for (int i = std::max(0, y - (height - 1) / 2); i <= std::min(rows - 1, y + height / 2); i++)
+                    for (int j = std::max(0, x - (width - 1) / 2); j <= std::min(cols - 1, x + width / 2); j++)
+                        value = extremum<is_max>(value, src(i, j));
+                dst(y, x) = value;
+            }
+        }
+        return dst;
+    }
+
+    template <typename T>
+    image<T> random_image(int height, int width, int levels, std::mt19937 &rng)
+    {
+        auto img = image<T>(height, width);
+        std::uniform_int_distribution<int> dist(0, levels - 1);
+        img.foreach([&dist, &rng](T &x) { x = static_cast<T>(dist(rng)); });
+        return img;
+    }
+}
+
+SCENARIO("Minimum and maximum filters of rectangular windows match the exhaustive search")
+{
+    GIVEN("Random images of various sizes, including sizes smaller than the windows")
+    {
+        std::mt19937 rng(47);
+        auto sizes = std::vector<roi_point>({ { 1, 1 }, { 5, 3 }, { 17, 9 }, { 40, 33 }, { 67, 12 } });
+        auto windows = std::vector<roi_point>({ { 1, 1 }, { 3, 3 }, { 5, 5 }, { 1, 7 }, { 4, 2 }, { 6, 9 }, { 15, 1 } });
+        THEN("Erosion and dilation of uint16_t images match at each instruction set tier")
+        {
+            for (auto size : sizes)
+            {
+                auto src = random_image<uint16_t>(size._y, size._x, 65536, rng);
+                for (auto window : windows)
+                {
+                    auto min_ref = reference_extremum<false>(src, window._y, window._x);
+                    auto max_ref = reference_extremum<true>(src, window._y, window._x);
+                    for (auto level : { simd_level_e::scalar, simd_level_e::sse4, simd_level_e::avx2 })
+                    {
+                        INFO("image " << size._x << "x" << size._y << ", window " << window._x << "x" << window._y
+                            << ", level " << static_cast<int>(level));
+                        CHECK(erode(src, window._y, window._x, level).to_vector() == min_ref.to_vector());
+                        CHECK(dilate(src, window._y, window._x, level).to_vector() == max_ref.to_vector());
+                    }
+                }
+            }
+        }
+
+        THEN("Other pixel types and non-contiguous images are filtered with the scalar code")
+        {
+            auto src = random_image<float>(23, 31, 1000, rng);
+            auto view = src.transpose();
+            for (auto window : windows)
+            {
+                INFO("window " << window._x << "x" << window._y);
+                CHECK(erode(src, window._y, window._x).to_vector() ==
+                    reference_extremum<false>(src, window._y, window._x).to_vector());
+                CHECK(dilate(view, window._y, window._x).to_vector() ==
+                    reference_extremum<true>(view, window._y, window._x).to_vector());
+            }
+        }
+    }
+
+    GIVEN("A random image and the 3x3 support filter of the image API")
+    {
+        std::mt19937 rng(3);
+        auto src = random_image<uint16_t>(48, 64, 1024, rng);
+        THEN("The 3x3 minimum and maximum filters match the support filter with mirrored borders")
+        {
+            auto min3x3 = src.filter<3, 3>([](support<3, 3, uint16_t> &data) { return data.minimum(); });
+            auto max3x3 = src.filter<3, 3>([](support<3, 3, uint16_t> &data) { return data.maximum(); });
+            CHECK(erode(src, 3, 3).to_vector() == min3x3.to_vector());
+            CHECK(dilate(src, 3, 3).to_vector() == max3x3.to_vector());
+        }
+    }
+}
+
+SCENARIO("Opening and closing fuse the two filters without changing the result")
+{
+    GIVEN("A binary image with speckles and holes")
+    {
+        std::mt19937 rng(5);
+        auto src = random_image<uint16_t>(61, 80, 2, rng);
+        THEN("Opening is erosion followed by dilation and closing vice versa")
+        {
+            for (auto window : std::vector<roi_point>({ { 3, 3 }, { 5, 5 }, { 2, 7 } }))
+            {
+                for (auto level : { simd_level_e::scalar, simd_level_e::sse4, simd_level_e::avx2 })
+                {
+                    INFO("window " << window._x << "x" << window._y << ", level " << static_cast<int>(level));
+                    auto opened = dilate(erode(src, window._y, window._x), window._y, window._x);
+                    auto closed = erode(dilate(src, window._y, window._x), window._y, window._x);
+                    CHECK(morphological_open(src, window._y, window._x, level).to_vector() == opened.to_vector());
+                    CHECK(morphological_close(src, window._y, window._x, level).to_vector() == closed.to_vector());
+                }
+            }
+        }
+
+        THEN("Two 3x3 erosions followed by two 3x3 dilations equal a single 5x5 opening")
+        {
+            auto twice = erode(erode(src, 3, 3), 3, 3);
+            twice = dilate(dilate(twice, 3, 3), 3, 3);
+            CHECK(morphological_open(src, 5, 5).to_vector() == twice.to_vector());
+        }
+    }
+}
@@ -30,6 +30,7 @@
 #include <memory>
 #include <random>
 #include <algorithm>
+#include <limits>
 #include <vector>
 
 using namespace Teisko;
@@ -173,4 +174,104 @@ namespace libpolyscale_tests
             }
         }
     }
+
+    SCENARIO("Samples marked as NaN are excluded from the polynomial fit")
+    {
+        GIVEN("A grid sampled from a 4th order polynomial with some samples missing")
+        {
+            const size_t cols = 20;
+            const size_t rows = 12;
+            std::vector<double> expected(cols * rows);
+            grid_2d<double> A(cols, rows);
+            for (size_t j = 0; j < rows; j++)
+            {
+                for (size_t i = 0; i < cols; i++)
+                {
+                    auto x = static_cast<double>(i);
+                    auto y = static_cast<double>(j);
+                    expected[j * cols + i] = 2.0 + 0.01 * x - 0.02 * y + 0.001 * x * x * y - 0.0002 * y * y * y * x;
+                    A._grid[j * cols + i] = (i * 7 + j * 3) % 5 == 0
+                        ? std::numeric_limits<double>::quiet_NaN()
+                        : expected[j * cols + i];
+                }
+            }
+
+            WHEN("The grid is resized to original size")
+            {
+                grid_2d<double> B(cols, rows);
+
+                poly_4_scaler_2d<double> polynomial;
+                polynomial.scale(A, B);
+
+                THEN("The missing samples are reconstructed from the model")
+                {
+                    for (size_t i = 0; i < B._grid.size(); i++)
+                    {
+                        CHECK(B._grid[i] == Approx(expected[i]).epsilon(1e-9));
+                    }
+                }
+            }
+        }
+    }
+
+    SCENARIO("Polynomial surface is evaluated row by row at full resolution")
+    {
+        GIVEN("A 3rd order fit of a grid sampled from a cubic polynomial")
+        {
+            const size_t cols = 16;
+            const size_t rows = 10;
+            auto surface = [](double x, double y)
+            {
+                return 100.0 + 2.0 * x - 3.0 * y + 0.05 * x * y - 0.01 * x * x * x + 0.02 * x * y * y;
+            };
+            grid_2d<double> A(cols, rows);
+            for (size_t j = 0; j < rows; j++)
+                for (size_t i = 0; i < cols; i++)
+                    A._grid[j * cols + i] = surface(static_cast<double>(i), static_cast<double>(j));
+
+            poly_3_scaler_2d<double> polynomial;
+            auto in_view = A.to_view();
+            polynomial.poly_fit_2d(in_view);
+
+            WHEN("The model is evaluated on a large output with every instruction set tier")
+            {
+                const int out_rows = 181;
+                const int out_cols = 263;
+                image<double> scalar(out_rows, out_cols);
+                polynomial.interp(scalar, 1, simd_level_e::scalar);
+
+                THEN("The output follows the polynomial on the stretched grid")
+                {
+                    auto h2 = (rows - 1) * 0.5;
+                    auto w2 = (cols - 1) * 0.5;
+                    auto oh2 = (out_rows - 1) * 0.5;
+                    auto ow2 = (out_cols - 1) * 0.5;
+                    for (int y = 0; y < out_rows; y += 9)
+                    {
+                        for (int x = 0; x < out_cols; x += 13)
+                        {
+                            // output (y, x) maps to the same model coordinate as input (v, u)
+                            auto u = ((2 * x - ow2) / ow2 * w2 + w2) * 0.5;
+                            auto v = ((2 * y - oh2) / oh2 * h2 + h2) * 0.5;
+                            CHECK(scalar(y, x) == Approx(surface(u, v)).epsilon(1e-9));
+                        }
+                    }
+                }
+
+                THEN("All tiers and thread counts produce identical output")
+                {
+                    for (auto level : { simd_level_e::sse4, simd_level_e::avx2, simd_level_e::avx512 })
+                    {
+                        for (auto threads : { 1u, 4u })
+                        {
+                            INFO("level " << static_cast<int>(level) << " threads " << threads);
+                            image<double> out(out_rows, out_cols);
+                            polynomial.interp(out, threads, level);
+                            CHECK(out.to_vector() == scalar.to_vector());
+                        }
+                    }
+                }
+            }
+        }
+    }
 }
@@ -28,6 +28,8 @@
 
 #include "Teisko/Image/RGB.hpp"
 #include "catch.hpp"
+#include <random>
+#include <vector>
 
 using namespace Teisko;
 
@@ -143,3 +145,129 @@ SCENARIO("Error handling -- accessing 3rd channel of rgb image throws")
     CHECK_NOTHROW(img[2]);
     CHECK_THROWS(img[3]);
 }
+
+template <typename T>
+void check_interleaving_tiers(int channels, size_t count)
+{
+    std::mt19937 rng(static_cast<unsigned int>(count * 7 + channels));
+    std::uniform_int_distribution<int> dist(0, 255);
+    std::vector<std::vector<T>> planes(channels, std::vector<T>(count));
+    for (auto &plane : planes)
+        for (auto &item : plane)
+            item = static_cast<T>(dist(rng));
+
+    std::vector<T> reference(count * channels);
+    for (size_t i = 0; i < count; i++)
+        for (int c = 0; c < channels; c++)
+            reference[i * channels + c] = planes[c][i];
+
+    const T *src[4] = {};
+    for (int c = 0; c < channels; c++)
+        src[c] = planes[c].data();
+
+    for (auto level : { simd_level_e::scalar, simd_level_e::sse4, simd_level_e::avx2 })
+    {
+        if (supported_simd_level(level) != level)
+            continue;
+        INFO("bytes=" << sizeof(T) << " channels=" << channels << " count=" << count << " level=" << (int)level);
+        std::vector<T> interleaved(count * channels);
+        interleave(src, channels, interleaved.data(), count, level);
+        CHECK(interleaved == reference);
+
+        std::vector<std::vector<T>> restored(channels, std::vector<T>(count));
+        T *dst[4] = {};
+        for (int c = 0; c < channels; c++)
+            dst[c] = restored[c].data();
+        deinterleave(reference.data(), channels, dst, count, level);
+        CHECK(restored == planes);
+    }
+}
+
+SCENARIO("Planes can be interleaved and deinterleaved with all instruction set tiers")
+{
+    GIVEN("Random planes of 8, 16 and 32-bit items and counts not divisible by the vector widths")
+    {
+        THEN("All tiers produce the same result as the scalar reference")
+        {
+            for (auto channels : { 2, 3, 4 })
+            {
+                for (size_t count : { 0, 1, 15, 16, 33, 100 })
+                {
+                    check_interleaving_tiers<uint8_t>(channels, count);
+                    check_interleaving_tiers<uint16_t>(channels, count);
+                    check_interleaving_tiers<float>(channels, count);
+                }
+            }
+        }
+    }
+}
+
+SCENARIO("RGB images can be converted between layouts")
+{
+    auto layouts = { rgb_layout_e::paged, rgb_layout_e::tiled, rgb_layout_e::interleaved, rgb_layout_e::interleaved_stride_4 };
+
+    GIVEN("Self contained images of odd and even widths with a non-default color order")
+    {
+        THEN("Copies and in place conversions to every layout preserve the channels")
+        {
+            for (auto size : { roi_point(5, 3), roi_point(40, 2) })
+            {
+                for (auto from : layouts)
+                {
+                    auto img = rgb_image_s<uint16_t>(size, from, rgb_order_e::bgr);
+                    int counter = 0;
+                    img.full_image().foreach([&counter](uint16_t &x) { x = static_cast<uint16_t>(++counter); });
+                    auto red = img[rgb_color_e::red].to_vector();
+                    auto green = img[rgb_color_e::green].to_vector();
+                    auto blue = img[rgb_color_e::blue].to_vector();
+
+                    for (auto to : layouts)
+                    {
+                        INFO("width=" << size._x << " from=" << (int)from << " to=" << (int)to);
+                        auto copy = img.to_layout(to);
+                        CHECK(copy.layout() == to);
+                        CHECK(copy[rgb_color_e::red].to_vector() == red);
+                        CHECK(copy[rgb_color_e::green].to_vector() == green);
+                        CHECK(copy[rgb_color_e::blue].to_vector() == blue);
+
+                        auto inplace = img.to_layout(from);
+                        inplace.convert_layout(to);
+                        CHECK(inplace.layout() == to);
+                        CHECK(inplace[rgb_color_e::red].to_vector() == red);
+                        CHECK(inplace[rgb_color_e::green].to_vector() == green);
+                        CHECK(inplace[rgb_color_e::blue].to_vector() == blue);
+                    }
+                }
+            }
+        }
+    }
+
+    GIVEN("An external tiled buffer")
+    {
+        roi_point size(3, 2);
+        auto data = std::vector<uint8_t>({
+            1, 2, 3, /* */ 11, 12, 13, /* */ 21, 22, 23,
+            4, 5, 6, /* */ 14, 15, 16, /* */ 24, 25, 26
+        });
+        auto img = rgb_image_s<uint8_t>(size, data.data(), rgb_layout_e::tiled);
+
+        WHEN("The image is converted in place to interleaved layout")
+        {
+            img.convert_layout(rgb_layout_e::interleaved);
+            THEN("The external buffer contains the interleaved data")
+            {
+                CHECK(data == std::vector<uint8_t>({
+                    1, 11, 21, 2, 12, 22, 3, 13, 23,
+                    4, 14, 24, 5, 15, 25, 6, 16, 26 }));
+            }
+        }
+
+        WHEN("The image is converted to a layout of different size")
+        {
+            THEN("The conversion throws")
+            {
+                CHECK_THROWS(img.convert_layout(rgb_layout_e::interleaved_stride_4));
+            }
+        }
+    }
+}
@@ -32,8 +32,13 @@
 #include <algorithm>
 #include <vector>
 #include <ostream>
+#include <sstream>
 #include <fstream>
 #include <map>
+#if !(defined(WIN32) || defined(_WIN32))
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "_data/icc_profiles.hpp"
 using namespace Teisko;
@@ -321,3 +326,255 @@ SCENARIO("Tiff tag class exposes serialization methods")
         }
     }
 }
+
+SCENARIO("Tiff metadata can be scanned without reading the image data")
+{
+    GIVEN("A bayer image with a description and exif tags written to a stream")
+    {
+        const std::string description = "Exposure series frame 3";
+        image<uint16_t> bayer(64, 48);
+        bayer.fill(123);
+        tiff_file tiff;
+        tiff.add_tag(tiff_tag<ASCII>(tag_image_description, description));
+        tiff.add_exif_tag(tiff_tag<RATIONAL>(tag_exif_exposure_time, { 1, 30 }));
+        tiff.add_exif_tag(tiff_tag<SHORT>(tag_exif_iso_speed, 400));
+        std::stringstream stream;
+        tiff.write_image(stream, bayer, 10, tag_photometric_interpretation_bayer);
+
+        WHEN("The metadata is scanned")
+        {
+            tiff_metadata metadata(stream);
+            THEN("All primary tags match the ones parsed by the full reader")
+            {
+                REQUIRE(metadata.is_valid());
+                tiff_file reference;
+                stream.clear();
+                reference.read(stream);
+                CHECK(metadata.tags() == reference.tags());
+                for (auto id : metadata.tags())
+                    CHECK(metadata.tag_as_string(id) == reference.tag_as_string(id));
+            }
+            AND_THEN("The exif tags can be queried")
+            {
+                CHECK(metadata.exif_tags().size() == 2);
+                CHECK(metadata.tag_as_string(tag_exif_exposure_time) == "1/30");
+                CHECK(metadata.tag_as_vector(tag_exif_iso_speed) == std::vector<int>{ 400 });
+                CHECK(metadata.tag_as_string(tag_image_description) == description);
+            }
+        }
+
+        WHEN("The metadata is scanned deferring all out-of-line values")
+        {
+            tiff_metadata metadata(stream, 0);
+            THEN("Inline values are available and the deferred ones can be read on demand")
+            {
+                CHECK(metadata.tag_as_vector(tag_image_width) == std::vector<int>{ 48 });
+                CHECK_FALSE(metadata.has_value(tag_image_description));
+                CHECK(metadata.tag_as_string(tag_image_description) == "");
+                CHECK_THROWS(metadata.tag(tag_image_description));
+
+                metadata.read_values(stream, { tag_image_description, tag_exif_exposure_time });
+                CHECK(metadata.tag_as_string(tag_image_description) == description);
+                CHECK(metadata.tag_as_string(tag_exif_exposure_time) == "1/30");
+            }
+        }
+    }
+
+    GIVEN("A stream not containing a tiff file")
+    {
+        std::istringstream stream("GIF89a -- definitely not a tiff");
+        THEN("The metadata is not valid")
+        {
+            tiff_metadata metadata(stream);
+            CHECK_FALSE(metadata.is_valid());
+            CHECK(metadata.tags().empty());
+        }
+    }
+
+    GIVEN("A tiff directory with a value count far beyond the end of the stream")
+    {
+        // header, one directory entry of tag_image_description with 0x1fffffff characters at offset 26
+        const uint8_t file[] = {
+            'I', 'I', 42, 0, 8, 0, 0, 0,
+            1, 0,
+            0x0e, 0x01, 2, 0, 0xff, 0xff, 0xff, 0x1f, 26, 0, 0, 0,
+            0, 0, 0, 0,
+            'x', 0 };
+        std::stringstream stream(std::string(file, file + sizeof(file)));
+        THEN("The directory is valid, but the values are never loaded")
+        {
+            tiff_metadata metadata(stream, 0xffffffff);
+            REQUIRE(metadata.is_valid());
+            CHECK(metadata.tags() == std::vector<tiff_tags>{ tag_image_description });
+            CHECK_FALSE(metadata.has_value(tag_image_description));
+            metadata.read_values(stream, { tag_image_description });
+            CHECK_FALSE(metadata.has_value(tag_image_description));
+        }
+    }
+}
+
+SCENARIO("A collection of tiff files can be indexed and the index reused")
+{
+    GIVEN("Three tiff files with different exposures and one non-tiff file")
+    {
+        std::vector<std::string> files = { "index_0.tif", "index_1.tif", "index_2.tif", "index_3.txt" };
+        for (int i = 0; i < 3; i++)
+        {
+            image<uint16_t> bayer(8, 8 + i * 2);
+            bayer.fill(0);
+            tiff_file tiff;
+            tiff.add_tag(tiff_tag<ASCII>(tag_image_description, "frame " + std::to_string(i)));
+            tiff.add_exif_tag(tiff_tag<RATIONAL>(tag_exif_exposure_time, { 1, 10u * (i + 1) }));
+            std::ofstream file(files[i], std::ios::binary);
+            tiff.write_image(file, bayer, 16, tag_photometric_interpretation_bayer);
+        }
+        std::ofstream(files[3]) << "not a tiff";
+
+        WHEN("The files are scanned in parallel")
+        {
+            tiff_index index;
+            CHECK(index.scan(files, 4) == 4);
+            THEN("Only the tiff files are indexed in sorted order")
+            {
+                REQUIRE(index.records().size() == 3);
+                for (int i = 0; i < 3; i++)
+                {
+                    auto &record = index.records()[i];
+                    CHECK(record.path == files[i]);
+                    CHECK(record.tag_as_string(tag_image_description) == "frame " + std::to_string(i));
+                    CHECK(record.tag_as_vector(tag_image_width) == std::vector<int>{ 8 + i * 2 });
+                }
+            }
+            AND_THEN("The records can be searched by exposure")
+            {
+                auto found = index.find_if([](const tiff_index::record_s &r)
+                {
+                    auto exposure = r.tag_as_vector<double>(tag_exif_exposure_time);
+                    return exposure.size() == 2 && exposure[0] / exposure[1] < 0.04;
+                });
+                REQUIRE(found.size() == 1);
+                CHECK(found[0]->path == files[2]);
+            }
+            AND_WHEN("The index is saved and loaded")
+            {
+                std::stringstream stream;
+                index.save(stream);
+                tiff_index loaded;
+                loaded.load(stream);
+                THEN("The loaded records match the original ones")
+                {
+                    REQUIRE(loaded.records().size() == 3);
+                    for (size_t i = 0; i < 3; i++)
+                    {
+                        auto &a = index.records()[i];
+                        auto &b = loaded.records()[i];
+                        CHECK(a.path == b.path);
+                        CHECK(a.file_size == b.file_size);
+                        CHECK(a.modified == b.modified);
+                        CHECK(a.tag_as_string(tag_exif_exposure_time) == b.tag_as_string(tag_exif_exposure_time));
+                        CHECK(a.tag_as_string(tag_image_description) == b.tag_as_string(tag_image_description));
+                    }
+                }
+                AND_THEN("Rescanning the unchanged files reads only the non-tiff file")
+                {
+                    CHECK(loaded.scan(files) == 1);
+                    CHECK(loaded.records().size() == 3);
+                }
+                AND_THEN("An index with a different tag set rescans all files")
+                {
+                    tiff_index other({ tag_image_width });
+                    std::stringstream copy(stream.str());
+                    other.load(copy);
+                    CHECK(other.scan(files) == 4);
+                    CHECK(other.records()[0].tags.size() == 1);
+                }
+            }
+        }
+
+        WHEN("The current directory is scanned without recursion")
+        {
+            tiff_index index;
+            index.scan_directory(".", false);
+            THEN("The written tiff files are found")
+            {
+                auto found = index.find_if([](const tiff_index::record_s &r)
+                {
+                    return r.path.find("index_1.tif") != std::string::npos;
+                });
+                CHECK(found.size() == 1);
+            }
+        }
+
+#if !(defined(WIN32) || defined(_WIN32))
+        WHEN("A folder links back to its parent and to one of the files")
+        {
+            mkdir("index_links", 0755);
+            unlink("index_links/parent");
+            unlink("index_links/frame.tif");
+            REQUIRE(symlink("..", "index_links/parent") == 0);
+            REQUIRE(symlink("../index_1.tif", "index_links/frame.tif") == 0);
+            tiff_index index;
+            index.scan_directory("index_links");
+            THEN("The file link is indexed but the folder link is not followed")
+            {
+                REQUIRE(index.records().size() == 1);
+                CHECK(index.records()[0].path == "index_links/frame.tif");
+            }
+        }
+#endif
+    }
+
+    GIVEN("A stream not containing an index")
+    {
+        std::istringstream stream("nonsense");
+        tiff_index index;
+        CHECK_THROWS(index.load(stream));
+    }
+
+    GIVEN("Index streams with counts beyond the end of the stream")
+    {
+        // magic, version, tag count and record count
+        auto corrupt = [](uint32_t tag_count, uint32_t record_count)
+        {
+            std::stringstream stream;
+            stream.write("TKIX", 4);
+            for (auto x : { 1u, tag_count, record_count })
+                for (int i = 0; i < 4; i++)
+                    stream.put(static_cast<char>((x >> (8 * i)) & 0xff));
+            return stream;
+        };
+        THEN("Loading throws instead of allocating for the counts")
+        {
+            tiff_index index;
+            auto tags = corrupt(0xffffffff, 0);
+            CHECK_THROWS_AS(index.load(tags), const std::runtime_error&);
+            auto records = corrupt(0, 0x10000000);
+            CHECK_THROWS_AS(index.load(records), const std::runtime_error&);
+            CHECK(index.records().empty());
+        }
+    }
+
+    GIVEN("An index stream with a tag count whose value size overflows 32 bits")
+    {
+        // magic, version, tag count, record count, path length, file size and modification time
+        std::stringstream stream;
+        stream.write("TKIX", 4);
+        auto put = [&stream](uint32_t x, int bytes)
+        {
+            for (int i = 0; i < bytes; i++)
+                stream.put(static_cast<char>((x >> (8 * i)) & 0xff));
+        };
+        for (auto x : { 1u, 0u, 1u, 0u, 0u, 0u, 0u, 0u })
+            put(x, 4);
+        // one tag of 2^29 doubles, 2^32 bytes in total
+        for (auto x : { 1u, static_cast<uint32_t>(tag_image_width), static_cast<uint32_t>(DOUBLE) })
+            put(x, 2);
+        put(0x20000000, 4);
+        THEN("Loading throws")
+        {
+            tiff_index index;
+            CHECK_THROWS_WITH(index.load(stream), "Corrupted tiff index");
+            CHECK(index.records().empty());
+        }
+    }
+}
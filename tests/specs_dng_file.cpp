@@ -0,0 +1,257 @@
+/*
+* Copyright (c) 2019, Intel Corporation
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the Intel Corporation nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "Teisko/DngFile.hpp"
+#include "catch.hpp"
+
+#include <cstdint>
+#include <random>
+#include <sstream>
+#include <vector>
+
+using namespace Teisko;
+
+namespace
+{
+    bayer_image_s<uint16_t> make_random_raw(int height, int width, bayer_pattern_e pattern, int max_value)
+    {
+        std::mt19937 rng(height * 31 + width);
+        std::uniform_int_distribution<int> dist(0, max_value);
+        bayer_image_s<uint16_t> raw(height, width, pattern);
+        raw._img.foreach([&](uint16_t &pix) { pix = static_cast<uint16_t>(dist(rng)); });
+        return raw;
+    }
+
+    int count_differences(bayer_image_s<uint16_t> &a, bayer_image_s<uint16_t> &b)
+    {
+        int errors = 0;
+        a._img.foreach([&errors](uint16_t &x, uint16_t &y) { errors += x != y; }, b._img);
+        return errors;
+    }
+}
+
+SCENARIO("Raw images can be stored to and restored from DNG files")
+{
+    GIVEN("A 10-bit raw image whose size is not a multiple of the tile size")
+    {
+        auto raw = make_random_raw(70, 90, bayer_pattern_e::grbg, 1023);
+        dng_file dng;
+        dng.tile_width = 32;
+        dng.tile_height = 48;
+        dng.black_level = { 64.0f, 64.5f, 63.25f, 64.0f };
+        dng.white_level = 1023;
+        dng.exposure_time = 0.02;
+        dng.iso = 200;
+        dng.f_number = 2.8;
+        dng.description = "unit test";
+
+        for (auto compression : { dng_compression_e::lossless_jpeg, dng_compression_e::uncompressed })
+        {
+            WHEN("The image is written and read back")
+            {
+                dng.compression = compression;
+                std::stringstream stream;
+                dng.write(stream, raw, 2);
+
+                dng_file result;
+                auto restored = result.read(stream, 3);
+
+                THEN("Pixels and metadata are restored")
+                {
+                    REQUIRE(restored._img._width == 90);
+                    REQUIRE(restored._img._height == 70);
+                    CHECK(restored._layout.get_color_pattern() == raw._layout.get_color_pattern());
+                    CHECK(count_differences(restored, raw) == 0);
+                    CHECK(result.compression == compression);
+                    CHECK(result.black_level == dng.black_level);
+                    CHECK(result.white_level == 1023);
+                    CHECK(result.exposure_time == Approx(0.02));
+                    CHECK(result.iso == Approx(200));
+                    CHECK(result.f_number == Approx(2.8));
+                    CHECK(result.description == "unit test");
+                    CHECK(result.camera_model == "Teisko");
+                }
+            }
+        }
+    }
+
+    GIVEN("An RGB-IR 4x4 raw image")
+    {
+        auto raw = make_random_raw(32, 48, bayer_pattern_e::bgrg_gigi_rgbg_gigi, 4095);
+        dng_file dng;
+        dng.tile_width = 16;
+        dng.tile_height = 16;
+
+        WHEN("The image is written and read back")
+        {
+            std::stringstream stream;
+            dng.write(stream, raw);
+            dng_file result;
+            auto restored = result.read(stream);
+
+            THEN("The layout with the infrared pixels is recovered")
+            {
+                CHECK(result.pattern == bayer_pattern_e::bgrg_gigi_rgbg_gigi);
+                CHECK(restored._layout.get_channels() == 16);
+                CHECK(count_differences(restored, raw) == 0);
+            }
+        }
+    }
+
+    GIVEN("A tile size that is not a multiple of 16")
+    {
+        auto raw = make_random_raw(8, 8, bayer_pattern_e::rggb, 255);
+        dng_file dng;
+        dng.tile_width = 20;
+        std::stringstream stream;
+        THEN("Writing throws")
+        {
+            CHECK_THROWS(dng.write(stream, raw));
+        }
+    }
+
+    GIVEN("A DNG file whose tile byte count runs past the end of the stream")
+    {
+        auto raw = make_random_raw(16, 16, bayer_pattern_e::rggb, 255);
+        dng_file dng;
+        dng.tile_width = 16;
+        dng.tile_height = 16;
+        dng.compression = dng_compression_e::uncompressed;
+        std::stringstream stream;
+        dng.write(stream, raw);
+        auto bytes = stream.str();
+
+        // The single TileByteCounts entry (tag 325, LONG, count 1) holds its value inline
+        const std::string entry("\x45\x01\x04\x00\x01\x00\x00\x00", 8);
+        auto position = bytes.find(entry);
+        REQUIRE(position != std::string::npos);
+        bytes.replace(position + 8, 4, std::string("\xf0\xff\xff\x7f", 4));
+
+        THEN("Reading throws before the tile is allocated")
+        {
+            std::stringstream corrupt(bytes);
+            dng_file result;
+            CHECK_THROWS_WITH(result.read(corrupt), "Truncated raw image tile");
+        }
+    }
+
+    GIVEN("DNG files whose tile byte count is too short for the samples of the tile")
+    {
+        auto raw = make_random_raw(16, 16, bayer_pattern_e::rggb, 255);
+        THEN("Reading throws before the image is allocated")
+        {
+            for (auto compression : { dng_compression_e::uncompressed, dng_compression_e::lossless_jpeg })
+            {
+                dng_file dng;
+                dng.tile_width = 16;
+                dng.tile_height = 16;
+                dng.compression = compression;
+                std::stringstream stream;
+                dng.write(stream, raw);
+                auto bytes = stream.str();
+
+                // 8 bytes hold neither 256 16-bit samples nor one bit per sample
+                const std::string entry("\x45\x01\x04\x00\x01\x00\x00\x00", 8);
+                auto position = bytes.find(entry);
+                REQUIRE(position != std::string::npos);
+                bytes.replace(position + 8, 4, std::string("\x08\x00\x00\x00", 4));
+
+                std::stringstream corrupt(bytes);
+                dng_file result;
+                CHECK_THROWS_WITH(result.read(corrupt), "Raw image tile is too short");
+            }
+        }
+    }
+}
+
+SCENARIO("DNG metadata maps to preprocessing parameters")
+{
+    GIVEN("A DNG description with black level, white level and linearization table")
+    {
+        dng_file dng;
+        dng.pattern = bayer_pattern_e::rggb;
+        dng.black_level = { 64.0f, 65.0f, 66.0f, 67.0f };
+        dng.white_level = 4095;
+        for (int i = 0; i < 16; i++)
+            dng.linearization_table.push_back(static_cast<uint16_t>(i * i));
+
+        WHEN("The values are applied to a preprocessor and read back")
+        {
+            preprocessor_s preprocessor;
+            dng.apply_to(preprocessor);
+            dng_file copy;
+            copy.pattern = dng.pattern;
+            copy.set_from(preprocessor, 4.0f, 0.01f);
+
+            THEN("The black levels and saturation are preserved")
+            {
+                CHECK(preprocessor.saturation == 4095.0f);
+                CHECK(copy.black_level == dng.black_level);
+                CHECK(copy.white_level == 4095);
+            }
+        }
+
+        WHEN("The linearization table is converted to linearization_s and back")
+        {
+            auto linearization = dng.get_linearization();
+            dng_file copy;
+            copy.set_linearization(linearization);
+
+            THEN("The table covers the full input range and is identical in the original range")
+            {
+                REQUIRE(copy.linearization_table.size() >= dng.linearization_table.size());
+                for (size_t i = 0; i < dng.linearization_table.size(); i++)
+                    CHECK(copy.linearization_table[i] == dng.linearization_table[i]);
+            }
+        }
+    }
+
+    GIVEN("A plain16 raw file and its .meta side-car")
+    {
+        std::string plain16 = { 1, 0, 2, 0, 3, 0, 0, 1, 5, 0, 6, 0 };
+        std::istringstream raw_stream(plain16);
+        std::istringstream meta_stream("exposure_time\t0.01\niso\t100\nanalog_gain\t2\naperture\t1.8\n");
+
+        WHEN("The files are parsed")
+        {
+            auto raw = dng_file::read_plain16(raw_stream, 2, 3, bayer_pattern_e::bggr);
+            dng_file dng;
+            dng.read_meta(meta_stream);
+
+            THEN("Pixels are read in little endian row major order and metadata is set")
+            {
+                CHECK(raw._img(0, 2) == 3);
+                CHECK(raw._img(1, 0) == 256);
+                CHECK(raw._img(1, 2) == 6);
+                CHECK(dng.exposure_time == Approx(0.01));
+                CHECK(dng.iso == Approx(100));
+                CHECK(dng.f_number == Approx(1.8));
+            }
+        }
+    }
+}
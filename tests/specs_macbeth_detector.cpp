@@ -152,6 +152,20 @@ struct macbeth_generator
 
 namespace teisko_libmacbeth_tests
 {
+    /// Returns the average of the vertices of each polygon
+    std::vector<point_xy> polygon_centers(std::vector<std::vector<point_xy>> &polygons)
+    {
+        std::vector<point_xy> centers;
+        for (auto &polygon : polygons)
+        {
+            point_xy sum(0, 0);
+            for (auto &p : polygon)
+                sum = sum + p;
+            centers.push_back(sum * (1.0 / polygon.size()));
+        }
+        return centers;
+    }
+
     SCENARIO("Macbeth detector founds a chart from artificial RGB image")
     {
         auto model = macbeth_generator(640, 480);
@@ -206,6 +220,594 @@ namespace teisko_libmacbeth_tests
         }
     }
 
+    SCENARIO("Macbeth detector finds a chart from a large bayer image without demosaicing it")
+    {
+        // Artificial macbeth chart magnified and seen through bayer GRBG filter
+        auto magnified_bayer = [](macbeth_generator &model, int magnification)
+        {
+            auto magnified = rgb_image_s<uint16_t>(roi_point(640 * magnification, 480 * magnification));
+            for (int ch : { 0, 1, 2 })
+                for (int y = 0; y < magnified[ch]._height; y++)
+                    for (int x = 0; x < magnified[ch]._width; x++)
+                        magnified[ch](y, x) = model.canvas[ch](y / magnification, x / magnification);
+            model.canvas = magnified;
+            return model.mosaic(bayer_pattern_e::grbg);
+        };
+
+        GIVEN("A chart magnified by three -- reduced by two to the 1MP range")
+        {
+            auto model = macbeth_generator(640, 480);
+            auto bayer = magnified_bayer(model, 3);
+
+            WHEN("The chart is detected from the bayer image and from the demosaiced image")
+            {
+                auto detection = macbeth_chart().find(bayer);
+                auto rgb = demosaic_bilinear_rgb(bayer, MIRROR_EVEN);
+                auto reference = macbeth_chart().find(rgb);
+
+                THEN("Both detections are valid and the patch centroids match")
+                {
+                    REQUIRE(detection.is_valid() == true);
+                    REQUIRE(reference.is_valid() == true);
+                    auto scale = point_xy(0.5, 0.5);
+                    CHECK(get_patch_trimmed_mean<uint16_t>(bayer[1], detection.polygons, scale) == model.get_patch_values(0));
+                    CHECK(get_patch_trimmed_mean<uint16_t>(bayer[2], detection.polygons, scale) == model.get_patch_values(2));
+
+                    auto centroids = polygon_centers(detection.polygons);
+                    auto reference_centroids = polygon_centers(reference.polygons);
+                    REQUIRE(centroids.size() == reference_centroids.size());
+                    for (size_t i = 0; i < centroids.size(); i++)
+                    {
+                        CHECK(std::abs(centroids[i].x - reference_centroids[i].x) < 8.0);
+                        CHECK(std::abs(centroids[i].y - reference_centroids[i].y) < 8.0);
+                    }
+                }
+            }
+        }
+
+        GIVEN("A chart magnified by four -- reduced by the odd scale of three to the 1MP range")
+        {
+            auto model = macbeth_generator(640, 480);
+            auto bayer = magnified_bayer(model, 4);
+
+            WHEN("The chart is detected from the bayer image and from the demosaiced image")
+            {
+                auto detection = macbeth_chart().find(bayer);
+                auto rgb = demosaic_bilinear_rgb(bayer, MIRROR_EVEN);
+                auto reference = macbeth_chart().find(rgb);
+
+                THEN("The polygons are identical")
+                {
+                    REQUIRE(detection.is_valid() == true);
+                    CHECK(detection.polygons == reference.polygons);
+                    auto scale = point_xy(0.5, 0.5);
+                    CHECK(get_patch_trimmed_mean<uint16_t>(bayer[1], detection.polygons, scale) == model.get_patch_values(0));
+                }
+            }
+        }
+    }
+
+    SCENARIO("Macbeth detector evaluates the candidates concurrently with deterministic results")
+    {
+        auto model = macbeth_generator(640, 480);
+        GIVEN("An artificial rotated grayscale macbeth chart with noise")
+        {
+            image<uint16_t> gray_scale_image = model.to_gray_scale();
+            gray_scale_image = rotate_image(gray_scale_image, 17.0);
+            std::mt19937 rng(9);
+            std::uniform_int_distribution<int> noise(-20, 20);
+            gray_scale_image.foreach([&](uint16_t &pix) { pix = static_cast<uint16_t>(std::max(0, pix + noise(rng))); });
+
+            WHEN("The chart is detected with one and with several threads")
+            {
+                auto single = macbeth_chart(0.65, 1).find(gray_scale_image);
+                auto first = macbeth_chart(0.65, 4).find(gray_scale_image);
+                auto second = macbeth_chart(0.65, 4).find(gray_scale_image);
+
+                THEN("The detected polygons are identical")
+                {
+                    REQUIRE(single.is_valid() == true);
+                    REQUIRE(first.polygons.size() == single.polygons.size());
+                    REQUIRE(second.polygons.size() == single.polygons.size());
+                    for (size_t i = 0; i < single.polygons.size(); i++)
+                    {
+                        for (size_t j = 0; j < single.polygons[i].size(); j++)
+                        {
+                            CHECK(first.polygons[i][j].x == single.polygons[i][j].x);
+                            CHECK(first.polygons[i][j].y == single.polygons[i][j].y);
+                            CHECK(second.polygons[i][j].x == single.polygons[i][j].x);
+                            CHECK(second.polygons[i][j].y == single.polygons[i][j].y);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    SCENARIO("Macbeth detector tracks a chart over a sequence of frames")
+    {
+        auto model = macbeth_generator(640, 480);
+        auto clean = model.to_gray_scale();
+        std::mt19937 rng(46);
+        std::uniform_int_distribution<int> noise(-15, 15);
+
+        // Returns a noisy frame with the chart moved by `shift` pixels
+        auto frame = [&](roi_point shift)
+        {
+            auto img = image<uint16_t>(clean.size()).fill(0);
+            for (int y = 0; y < img._height; y++)
+            {
+                for (int x = 0; x < img._width; x++)
+                {
+                    auto src = roi_point(x, y) - shift;
+                    int value = src._x >= 0 && src._y >= 0 && src._x < clean._width && src._y < clean._height
+                        ? clean(src) : 0;
+                    img(y, x) = static_cast<uint16_t>(std::max(0, value + noise(rng)));
+                }
+            }
+            return img;
+        };
+
+        GIVEN("A chart detected from the first frame")
+        {
+            auto first = frame(roi_point(0, 0));
+            auto chart = macbeth_chart();
+            chart.find(first);
+            REQUIRE(chart.is_valid());
+            REQUIRE(chart.is_tracked() == false);
+            auto previous = chart.polygons;
+
+            WHEN("The chart is tracked to a frame with only different noise")
+            {
+                auto next = frame(roi_point(0, 0));
+                chart.track(next);
+
+                THEN("The previous polygons are verified as they are")
+                {
+                    REQUIRE(chart.is_tracked());
+                    REQUIRE(chart.polygons.size() == previous.size());
+                    for (size_t i = 0; i < previous.size(); i++)
+                    {
+                        for (size_t j = 0; j < previous[i].size(); j++)
+                        {
+                            CHECK(chart.polygons[i][j].x == previous[i][j].x);
+                            CHECK(chart.polygons[i][j].y == previous[i][j].y);
+                        }
+                    }
+                }
+            }
+
+            WHEN("The chart is tracked to a frame where the chart has moved a few pixels")
+            {
+                auto next = frame(roi_point(-9, -6));
+                chart.track(next);
+
+                THEN("The polygons follow the chart and cover the same patches")
+                {
+                    REQUIRE(chart.is_tracked());
+                    auto moved = polygon_centers(chart.polygons);
+                    auto original = polygon_centers(previous);
+                    for (size_t i = 0; i < moved.size(); i++)
+                    {
+                        CHECK(std::abs(moved[i].x - original[i].x + 9) <= 4);
+                        CHECK(std::abs(moved[i].y - original[i].y + 6) <= 4);
+                    }
+                    // the patch values are off only by the noise
+                    auto values = get_patch_trimmed_mean(next, chart.polygons);
+                    auto expected = model.get_patch_values(-1);
+                    for (size_t i = 0; i < values.size(); i++)
+                        CHECK(std::abs(values[i] - expected[i]) < 2.0);
+                }
+            }
+
+            WHEN("The chart is tracked to a frame where the chart has been rotated")
+            {
+                auto rotated = rotate_image(first, 30.0);
+                chart.track(rotated);
+
+                THEN("The chart is detected again from scratch")
+                {
+                    CHECK(chart.is_tracked() == false);
+                    CHECK(chart.is_valid());
+                }
+            }
+
+            WHEN("The chart is tracked to a frame without a chart")
+            {
+                auto blank = image<uint16_t>(clean.size()).fill(1000);
+                chart.track(blank);
+
+                THEN("Neither tracking nor detection finds the chart")
+                {
+                    CHECK(chart.is_tracked() == false);
+                    CHECK(chart.is_valid() == false);
+                }
+            }
+
+            WHEN("The detector is reused to find a chart from a frame without a chart")
+            {
+                auto blank = image<uint16_t>(clean.size()).fill(1000);
+                chart.find(blank);
+
+                THEN("The failed detection keeps the previous chart")
+                {
+                    CHECK(chart.is_valid());
+                    CHECK(chart.polygons == previous);
+                }
+            }
+        }
+    }
+
+    SCENARIO("Several charts of different geometries are located from one detection pass")
+    {
+        auto macbeth_values = macbeth_generator(640, 480).get_patch_values(-1);
+        auto grid_value = [](int patch) { return static_cast<uint16_t>(100 + 6 * (patch * 37 % 100)); };
+
+        GIVEN("A noisy image of a 6x4 Macbeth chart, a 10x10 chart and a smaller Macbeth chart")
+        {
+            auto img = image<uint16_t>(700, 1000).fill(0);
+            for (int row = 0; row < 4; row++)
+            {
+                for (int col = 0; col < 6; col++)
+                {
+                    img.region(44, 44, 80 + 52 * row, 60 + 52 * col).fill(macbeth_values[row * 6 + col]);
+                    img.region(30, 30, 400 + 36 * row, 60 + 36 * col).fill(macbeth_values[row * 6 + col]);
+                }
+            }
+            for (int row = 0; row < 10; row++)
+                for (int col = 0; col < 10; col++)
+                    img.region(26, 26, 300 + 34 * row, 560 + 34 * col).fill(grid_value(row * 10 + col));
+
+            std::mt19937 rng(50);
+            std::uniform_int_distribution<int> noise(-10, 10);
+            img.foreach([&](uint16_t &pix) { pix = static_cast<uint16_t>(std::max(0, pix + noise(rng))); });
+
+            WHEN("The charts are located together")
+            {
+                auto charts = std::vector<macbeth_chart>{
+                    macbeth_chart(), macbeth_chart(chart_geometry_s(10, 10)), macbeth_chart() };
+                macbeth_chart::find_all(charts, img);
+
+                THEN("Each chart is valid and covers patches of its own values")
+                {
+                    REQUIRE(charts[0].is_valid());
+                    REQUIRE(charts[1].is_valid());
+                    REQUIRE(charts[2].is_valid());
+                    CHECK(charts[1].polygons.size() == 100);
+
+                    for (auto i : { 0, 2 })
+                    {
+                        auto values = get_patch_trimmed_mean(img, charts[i].polygons);
+                        for (size_t j = 0; j < values.size(); j++)
+                        {
+                            INFO("chart " << i << " patch " << j);
+                            CHECK(std::abs(values[j] - macbeth_values[j]) < 3.0);
+                        }
+                    }
+
+                    // The order of the patches of a chart without a ramp is known up to a rotation
+                    auto values = get_patch_trimmed_mean(img, charts[1].polygons);
+                    std::vector<double> expected;
+                    for (int j = 0; j < 100; j++)
+                        expected.push_back(grid_value(j));
+                    std::sort(values.begin(), values.end());
+                    std::sort(expected.begin(), expected.end());
+                    for (size_t j = 0; j < values.size(); j++)
+                        CHECK(std::abs(values[j] - expected[j]) < 3.0);
+                }
+
+                THEN("The two Macbeth charts are different charts")
+                {
+                    auto first = polygon_centers(charts[0].polygons);
+                    auto second = polygon_centers(charts[2].polygons);
+                    REQUIRE(first.size() == second.size());
+                    for (size_t j = 0; j < first.size(); j++)
+                        CHECK(norm(first[j] - second[j]) > 100.0);
+                }
+
+                THEN("The first chart matches the chart located alone")
+                {
+                    auto alone = macbeth_chart().find(img);
+                    CHECK(alone.polygons == charts[0].polygons);
+                }
+            }
+        }
+    }
+
+    SCENARIO("Chart geometries are validated on construction")
+    {
+        GIVEN("Geometries with a valid and with an invalid size or ramp")
+        {
+            THEN("Only the valid geometries are accepted")
+            {
+                CHECK(chart_geometry_s(10, 10).ramp.empty());
+                CHECK(chart_geometry_s(3, 2, { 0, 5 }).patches() == 6);
+                CHECK_THROWS_WITH(chart_geometry_s(1, 10), "Chart should have at least 2x2 patches");
+                CHECK_THROWS_WITH(chart_geometry_s(3, 2, { 6, 0 }), "Chart ramp refers to a patch outside the chart");
+                CHECK_THROWS_WITH(chart_geometry_s(3, 2, { 4 }), "Chart ramp should have at least 2 patches");
+            }
+        }
+    }
+
+    SCENARIO("Patch statistics are gathered from scanline spans of all patches in one pass")
+    {
+        GIVEN("A noisy image and quads of various shapes, some crossing the image borders")
+        {
+            std::mt19937 rng(45);
+            std::uniform_int_distribution<int> noise(0, 4095);
+            std::uniform_real_distribution<double> u(-1.0, 1.0);
+            auto img = image<uint16_t>(150, 200);
+            img.foreach([&](uint16_t &pix) { pix = static_cast<uint16_t>(noise(rng)); });
+
+            std::vector<std::vector<point_xy>> polygons;
+            for (int i = 0; i < 60; i++)
+            {
+                auto center = point_xy(100 + 110 * u(rng), 75 + 85 * u(rng));
+                auto radius = 5 + 20 * (1 + u(rng));
+                auto angle = 3.14 * u(rng);
+                std::vector<point_xy> quad;
+                for (int c = 0; c < 4; c++)
+                {
+                    // every fifth quad is made concave by pulling one corner inside
+                    auto r = (i % 5 == 0 && c == 1) ? radius * 0.2 : radius * (1 + 0.3 * u(rng));
+                    auto a = angle + c * 1.5707963267948966;
+                    quad.emplace_back(center.x + r * std::cos(a), center.y + r * std::sin(a));
+                }
+                polygons.push_back(quad);
+            }
+            // and an axis aligned quad with integral corners
+            polygons.push_back({ point_xy(10, 10), point_xy(30, 10), point_xy(30, 20), point_xy(10, 20) });
+
+            WHEN("The statistics are computed from the spans")
+            {
+                auto stats = get_patch_statistics(img, polygons);
+
+                THEN("Each patch matches the statistics of the pixels under its stencil")
+                {
+                    REQUIRE(stats.size() == polygons.size());
+                    for (size_t i = 0; i < polygons.size(); i++)
+                    {
+                        INFO("polygon " << i);
+                        auto offset = roi_point(0, 0);
+                        auto stencil = get_patch_stencil(img.size(), polygons[i], offset);
+                        std::vector<uint16_t> pixels;
+                        auto region = img.region(stencil.size(), offset);
+                        get_pixel_data(region, stencil, pixels);
+
+                        REQUIRE(stats[i].count == pixels.size());
+                        if (pixels.empty())
+                            continue;
+                        CHECK(stats[i].trimmed_mean == get_patch_trimmed_mean(img.region(stencil.size(), offset), stencil));
+                        CHECK(stats[i].deviation == get_patch_deviation(img.region(stencil.size(), offset), stencil));
+                        CHECK(stats[i].minimum == *std::min_element(pixels.begin(), pixels.end()));
+                        CHECK(stats[i].maximum == *std::max_element(pixels.begin(), pixels.end()));
+                        double sum = 0;
+                        for (auto p : pixels)
+                            sum += p;
+                        CHECK(stats[i].mean == Approx(sum / pixels.size()));
+                    }
+                    CHECK(stats.back().count == 20 * 10);
+                }
+            }
+        }
+
+        GIVEN("Quads with integral corners, whose edges pass through pixel centers at fractional slopes")
+        {
+            std::mt19937 rng(46);
+            std::uniform_int_distribution<int> corner(-10, 210);
+            auto size = roi_point(200, 150);
+            std::vector<std::vector<point_xy>> polygons;
+            for (int i = 0; i < 200; i++)
+            {
+                std::vector<point_xy> quad;
+                for (int c = 0; c < 4; c++)
+                    quad.emplace_back(corner(rng), corner(rng));
+                polygons.push_back(quad);
+            }
+
+            THEN("The spans cover exactly the pixels of the stencils, also when the quads are scaled")
+            {
+                for (auto scale : { point_xy(1.0, 1.0), point_xy(1.0 / 3, 0.7) })
+                {
+                    auto spans = patch_spans_s(size, polygons, scale);
+                    for (size_t i = 0; i < polygons.size(); i++)
+                    {
+                        INFO("polygon " << i << " scale " << scale.x);
+                        auto mask = image<uint8_t>(size).fill(0);
+                        for (auto &span : spans.spans)
+                            if (span.index == static_cast<int>(i))
+                                for (int x = span.x0; x < span.x1; x++)
+                                    mask(span.y, x)++;
+
+                        std::vector<point_xy> quad;
+                        for (auto &p : polygons[i])
+                            quad.push_back(p * scale);
+                        auto offset = roi_point(0, 0);
+                        auto stencil = get_patch_stencil(size, quad, offset);
+                        int mismatches = 0;
+                        size_t covered = 0;
+                        for (int y = 0; y < size._y; y++)
+                            for (int x = 0; x < size._x; x++)
+                            {
+                                auto sx = x - offset._x;
+                                auto sy = y - offset._y;
+                                auto inside = sx >= 0 && sy >= 0 && sx < stencil._width && sy < stencil._height
+                                    && stencil(sy, sx) != 0;
+                                covered += inside ? 1 : 0;
+                                if (mask(y, x) != (inside ? 1 : 0))
+                                    mismatches++;
+                            }
+                        CHECK(mismatches == 0);
+                        CHECK(spans.counts[i] == covered);
+                    }
+                }
+            }
+        }
+    }
+
+    SCENARIO("Barrel distortion strength is searched without evaluating every step")
+    {
+        GIVEN("Corners of 6x4 rotated, barrel distorted and noisy squares")
+        {
+            std::mt19937 rng(44);
+            std::uniform_real_distribution<double> u(-1.0, 1.0);
+            auto center = point_xy(500.0, 375.0);
+            auto r2 = norm2(center);
+
+            // Reference: barrel correct a copy of the corners at each step and compare the
+            // standard deviations of the diagonal differences
+            auto reference_cost = [&](const std::vector<point_xy> &corners, double alpha)
+            {
+                variance_s squareness;
+                auto a = alpha / r2;
+                for (size_t i = 0; i < corners.size(); i += 4)
+                {
+                    point_xy p[4];
+                    for (int c = 0; c < 4; c++)
+                    {
+                        p[c] = corners[i + c];
+                        if (a != 0.0)
+                        {
+                            auto d = p[c] - center;
+                            p[c] = center + d / (1 + a * norm2(d));
+                        }
+                    }
+                    squareness += norm(p[0] - p[2]) - norm(p[1] - p[3]);
+                }
+                return squareness();
+            };
+
+            THEN("The costs match the reference exactly and the best step matches the exhaustive search")
+            {
+                for (int trial = 0; trial < 50; trial++)
+                {
+                    auto distortion = 1.5 + 1.5 * u(rng);
+                    auto angle = 0.3 * u(rng);
+                    auto pitch = 110.0 + 30 * u(rng);
+                    std::vector<point_xy> corners;
+                    for (int row = 0; row < 4; row++)
+                    {
+                        for (int col = 0; col < 6; col++)
+                        {
+                            for (int c = 0; c < 4; c++)
+                            {
+                                auto a = angle + c * 1.5707963267948966 + 0.7853981633974483;
+                                auto v = point_xy((col - 2.5) * pitch + std::cos(a) * pitch * 0.4,
+                                                  (row - 1.5) * pitch + std::sin(a) * pitch * 0.4);
+                                auto d = point_xy(std::cos(angle) * v.x - std::sin(angle) * v.y,
+                                                  std::sin(angle) * v.x + std::cos(angle) * v.y);
+                                d = d * (1 + distortion * 0.3 * norm2(d) / r2) + point_xy(u(rng), u(rng)) * 0.5;
+                                corners.push_back(center + d);
+                            }
+                        }
+                    }
+
+                    int exhaustive = -32;
+                    std::vector<double> costs;
+                    for (int k = -32; k <= 32; k++)
+                    {
+                        costs.push_back(reference_cost(corners, k * 0.1));
+                        if (costs.back() < costs[exhaustive + 32])
+                            exhaustive = k;
+                    }
+
+                    for (auto level : { simd_level_e::scalar, simd_level_e::sse4, simd_level_e::avx2 })
+                    {
+                        INFO("trial " << trial << " level " << static_cast<int>(level));
+                        barrel_squareness_s squareness(corners, center, level);
+                        REQUIRE(squareness.size() == 24);
+                        for (int k = -32; k <= 32; k++)
+                            CHECK(squareness(k * 0.1 / r2) == costs[k + 32]);
+                        CHECK(std::abs(squareness.best_alpha() - exhaustive * 0.1) < 0.01);
+                    }
+                }
+            }
+        }
+    }
+
+    SCENARIO("Squareness of feature paths is scored with shared trigonometric tables")
+    {
+        GIVEN("Perimeters of noisy squares and circles of various lengths")
+        {
+            std::mt19937 rng(49);
+            std::uniform_real_distribution<double> u(-1.0, 1.0);
+            std::vector<std::vector<point_xy>> paths;
+            for (int i = 0; i < 40; i++)
+            {
+                // a few lengths repeat, so the tables are both reused and rebuilt
+                size_t length = 20 + (i % 7) * 53 + (i % 3);
+                std::vector<point_xy> path;
+                for (size_t n = 0; n < length; n++)
+                {
+                    auto t = 6.283185307179586 * n / length;
+                    auto r = 40.0 + 2 * u(rng);
+                    if (i % 2 == 0)     // square: scale the unit circle to the unit square
+                        r /= std::max(std::abs(std::cos(t)), std::abs(std::sin(t)));
+                    path.emplace_back(100 + r * std::cos(t), 80 + r * std::sin(t));
+                }
+                paths.push_back(path);
+            }
+            auto centroid = point_xy(100.5, 79.5);
+
+            // Reference: a DFT of the centroid distances per harmonic with a table per path
+            auto reference_rms = [&centroid](const std::vector<point_xy> &path)
+            {
+                auto sz = path.size();
+                if (sz < 32)
+                    return -1.0;
+                double angle = 6.283185307179586 / sz;
+                std::vector<point_xy> trigs(sz);
+                for (size_t i = 0; i < sz; i++)
+                    trigs[i] = { std::cos(angle * i), std::sin(angle * i) };
+                const double sqFFT[15] = {
+                    0.0010871038, 0.0012745257, 0.0019206153, 0.0760958988, 0.0007661686,
+                    0.0000199350, 0.0005197369, 0.0158663285, 0.0003992480, 0.0000085283,
+                    0.0003177932, 0.0070672313, 0.0002918863, 0.0000040173, 0.0002226015
+                };
+                std::vector<double> magnitude;
+                for (size_t i = 0; i < 16; i++)
+                {
+                    size_t idx = 0;
+                    point_xy item;
+                    for (auto &p : path)
+                    {
+                        item += norm(p - centroid) * trigs[idx];
+                        idx += i;
+                        if (idx >= sz)
+                            idx -= sz;
+                    }
+                    magnitude.push_back(norm(item));
+                }
+                double rms = 0.0;
+                double scale = 1.0 / magnitude[0];
+                for (int i = 0; i < 15; i++)
+                {
+                    auto diff = sqFFT[i] - magnitude[i + 1] * scale;
+                    rms += diff * diff;
+                }
+                return std::sqrt(rms * (2.0 / 31));
+            };
+
+            THEN("The scores match the reference and squares score several times better than circles")
+            {
+                for (auto level : { simd_level_e::scalar, simd_level_e::sse4, simd_level_e::avx2 })
+                {
+                    square_spectrum_s spectrum(level);
+                    for (size_t i = 0; i < paths.size(); i++)
+                    {
+                        INFO("path " << i << " of length " << paths[i].size() << ", level " << static_cast<int>(level));
+                        auto rms = spectrum(paths[i], centroid);
+                        CHECK(rms == reference_rms(paths[i]));
+                        if (paths[i].size() >= 32)
+                            CHECK((rms < 0.01) == (i % 2 == 0));
+                        else
+                            CHECK(rms == -1.0);
+                    }
+                }
+            }
+        }
+    }
+
     SCENARIO("Macbeth detector founds a chart from artificial gray scale image. "
         "In this scenario we also show that the chart locator fails to find the chart (by design) "
         "from those otherwise perfectly discovered charts of 6x4 patches, where there is no "
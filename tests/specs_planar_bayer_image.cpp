@@ -0,0 +1,137 @@
+/*
+* Copyright (c) 2019, Intel Corporation
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of the Intel Corporation nor the
+*       names of its contributors may be used to endorse or promote products
+*       derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+* ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "Teisko/LensShading.hpp"
+#include "Teisko/PlanarBayerImage.hpp"
+#include "Teisko/Preprocessing.hpp"
+#include "catch.hpp"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+using namespace Teisko;
+
+namespace
+{
+    bayer_image_s<uint16_t> make_random_bayer(int height, int width, bayer_pattern_e pattern)
+    {
+        std::mt19937 rng(height * 31 + width);
+        std::uniform_int_distribution<int> dist(0, 1023);
+        bayer_image_s<uint16_t> raw(height, width, pattern);
+        raw._img.foreach([&](uint16_t &pix) { pix = static_cast<uint16_t>(dist(rng)); });
+        return raw;
+    }
+}
+
+SCENARIO("Bayer images can be split to contiguous planes and merged back")
+{
+    auto patterns = { bayer_pattern_e::rggb, bayer_pattern_e::grbg_4x2, bayer_pattern_e::bgrg_gigi_rgbg_gigi };
+    auto levels = { simd_level_e::scalar, simd_level_e::sse4, simd_level_e::avx2, simd_level_e::avx512 };
+
+    GIVEN("Random 2x2, 4x2 and 4x4 images with channel widths not divisible by the vector widths")
+    {
+        THEN("Every plane matches the strided channel view and merging restores the image")
+        {
+            for (auto pattern : patterns)
+            {
+                for (auto level : levels)
+                {
+                    INFO("pattern=" << (int)pattern << " level=" << (int)level);
+                    auto raw = make_random_bayer(36, 4 * 37, pattern);
+                    planar_bayer_image<uint16_t> planar(raw, 3, level);
+
+                    CHECK(get_channel_dim(planar)._x == get_channel_dim(raw)._x);
+                    CHECK(get_channel_dim(planar)._y == get_channel_dim(raw)._y);
+                    for (auto i : raw)
+                    {
+                        CHECK(planar[i].is_contiguous());
+                        CHECK(planar[i].to_vector() == raw[i].to_vector());
+                    }
+
+                    auto merged = planar.to_bayer(3, level);
+                    CHECK(merged._img.to_vector() == raw._img.to_vector());
+                }
+            }
+        }
+
+        THEN("A strided source view is split through the scalar path")
+        {
+            auto raw = make_random_bayer(24, 40, bayer_pattern_e::rggb);
+            auto view = raw._img.mirror();
+            auto mirrored = bayer_image_s<uint16_t>(view, bayer_pattern_e::grbg);
+            planar_bayer_image<uint16_t> planar(mirrored);
+            for (auto i : mirrored)
+                CHECK(planar[i].to_vector() == mirrored[i].to_vector());
+        }
+
+        THEN("Merging to an image of different size throws")
+        {
+            auto raw = make_random_bayer(24, 40, bayer_pattern_e::rggb);
+            planar_bayer_image<uint16_t> planar(raw);
+            bayer_image_s<uint16_t> other(24, 44, bayer_pattern_e::rggb);
+            CHECK_THROWS(planar.merge(other));
+        }
+    }
+}
+
+SCENARIO("Preprocessing and characterization accept planar bayer images")
+{
+    GIVEN("An RGB-IR image and its planar copy")
+    {
+        auto raw = make_random_bayer(56, 84, bayer_pattern_e::bgrg_gigi_rgbg_gigi);
+        planar_bayer_image<uint16_t> planar(raw);
+
+        THEN("The flat field white point is the same")
+        {
+            auto a = get_flatfield_white_point(raw);
+            auto b = get_flatfield_white_point(planar);
+            CHECK(a._r_per_g == b._r_per_g);
+            CHECK(a._b_per_g == b._b_per_g);
+            CHECK(a._i_per_g == b._i_per_g);
+        }
+
+        THEN("Black level removal gives the same channels")
+        {
+            std::vector<int> black_level(16);
+            for (size_t i = 0; i < black_level.size(); i++)
+                black_level[i] = 60 + static_cast<int>(i) * 10;
+            remove_black_level(raw, black_level);
+            remove_black_level(planar, black_level);
+            CHECK(planar.to_bayer()._img.to_vector() == raw._img.to_vector());
+        }
+
+        THEN("The lens shading grid is the same")
+        {
+            auto model = lensshading_calculator{ 5, 3 };
+            auto a = model.calculate_grid(raw);
+            auto b = model.calculate_grid(planar);
+            CHECK(a.grid == b.grid);
+        }
+    }
+}
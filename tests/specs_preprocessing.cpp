@@ -44,6 +44,46 @@ namespace libprepro_algorithm_tests
             .set(1.0f, 0.01f, std::vector<float>{ 2.f, 3.f, 4.f }));
     }
 
+    SCENARIO("Black level model interpolates between grid points and is recompiled after changes")
+    {
+        GIVEN("A black level model with two exposures")
+        {
+            auto model = black_level_model{};
+            model.set(1.0f, 0.01f, std::vector<float>{ 2.f, 3.f, 4.f })
+                .set(1.0f, 0.03f, std::vector<float>{ 4.f, 5.f, 6.f });
+
+            THEN("The values between and at the grid points are interpolated, also in batches")
+            {
+                auto tree = interpolate_x_dim<float>{};
+                std::vector<float> low = { 2.f, 3.f, 4.f };
+                std::vector<float> high = { 4.f, 5.f, 6.f };
+                tree.set({ 1.0f, 0.01f }, low);
+                tree.set({ 1.0f, 0.03f }, high);
+                CHECK(model.get(1.0f, 0.02f) == tree.get({ 1.0f, 0.02f }));
+                CHECK(model.get(1.0f, 0.02f)[1] == Approx(4.f));
+                float pairs[] = { 1.0f, 0.01f, 2.0f, 0.03f };
+                float out[6];
+                REQUIRE(model.max_size() == 3);
+                model.get(pairs, 2, out);
+                CHECK(std::vector<float>(out, out + 6) == (std::vector<float>{ 2.f, 3.f, 4.f, 4.f, 5.f, 6.f }));
+            }
+            AND_THEN("An empty model returns no values")
+            {
+                CHECK(black_level_model{}.get(1.0f, 0.02f).empty());
+            }
+            AND_WHEN("A grid point is changed")
+            {
+                model.set(1.0f, 0.03f, std::vector<float>{ 6.f, 7.f, 8.f });
+                THEN("The lookup uses the new data")
+                {
+                    float out[3];
+                    CHECK(model.get(1.0f, 0.03f, out) == 3);
+                    CHECK(std::vector<float>(out, out + 3) == (std::vector<float>{ 6.f, 7.f, 8.f }));
+                }
+            }
+        }
+    }
+
     SCENARIO("How chromaticity is calculated")
     {
         GIVEN("One chromaticity calculator and four sensitivity values")
@@ -338,6 +378,106 @@ namespace libprepro_algorithm_tests
     }
 
 
+    SCENARIO("RGB IR contamination weights can be interpolated bilinearly or reused from cache")
+    {
+        GIVEN("A contamination grid with weights increasing linearly left to right in RGIB layout")
+        {
+            auto info = bayer_info_s{ bayer_pattern_e::rgib };
+            auto grid = make_simple_rgb_ir_struct(info, 0.f, 0.f, 0.f);
+            for (int i = 0; i < 8 * 8 * 3; i++)
+                grid._grid_data[i] = 0.1f + 0.02f * (i % 8) + 0.05f * (i / 64);
+
+            const int height = 48;
+            const int width = 72;
+            const float ir = 1000.0f;
+            auto original = bayer_image_s<float>(height, width, bayer_pattern_e::rgib);
+            for (auto ch : original)
+                original[ch].fill(info[ch] == color_info_e::ir ? ir : 2000.0f + 100.0f * ch);
+
+            // Contaminates each color channel by the weights linearly interpolated from the grid
+            auto contaminated = original;
+            auto grid_indices = remap_4x4_vector(grid._grid_indices, info);
+            for (auto ch : contaminated)
+            {
+                if (grid_indices[ch] < 0)
+                    continue;
+                auto chan = contaminated[ch];
+                for (int y = 0; y < chan._height; y++)
+                    for (int x = 0; x < chan._width; x++)
+                    {
+                        auto gx = 7.0f * x / (chan._width - 1);
+                        chan(y, x) += ir * (0.1f + 0.02f * gx + 0.05f * grid_indices[ch]);
+                    }
+            }
+
+            WHEN("The contamination is removed with polynomial and bilinear weights")
+            {
+                THEN("The original image is recovered")
+                {
+                    for (auto method : { ir_weight_interpolation_e::polynomial, ir_weight_interpolation_e::bilinear })
+                    {
+                        auto model = rgb_ir_contamination{};
+                        model._weight_interpolation = method;
+                        model.add_data_grid(grid);
+                        auto img = contaminated;
+                        model.remove_ir_contamination(img, 3);
+
+                        INFO("method " << static_cast<int>(method));
+                        auto result = img._img.to_vector();
+                        auto expected = original._img.to_vector();
+                        for (size_t i = 0; i < result.size(); i++)
+                            CHECK(result[i] == Approx(expected[i]).epsilon(1e-4));
+                    }
+                }
+            }
+
+            WHEN("The polynomial model is applied to an image with the default settings")
+            {
+                auto model = rgb_ir_contamination{};
+                model.add_data_grid(grid);
+                auto img = contaminated;
+                model.remove_ir_contamination(img);
+
+                THEN("No grid is cached")
+                {
+                    CHECK(model.cached_grid_count() == 0);
+                }
+            }
+
+            WHEN("The polynomial model with the cache enabled is applied to several images")
+            {
+                auto model = rgb_ir_contamination{};
+                model._max_cached_grids = 4;
+                model.add_data_grid(grid);
+                auto first = contaminated;
+                auto second = contaminated;
+                auto small_view = contaminated._img.region(24, 36, 0, 0);
+                auto small = bayer_image_s<float>(small_view, bayer_pattern_e::rgib);
+                model.remove_ir_contamination(first);
+                auto cached_after_first = model.cached_grid_count();
+                model.remove_ir_contamination(second);
+                auto cached_after_second = model.cached_grid_count();
+                model.remove_ir_contamination(small);
+                auto cached_after_small = model.cached_grid_count();
+
+                THEN("The upscaled grid is computed once per white point and channel size")
+                {
+                    CHECK(cached_after_first == 1);
+                    CHECK(cached_after_second == 1);
+                    CHECK(cached_after_small == 2);
+                    CHECK(first._img.to_vector() == second._img.to_vector());
+                }
+                AND_THEN("Adding a data grid invalidates the cache")
+                {
+                    auto other = make_simple_rgb_ir_struct(info, 0.2f, 0.2f, 0.2f);
+                    other._chromaticity = chromaticity(1.0, 1.0, 1.0);
+                    model.add_data_grid(other);
+                    CHECK(model.cached_grid_count() == 0);
+                }
+            }
+        }
+    }
+
     SCENARIO("Bayer image channels can be accessed by index")
     {
         GIVEN("A bayer image of 4x4 pixels as grbg order")
@@ -716,6 +856,158 @@ namespace libprepro_algorithm_tests
         return img;
     }
 
+    SCENARIO("Compiled preprocessing pipeline matches the preprocessor functions")
+    {
+        auto make_image = [](bayer_pattern_e pattern, unsigned int seed)
+        {
+            std::mt19937 rng(seed);
+            std::uniform_int_distribution<int> dist(0, 1100);
+            bayer_image_s<uint16_t> img(96, 160, pattern);
+            img._img.foreach([&](uint16_t &pix) { pix = static_cast<uint16_t>(dist(rng)); });
+            return img;
+        };
+
+        GIVEN("A preprocessor with black level and saturation and 2x2 and DP 4x2 images")
+        {
+            preprocessor_s prepro;
+            prepro.saturation = 1023.0f;
+            prepro.bl_model.set(1.0f, 300.0f, std::vector<float>{ 64.0f, 60.5f, 66.0f, 62.0f });
+
+            linearization_s linearization;
+            linearization.grid_indices = std::vector<int8_t>(16, 0);
+            linearization.knee_points = { { roi_point(0, 0), roi_point(512, 700), roi_point(1023, 1023) } };
+
+            for (auto pattern : { bayer_pattern_e::rggb, bayer_pattern_e::grbg_4x2 })
+            {
+                for (auto sve : { 0, 0x0505 })
+                {
+                    INFO("pattern=" << (int)pattern << " sve=" << sve);
+                    prepro.sve_matrix = static_cast<uint16_t>(sve);
+                    prepro.lsc_mode = sve ? lsc_gain_mode_e::pyramid : lsc_gain_mode_e::full_resolution;
+                    auto layout = bayer_info_s(pattern);
+                    preprocess_pipeline_s<uint16_t> pipeline(prepro, layout, 1.0f, 300.0f, 3);
+
+                    auto a = make_image(pattern, 1);
+                    auto b = a;
+                    prepro.preprocess_fn1(a);
+                    pipeline.preprocess_fn1(b);
+                    CHECK(a._img.to_vector() == b._img.to_vector());
+
+                    a = make_image(pattern, 2);
+                    b = a;
+                    prepro.preprocess_fn3a(a);
+                    pipeline.preprocess_fn3a(b);
+                    CHECK(a._layout == b._layout);
+                    CHECK(a._img.size() == b._img.size());
+                    CHECK(a._img.to_vector() == b._img.to_vector());
+
+                    a = make_image(pattern, 3);
+                    b = a;
+                    auto ff_a = make_image(pattern, 4);
+                    auto ff_b = ff_a;
+                    prepro.preprocess_fn3b(a, ff_a);
+                    pipeline.preprocess_fn3b(b, ff_b);
+                    CHECK(a._layout == b._layout);
+                    CHECK(a._img.to_vector() == b._img.to_vector());
+
+                    a = make_image(pattern, 5);
+                    b = a;
+                    linearization.linearize(a, 1023);
+                    prepro.preprocess_fn1(a);
+                    pipeline.set_linearization(linearization, 1023);
+                    pipeline.preprocess_fn1(b);
+                    CHECK(a._img.to_vector() == b._img.to_vector());
+                }
+            }
+
+            THEN("Images of other layouts are rejected")
+            {
+                preprocess_pipeline_s<uint16_t> pipeline(prepro, bayer_info_s(bayer_pattern_e::rggb));
+                auto img = make_image(bayer_pattern_e::bggr, 6);
+                CHECK_THROWS(pipeline.preprocess_fn1(img));
+            }
+        }
+
+        GIVEN("A preprocessor with IR contamination removal and 2x2 and 4x4 RGB-IR images")
+        {
+            for (auto pattern : { bayer_pattern_e::rgib, bayer_pattern_e::bgrg_gigi_rgbg_gigi })
+            {
+                INFO("pattern=" << (int)pattern);
+                preprocessor_s prepro;
+                prepro.saturation = 1023.0f;
+                prepro.bl_model.set(1.0f, 300.0f, std::vector<float>{ 64.0f, 60.5f, 66.0f, 62.0f });
+
+                auto layout = bayer_info_s(pattern);
+                auto grid = make_simple_rgb_ir_struct(layout, 0.15f, 0.2f, 0.1f);
+                REQUIRE(prepro.rgb_ir_model.add_data_grid(grid));
+                preprocess_pipeline_s<uint16_t> pipeline(prepro, layout, 1.0f, 300.0f, 3);
+
+                auto a = make_image(pattern, 7);
+                auto b = a;
+                prepro.preprocess_fn3a(a);
+                pipeline.preprocess_fn3a(b);
+                CHECK(a._layout == b._layout);
+                CHECK(a._img.to_vector() == b._img.to_vector());
+
+                a = make_image(pattern, 8);
+                b = a;
+                auto ff_a = make_image(pattern, 9);
+                auto ff_b = ff_a;
+                prepro.preprocess_fn3b(a, ff_a);
+                pipeline.preprocess_fn3b(b, ff_b);
+                CHECK(a._layout == b._layout);
+                CHECK(a._img.to_vector() == b._img.to_vector());
+            }
+        }
+    }
+
+    SCENARIO("LSC gain table can be computed from a reduced resolution flat field")
+    {
+        GIVEN("A vignetted flat field with noise and defect pixels and a constant image")
+        {
+            const int height = 480;
+            const int width = 640;
+            std::mt19937 rng(7);
+            std::normal_distribution<float> noise(0.0f, 4.0f);
+            bayer_image_s<float> flat_field(height, width, bayer_pattern_e::grbg);
+            for (int y = 0; y < height; y++)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    auto dx = (x - width / 2.0) / (width / 2.0);
+                    auto dy = (y - height / 2.0) / (width / 2.0);
+                    auto pixel = 800.0 * (1.0 - 0.35 * (dx * dx + dy * dy)) * (x % 2 ? 0.8 : 1.0);
+                    flat_field._img(y, x) = static_cast<float>(pixel) + noise(rng);
+                }
+            }
+            for (int i = 0; i < 200; i++)
+                flat_field._img(rng() % height, rng() % width) = (i & 1) ? 0.0f : 1023.0f;
+
+            bayer_image_s<float> full(height, width, bayer_pattern_e::grbg);
+            full._img.fill(100.0f);
+            auto pyramid = full;
+
+            WHEN("The gains are computed at full and reduced resolution")
+            {
+                preprocessor_s prepro;
+                prepro.calculate_and_apply_lsc_gain_table(full, flat_field);
+                prepro.lsc_mode = lsc_gain_mode_e::pyramid;
+                prepro.calculate_and_apply_lsc_gain_table(pyramid, flat_field);
+
+                THEN("The gains deviate from the full resolution gains by less than 1%")
+                {
+                    auto a = full._img.to_vector();
+                    auto b = pyramid._img.to_vector();
+                    float max_deviation = 0.0f;
+                    for (size_t i = 0; i < a.size(); i++)
+                        max_deviation = std::max(max_deviation, std::abs(b[i] - a[i]) / a[i]);
+                    INFO("max relative deviation " << max_deviation);
+                    CHECK(max_deviation < 0.01f);
+                }
+            }
+        }
+    }
+
     SCENARIO("Preprocessor can linearize/compress images with a piecewise linear curve")
     {
         GIVEN("A linearization_model with 3 knee-points and a 4x4 rggb image")
@@ -756,6 +1048,88 @@ namespace libprepro_algorithm_tests
     }
 
 
+    SCENARIO("Linearization LUTs are compiled once and applied with any instruction set")
+    {
+        GIVEN("Two knee point sets shared by the channels and a channel without a curve")
+        {
+            auto linearizer = linearization_s();
+            linearizer.grid_indices = std::vector<int8_t>(
+            {
+                0, 1, 0, 1,
+                1, -1, 1, 0,
+                0, 1, 0, 1,
+                1, 0, 1, 0
+            });
+            linearizer.knee_points.push_back({ { 0, 0 }, { 512, 256 }, { 4095, 4095 } });
+            linearizer.knee_points.push_back({ { 64, 0 }, { 1023, 3000 } });
+
+            auto reference = [&linearizer](bayer_image_s<uint16_t> &img, int max_val)
+            {
+                auto w = img._layout.get_width();
+                auto h = img._layout.get_height();
+                std::vector<std::vector<uint16_t>> luts;
+                for (auto ch : img._layout)
+                    luts.push_back(linearizer.make_lut(img._layout, static_cast<int>(ch), max_val));
+                for (int y = 0; y < img._img._height; y++)
+                    for (int x = 0; x < img._img._width; x++)
+                    {
+                        auto &lut = luts[(y % h) * w + x % w];
+                        auto &d = img._img(y, x);
+                        if (!lut.empty())
+                            d = lut[std::min<size_t>(d, lut.size() - 1)];
+                    }
+            };
+
+            WHEN("Images are linearized with every instruction set tier and thread count")
+            {
+                THEN("The results match the per channel LUTs")
+                {
+                    for (auto pattern : { bayer_pattern_e::rggb, bayer_pattern_e::bgrg_gigi_rgbg_gigi })
+                    {
+                        auto raw = bayer_image_s<uint16_t>(36, 77, pattern);
+                        uint32_t seed = 1;
+                        raw._img.foreach([&seed](uint16_t &d) { seed = seed * 1103515245u + 12345u; d = (seed >> 16) & 0x1fff; });
+                        auto expected = raw;
+                        reference(expected, 4000);
+                        linearizer.compile(raw._layout, 4000);
+
+                        for (auto level : { simd_level_e::scalar, simd_level_e::sse4, simd_level_e::avx2 })
+                        {
+                            for (unsigned threads : { 1u, 3u })
+                            {
+                                INFO("pattern " << static_cast<int>(pattern) << " level " << static_cast<int>(level)
+                                    << " threads " << threads);
+                                auto img = raw;
+                                linearizer.linearize(img, 4000, threads, level);
+                                CHECK(img._img.to_vector() == expected._img.to_vector());
+                            }
+                        }
+                    }
+                }
+            }
+
+            WHEN("The knee points change after the LUTs have been compiled")
+            {
+                auto img = bayer_image_s<uint16_t>(8, 16, bayer_pattern_e::rggb);
+                img._img.foreach([](uint16_t &d) { d = 700; });
+                auto before = img;
+                linearizer.compile(img._layout);
+                linearizer.linearize(before);
+                linearizer.knee_points[0].back()._y = 2000;
+                auto after = img;
+                linearizer.linearize(after);
+                auto expected = img;
+                reference(expected, 65535);
+
+                THEN("The stale LUTs are not used")
+                {
+                    CHECK(before._img.to_vector() != after._img.to_vector());
+                    CHECK(after._img.to_vector() == expected._img.to_vector());
+                }
+            }
+        }
+    }
+
     SCENARIO("Preprocessor can reconstruct all 2x2 and 4x4 IR sensors changing the pattern to the most matching non-ir 2x2 sensor, "
         "where there are no samples from the IR pixels and all channels contain only the corresponding R,G or B values")
     {
@@ -828,6 +1202,108 @@ namespace libprepro_algorithm_tests
         }
     }
 
+    SCENARIO("Luminance is averaged from bayer quads with all instruction sets")
+    {
+        GIVEN("Random bayer images of all 2x2 RGB layouts, with dimensions not divisible by the blocks")
+        {
+            std::mt19937 rng(5);
+            std::uniform_int_distribution<int> dist(0, 65535);
+            std::vector<bayer_image_s<uint16_t>> images;
+            for (auto pattern : { bayer_pattern_e::rggb, bayer_pattern_e::grbg, bayer_pattern_e::gbrg, bayer_pattern_e::bggr })
+            {
+                images.emplace_back(2 * 3 * 17 + 3, 2 * 3 * 29 + 5, pattern);
+                images.back()._img.foreach([&](uint16_t &pix) { pix = static_cast<uint16_t>(dist(rng)); });
+            }
+
+            WHEN("The images are subsampled by blocks of 1 and 3 quads")
+            {
+                THEN("The results match the block averages of (2R + G1 + G2 + 2B) / 6")
+                {
+                    for (auto &img : images)
+                    {
+                        for (int quads : { 1, 3 })
+                        {
+                            auto expected = image<uint16_t>(img._img._height / (2 * quads), img._img._width / (2 * quads));
+                            for (int y = 0; y < expected._height; y++)
+                                for (int x = 0; x < expected._width; x++)
+                                {
+                                    uint32_t sum = 0;
+                                    for (int j = 0; j < 2 * quads; j++)
+                                        for (int i = 0; i < 2 * quads; i++)
+                                        {
+                                            auto sy = y * 2 * quads + j;
+                                            auto sx = x * 2 * quads + i;
+                                            auto weight = img._layout[(sy & 1) * 2 + (sx & 1)] == color_info_e::green ? 1 : 2;
+                                            sum += weight * img._img(sy, sx);
+                                        }
+                                    uint32_t divisor = 6 * quads * quads;
+                                    expected(y, x) = static_cast<uint16_t>((sum + divisor / 2) / divisor);
+                                }
+
+                            for (auto level : { simd_level_e::scalar, simd_level_e::sse4, simd_level_e::avx2 })
+                            {
+                                INFO("pattern " << static_cast<int>(img._layout) << " quads " << quads << " level " << static_cast<int>(level));
+                                CHECK(bayer_luminance_subsample(img, quads, 3, level).to_vector() == expected.to_vector());
+                            }
+                        }
+                    }
+                }
+                AND_THEN("Other layouts are rejected")
+                {
+                    auto ir_image = bayer_image_s<uint16_t>(8, 8, bayer_pattern_e::rgib);
+                    CHECK_THROWS(bayer_luminance_subsample(ir_image, 1));
+                }
+            }
+        }
+    }
+
+    SCENARIO("Block medians are selected identically with all instruction sets")
+    {
+        GIVEN("A channel view of a random bayer image with large and small pixel values")
+        {
+            std::mt19937 rng(11);
+            std::uniform_int_distribution<int> dist(0, 65535);
+            auto bayer = bayer_image_s<uint16_t>(2 * 91, 2 * 267, bayer_pattern_e::rggb);
+            bayer._img.foreach([&](uint16_t &pix) { pix = static_cast<uint16_t>(dist(rng) >> (pix & 1 ? 0 : 6)); });
+            auto channel = bayer[1];
+
+            // Reference: the item (w * h) / 2 of each sorted block
+            auto reference = [&channel](roi_point block)
+            {
+                auto result = image<uint16_t>(channel.size() / block);
+                for (int y = 0; y < result._height; y++)
+                    for (int x = 0; x < result._width; x++)
+                    {
+                        std::vector<uint16_t> items;
+                        for (int j = 0; j < block._y; j++)
+                            for (int i = 0; i < block._x; i++)
+                                items.push_back(channel(y * block._y + j, x * block._x + i));
+                        std::sort(items.begin(), items.end());
+                        result(y, x) = items[items.size() / 2];
+                    }
+                return result.to_vector();
+            };
+
+            WHEN("The channel is subsampled with various block sizes")
+            {
+                THEN("The results match sorting each block")
+                {
+                    for (auto block : { roi_point(7, 7), roi_point(5, 3), roi_point(4, 4), roi_point(1, 1), roi_point(16, 2) })
+                    {
+                        auto expected = reference(block);
+                        for (auto level : { simd_level_e::scalar, simd_level_e::sse4, simd_level_e::avx2 })
+                        {
+                            INFO("block " << block._x << "x" << block._y << " level " << static_cast<int>(level));
+                            CHECK(median_subsample(channel, block, 3, level).to_vector() == expected);
+                        }
+                    }
+                    CHECK(median_subsample_7x7(channel).to_vector() == reference(roi_point(7, 7)));
+                    CHECK_THROWS(median_subsample(channel, roi_point(0, 7)));
+                }
+            }
+        }
+    }
+
     /// Makes a bayer image with constant r,g,g,b, (i) values
     /// demosaics the image for R,G,B (and optionally I)
     /// checks that each R,G,B, I channel is flat and contains just the original pixel value
@@ -1039,6 +1515,55 @@ namespace libprepro_algorithm_tests
             }
         }
     }
+
+    template <typename T>
+    void check_demosaic_rgb(bayer_pattern_e pattern, uint32_t rep_scheme, rgb_layout_e layout, simd_level_e level)
+    {
+        std::mt19937 rng(static_cast<unsigned int>(pattern) + rep_scheme);
+        std::uniform_int_distribution<int> dist(0, 4095);
+        bayer_image_s<T> img(20, 44, pattern);
+        img._img.foreach([&](T &pix) { pix = static_cast<T>(dist(rng)); });
+
+        auto rgb = demosaic_bilinear_rgb(img, rep_scheme, layout, 3, level);
+        INFO("pattern=" << (int)pattern << " rep=" << rep_scheme << " layout=" << (int)layout << " level=" << (int)level);
+        CHECK(rgb[rgb_color_e::red].to_vector() == demosaic_bilinear(img, color_info_e::red, rep_scheme).to_vector());
+        CHECK(rgb[rgb_color_e::green].to_vector() == demosaic_bilinear(img, color_info_e::green, rep_scheme).to_vector());
+        CHECK(rgb[rgb_color_e::blue].to_vector() == demosaic_bilinear(img, color_info_e::blue, rep_scheme).to_vector());
+    }
+
+    SCENARIO("All three channels are demosaiced in a single pass")
+    {
+        GIVEN("Random 2x2, 2x2 RGB-IR and 4x4 RGB-IR images")
+        {
+            auto patterns = { bayer_pattern_e::rggb, bayer_pattern_e::gbrg, bayer_pattern_e::grbi,
+                bayer_pattern_e::bgrg_gigi_rgbg_gigi, bayer_pattern_e::gigi_bgrg_gigi_rgbg };
+            auto schemes = { (uint32_t)ZERO_PAD, (uint32_t)REPLICATE, (uint32_t)REPLICATE_EVEN, (uint32_t)MIRROR_EVEN };
+            auto levels = { simd_level_e::scalar, simd_level_e::sse4, simd_level_e::avx2 };
+
+            THEN("The channels match three calls of the single channel demosaicer with every tier")
+            {
+                for (auto pattern : patterns)
+                    for (auto scheme : schemes)
+                        for (auto level : levels)
+                            check_demosaic_rgb<uint16_t>(pattern, scheme, rgb_layout_e::paged, level);
+            }
+
+            THEN("Floating point and interleaved outputs match too")
+            {
+                for (auto pattern : patterns)
+                {
+                    check_demosaic_rgb<float>(pattern, REPLICATE_EVEN, rgb_layout_e::paged, simd_level_e::avx2);
+                    check_demosaic_rgb<uint16_t>(pattern, MIRROR_EVEN, rgb_layout_e::interleaved, simd_level_e::avx2);
+                }
+            }
+
+            THEN("Dual pixel images are rejected")
+            {
+                bayer_image_s<uint16_t> img(8, 16, bayer_pattern_e::grbg_4x2);
+                CHECK_THROWS(demosaic_bilinear_rgb(img));
+            }
+        }
+    }
 }
 
 #if 0
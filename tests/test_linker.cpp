@@ -3,14 +3,17 @@
 #include "Teisko/Chromaticity.hpp"
 #include "Teisko/Color.hpp"
 #include "Teisko/ColorCorrection.hpp"
+#include "Teisko/DngFile.hpp"
 #include "Teisko/LateralChromaticAberration.hpp"
 #include "Teisko/LensShading.hpp"
 #include "Teisko/MacbethDetector.hpp"
 #include "Teisko/NoiseModel.hpp"
+#include "Teisko/PlanarBayerImage.hpp"
 #include "Teisko/Preprocessing.hpp"
 #include "Teisko/SpectralResponse.hpp"
 #include "Teisko/Algorithm/Bit.hpp"
 #include "Teisko/Algorithm/ConvexHull.hpp"
+#include "Teisko/Algorithm/CpuFeatures.hpp"
 #include "Teisko/Algorithm/DelaunayTriangulation.hpp"
 #include "Teisko/Algorithm/Functors.hpp"
 #include "Teisko/Algorithm/Histogram.hpp"
@@ -18,6 +21,8 @@
 #include "Teisko/Algorithm/Iterators.hpp"
 #include "Teisko/Algorithm/LinearSpace.hpp"
 #include "Teisko/Algorithm/NelderMead.hpp"
+#include "Teisko/Algorithm/Parallel.hpp"
+#include "Teisko/Algorithm/PointGrid.hpp"
 #include "Teisko/Algorithm/PointXY.hpp"
 #include "Teisko/Algorithm/Pow2.hpp"
 #include "Teisko/Algorithm/ReduceTo.hpp"
@@ -29,6 +34,10 @@
 #include "Teisko/Image/Algorithms.hpp"
 #include "Teisko/Image/API.hpp"
 #include "Teisko/Image/Conversion.hpp"
+#include "Teisko/Image/GradientThreshold.hpp"
+#include "Teisko/Image/Interleave.hpp"
+#include "Teisko/Image/LosslessJPEG.hpp"
+#include "Teisko/Image/Morphology.hpp"
 #include "Teisko/Image/Point.hpp"
 #include "Teisko/Image/Polyscale.hpp"
 #include "Teisko/Image/RGB.hpp"